@@ -90,7 +90,7 @@ bool is_rtvm;
 bool is_winvm;
 bool skip_pci_mem64bar_workaround = false;
 
-static int guest_ncpus;
+int guest_ncpus;
 static int virtio_msix = 1;
 static bool debugexit_enabled;
 static char mac_seed_str[50];
@@ -127,6 +127,29 @@ struct mt_vmm_info {
 	int		mt_vcpu;
 } mt_vmm_info[VM_MAXCPU];
 
+/*
+ * With --ioreq_workers, vm_loop only dispatches the ioreqs and each vCPU
+ * has a worker thread to emulate them, so that a slow device handler holds
+ * up the vCPU accessing it only. Handlers not flagged as concurrent are
+ * still run one at a time, under ioreq_serial_mtx.
+ */
+struct ioreq_worker {
+	pthread_t	thr;
+	pthread_cond_t	cond;
+	struct vmctx	*ctx;
+	int		vcpu;
+	bool		pending;	/* kicked for the ioreq of its vCPU */
+};
+
+static bool ioreq_workers;
+static struct ioreq_worker ioreq_worker_info[VM_MAXCPU];
+static pthread_mutex_t ioreq_worker_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ioreq_worker_done = PTHREAD_COND_INITIALIZER;
+static int ioreq_workers_busy;
+static uint64_t ioreq_workers_completed;
+static bool ioreq_workers_exit;
+static pthread_mutex_t ioreq_serial_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static struct vmctx *_ctx;
 
 static void
@@ -141,7 +164,7 @@ usage(int code)
 		"       %*s [--vtpm2 sock_path] [--virtio_poll interval] [--mac_seed seed_string]\n"
 		"       %*s [--vmcfg sub_options] [--dump vm_idx] [--debugexit] \n"
 		"       %*s [--logger-setting param_setting] [--pm_notify_channel]\n"
-		"       %*s [--pm_by_vuart vuart_node] <vm>\n"
+		"       %*s [--pm_by_vuart vuart_node] [--ioreq_workers] <vm>\n"
 		"       -A: create ACPI tables\n"
 		"       -B: bootargs for kernel\n"
 		"       -E: elf image path\n"
@@ -177,7 +200,8 @@ usage(int code)
 		"       --pm_notify_channel: define the channel used to notify guest about power event\n"
 		"       --pm_by_vuart:pty,/run/acrn/vuart_vmname or tty,/dev/ttySn\n"
 		"       --windows: support Oracle virtio-blk, virtio-net and virtio-input devices\n"
-		"            for windows guest with secure boot\n",
+		"            for windows guest with secure boot\n"
+		"       --ioreq_workers: emulate the I/O requests of each vCPU in its own thread\n",
 		progname, (int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
@@ -326,7 +350,7 @@ vmexit_mmio_emul(struct vmctx *ctx, struct vhm_request *vhm_req, int *pvcpu)
 	int err;
 
 	stats.vmexit_mmio_emul++;
-	err = emulate_mem(ctx, &vhm_req->reqs.mmio);
+	err = emulate_mem(ctx, *pvcpu, &vhm_req->reqs.mmio);
 
 	if (err) {
 		if (err == -ESRCH)
@@ -349,6 +373,7 @@ vmexit_pci_emul(struct vmctx *ctx, struct vhm_request *vhm_req, int *pvcpu)
 {
 	int err, in = (vhm_req->reqs.pci.direction == REQUEST_READ);
 
+	ioreq_serial_lock();
 	err = emulate_pci_cfgrw(ctx, *pvcpu, in,
 			vhm_req->reqs.pci.bus,
 			vhm_req->reqs.pci.dev,
@@ -356,6 +381,7 @@ vmexit_pci_emul(struct vmctx *ctx, struct vhm_request *vhm_req, int *pvcpu)
 			vhm_req->reqs.pci.reg,
 			vhm_req->reqs.pci.size,
 			&vhm_req->reqs.pci.value);
+	ioreq_serial_unlock();
 	if (err) {
 		pr_err("Unhandled pci cfg rw at %x:%x.%x reg 0x%x\n",
 			vhm_req->reqs.pci.bus,
@@ -413,6 +439,151 @@ handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int vcpu)
 	vm_notify_request_done(ctx, vcpu);
 }
 
+void
+ioreq_serial_lock(void)
+{
+	if (ioreq_workers)
+		pthread_mutex_lock(&ioreq_serial_mtx);
+}
+
+void
+ioreq_serial_unlock(void)
+{
+	if (ioreq_workers)
+		pthread_mutex_unlock(&ioreq_serial_mtx);
+}
+
+static inline bool
+is_ioreq_pending(struct vmctx *ctx, int vcpu)
+{
+	struct vhm_request *vhm_req = &vhm_req_buf[vcpu];
+
+	return (atomic_load(&vhm_req->processed) == REQ_STATE_PROCESSING)
+		&& (vhm_req->client == ctx->ioreq_client);
+}
+
+static void *
+ioreq_worker_thread(void *param)
+{
+	struct ioreq_worker *w = param;
+	bool pending;
+
+	for (;;) {
+		pthread_mutex_lock(&ioreq_worker_mtx);
+		while (!w->pending && !ioreq_workers_exit)
+			pthread_cond_wait(&w->cond, &ioreq_worker_mtx);
+		pending = w->pending;
+		pthread_mutex_unlock(&ioreq_worker_mtx);
+		if (!pending)
+			break;
+
+		/*
+		 * The ioreq is no longer PROCESSING once handle_vmexit has
+		 * notified its completion, so it can't be handled twice.
+		 */
+		if (is_ioreq_pending(w->ctx, w->vcpu))
+			handle_vmexit(w->ctx, &vhm_req_buf[w->vcpu], w->vcpu);
+
+		pthread_mutex_lock(&ioreq_worker_mtx);
+		w->pending = false;
+		ioreq_workers_busy--;
+		ioreq_workers_completed++;
+		pthread_cond_signal(&ioreq_worker_done);
+		pthread_mutex_unlock(&ioreq_worker_mtx);
+	}
+
+	return NULL;
+}
+
+static void
+ioreq_workers_deinit(int num)
+{
+	int i;
+
+	pthread_mutex_lock(&ioreq_worker_mtx);
+	ioreq_workers_exit = true;
+	for (i = 0; i < num; i++)
+		pthread_cond_signal(&ioreq_worker_info[i].cond);
+	pthread_mutex_unlock(&ioreq_worker_mtx);
+
+	for (i = 0; i < num; i++) {
+		pthread_join(ioreq_worker_info[i].thr, NULL);
+		pthread_cond_destroy(&ioreq_worker_info[i].cond);
+	}
+	ioreq_workers_exit = false;
+}
+
+static int
+ioreq_workers_init(struct vmctx *ctx)
+{
+	char tname[MAXCOMLEN + 1];
+	struct ioreq_worker *w;
+	int i, error;
+
+	for (i = 0; i < guest_ncpus; i++) {
+		w = &ioreq_worker_info[i];
+		w->ctx = ctx;
+		w->vcpu = i;
+		w->pending = false;
+		pthread_cond_init(&w->cond, NULL);
+
+		error = pthread_create(&w->thr, NULL, ioreq_worker_thread, w);
+		if (error != 0) {
+			pthread_cond_destroy(&w->cond);
+			ioreq_workers_deinit(i);
+			return error;
+		}
+		snprintf(tname, sizeof(tname), "ioreq %d", i);
+		pthread_setname_np(w->thr, tname);
+	}
+
+	return 0;
+}
+
+/*
+ * Kick the workers of the vCPUs with a new ioreq. Return the number of
+ * ioreqs the workers are busy with, and in @completed the number of ioreqs
+ * they have finished so far.
+ */
+static int
+ioreq_workers_dispatch(struct vmctx *ctx, uint64_t *completed)
+{
+	struct ioreq_worker *w;
+	int vcpu_id, busy;
+
+	pthread_mutex_lock(&ioreq_worker_mtx);
+	for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+		w = &ioreq_worker_info[vcpu_id];
+		if (!w->pending && is_ioreq_pending(ctx, vcpu_id)) {
+			w->pending = true;
+			ioreq_workers_busy++;
+			pthread_cond_signal(&w->cond);
+		}
+	}
+	busy = ioreq_workers_busy;
+	*completed = ioreq_workers_completed;
+	pthread_mutex_unlock(&ioreq_worker_mtx);
+
+	return busy;
+}
+
+/*
+ * VHM does not block vm_attach_ioreq_client while an ioreq is
+ * outstanding, so vm_loop sleeps here instead, until a worker signals
+ * that it has finished an ioreq since @completed was sampled. The ioreqs
+ * other vCPUs raised in the meantime are dispatched right after.
+ * With @all, wait until the workers are all idle.
+ */
+static void
+ioreq_workers_wait(uint64_t completed, bool all)
+{
+	pthread_mutex_lock(&ioreq_worker_mtx);
+	while ((ioreq_workers_busy > 0) &&
+		(all || (ioreq_workers_completed == completed)))
+		pthread_cond_wait(&ioreq_worker_done, &ioreq_worker_mtx);
+	pthread_mutex_unlock(&ioreq_worker_mtx);
+}
+
 static void
 guest_pm_notify_init(struct vmctx *ctx)
 {
@@ -653,7 +824,8 @@ vm_suspend_resume(struct vmctx *ctx)
 static void
 vm_loop(struct vmctx *ctx)
 {
-	int error;
+	int error, busy = 0;
+	uint64_t completed = 0;
 
 	ctx->ioreq_client = vm_create_ioreq_client(ctx);
 	if (ctx->ioreq_client <= 0) {
@@ -661,24 +833,42 @@ vm_loop(struct vmctx *ctx)
 		return;
 	}
 
+	if (ioreq_workers && (ioreq_workers_init(ctx) != 0)) {
+		pr_err("%s, failed to create ioreq workers, handle ioreqs in vm_loop.\n",
+			__func__);
+		ioreq_workers = false;
+	}
+
 	if (vm_run(ctx) != 0) {
 		pr_err("%s, failed to run VM.\n", __func__);
-		return;
+		goto out;
 	}
 
 	while (1) {
 		int vcpu_id;
-		struct vhm_request *vhm_req;
 
-		error = vm_attach_ioreq_client(ctx);
-		if (error)
-			break;
+		if (busy == 0) {
+			error = vm_attach_ioreq_client(ctx);
+			if (error)
+				break;
+		} else {
+			ioreq_workers_wait(completed, false);
+		}
 
-		for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
-			vhm_req = &vhm_req_buf[vcpu_id];
-			if ((atomic_load(&vhm_req->processed) == REQ_STATE_PROCESSING)
-				&& (vhm_req->client == ctx->ioreq_client))
-				handle_vmexit(ctx, vhm_req, vcpu_id);
+		if (ioreq_workers) {
+			busy = ioreq_workers_dispatch(ctx, &completed);
+
+			/* the suspend handling below needs the workers idle */
+			if (vm_get_suspend_mode() != VM_SUSPEND_NONE) {
+				ioreq_workers_wait(completed, true);
+				busy = 0;
+			}
+		} else {
+			for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+				if (is_ioreq_pending(ctx, vcpu_id))
+					handle_vmexit(ctx, &vhm_req_buf[vcpu_id],
+						vcpu_id);
+			}
 		}
 
 		if (VM_SUSPEND_FULL_RESET == vm_get_suspend_mode() ||
@@ -696,6 +886,12 @@ vm_loop(struct vmctx *ctx)
 		}
 	}
 	pr_err("VM loop exit\n");
+
+out:
+	if (ioreq_workers) {
+		ioreq_workers_wait(completed, true);
+		ioreq_workers_deinit(guest_ncpus);
+	}
 }
 
 static int
@@ -733,6 +929,7 @@ enum {
 	CMD_OPT_PM_NOTIFY_CHANNEL,
 	CMD_OPT_PM_BY_VUART,
 	CMD_OPT_WINDOWS,
+	CMD_OPT_IOREQ_WORKERS,
 };
 
 static struct option long_options[] = {
@@ -771,6 +968,7 @@ static struct option long_options[] = {
 	{"pm_notify_channel",	required_argument,	0, CMD_OPT_PM_NOTIFY_CHANNEL},
 	{"pm_by_vuart",	required_argument,	0, CMD_OPT_PM_BY_VUART},
 	{"windows",		no_argument,		0, CMD_OPT_WINDOWS},
+	{"ioreq_workers",	no_argument,		0, CMD_OPT_IOREQ_WORKERS},
 	{0,			0,			0,  0  },
 };
 
@@ -934,6 +1132,9 @@ main(int argc, char *argv[])
 		case CMD_OPT_WINDOWS:
 			is_winvm = true;
 			break;
+		case CMD_OPT_IOREQ_WORKERS:
+			ioreq_workers = true;
+			break;
 		case 'h':
 			usage(0);
 		default:
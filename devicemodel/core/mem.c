@@ -27,9 +27,16 @@
  */
 
 /*
- * Memory ranges are represented with an RB tree. On insertion, the range
- * is checked for overlaps. On lookup, the key has the same base and limit
- * so it can be searched within the range.
+ * Memory ranges are kept in sorted arrays, published as a snapshot which
+ * is never modified: register/unregister, which only happen when devices
+ * are set up or their BARs are reprogrammed, publish an updated copy and
+ * free the old one once no vCPU is looking it up. On insertion, the range
+ * is checked for overlaps. On lookup, the range containing the address is
+ * found by binary search.
+ *
+ * Lookups take no lock. Each vCPU marks the short window during which it
+ * uses the snapshot and keeps a copy of the range it hit last, which stays
+ * valid until a new snapshot is published.
  */
 
 #include <errno.h>
@@ -37,96 +44,126 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include "vmm.h"
+#include "dm.h"
 #include "mem.h"
-#include "tree.h"
+#include "atomic.h"
+#include "log.h"
 
 #define MEMNAMESZ (80)
 
-struct mmio_rb_range {
-	RB_ENTRY(mmio_rb_range)	mr_link;	/* RB tree links */
+struct mmio_range {
 	struct mem_range	mr_param;
 	uint64_t                mr_base;
 	uint64_t                mr_end;
 };
 
-static RB_HEAD(mmio_rb_tree, mmio_rb_range) mmio_rb_root, mmio_rb_fallback;
-RB_PROTOTYPE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
+struct mmio_snapshot {
+	uint64_t		gen;
+	int			nr_ranges;	/* in ranges[0, nr_ranges) */
+	int			nr_fallback;	/* in the ranges following them */
+	struct mmio_range	ranges[];
+};
 
 /*
- * Per-VM cache. Since most accesses from a vCPU will be to
+ * Per-vCPU cache. Since most accesses from a vCPU will be to
  * consecutive addresses in a range, it makes sense to cache the
  * result of a lookup.
  */
-static struct mmio_rb_range	*mmio_hint __aligned(sizeof(struct mmio_rb_range *));
+struct mmio_vcpu_cache {
+	int			reading;	/* looking up the snapshot */
+	uint64_t		gen;		/* of the snapshot hint is from */
+	struct mmio_range	hint;
+} __aligned(64);
 
-static pthread_rwlock_t mmio_rwlock;
+static struct mmio_vcpu_cache mmio_cache[VM_MAXCPU];
 
-static int
-mmio_rb_range_compare(struct mmio_rb_range *a, struct mmio_rb_range *b)
+static struct mmio_snapshot *mmio_snap;
+static uint64_t mmio_gen;
+
+/* Serializes the updates of mmio_snap */
+static pthread_mutex_t mmio_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static struct mmio_range *
+mmio_set(struct mmio_snapshot *snap, bool fallback, int *num)
 {
-	if (a->mr_end < b->mr_base)
-		return -1;
-	else if (a->mr_base > b->mr_end)
-		return 1;
-	return 0;
+	*num = fallback ? snap->nr_fallback : snap->nr_ranges;
+	return fallback ? &snap->ranges[snap->nr_ranges] : snap->ranges;
 }
 
+/*
+ * Return the index of the first range in @set ending at or above @addr,
+ * which is @num if there is none.
+ */
 static int
-mmio_rb_lookup(struct mmio_rb_tree *rbt, uint64_t addr,
-		struct mmio_rb_range **entry)
+mmio_search(const struct mmio_range *set, int num, uint64_t addr)
 {
-	struct mmio_rb_range find, *res;
-
-	find.mr_base = find.mr_end = addr;
-
-	res = RB_FIND(mmio_rb_tree, rbt, &find);
-
-	if (res != NULL) {
-		*entry = res;
-		return 0;
+	int lo = 0, hi = num, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (set[mid].mr_end < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
-	return -1;
+	return lo;
 }
 
-static int
-mmio_rb_add(struct mmio_rb_tree *rbt, struct mmio_rb_range *new)
+static struct mmio_range *
+mmio_lookup(struct mmio_snapshot *snap, bool fallback, uint64_t addr)
 {
-	struct mmio_rb_range *overlap;
+	struct mmio_range *set;
+	int num, i;
 
-	overlap = RB_INSERT(mmio_rb_tree, rbt, new);
+	set = mmio_set(snap, fallback, &num);
+	i = mmio_search(set, num, addr);
+	if ((i < num) && (set[i].mr_base <= addr))
+		return &set[i];
 
-	if (overlap != NULL) {
-#ifdef RB_DEBUG
-		pr_dbg("overlap detected: new %lx:%lx, tree %lx:%lx\n",
-		       new->mr_base, new->mr_end,
-		       overlap->mr_base, overlap->mr_end);
-#endif
+	return NULL;
+}
 
-		return -1;
+/* Copy the current snapshot, with room for @extra more ranges */
+static struct mmio_snapshot *
+mmio_snapshot_dup(int extra)
+{
+	struct mmio_snapshot *old = mmio_snap, *new;
+	int num = old->nr_ranges + old->nr_fallback;
+
+	new = malloc(sizeof(*new) + (num + extra) * sizeof(struct mmio_range));
+	if (new != NULL) {
+		memcpy(new, old, sizeof(*new) + num * sizeof(struct mmio_range));
+		new->gen = old->gen + 1;
 	}
 
-	return 0;
+	return new;
 }
 
-#if RB_DEBUG
+/*
+ * Make @new the current snapshot and free the old one once no vCPU can be
+ * looking it up any more. A vCPU sets its reading flag before it loads
+ * mmio_snap, so it either loads @new or is waited for here.
+ */
 static void
-mmio_rb_dump(struct mmio_rb_tree *rbt)
+mmio_publish(struct mmio_snapshot *new)
 {
-	struct mmio_rb_range *np;
+	struct mmio_snapshot *old = mmio_snap;
+	int i;
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
-	RB_FOREACH(np, mmio_rb_tree, rbt) {
-		pr_dbg(" %lx:%lx, %s\n", np->mr_base, np->mr_end,
-		       np->mr_param.name);
+	atomic_store(&mmio_snap, new);
+	for (i = 0; i < VM_MAXCPU; i++) {
+		while (atomic_load(&mmio_cache[i].reading) != 0)
+			sched_yield();
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
-}
-#endif
+	/* the vCPU hints are valid only while mmio_gen is not changed */
+	atomic_store(&mmio_gen, new->gen);
 
-RB_GENERATE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
+	free(old);
+}
 
 static int
 mem_read(void *ctx, int vcpu, uint64_t gpa, uint64_t *rval, int size, void *arg)
@@ -151,66 +188,105 @@ mem_write(void *ctx, int vcpu, uint64_t gpa, uint64_t wval, int size, void *arg)
 }
 
 int
-emulate_mem(struct vmctx *ctx, struct mmio_request *mmio_req)
+emulate_mem(struct vmctx *ctx, int vcpu, struct mmio_request *mmio_req)
 {
 	uint64_t paddr = mmio_req->address;
 	int size = mmio_req->size;
-	struct mmio_rb_range *hint, *entry = NULL;
-	int err;
+	struct mmio_vcpu_cache *cache;
+	struct mmio_snapshot *snap;
+	struct mmio_range *entry;
+	struct mem_range mr;
+	int err = 0;
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
+	if ((vcpu < 0) || (vcpu >= VM_MAXCPU))
+		return -EINVAL;
 
 	/*
-	 * First check the per-VM cache
+	 * First check the per-vCPU cache
 	 */
-	hint = mmio_hint;
-
-	if (hint && paddr >= hint->mr_base && paddr <= hint->mr_end)
-		entry = hint;
-	else if (mmio_rb_lookup(&mmio_rb_root, paddr, &entry) == 0)
-		/* Update the per-VM cache */
-		mmio_hint = entry;
-	else if (mmio_rb_lookup(&mmio_rb_fallback, paddr, &entry)) {
-		pthread_rwlock_unlock(&mmio_rwlock);
-		return -ESRCH;
+	cache = &mmio_cache[vcpu];
+	if ((cache->gen == atomic_load(&mmio_gen)) &&
+		(paddr >= cache->hint.mr_base) && (paddr <= cache->hint.mr_end)) {
+		mr = cache->hint.mr_param;
+	} else {
+		/*
+		 * The snapshot may be replaced meanwhile but is not freed
+		 * until reading is cleared, so keep a copy of the range.
+		 */
+		atomic_store(&cache->reading, 1);
+		snap = atomic_load(&mmio_snap);
+		entry = mmio_lookup(snap, false, paddr);
+		if (entry != NULL) {
+			/* Update the per-vCPU cache */
+			cache->hint = *entry;
+			cache->gen = snap->gen;
+			mr = entry->mr_param;
+		} else {
+			entry = mmio_lookup(snap, true, paddr);
+			if (entry != NULL)
+				mr = entry->mr_param;
+			else
+				err = -ESRCH;
+		}
+		atomic_store(&cache->reading, 0);
+
+		if (err != 0)
+			return err;
 	}
 
-	pthread_rwlock_unlock(&mmio_rwlock);
-
-	if (entry == NULL)
-		return -EINVAL;
+	if ((mr.flags & MEM_F_CONCURRENT) == 0)
+		ioreq_serial_lock();
 
 	if (mmio_req->direction == REQUEST_READ)
-		err = mem_read(ctx, 0, paddr, (uint64_t *)&mmio_req->value,
-				size, &entry->mr_param);
+		err = mem_read(ctx, vcpu, paddr, (uint64_t *)&mmio_req->value,
+				size, &mr);
 	else
-		err = mem_write(ctx, 0, paddr, mmio_req->value,
-				size, &entry->mr_param);
+		err = mem_write(ctx, vcpu, paddr, mmio_req->value,
+				size, &mr);
+
+	if ((mr.flags & MEM_F_CONCURRENT) == 0)
+		ioreq_serial_unlock();
 
 	return err;
 }
 
 static int
-register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
+register_mem_int(bool fallback, struct mem_range *memp)
 {
-	struct mmio_rb_range *entry, *mrp;
-	int err;
+	struct mmio_snapshot *new;
+	struct mmio_range *set;
+	uint64_t base, end;
+	int num, i, err;
 
 	err = -1;
-
-	mrp = malloc(sizeof(struct mmio_rb_range));
-
-	if (mrp != NULL) {
-		mrp->mr_param = *memp;
-		mrp->mr_base = memp->base;
-		mrp->mr_end = memp->base + memp->size - 1;
-		pthread_rwlock_wrlock(&mmio_rwlock);
-		if (mmio_rb_lookup(rbt, memp->base, &entry) != 0)
-			err = mmio_rb_add(rbt, mrp);
-		pthread_rwlock_unlock(&mmio_rwlock);
-		if (err)
-			free(mrp);
+	base = memp->base;
+	end = memp->base + memp->size - 1;
+
+	pthread_mutex_lock(&mmio_mtx);
+	new = mmio_snapshot_dup(1);
+	if (new != NULL) {
+		set = mmio_set(new, fallback, &num);
+		i = mmio_search(set, num, base);
+
+		/* the range must not overlap the ones around it */
+		if ((i == num) || (set[i].mr_base > end)) {
+			memmove(&set[i + 1], &set[i],
+				((char *)&new->ranges[new->nr_ranges + new->nr_fallback] -
+				 (char *)&set[i]));
+			set[i].mr_param = *memp;
+			set[i].mr_base = base;
+			set[i].mr_end = end;
+			if (fallback)
+				new->nr_fallback++;
+			else
+				new->nr_ranges++;
+
+			mmio_publish(new);
+			err = 0;
+		} else
+			free(new);
 	}
+	pthread_mutex_unlock(&mmio_mtx);
 
 	return err;
 }
@@ -218,42 +294,53 @@ register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 int
 register_mem(struct mem_range *memp)
 {
-	return register_mem_int(&mmio_rb_root, memp);
+	return register_mem_int(false, memp);
 }
 
 int
 register_mem_fallback(struct mem_range *memp)
 {
-	return register_mem_int(&mmio_rb_fallback, memp);
+	return register_mem_int(true, memp);
 }
 
 static int
-unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
+unregister_mem_int(bool fallback, struct mem_range *memp)
 {
+	struct mmio_snapshot *new;
+	struct mmio_range *entry, *end;
 	struct mem_range *mr;
-	struct mmio_rb_range *entry = NULL;
 	int err;
 
-	pthread_rwlock_wrlock(&mmio_rwlock);
-	err = mmio_rb_lookup(rbt, memp->base, &entry);
-	if (err == 0) {
+	err = -1;
+
+	pthread_mutex_lock(&mmio_mtx);
+	entry = mmio_lookup(mmio_snap, fallback, memp->base);
+	if (entry != NULL) {
 		mr = &entry->mr_param;
 		if (strncmp(mr->name, memp->name, MEMNAMESZ)
 			|| (mr->base != memp->base) || (mr->size != memp->size)
 			|| ((mr->flags & MEM_F_IMMUTABLE) != 0)) {
-			err = -1;
-		} else {
-			RB_REMOVE(mmio_rb_tree, rbt, entry);
-
-			/* flush Per-VM cache */
-			if (mmio_hint == entry)
-				mmio_hint = NULL;
+			entry = NULL;
 		}
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
 
-	if (entry)
-		free(entry);
+	if (entry != NULL) {
+		new = mmio_snapshot_dup(0);
+		if (new != NULL) {
+			entry = &new->ranges[entry - mmio_snap->ranges];
+			end = &new->ranges[new->nr_ranges + new->nr_fallback];
+			memmove(entry, entry + 1,
+				(char *)end - (char *)(entry + 1));
+			if (fallback)
+				new->nr_fallback--;
+			else
+				new->nr_ranges--;
+
+			mmio_publish(new);
+			err = 0;
+		}
+	}
+	pthread_mutex_unlock(&mmio_mtx);
 
 	return err;
 }
@@ -261,19 +348,35 @@ unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 int
 unregister_mem(struct mem_range *memp)
 {
-	return unregister_mem_int(&mmio_rb_root, memp);
+	return unregister_mem_int(false, memp);
 }
 
 int
 unregister_mem_fallback(struct mem_range *memp)
 {
-	return unregister_mem_int(&mmio_rb_fallback, memp);
+	return unregister_mem_int(true, memp);
 }
 
 void
 init_mem(void)
 {
-	RB_INIT(&mmio_rb_root);
-	RB_INIT(&mmio_rb_fallback);
-	pthread_rwlock_init(&mmio_rwlock, NULL);
+	struct mmio_snapshot *new;
+
+	/* no vCPU is running yet, nor are the ranges of a previous VM used */
+	new = calloc(1, sizeof(*new));
+	if (new == NULL) {
+		pr_err("%s: failed to allocate mmio ranges\n", __func__);
+		exit(1);
+	}
+
+	/* the vCPU hints start with generation 0, which is never used */
+	pthread_mutex_lock(&mmio_mtx);
+	if (mmio_snap != NULL) {
+		new->gen = mmio_snap->gen + 1;
+		free(mmio_snap);
+	} else
+		new->gen = 1;
+	mmio_snap = new;
+	atomic_store(&mmio_gen, new->gen);
+	pthread_mutex_unlock(&mmio_mtx);
 }
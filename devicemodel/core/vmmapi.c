@@ -571,6 +571,12 @@ vm_intr_monitor(struct vmctx *ctx, void *intr_buf)
 	return ioctl(ctx->fd, IC_VM_INTR_MONITOR, intr_buf);
 }
 
+int
+vm_get_vcpu_exit_stats(struct vmctx *ctx, struct acrn_vcpu_exit_stats *stats)
+{
+	return ioctl(ctx->fd, IC_GET_VCPU_EXIT_STATS, stats);
+}
+
 int
 vm_ioeventfd(struct vmctx *ctx, struct acrn_ioeventfd *args)
 {
@@ -30,8 +30,11 @@
 #include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <linux/falloc.h>
 #include <linux/fs.h>
+#include <linux/io_uring.h>
 #include <errno.h>
 #include <err.h>
 #include <fcntl.h>
@@ -66,6 +69,16 @@
 #define BLOCKIF_MAXREQ	(64 + BLOCKIF_NUMTHR)
 #define MAX_DISCARD_SEGMENT	256
 
+/*
+ * io_uring engine: the ring is sized to hold every request element, so the
+ * submission queue can never overflow. Guest memory is registered as fixed
+ * buffers in chunks of at most 1G, which is the per-buffer kernel limit.
+ */
+#define BLOCKIF_URING_ENTRIES	128
+#define BLOCKIF_URING_MAXBUF	64
+#define BLOCKIF_URING_BUFSZ	(1UL << 30)
+#define BLOCKIF_URING_NUMTHR	1
+
 /*
  * Debug printf
  */
@@ -80,6 +93,11 @@ enum blockop {
 	BOP_DISCARD
 };
 
+enum blockaio {
+	BLOCKIF_AIO_THREADS,
+	BLOCKIF_AIO_URING
+};
+
 enum blockstat {
 	BST_FREE,
 	BST_BLOCK,
@@ -97,6 +115,40 @@ struct blockif_elem {
 	off_t		     block;
 };
 
+struct blockif_uring {
+	int			fd;
+	pthread_t		tid;
+
+	/* submission queue, protected by blockif_ctxt.mtx */
+	uint32_t		*sq_head;
+	uint32_t		*sq_tail;
+	uint32_t		*sq_array;
+	uint32_t		sq_mask;
+	uint32_t		sq_entries;
+	uint32_t		sq_local_tail;
+	uint32_t		to_submit;
+	int			plugged;
+	int			failed;	/* ring is unusable, use the threads */
+	int			exited;	/* reaper thread is gone */
+	struct io_uring_sqe	*sqes;
+
+	/* completion queue, only touched by the reaper thread */
+	uint32_t		*cq_head;
+	uint32_t		*cq_tail;
+	uint32_t		cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	void			*sq_ring;
+	void			*cq_ring;
+	size_t			sq_ring_sz;
+	size_t			cq_ring_sz;
+	size_t			sqes_sz;
+
+	/* guest memory registered as fixed buffers */
+	struct iovec		bufs[BLOCKIF_URING_MAXBUF];
+	int			nbufs;
+};
+
 struct blockif_ctxt {
 	int			fd;
 	int			isblk;
@@ -113,6 +165,9 @@ struct blockif_ctxt {
 	int			max_discard_seg;
 	int			discard_sector_alignment;
 	int			closing;
+	int			cloned;	/* fd and lock are owned by the parent */
+	int			aio;
+	int			nthr;
 	pthread_t		btid[BLOCKIF_NUMTHR];
 	pthread_mutex_t		mtx;
 	pthread_cond_t		cond;
@@ -125,6 +180,9 @@ struct blockif_ctxt {
 
 	/* write cache enable */
 	uint8_t			wce;
+
+	/* valid only when aio is BLOCKIF_AIO_URING */
+	struct blockif_uring	ring;
 };
 
 static pthread_once_t blockif_once = PTHREAD_ONCE_INIT;
@@ -204,13 +262,26 @@ blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 	return (be->status == BST_PEND);
 }
 
+/*
+ * Whether a request of this type is served by io_uring rather than by the
+ * worker threads. Must be called with bc->mtx held.
+ */
+static int
+blockif_uring_op(struct blockif_ctxt *bc, enum blockop op)
+{
+	if (bc->aio != BLOCKIF_AIO_URING || bc->ring.failed)
+		return 0;
+	return (op == BOP_READ || op == BOP_FLUSH ||
+		(op == BOP_WRITE && !bc->rdonly));
+}
+
 static int
 blockif_dequeue(struct blockif_ctxt *bc, pthread_t t, struct blockif_elem **bep)
 {
 	struct blockif_elem *be;
 
 	TAILQ_FOREACH(be, &bc->pendq, link) {
-		if (be->status == BST_PEND)
+		if (be->status == BST_PEND && !blockif_uring_op(bc, be->op))
 			break;
 	}
 	if (be == NULL)
@@ -406,6 +477,396 @@ blockif_thr(void *arg)
 	return NULL;
 }
 
+static int
+io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			flags, NULL, 0);
+}
+
+static int
+io_uring_register(int fd, unsigned int opcode, void *arg,
+		unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void
+blockif_uring_deinit(struct blockif_uring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_sz);
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_sz);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_sz);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+static int
+blockif_uring_init(struct blockif_uring *ring)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	ring->fd = io_uring_setup(BLOCKIF_URING_ENTRIES, &p);
+	if (ring->fd < 0) {
+		WPRINTF(("%s: io_uring_setup failed, errno %d\n",
+			__func__, errno));
+		ring->fd = -1;
+		return -1;
+	}
+
+	ring->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	ring->cq_ring_sz = p.cq_off.cqes +
+			p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_sz > ring->sq_ring_sz)
+			ring->sq_ring_sz = ring->cq_ring_sz;
+		ring->cq_ring_sz = ring->sq_ring_sz;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		goto fail;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ring = ring->sq_ring;
+	else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_sz, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring->fd,
+				IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			goto fail;
+		}
+	}
+
+	ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto fail;
+	}
+
+	sq = ring->sq_ring;
+	ring->sq_head = (uint32_t *)(sq + p.sq_off.head);
+	ring->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+	ring->sq_array = (uint32_t *)(sq + p.sq_off.array);
+	ring->sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+	ring->sq_entries = p.sq_entries;
+	ring->sq_local_tail = *ring->sq_tail;
+
+	cq = ring->cq_ring;
+	ring->cq_head = (uint32_t *)(cq + p.cq_off.head);
+	ring->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+	ring->cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return 0;
+
+fail:
+	WPRINTF(("%s: failed to map io_uring, errno %d\n", __func__, errno));
+	blockif_uring_deinit(ring);
+	return -1;
+}
+
+/*
+ * Look up the registered fixed buffer that fully contains the iovec.
+ * Returns the buffer index, or -1 if the iovec is not in guest memory.
+ */
+static int
+blockif_uring_find_buf(struct blockif_uring *ring, const struct iovec *iov)
+{
+	uintptr_t base, start;
+	int i;
+
+	start = (uintptr_t)iov->iov_base;
+	for (i = 0; i < ring->nbufs; i++) {
+		base = (uintptr_t)ring->bufs[i].iov_base;
+		if (start >= base &&
+			start + iov->iov_len <= base + ring->bufs[i].iov_len)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Fill one SQE for the element. The SQE is only made visible to the kernel
+ * by blockif_uring_submit(). Must be called with bc->mtx held.
+ */
+static void
+blockif_uring_prep(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_uring *ring = &bc->ring;
+	struct blockif_req *br;
+	struct io_uring_sqe *sqe;
+	uint32_t idx;
+	int buf;
+
+	idx = ring->sq_local_tail & ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = bc->fd;
+	sqe->user_data = (uint64_t)(uintptr_t)be;
+
+	br = (be != NULL) ? be->req : NULL;
+	if (be == NULL) {
+		/*
+		 * Wakeup for the reaper thread on close. It is drained so
+		 * that every request submitted before is reaped first.
+		 */
+		sqe->opcode = IORING_OP_NOP;
+		sqe->flags = IOSQE_IO_DRAIN;
+	} else if (be->op == BOP_FLUSH) {
+		/*
+		 * A flush is a barrier: it must not start before the writes
+		 * submitted ahead of it are done, nor be passed by later ones.
+		 */
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->flags = IOSQE_IO_DRAIN;
+	} else {
+		sqe->off = br->offset + bc->sub_file_start_lba;
+		buf = (br->iovcnt == 1) ?
+			blockif_uring_find_buf(ring, &br->iov[0]) : -1;
+		if (buf >= 0) {
+			sqe->opcode = (be->op == BOP_READ) ?
+				IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+			sqe->addr = (uint64_t)(uintptr_t)br->iov[0].iov_base;
+			sqe->len = br->iov[0].iov_len;
+			sqe->buf_index = buf;
+		} else {
+			sqe->opcode = (be->op == BOP_READ) ?
+				IORING_OP_READV : IORING_OP_WRITEV;
+			sqe->addr = (uint64_t)(uintptr_t)br->iov;
+			sqe->len = br->iovcnt;
+		}
+		/*
+		 * In writethru mode, ask for O_DSYNC semantics on the write
+		 * itself instead of issuing a separate fsync().
+		 */
+		if (be->op == BOP_WRITE && !bc->wce)
+			sqe->rw_flags = RWF_DSYNC;
+	}
+
+	ring->sq_array[idx] = idx;
+	ring->sq_local_tail++;
+	ring->to_submit++;
+}
+
+/*
+ * Move the pending elements served by io_uring to the busy queue and
+ * prepare their SQEs. Blocked elements stay on the pending queue until
+ * blockif_complete() releases them, as they do for the worker threads.
+ * Must be called with bc->mtx held.
+ */
+static void
+blockif_uring_dispatch(struct blockif_ctxt *bc)
+{
+	struct blockif_elem *be, *next;
+
+	for (be = TAILQ_FIRST(&bc->pendq); be != NULL; be = next) {
+		next = TAILQ_NEXT(be, link);
+		if (be->status != BST_PEND || !blockif_uring_op(bc, be->op))
+			continue;
+		TAILQ_REMOVE(&bc->pendq, be, link);
+		be->status = BST_BUSY;
+		be->tid = 0;
+		TAILQ_INSERT_TAIL(&bc->busyq, be, link);
+		blockif_uring_prep(bc, be);
+	}
+}
+
+/*
+ * Take back the SQEs the kernel has not consumed, and hand their elements
+ * and every later request to the worker threads. Without SQPOLL the kernel
+ * only reads the submission queue from io_uring_enter(), which is always
+ * called with bc->mtx held, so the tail can be rewound safely.
+ * Must be called with bc->mtx held.
+ */
+static void
+blockif_uring_reclaim(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ring = &bc->ring;
+	struct blockif_elem *be;
+	uint32_t tail;
+
+	tail = ring->sq_local_tail;
+	ring->sq_local_tail -= ring->to_submit;
+	ring->to_submit = 0;
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+	ring->failed = 1;
+
+	/* newest first, so that they go back to the pending queue in order */
+	while (tail != ring->sq_local_tail) {
+		tail--;
+		be = (struct blockif_elem *)(uintptr_t)
+			ring->sqes[tail & ring->sq_mask].user_data;
+		if (be == NULL)
+			continue;
+		TAILQ_REMOVE(&bc->busyq, be, link);
+		be->status = BST_PEND;
+		TAILQ_INSERT_HEAD(&bc->pendq, be, link);
+	}
+	pthread_cond_broadcast(&bc->cond);
+}
+
+/*
+ * Publish the prepared SQEs and hand them to the kernel with a single
+ * io_uring_enter(). If the kernel refuses them for good, they are taken
+ * back and served by the worker threads instead; -1 is returned.
+ * Must be called with bc->mtx held.
+ */
+static int
+blockif_uring_submit(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ring = &bc->ring;
+	int ret;
+
+	if (ring->to_submit == 0)
+		return 0;
+
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+	while (ring->to_submit > 0) {
+		ret = io_uring_enter(ring->fd, ring->to_submit, 0, 0);
+		if (ret < 0) {
+			/* EBUSY: the reaper drains the CQ without bc->mtx */
+			if (errno == EINTR || errno == EAGAIN ||
+				errno == EBUSY)
+				continue;
+			WPRINTF(("%s: io_uring_enter failed, errno %d\n",
+				__func__, errno));
+			blockif_uring_reclaim(bc);
+			return -1;
+		}
+		ring->to_submit -= ret;
+	}
+	return 0;
+}
+
+/*
+ * The reaper can't wait for completions any more: fail the requests owned
+ * by io_uring so that their callers don't wait forever, and hand every
+ * later request to the worker threads.
+ */
+static void
+blockif_uring_fail(struct blockif_ctxt *bc)
+{
+	struct blockif_elem *done[BLOCKIF_MAXREQ];
+	struct blockif_elem *be;
+	struct blockif_req *br;
+	int i, n;
+
+	n = 0;
+	pthread_mutex_lock(&bc->mtx);
+	bc->ring.failed = 1;
+	bc->ring.exited = 1;
+	TAILQ_FOREACH(be, &bc->busyq, link) {
+		if (be->tid == 0 && be->status == BST_BUSY) {
+			be->status = BST_DONE;
+			done[n++] = be;
+		}
+	}
+	pthread_mutex_unlock(&bc->mtx);
+
+	for (i = 0; i < n; i++) {
+		br = done[i]->req;
+		(*br->callback)(br, EIO);
+	}
+
+	pthread_mutex_lock(&bc->mtx);
+	for (i = 0; i < n; i++)
+		blockif_complete(bc, done[i]);
+	pthread_cond_broadcast(&bc->cond);
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+static void *
+blockif_uring_thr(void *arg)
+{
+	struct blockif_ctxt *bc;
+	struct blockif_uring *ring;
+	struct blockif_elem *done[BLOCKIF_URING_ENTRIES];
+	struct blockif_elem *be;
+	struct blockif_req *br;
+	struct io_uring_cqe *cqe;
+	uint32_t head, tail;
+	int i, n, err, stop;
+
+	bc = arg;
+	ring = &bc->ring;
+	stop = 0;
+
+	while (!stop) {
+		if (io_uring_enter(ring->fd, 0, 1,
+				IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+			WPRINTF(("%s: io_uring_enter failed, errno %d\n",
+				__func__, errno));
+			blockif_uring_fail(bc);
+			break;
+		}
+
+		/* Run the callbacks for every completion reaped ... */
+		n = 0;
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail && n < BLOCKIF_URING_ENTRIES) {
+			cqe = &ring->cqes[head & ring->cq_mask];
+			be = (struct blockif_elem *)(uintptr_t)cqe->user_data;
+			head++;
+			if (be == NULL) {
+				stop = 1;
+				continue;
+			}
+
+			br = be->req;
+			err = 0;
+			if (cqe->res < 0)
+				err = -cqe->res;
+			else if (be->op != BOP_FLUSH)
+				br->resid -= cqe->res;
+			be->status = BST_DONE;
+			(*br->callback)(br, err);
+			done[n++] = be;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+		/*
+		 * ... then recycle their elements under one lock, and issue
+		 * the requests that were blocked behind them.
+		 */
+		if (n > 0) {
+			pthread_mutex_lock(&bc->mtx);
+			for (i = 0; i < n; i++)
+				blockif_complete(bc, done[i]);
+			blockif_uring_dispatch(bc);
+			if (!ring->plugged)
+				blockif_uring_submit(bc);
+			pthread_cond_signal(&bc->cond);
+			pthread_mutex_unlock(&bc->mtx);
+		}
+	}
+
+	pthread_exit(NULL);
+	return NULL;
+}
+
 static void
 blockif_sigcont_handler(int signal)
 {
@@ -487,18 +948,68 @@ sub_file_unlock(struct blockif_ctxt *bc)
 }
 
 
+/*
+ * Set up the request queues and start the i/o engine of a context.
+ */
+static void
+blockif_start(struct blockif_ctxt *bc, int aio, const char *ident)
+{
+	char tname[MAXCOMLEN + 1];
+	int i;
+
+	pthread_mutex_init(&bc->mtx, NULL);
+	pthread_cond_init(&bc->cond, NULL);
+	TAILQ_INIT(&bc->freeq);
+	TAILQ_INIT(&bc->pendq);
+	TAILQ_INIT(&bc->busyq);
+	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
+		bc->reqs[i].status = BST_FREE;
+		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
+	}
+
+	/*
+	 * With io_uring, reads, writes and flushes are completed by a single
+	 * reaper thread. One worker thread is still kept for the requests
+	 * that io_uring does not cover (discard, writes to a ro image).
+	 */
+	bc->ring.fd = -1;
+	bc->aio = BLOCKIF_AIO_THREADS;
+	bc->nthr = BLOCKIF_NUMTHR;
+	if (aio == BLOCKIF_AIO_URING) {
+		if (blockif_uring_init(&bc->ring) == 0) {
+			bc->aio = BLOCKIF_AIO_URING;
+			bc->nthr = BLOCKIF_URING_NUMTHR;
+			if (snprintf(tname, sizeof(tname), "blk-%s-uring",
+						ident) >= sizeof(tname)) {
+				pr_err("blk thread name too long");
+			}
+			pthread_create(&bc->ring.tid, NULL, blockif_uring_thr, bc);
+			pthread_setname_np(bc->ring.tid, tname);
+		} else
+			pr_warn("blockif: io_uring unavailable, using threads\n");
+	}
+
+	for (i = 0; i < bc->nthr; i++) {
+		if (snprintf(tname, sizeof(tname), "blk-%s-%d",
+					ident, i) >= sizeof(tname)) {
+			pr_err("blk thread name too long");
+		}
+		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
+		pthread_setname_np(bc->btid[i], tname);
+	}
+}
+
 struct blockif_ctxt *
 blockif_open(const char *optstr, const char *ident)
 {
-	char tname[MAXCOMLEN + 1];
 	/* char name[MAXPATHLEN]; */
 	char *nopt, *xopts, *cp;
 	struct blockif_ctxt *bc;
 	struct stat sbuf;
 	/* struct diocgattr_arg arg; */
 	off_t size, psectsz, psectoff;
-	int fd, i, sectsz;
-	int writeback, ro, candiscard, ssopt, pssopt;
+	int fd, sectsz;
+	int writeback, ro, candiscard, ssopt, pssopt, aio;
 	long sz;
 	long long b;
 	int err_code = -1;
@@ -526,6 +1037,8 @@ blockif_open(const char *optstr, const char *ident)
 
 	candiscard = 0;
 
+	aio = BLOCKIF_AIO_THREADS;
+
 	/*
 	 * The first element in the optstring is always a pathname.
 	 * Optional elements follow
@@ -545,6 +1058,10 @@ blockif_open(const char *optstr, const char *ident)
 			writeback = 0;
 		else if (!strcmp(cp, "ro"))
 			ro = 1;
+		else if (!strcmp(cp, "aio=threads"))
+			aio = BLOCKIF_AIO_THREADS;
+		else if (!strcmp(cp, "aio=io_uring"))
+			aio = BLOCKIF_AIO_URING;
 		else if (!strncmp(cp, "discard", strlen("discard"))) {
 			strsep(&cp, "=");
 			if (cp != NULL) {
@@ -737,24 +1254,7 @@ blockif_open(const char *optstr, const char *ident)
 	bc->psectsz = psectsz;
 	bc->psectoff = psectoff;
 	bc->wce = writeback;
-	pthread_mutex_init(&bc->mtx, NULL);
-	pthread_cond_init(&bc->cond, NULL);
-	TAILQ_INIT(&bc->freeq);
-	TAILQ_INIT(&bc->pendq);
-	TAILQ_INIT(&bc->busyq);
-	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
-		bc->reqs[i].status = BST_FREE;
-		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
-	}
-
-	for (i = 0; i < BLOCKIF_NUMTHR; i++) {
-		if (snprintf(tname, sizeof(tname), "blk-%s-%d",
-					ident, i) >= sizeof(tname)) {
-			pr_err("blk thread name too long");
-		}
-		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
-		pthread_setname_np(bc->btid[i], tname);
-	}
+	blockif_start(bc, aio, ident);
 
 	/* free strdup memory */
 	if (nopt) {
@@ -773,6 +1273,41 @@ err:
 	return NULL;
 }
 
+/*
+ * Create another submission context on the backing file of bc, with its own
+ * request queues and i/o engine, so that several queues of one device don't
+ * share a lock. The clone must be closed before its parent.
+ */
+struct blockif_ctxt *
+blockif_clone(struct blockif_ctxt *parent, const char *ident)
+{
+	struct blockif_ctxt *bc;
+
+	bc = calloc(1, sizeof(struct blockif_ctxt));
+	if (bc == NULL) {
+		pr_err("calloc");
+		return NULL;
+	}
+
+	bc->fd = parent->fd;
+	bc->cloned = 1;
+	bc->isblk = parent->isblk;
+	bc->candiscard = parent->candiscard;
+	bc->max_discard_sectors = parent->max_discard_sectors;
+	bc->max_discard_seg = parent->max_discard_seg;
+	bc->discard_sector_alignment = parent->discard_sector_alignment;
+	bc->rdonly = parent->rdonly;
+	bc->size = parent->size;
+	bc->sub_file_start_lba = parent->sub_file_start_lba;
+	bc->sectsz = parent->sectsz;
+	bc->psectsz = parent->psectsz;
+	bc->psectoff = parent->psectoff;
+	bc->wce = parent->wce;
+	blockif_start(bc, parent->aio, ident);
+
+	return bc;
+}
+
 static int
 blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		enum blockop op)
@@ -783,11 +1318,21 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 
 	pthread_mutex_lock(&bc->mtx);
 	if (!TAILQ_EMPTY(&bc->freeq)) {
+		if (!blockif_enqueue(bc, breq, op)) {
+			/* blocked; issued when the request ahead completes */
+		} else if (blockif_uring_op(bc, op)) {
+			/*
+			 * Queue an SQE; it is submitted right away unless
+			 * the caller has plugged the queue.
+			 */
+			blockif_uring_dispatch(bc);
+			if (!bc->ring.plugged)
+				blockif_uring_submit(bc);
+		}
 		/*
-		 * Enqueue and inform the block i/o thread
-		 * that there is work available
+		 * Inform the block i/o thread that there is work available
 		 */
-		if (blockif_enqueue(bc, breq, op))
+		else
 			pthread_cond_signal(&bc->cond);
 	} else {
 		/*
@@ -844,6 +1389,11 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 		/*
 		 * Found it.
 		 */
+		/*
+		 * Requests unblocked by it are left for the reaper thread
+		 * or blockif_unplug() to issue, as the request they still
+		 * wait for is either in flight or plugged.
+		 */
 		blockif_complete(bc, be);
 		pthread_mutex_unlock(&bc->mtx);
 
@@ -865,6 +1415,16 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 		return -1;
 	}
 
+	/*
+	 * Requests owned by io_uring are left to complete; their callback
+	 * is invoked by the reaper thread. Nothing is submitted from here,
+	 * so a plugged batch is not split up.
+	 */
+	if (be->tid == 0) {
+		pthread_mutex_unlock(&bc->mtx);
+		return -EBUSY;
+	}
+
 	/*
 	 * Interrupt the processing thread to force it return
 	 * prematurely via it's normal callback path.
@@ -906,27 +1466,50 @@ int
 blockif_close(struct blockif_ctxt *bc)
 {
 	void *jval;
-	int i;
+	int i, stuck;
 
 	sub_file_unlock(bc);
 
 	/*
 	 * Stop the block i/o thread
 	 */
+	stuck = 0;
 	pthread_mutex_lock(&bc->mtx);
 	bc->closing = 1;
 	pthread_cond_broadcast(&bc->cond);
+	if (bc->aio == BLOCKIF_AIO_URING && !bc->ring.exited) {
+		/* a NOP without element tells the reaper thread to exit */
+		blockif_uring_prep(bc, NULL);
+		stuck = (blockif_uring_submit(bc) < 0);
+	}
 	pthread_mutex_unlock(&bc->mtx);
 
-	for (i = 0; i < BLOCKIF_NUMTHR; i++)
+	for (i = 0; i < bc->nthr; i++)
 		pthread_join(bc->btid[i], &jval);
 
+	if (stuck) {
+		/*
+		 * Nothing can wake the reaper thread from the kernel any
+		 * more: leave it, the ring and the context behind rather
+		 * than hang the caller.
+		 */
+		WPRINTF(("%s: io_uring reaper can't be stopped\n", __func__));
+		pthread_detach(bc->ring.tid);
+		return 0;
+	}
+
+	if (bc->aio == BLOCKIF_AIO_URING) {
+		pthread_join(bc->ring.tid, &jval);
+		blockif_uring_deinit(&bc->ring);
+	}
+
 	/* XXX Cancel queued i/o's ??? */
 
 	/*
 	 * Release resources
 	 */
-	close(bc->fd);
+	if (!bc->cloned)
+		close(bc->fd);
 	free(bc);
 
 	return 0;
@@ -1059,3 +1642,76 @@ blockif_flush_all(struct blockif_ctxt *bc)
 		err = errno;
 	return err;
 }
+
+/*
+ * Batch the requests issued until blockif_unplug() into one submission.
+ * Only the io_uring engine batches; for the thread pool these are no-ops.
+ */
+void
+blockif_plug(struct blockif_ctxt *bc)
+{
+	if (bc->aio != BLOCKIF_AIO_URING)
+		return;
+
+	pthread_mutex_lock(&bc->mtx);
+	bc->ring.plugged++;
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+void
+blockif_unplug(struct blockif_ctxt *bc)
+{
+	if (bc->aio != BLOCKIF_AIO_URING)
+		return;
+
+	pthread_mutex_lock(&bc->mtx);
+	if (bc->ring.plugged > 0 && --bc->ring.plugged == 0)
+		blockif_uring_submit(bc);
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+/*
+ * Register guest memory as io_uring fixed buffers, so that single-segment
+ * reads and writes don't have to pin the pages for every request.
+ * May be called once per context; failure only disables the optimization.
+ */
+int
+blockif_register_mem(struct blockif_ctxt *bc, const struct iovec *iov,
+		int iovcnt)
+{
+	struct blockif_uring *ring = &bc->ring;
+	size_t len, chunk;
+	char *base;
+	int i, n;
+
+	if (bc->aio != BLOCKIF_AIO_URING || ring->nbufs > 0)
+		return -1;
+
+	n = 0;
+	for (i = 0; i < iovcnt; i++) {
+		base = iov[i].iov_base;
+		len = iov[i].iov_len;
+		while (len > 0 && n < BLOCKIF_URING_MAXBUF) {
+			chunk = (len > BLOCKIF_URING_BUFSZ) ?
+					BLOCKIF_URING_BUFSZ : len;
+			ring->bufs[n].iov_base = base;
+			ring->bufs[n].iov_len = chunk;
+			base += chunk;
+			len -= chunk;
+			n++;
+		}
+	}
+
+	if (n == 0 || io_uring_register(ring->fd, IORING_REGISTER_BUFFERS,
+			ring->bufs, n) < 0) {
+		WPRINTF(("%s: failed to register %d buffers, errno %d\n",
+			__func__, n, errno));
+		return -1;
+	}
+
+	/* publish under the lock, blockif_uring_prep() reads it */
+	pthread_mutex_lock(&bc->mtx);
+	ring->nbufs = n;
+	pthread_mutex_unlock(&bc->mtx);
+	return 0;
+}
@@ -487,7 +487,10 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 	struct pci_vdev *pdi = arg;
 	struct pci_vdev_ops *ops = pdi->dev_ops;
 	uint64_t offset;
-	int i;
+	int i, ret = -1;
+
+	if (!pdi->bar_concurrent)
+		ioreq_serial_lock();
 
 	for (i = 0; i <= PCI_BARMAX; i++) {
 		if (pdi->bar[i].type == PCIBAR_IO &&
@@ -501,10 +504,14 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 			} else
 				(*ops->vdev_barwrite)(ctx, vcpu, pdi, i, offset,
 				                      bytes, bar_value(bytes, *eax));
-			return 0;
+			ret = 0;
+			break;
 		}
 	}
-	return -1;
+
+	if (!pdi->bar_concurrent)
+		ioreq_serial_unlock();
+	return ret;
 }
 
 static int
@@ -523,6 +530,9 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 
 	offset = addr - pdi->bar[bidx].addr;
 
+	if (!pdi->bar_concurrent)
+		ioreq_serial_lock();
+
 	if (dir == MEM_F_WRITE) {
 		if (size == 8) {
 			(*ops->vdev_barwrite)(ctx, vcpu, pdi, bidx, offset,
@@ -552,6 +562,9 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 		}
 	}
 
+	if (!pdi->bar_concurrent)
+		ioreq_serial_unlock();
+
 	return 0;
 }
 
@@ -614,7 +627,8 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 		iop.port = dev->bar[idx].addr;
 		iop.size = dev->bar[idx].size;
 		if (registration) {
-			iop.flags = IOPORT_F_INOUT;
+			/* pci_emul_io_handler serializes as needed */
+			iop.flags = IOPORT_F_INOUT | IOPORT_F_CONCURRENT;
 			iop.handler = pci_emul_io_handler;
 			iop.arg = dev;
 			error = register_inout(&iop);
@@ -628,7 +642,8 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 		mr.base = dev->bar[idx].addr;
 		mr.size = dev->bar[idx].size;
 		if (registration) {
-			mr.flags = MEM_F_RW;
+			/* pci_emul_mem_handler serializes as needed */
+			mr.flags = MEM_F_RW | MEM_F_CONCURRENT;
 			mr.handler = pci_emul_mem_handler;
 			mr.arg1 = dev;
 			mr.arg2 = idx;
@@ -618,6 +618,9 @@ vhost_dev_init(struct vhost_dev *vdev,
 	 * which expose as virtio host_features for virtio FE driver.
 	 */
 	vdev->base->device_caps &= ~(vhost_features ^ features);
+
+	/* vhost only gets split ring addresses from us */
+	vdev->base->device_caps &= ~(1UL << VIRTIO_F_RING_PACKED);
 	vdev->started = false;
 
 	return 0;
@@ -69,6 +69,42 @@ virtio_start_timer(struct acrn_timer *timer, time_t sec, time_t nsec)
 	}
 }
 
+/*
+ * Whether queue notifications are dispatched with the device lock held,
+ * see VIRTIO_QNOTIFY_UNLOCKED.
+ */
+static inline bool
+virtio_qnotify_locked(struct virtio_base *base)
+{
+	return base->mtx != NULL &&
+		(base->flags & VIRTIO_QNOTIFY_UNLOCKED) == 0;
+}
+
+/*
+ * Dispatch a notification of queue idx to the device.
+ */
+static void
+virtio_qnotify(struct virtio_base *base, uint64_t idx)
+{
+	struct virtio_ops *vops = base->vops;
+	struct virtio_vq_info *vq;
+
+	if (idx >= vops->nvq) {
+		pr_err("%s: queue %lu notify out of range\r\n",
+			vops->name, idx);
+		return;
+	}
+
+	vq = &base->queues[idx];
+	if (vq->notify)
+		(*vq->notify)(DEV_STRUCT(base), vq);
+	else if (vops->qnotify)
+		(*vops->qnotify)(DEV_STRUCT(base), vq);
+	else
+		pr_err("%s: qnotify queue %lu: missing vq/vops notify\r\n",
+			vops->name, idx);
+}
+
 static void
 virtio_poll_timer(void *arg, uint64_t nexp)
 {
@@ -82,7 +118,7 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 	vops = base->vops;
 	name = vops->name;
 
-	if (base->mtx)
+	if (virtio_qnotify_locked(base))
 		pthread_mutex_lock(base->mtx);
 
 	base->polling_in_progress = 1;
@@ -91,7 +127,7 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 		vq = &base->queues[i];
 		if(!vq_ring_ready(vq))
 			continue;
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(base, vq);
 		/* TODO: call notify when necessary */
 		if (vq->notify)
 			(*vq->notify)(DEV_STRUCT(base), vq);
@@ -102,7 +138,7 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 				name, i);
 	}
 
-	if (base->mtx)
+	if (virtio_qnotify_locked(base))
 		pthread_mutex_unlock(base->mtx);
 
 	virtio_start_timer(&base->polling_timer, 0, virtio_poll_interval);
@@ -138,6 +174,12 @@ virtio_linkup(struct virtio_base *base, struct virtio_ops *vops,
 	dev->arg = base;
 	base->backend_type = backend_type;
 
+	/*
+	 * BAR accesses, the MSI-X table and PBA included, are serialized
+	 * on base->mtx, set by every device
+	 */
+	dev->bar_concurrent = true;
+
 	base->queues = queues;
 	for (i = 0; i < vops->nvq; i++) {
 		queues[i].base = base;
@@ -185,6 +227,16 @@ virtio_reset_dev(struct virtio_base *base)
 		vq->gpa_used[0] = 0;
 		vq->gpa_used[1] = 0;
 		vq->enabled = 0;
+		vq->pdesc = NULL;
+		vq->driver_event = NULL;
+		vq->device_event = NULL;
+		vq->used_idx = 0;
+		vq->avail_wrap = true;
+		vq->used_wrap = true;
+		vq->last_ndesc = 0;
+		vq->used_since_event = 0;
+		free(vq->chain_ndesc);
+		vq->chain_ndesc = NULL;
 	}
 	base->negotiated_caps = 0;
 	base->curq = 0;
@@ -320,6 +372,62 @@ virtio_vq_init(struct virtio_base *base, uint32_t pfn)
 	vq->flags = VQ_ALLOC;
 }
 
+/*
+ * Packed ring counterpart of virtio_vq_enable().  With VIRTIO_F_RING_PACKED
+ * the "avail" and "used" addresses programmed by the guest point to the
+ * driver and device event suppression structures respectively, and there
+ * is a single descriptor ring shared by both sides.
+ */
+static void
+virtio_vq_enable_packed(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	uint16_t qsz;
+	uint64_t phys;
+	void *vb;
+
+	qsz = vq->qsize;
+
+	/*
+	 * The used element only carries the buffer id, so remember how
+	 * many ring slots each id took to know how far to skip.
+	 */
+	free(vq->chain_ndesc);
+	vq->chain_ndesc = calloc(qsz, sizeof(uint16_t));
+	if (vq->chain_ndesc == NULL) {
+		pr_err("%s: failed to allocate packed ring state\r\n",
+			base->vops->name);
+		return;
+	}
+
+	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+		qsz * sizeof(struct vring_packed_desc));
+	vq->pdesc = (struct vring_packed_desc *)vb;
+
+	phys = (((uint64_t)vq->gpa_avail[1]) << 32) | vq->gpa_avail[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+		sizeof(struct vring_packed_desc_event));
+	vq->driver_event = (struct vring_packed_desc_event *)vb;
+
+	phys = (((uint64_t)vq->gpa_used[1]) << 32) | vq->gpa_used[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+		sizeof(struct vring_packed_desc_event));
+	vq->device_event = (struct vring_packed_desc_event *)vb;
+
+	/* Both wrap counters start at 1, see 2.7.1 of the virtio spec. */
+	vq->last_avail = 0;
+	vq->used_idx = 0;
+	vq->avail_wrap = true;
+	vq->used_wrap = true;
+	vq->last_ndesc = 0;
+	vq->used_since_event = 0;
+
+	vq->enabled = true;
+
+	mb();
+	vq->flags = VQ_ALLOC | VQ_PACKED;
+}
+
 /*
  * Initialize the currently-selected virtio queue (base->curq).
  * The guest just gave us the gpa of desc array, avail ring and
@@ -338,6 +446,11 @@ virtio_vq_enable(struct virtio_base *base)
 	vq = &base->queues[base->curq];
 	qsz = vq->qsize;
 
+	if (base->negotiated_caps & (1UL << VIRTIO_F_RING_PACKED)) {
+		virtio_vq_enable_packed(base, vq);
+		return;
+	}
+
 	/* descriptors */
 	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
 	size = qsz * sizeof(struct vring_desc);
@@ -386,95 +499,177 @@ _vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
 #define	VQ_MAX_DESCRIPTORS	512	/* see below */
 
 /*
- * Examine the chain of descriptors starting at the "next one" to
- * make sure that they describe a sensible request.  If so, return
- * the number of "real" descriptors that would be needed/used in
- * acting on this request.  This may be smaller than the number of
- * available descriptors, e.g., if there are two available but
- * they are two separate requests, this just returns 1.  Or, it
- * may be larger: if there are indirect descriptors involved,
- * there may only be one descriptor available but it may be an
- * indirect pointing to eight more.  We return 8 in this case,
- * i.e., we do not count the indirect descriptors, only the "real"
- * ones.
- *
- * Basically, this vets the flags and vd_next field of each
- * descriptor and tells you how many are involved.  Since some may
- * be indirect, this also needs the vmctx (in the pci_vdev
- * at base->dev) so that it can find indirect descriptors.
- *
- * As we process each descriptor, we copy and adjust it (guest to
- * host address wise, also using the vmtctx) into the given iov[]
- * array (of the given size).  If the array overflows, we stop
- * placing values into the array but keep processing descriptors,
- * up to VQ_MAX_DESCRIPTORS, before giving up and returning -1.
- * So you, the caller, must not assume that iov[] is as big as the
- * return value (you can process the same thing twice to allocate
- * a larger iov array if needed, or supply a zero length to find
- * out how much space is needed).
- *
- * If you want to verify the WRITE flag on each descriptor, pass a
- * non-NULL "flags" pointer to an array of "uint16_t" of the same size
- * as n_iov and we'll copy each flags field after unwinding any
- * indirects.
- *
- * If some descriptor(s) are invalid, this prints a diagnostic message
- * and returns -1.  If no descriptors are ready now it simply returns 0.
- *
- * You are assumed to have done a vq_ring_ready() if needed (note
- * that vq_has_descs() does one).
+ * Packed descriptors are fetched from a ring the guest writes
+ * sequentially, so pull the next few cache lines in ahead of the
+ * walk instead of taking a miss on every descriptor.
  */
-int
-vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
-	    struct iovec *iov, int n_iov, uint16_t *flags)
+#define	VQ_PACKED_PREFETCH	8	/* descriptors per prefetch batch */
+
+static inline void
+_vq_record_packed(int i, volatile struct vring_packed_desc *vd,
+		  struct vmctx *ctx, struct iovec *iov, int n_iov,
+		  uint16_t *flags)
+{
+	if (i >= n_iov)
+		return;
+	iov[i].iov_base = paddr_guest2host(ctx, vd->addr, vd->len);
+	iov[i].iov_len = vd->len;
+	if (flags != NULL)
+		flags[i] = vd->flags & (VRING_DESC_F_NEXT | VRING_DESC_F_WRITE |
+			VRING_DESC_F_INDIRECT);
+}
+
+static inline bool
+_vq_packed_desc_avail(struct virtio_vq_info *vq, uint16_t flags)
+{
+	return !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL)) == vq->avail_wrap &&
+	    !!(flags & (1 << VRING_PACKED_DESC_F_USED)) != vq->avail_wrap;
+}
+
+static inline void
+_vq_packed_prefetch(struct virtio_vq_info *vq, uint16_t idx)
+{
+	uint16_t i, slot;
+
+	if (idx % VQ_PACKED_PREFETCH)
+		return;
+
+	/* 4 descriptors per 64-byte cache line */
+	for (i = 0; i < VQ_PACKED_PREFETCH; i += 4) {
+		slot = idx + VQ_PACKED_PREFETCH + i;
+		if (slot >= vq->qsize)
+			slot -= vq->qsize;
+		if (slot < vq->qsize)
+			__builtin_prefetch((const void *)&vq->pdesc[slot]);
+	}
+}
+
+/*
+ * vq_getchain() for packed rings.  Descriptors of a chain occupy
+ * consecutive ring slots; the buffer id is carried by the last one
+ * and is what we hand back in *pidx for vq_relchain().
+ */
+static int
+vq_getchain_packed(struct virtio_vq_info *vq, uint16_t *pidx,
+		   struct iovec *iov, int n_iov, uint16_t *flags)
 {
 	int i;
-	u_int ndesc, n_indir;
-	u_int idx, next;
+	u_int ndesc, n_indir, j;
+	uint16_t idx, dflags, id;
+	bool wrap;
 
-	volatile struct vring_desc *vdir, *vindir, *vp;
+	volatile struct vring_packed_desc *vdir, *vindir, *vp;
 	struct vmctx *ctx;
 	struct virtio_base *base;
 	const char *name;
 
 	base = vq->base;
 	name = base->vops->name;
+	ctx = base->dev->vmctx;
 
-	/*
-	 * Note: it's the responsibility of the guest not to
-	 * update vq->avail->idx until all of the descriptors
-	 * the guest has written are valid (including all their
-	 * next fields and vd_flags).
-	 *
-	 * Compute (last_avail - idx) in integers mod 2**16.  This is
-	 * the number of descriptors the device has made available
-	 * since the last time we updated vq->last_avail.
-	 *
-	 * We just need to do the subtraction as an unsigned int,
-	 * then trim off excess bits.
-	 */
 	idx = vq->last_avail;
-	ndesc = (uint16_t)((u_int)vq->avail->idx - idx);
-	if (ndesc == 0)
+	wrap = vq->avail_wrap;
+	if (!_vq_packed_desc_avail(vq, vq->pdesc[idx].flags))
 		return 0;
-	if (ndesc > vq->qsize) {
-		/* XXX need better way to diagnose issues */
-		pr_err("%s: ndesc (%u) out of range, driver confused?\r\n",
-		    name, (u_int)ndesc);
-		return -1;
+
+	/* Don't read the descriptor body before its flags. */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	i = 0;
+	for (ndesc = 1; ndesc <= vq->qsize; ndesc++) {
+		_vq_packed_prefetch(vq, idx);
+		vdir = &vq->pdesc[idx];
+		dflags = vdir->flags;
+		if (ndesc > 1 && !_vq_packed_desc_avail(vq, dflags)) {
+			pr_err("%s: packed chain not fully available, "
+			    "driver confused?\r\n", name);
+			goto fail;
+		}
+
+		if ((dflags & VRING_DESC_F_INDIRECT) == 0) {
+			_vq_record_packed(i, vdir, ctx, iov, n_iov, flags);
+			i++;
+		} else if ((base->device_caps &
+		    (1 << VIRTIO_RING_F_INDIRECT_DESC)) == 0) {
+			pr_err("%s: descriptor has forbidden INDIRECT flag, "
+			    "driver confused?\r\n", name);
+			goto fail;
+		} else {
+			n_indir = vdir->len / 16;
+			if ((vdir->len & 0xf) || n_indir == 0) {
+				pr_err("%s: invalid indir len 0x%x, "
+				    "driver confused?\r\n",
+				    name, (u_int)vdir->len);
+				goto fail;
+			}
+			/* Indirect tables are walked in order, no next. */
+			vindir = paddr_guest2host(ctx, vdir->addr, vdir->len);
+			for (j = 0; j < n_indir; j++) {
+				vp = &vindir[j];
+				if (vp->flags & VRING_DESC_F_INDIRECT) {
+					pr_err("%s: indirect desc has INDIR flag,"
+					    " driver confused?\r\n", name);
+					goto fail;
+				}
+				_vq_record_packed(i, vp, ctx, iov, n_iov, flags);
+				if (++i > VQ_MAX_DESCRIPTORS)
+					goto loopy;
+			}
+		}
+
+		if (++idx >= vq->qsize) {
+			idx = 0;
+			vq->avail_wrap = !vq->avail_wrap;
+		}
+
+		if ((dflags & VRING_DESC_F_NEXT) == 0) {
+			id = vdir->id;
+			if (id >= vq->qsize) {
+				pr_err("%s: buffer id %u out of range, "
+				    "driver confused?\r\n", name, id);
+				goto fail;
+			}
+			vq->chain_ndesc[id] = ndesc;
+			vq->last_ndesc = ndesc;
+			vq->last_avail = idx;
+			*pidx = id;
+			return i;
+		}
+		if (i > VQ_MAX_DESCRIPTORS)
+			goto loopy;
 	}
 
-	/*
-	 * Now count/parse "involved" descriptors starting from
-	 * the head of the chain.
-	 *
-	 * To prevent loops, we could be more complicated and
-	 * check whether we're re-visiting a previously visited
-	 * index, but we just abort if the count gets excessive.
-	 */
+loopy:
+	pr_err("%s: descriptor loop? count > %d - driver confused?\r\n",
+	    name, i);
+fail:
+	vq->avail_wrap = wrap;
+	return -1;
+}
+
+/*
+ * Now count/parse "involved" descriptors starting from
+ * the head of a split ring chain.
+ *
+ * To prevent loops, we could be more complicated and
+ * check whether we're re-visiting a previously visited
+ * index, but we just abort if the count gets excessive.
+ */
+static int
+vq_walk_chain(struct virtio_vq_info *vq, u_int next,
+	      struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	int i;
+	u_int n_indir;
+
+	volatile struct vring_desc *vdir, *vindir, *vp;
+	struct vmctx *ctx;
+	struct virtio_base *base;
+	const char *name;
+
+	base = vq->base;
+	name = base->vops->name;
 	ctx = base->dev->vmctx;
-	*pidx = next = vq->avail->ring[idx & (vq->qsize - 1)];
-	vq->last_avail++;
 	for (i = 0; i < VQ_MAX_DESCRIPTORS; next = vdir->next) {
 		if (next >= vq->qsize) {
 			pr_err("%s: descriptor index %u out of range, "
@@ -541,6 +736,86 @@ loopy:
 	return -1;
 }
 
+/*
+ * Examine the chain of descriptors starting at the "next one" to
+ * make sure that they describe a sensible request.  If so, return
+ * the number of "real" descriptors that would be needed/used in
+ * acting on this request.  This may be smaller than the number of
+ * available descriptors, e.g., if there are two available but
+ * they are two separate requests, this just returns 1.  Or, it
+ * may be larger: if there are indirect descriptors involved,
+ * there may only be one descriptor available but it may be an
+ * indirect pointing to eight more.  We return 8 in this case,
+ * i.e., we do not count the indirect descriptors, only the "real"
+ * ones.
+ *
+ * Basically, this vets the flags and vd_next field of each
+ * descriptor and tells you how many are involved.  Since some may
+ * be indirect, this also needs the vmctx (in the pci_vdev
+ * at base->dev) so that it can find indirect descriptors.
+ *
+ * As we process each descriptor, we copy and adjust it (guest to
+ * host address wise, also using the vmtctx) into the given iov[]
+ * array (of the given size).  If the array overflows, we stop
+ * placing values into the array but keep processing descriptors,
+ * up to VQ_MAX_DESCRIPTORS, before giving up and returning -1.
+ * So you, the caller, must not assume that iov[] is as big as the
+ * return value (you can process the same thing twice to allocate
+ * a larger iov array if needed, or supply a zero length to find
+ * out how much space is needed).
+ *
+ * If you want to verify the WRITE flag on each descriptor, pass a
+ * non-NULL "flags" pointer to an array of "uint16_t" of the same size
+ * as n_iov and we'll copy each flags field after unwinding any
+ * indirects.
+ *
+ * If some descriptor(s) are invalid, this prints a diagnostic message
+ * and returns -1.  If no descriptors are ready now it simply returns 0.
+ *
+ * You are assumed to have done a vq_ring_ready() if needed (note
+ * that vq_has_descs() does one).
+ */
+int
+vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
+	    struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	u_int ndesc, idx;
+	const char *name;
+
+	if (vq->flags & VQ_PACKED)
+		return vq_getchain_packed(vq, pidx, iov, n_iov, flags);
+
+	name = vq->base->vops->name;
+
+	/*
+	 * Note: it's the responsibility of the guest not to
+	 * update vq->avail->idx until all of the descriptors
+	 * the guest has written are valid (including all their
+	 * next fields and vd_flags).
+	 *
+	 * Compute (last_avail - idx) in integers mod 2**16.  This is
+	 * the number of descriptors the device has made available
+	 * since the last time we updated vq->last_avail.
+	 *
+	 * We just need to do the subtraction as an unsigned int,
+	 * then trim off excess bits.
+	 */
+	idx = vq->last_avail;
+	ndesc = (uint16_t)((u_int)vq->avail->idx - idx);
+	if (ndesc == 0)
+		return 0;
+	if (ndesc > vq->qsize) {
+		/* XXX need better way to diagnose issues */
+		pr_err("%s: ndesc (%u) out of range, driver confused?\r\n",
+		    name, (u_int)ndesc);
+		return -1;
+	}
+
+	*pidx = vq->avail->ring[idx & (vq->qsize - 1)];
+	vq->last_avail++;
+	return vq_walk_chain(vq, *pidx, iov, n_iov, flags);
+}
+
 /*
  * Return the currently-first request chain back to the available queue.
  *
@@ -550,7 +825,47 @@ loopy:
 void
 vq_retchain(struct virtio_vq_info *vq)
 {
-	vq->last_avail--;
+	if ((vq->flags & VQ_PACKED) == 0) {
+		vq->last_avail--;
+		return;
+	}
+
+	if (vq->last_avail < vq->last_ndesc) {
+		vq->last_avail += vq->qsize;
+		vq->avail_wrap = !vq->avail_wrap;
+	}
+	vq->last_avail -= vq->last_ndesc;
+}
+
+/*
+ * Packed ring flavour of vq_relchain(): write a used descriptor at the
+ * device's position and skip as many slots as the chain consumed.  The
+ * flags go last so the guest never sees a half written element.
+ */
+static void
+vq_relchain_packed(struct virtio_vq_info *vq, uint16_t id, uint32_t iolen)
+{
+	volatile struct vring_packed_desc *vd;
+	uint16_t flags, ndesc;
+
+	vd = &vq->pdesc[vq->used_idx];
+	vd->id = id;
+	vd->len = iolen;
+
+	flags = vq->used_wrap ? ((1 << VRING_PACKED_DESC_F_AVAIL) |
+		(1 << VRING_PACKED_DESC_F_USED)) : 0;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	vd->flags = flags;
+
+	ndesc = vq->chain_ndesc[id];
+	if (ndesc == 0)
+		ndesc = 1;
+	vq->used_idx += ndesc;
+	if (vq->used_idx >= vq->qsize) {
+		vq->used_idx -= vq->qsize;
+		vq->used_wrap = !vq->used_wrap;
+	}
+	vq->used_since_event += ndesc;
 }
 
 /*
@@ -577,6 +892,11 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	 * (I apologize for the two fields named idx; the
 	 * virtio spec calls the one that vue points to, "id"...)
 	 */
+	if (vq->flags & VQ_PACKED) {
+		vq_relchain_packed(vq, idx, iolen);
+		return;
+	}
+
 	mask = vq->qsize - 1;
 	vuh = vq->used;
 
@@ -587,6 +907,222 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	vuh->idx = uidx;
 }
 
+/*
+ * Batched vq_getchain(): fetch up to n chains in one go.
+ *
+ * The avail index of a split ring is read once for the whole batch.
+ * The descriptors of all chains are packed back to back into iov[]
+ * (and flags[], if given); chains[i].iov/flags point at the start of
+ * chain i and chains[i].niov is its descriptor count.  A chain that
+ * would not fit in what is left of iov[] is put back and ends the
+ * batch, so the next call starts with it.
+ *
+ * Returns the number of chains fetched, 0 if none are available, or
+ * -1 if the first chain is invalid, in which case chains[0].idx has
+ * the same meaning as *pidx after a failing vq_getchain().  An invalid
+ * chain after the first one also ends the batch and is reported by
+ * the next call.  As with vq_getchain(), a first chain longer than
+ * n_iov is still returned, with its full length in chains[0].niov.
+ */
+int
+vq_getchains(struct virtio_vq_info *vq, struct vq_chain *chains, int n,
+	     struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	u_int navail, mask;
+	uint16_t idx, last_avail, last_ndesc;
+	bool avail_wrap;
+	int got, used, r;
+
+	if (n <= 0)
+		return 0;
+
+	mask = vq->qsize - 1;
+	navail = 0;
+	if ((vq->flags & VQ_PACKED) == 0) {
+		navail = (uint16_t)((u_int)vq->avail->idx - vq->last_avail);
+		if (navail == 0)
+			return 0;
+		if (navail > vq->qsize) {
+			pr_err("%s: ndesc (%u) out of range, driver confused?\r\n",
+			    vq->base->vops->name, navail);
+			return -1;
+		}
+	}
+
+	for (got = 0, used = 0; got < n; got++) {
+		last_avail = vq->last_avail;
+		last_ndesc = vq->last_ndesc;
+		avail_wrap = vq->avail_wrap;
+		idx = vq->qsize;
+
+		if (vq->flags & VQ_PACKED) {
+			r = vq_getchain_packed(vq, &idx, &iov[used],
+				n_iov - used, flags ? &flags[used] : NULL);
+			if (r == 0)
+				break;
+		} else {
+			if (got == navail)
+				break;
+			idx = vq->avail->ring[vq->last_avail & mask];
+			vq->last_avail++;
+			r = vq_walk_chain(vq, idx, &iov[used], n_iov - used,
+				flags ? &flags[used] : NULL);
+		}
+
+		if (got == 0) {
+			chains[0].idx = idx;
+			if (r < 0)
+				return -1;
+		} else if (r < 0 || used + r > n_iov) {
+			vq->last_avail = last_avail;
+			vq->last_ndesc = last_ndesc;
+			vq->avail_wrap = avail_wrap;
+			break;
+		}
+
+		chains[got].idx = idx;
+		chains[got].niov = r;
+		chains[got].iov = &iov[used];
+		chains[got].flags = flags ? &flags[used] : NULL;
+		chains[got].iolen = 0;
+		used += r;
+	}
+
+	return got;
+}
+
+/*
+ * Return the last n chains fetched by vq_getchain()/vq_getchains(),
+ * most recent last in chains[], back to the available ring.
+ */
+void
+vq_retchains(struct virtio_vq_info *vq, const struct vq_chain *chains, int n)
+{
+	u_int ndesc;
+	int i;
+
+	if ((vq->flags & VQ_PACKED) == 0) {
+		vq->last_avail -= n;
+		return;
+	}
+
+	for (i = 0, ndesc = 0; i < n; i++)
+		ndesc += vq->chain_ndesc[chains[i].idx];
+	while (ndesc > vq->last_avail) {
+		ndesc -= vq->last_avail;
+		vq->last_avail = vq->qsize;
+		vq->avail_wrap = !vq->avail_wrap;
+	}
+	vq->last_avail -= ndesc;
+}
+
+/*
+ * Batched vq_relchain(): return n chains with their chains[i].iolen
+ * to the guest.  All used elements are written first and published
+ * with a single index (split) or head flags (packed) update, so the
+ * guest never sees a partial batch.  The caller still does one
+ * vq_endchains() afterwards for the interrupt decision.
+ */
+void
+vq_relchains(struct virtio_vq_info *vq, const struct vq_chain *chains, int n)
+{
+	volatile struct vring_used *vuh;
+	volatile struct vring_used_elem *vue;
+	volatile struct vring_packed_desc *vd;
+	uint16_t uidx, mask, head, head_flags, flags, ndesc;
+	int i;
+
+	if (n <= 0)
+		return;
+
+	if ((vq->flags & VQ_PACKED) == 0) {
+		mask = vq->qsize - 1;
+		vuh = vq->used;
+		uidx = vuh->idx;
+		for (i = 0; i < n; i++) {
+			vue = &vuh->ring[uidx++ & mask];
+			vue->id = chains[i].idx;
+			vue->len = chains[i].iolen;
+		}
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		vuh->idx = uidx;
+		return;
+	}
+
+	/*
+	 * Fill in every used element, then flip the flags of all but
+	 * the first one, and the first one last: the guest walks used
+	 * descriptors in order and stops at the first one not yet used.
+	 */
+	head = vq->used_idx;
+	head_flags = flags = vq->used_wrap ?
+		((1 << VRING_PACKED_DESC_F_AVAIL) |
+		(1 << VRING_PACKED_DESC_F_USED)) : 0;
+	for (i = 0; i < n; i++) {
+		vd = &vq->pdesc[vq->used_idx];
+		vd->id = chains[i].idx;
+		vd->len = chains[i].iolen;
+		if (i > 0) {
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			vd->flags = flags;
+		}
+
+		ndesc = vq->chain_ndesc[chains[i].idx];
+		if (ndesc == 0)
+			ndesc = 1;
+		vq->used_idx += ndesc;
+		if (vq->used_idx >= vq->qsize) {
+			vq->used_idx -= vq->qsize;
+			vq->used_wrap = !vq->used_wrap;
+			flags ^= (1 << VRING_PACKED_DESC_F_AVAIL) |
+				(1 << VRING_PACKED_DESC_F_USED);
+		}
+		vq->used_since_event += ndesc;
+	}
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	vq->pdesc[head].flags = head_flags;
+}
+
+/*
+ * vq_endchains() for packed rings.  The driver event suppression
+ * structure replaces both VRING_AVAIL_F_NO_INTERRUPT and used_event:
+ * with EVENT_IDX the driver may ask for an interrupt only once a given
+ * ring offset (qualified by its wrap counter) has been used.
+ */
+static void
+vq_endchains_packed(struct virtio_vq_info *vq, int used_all_avail)
+{
+	struct virtio_base *base;
+	uint16_t off_wrap, event_idx, new_idx, old_idx, used;
+	int intr;
+
+	base = vq->base;
+	used = vq->used_since_event;
+	vq->used_since_event = 0;
+
+	if (used_all_avail &&
+	    (base->negotiated_caps & (1 << VIRTIO_F_NOTIFY_ON_EMPTY)))
+		intr = 1;
+	else if (vq->driver_event->flags == VRING_PACKED_EVENT_FLAG_DISABLE)
+		intr = 0;
+	else if (vq->driver_event->flags == VRING_PACKED_EVENT_FLAG_DESC &&
+	    (base->negotiated_caps & (1 << VIRTIO_RING_F_EVENT_IDX))) {
+		off_wrap = vq->driver_event->off_wrap;
+		event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+		if (!!(off_wrap & (1 << VRING_PACKED_EVENT_F_WRAP_CTR)) !=
+		    vq->used_wrap)
+			event_idx -= vq->qsize;
+		new_idx = vq->used_idx;
+		old_idx = new_idx - used;
+		intr = (uint16_t)(new_idx - event_idx - 1) <
+			(uint16_t)(new_idx - old_idx);
+	} else
+		intr = used != 0;
+
+	if (intr)
+		vq_interrupt(base, vq);
+}
+
 /*
  * Driver has finished processing "available" chains and calling
  * vq_relchain on each one.  If driver used all the available
@@ -622,6 +1158,11 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 	atomic_thread_fence();
 
 	base = vq->base;
+	if (vq->flags & VQ_PACKED) {
+		vq_endchains_packed(vq, used_all_avail);
+		return;
+	}
+
 	old_idx = vq->save_used;
 	vq->save_used = new_idx = vq->used->idx;
 	if (used_all_avail &&
@@ -664,7 +1205,28 @@ void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *v
 	if (virtio_poll_enabled && backend_type == BACKEND_VBSU && polling_in_progress == 1)
 		return;
 
-	vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+	if (vq->flags & VQ_PACKED)
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	else
+		vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+}
+
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * Asks the guest not to notify us on new available buffers.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return None
+ */
+void vq_set_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	if (vq->flags & VQ_PACKED)
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	else
+		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
 }
 
 struct config_reg {
@@ -875,6 +1437,11 @@ virtio_pci_legacy_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 	uint32_t newoff;
 	int error;
 
+	if (offset == VIRTIO_PCI_QUEUE_NOTIFY && size == 2 &&
+	    !virtio_qnotify_locked(base)) {
+		virtio_qnotify(base, value);
+		return;
+	}
 
 	if (base->mtx)
 		pthread_mutex_lock(base->mtx);
@@ -944,19 +1511,7 @@ bad:
 		base->curq = value;
 		break;
 	case VIRTIO_PCI_QUEUE_NOTIFY:
-		if (value >= vops->nvq) {
-			pr_err("%s: queue %d notify out of range\r\n",
-				name, (int)value);
-			goto done;
-		}
-		vq = &base->queues[value];
-		if (vq->notify)
-			(*vq->notify)(DEV_STRUCT(base), vq);
-		else if (vops->qnotify)
-			(*vops->qnotify)(DEV_STRUCT(base), vq);
-		else
-			pr_err("%s: qnotify queue %d: missing vq/vops notify\r\n",
-				name, (int)value);
+		virtio_qnotify(base, value);
 		break;
 	case VIRTIO_PCI_STATUS:
 		base->status = value;
@@ -1374,10 +1929,13 @@ virtio_common_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 		if (base->status & VIRTIO_CONFIG_S_DRIVER_OK)
 			break;
 		if (base->driver_feature_select < 2) {
+			uint64_t shift = base->driver_feature_select * 32;
+
+			/* merge this 32-bit half, keep the other one */
 			value &= 0xffffffff;
 			base->negotiated_caps =
-				(value << (base->driver_feature_select * 32))
-				& base->device_caps;
+				((base->negotiated_caps & ~(0xffffffffUL << shift)) |
+				(value << shift)) & base->device_caps;
 			if (vops->apply_features)
 				(*vops->apply_features)(DEV_STRUCT(base),
 					base->negotiated_caps);
@@ -1545,28 +2103,8 @@ virtio_notify_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 			uint64_t value)
 {
 	struct virtio_base *base = dev->arg;
-	struct virtio_vq_info *vq;
-	struct virtio_ops *vops;
-	const char *name;
-	uint64_t idx;
-
-	idx = offset / VIRTIO_MODERN_NOTIFY_OFF_MULT;
-	vops = base->vops;
-	name = vops->name;
 
-	if (idx >= vops->nvq) {
-		pr_err("%s: queue %lu notify out of range\r\n", name, idx);
-		return;
-	}
-
-	vq = &base->queues[idx];
-	if (vq->notify)
-		(*vq->notify)(DEV_STRUCT(base), vq);
-	else if (vops->qnotify)
-		(*vops->qnotify)(DEV_STRUCT(base), vq);
-	else
-		pr_err("%s: qnotify queue %lu: missing vq/vops notify\r\n",
-			name, idx);
+	virtio_qnotify(base, offset / VIRTIO_MODERN_NOTIFY_OFF_MULT);
 }
 
 static uint32_t
@@ -1650,6 +2188,13 @@ virtio_pci_modern_mmio_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		return;
 	}
 
+	if (capid == VIRTIO_PCI_CAP_NOTIFY_CFG &&
+	    !virtio_qnotify_locked(base)) {
+		virtio_notify_cfg_write(dev, offset - VIRTIO_CAP_NOTIFY_OFFSET,
+			size, value);
+		return;
+	}
+
 	if (base->mtx)
 		pthread_mutex_lock(base->mtx);
 
@@ -1689,7 +2234,6 @@ virtio_pci_modern_pio_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 			    uint64_t value)
 {
 	struct virtio_base *base = dev->arg;
-	struct virtio_vq_info *vq;
 	struct virtio_ops *vops;
 	const char *name;
 	uint64_t idx;
@@ -1705,24 +2249,12 @@ virtio_pci_modern_pio_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		return;
 	}
 
-	if (idx >= vops->nvq) {
-		pr_err("%s: queue %lu notify out of range\r\n", name, idx);
-		return;
-	}
-
-	if (base->mtx)
+	if (virtio_qnotify_locked(base))
 		pthread_mutex_lock(base->mtx);
 
-	vq = &base->queues[idx];
-	if (vq->notify)
-		(*vq->notify)(DEV_STRUCT(base), vq);
-	else if (vops->qnotify)
-		(*vops->qnotify)(DEV_STRUCT(base), vq);
-	else
-		pr_err("%s: qnotify queue %lu: missing vq/vops notify\r\n",
-			name, idx);
+	virtio_qnotify(base, idx);
 
-	if (base->mtx)
+	if (virtio_qnotify_locked(base))
 		pthread_mutex_unlock(base->mtx);
 }
 
@@ -1746,11 +2278,15 @@ virtio_pci_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		int baridx, uint64_t offset, int size)
 {
 	struct virtio_base *base = dev->arg;
+	uint64_t value;
 
 	if (base->flags & VIRTIO_USE_MSIX) {
 		if (baridx == pci_msix_table_bar(dev) ||
 		    baridx == pci_msix_pba_bar(dev)) {
-			return pci_emul_msix_tread(dev, offset, size);
+			VIRTIO_BASE_LOCK(base);
+			value = pci_emul_msix_tread(dev, offset, size);
+			VIRTIO_BASE_UNLOCK(base);
+			return value;
 		}
 	}
 
@@ -1796,7 +2332,9 @@ virtio_pci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 	if (base->flags & VIRTIO_USE_MSIX) {
 		if (baridx == pci_msix_table_bar(dev) ||
 		    baridx == pci_msix_pba_bar(dev)) {
+			VIRTIO_BASE_LOCK(base);
 			pci_emul_msix_twrite(dev, offset, size, value);
+			VIRTIO_BASE_UNLOCK(base);
 			return;
 		}
 	}
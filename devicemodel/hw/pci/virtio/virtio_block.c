@@ -35,13 +35,16 @@
 #include <openssl/md5.h>
 
 #include "dm.h"
+#include "vmmapi.h"
 #include "pci_core.h"
 #include "virtio.h"
 #include "block_if.h"
 #include "monitor.h"
 
 #define VIRTIO_BLK_RINGSZ	64
+#define VIRTIO_BLK_BATCH	16	/* chains fetched per vq_getchains */
 #define VIRTIO_BLK_MAX_OPTS_LEN	256
+#define VIRTIO_BLK_MAX_QUEUES	16
 
 #define VIRTIO_BLK_S_OK	0
 #define VIRTIO_BLK_S_IOERR	1
@@ -55,12 +58,20 @@
 #define	VIRTIO_BLK_F_BLK_SIZE	(1 << 6)	/* cfg block size valid */
 #define	VIRTIO_BLK_F_FLUSH	(1 << 9)	/* Cache flush support */
 #define	VIRTIO_BLK_F_TOPOLOGY	(1 << 10)	/* Optimal I/O alignment */
+#define	VIRTIO_BLK_F_MQ		(1 << 12)	/* Multiple virtqueues */
 
 /* Device can toggle its cache between writeback and writethrough modes */
 #define	VIRTIO_BLK_F_CONFIG_WCE	(1 << 11)
 
 #define	VIRTIO_BLK_F_DISCARD	(1 << 13)
 
+/*
+ * Offered on the virtio 1.0 interface, which the device provides next to
+ * the legacy one
+ */
+#define VIRTIO_BLK_S_MODERNCAPS      \
+	((1UL << VIRTIO_F_VERSION_1) | (1UL << VIRTIO_F_RING_PACKED))
+
 /*
  * Basic device capabilities
  */
@@ -68,6 +79,7 @@
 	(VIRTIO_BLK_F_SEG_MAX |						    \
 	VIRTIO_BLK_F_BLK_SIZE |						    \
 	VIRTIO_BLK_F_TOPOLOGY |						    \
+	VIRTIO_BLK_S_MODERNCAPS |					    \
 	(1 << VIRTIO_RING_F_INDIRECT_DESC))	/* indirect descriptors */
 
 /*
@@ -98,8 +110,8 @@ struct virtio_blk_config {
 	} topology;
 	uint8_t	writeback;
 	uint8_t unused;
-	/* Reserve for num_queues when VIRTIO_BLK_F_MQ is support*/
-	uint16_t reserve;
+	/* The number of virtqueues, valid with VIRTIO_BLK_F_MQ */
+	uint16_t num_queues;
 	/* The maximum discard sectors (in 512-byte sectors) for one segment */
 	uint32_t max_discard_sectors;
 	/* The maximum number of discard segments */
@@ -142,23 +154,37 @@ static struct monitor_vm_ops virtio_blk_rescan_ops = {
 
 struct virtio_blk_ioreq {
 	struct blockif_req req;
-	struct virtio_blk *blk;
+	struct virtio_blk_queue *q;
 	uint8_t *status;
 	uint16_t idx;
 };
 
+/*
+ * Per-virtqueue struct. Every queue submits to its own blockif context.
+ * Submission, completion and reset of the queue all run under its mtx,
+ * so queues never contend with each other.
+ */
+struct virtio_blk_queue {
+	pthread_mutex_t mtx;
+	struct virtio_vq_info *vq;
+	struct blockif_ctxt *bc;
+	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
+};
+
 /*
  * Per-device struct
  */
 struct virtio_blk {
 	struct virtio_base base;
+	struct virtio_ops ops;	/* per device, nvq depends on num_queues */
 	pthread_mutex_t mtx;
-	struct virtio_vq_info vq;
+	struct virtio_vq_info vqs[VIRTIO_BLK_MAX_QUEUES];
+	struct virtio_blk_queue *queues;
+	int num_queues;
 	struct virtio_blk_config cfg;
 	bool dummy_bctxt; /* Used in blockrescan. Indicate if the bctxt can be used */
 	struct blockif_ctxt *bc;
 	char ident[VIRTIO_BLK_BLK_ID_BYTES + 1];
-	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
 	uint8_t original_wce;
 };
 
@@ -169,7 +195,7 @@ static int virtio_blk_cfgwrite(void *, int, int, uint32_t);
 
 static struct virtio_ops virtio_blk_ops = {
 	"virtio_blk",		/* our name */
-	1,			/* we support 1 virtqueue */
+	1,			/* nvq, set from num_queues at init */
 	sizeof(struct virtio_blk_config), /* config reg size */
 	virtio_blk_reset,	/* reset */
 	virtio_blk_notify,	/* device-wide qnotify */
@@ -179,23 +205,38 @@ static struct virtio_ops virtio_blk_ops = {
 	NULL,			/* called on guest set status */
 };
 
+static void
+virtio_blk_set_wce(struct virtio_blk *blk, uint8_t wce)
+{
+	int i;
+
+	for (i = 0; i < blk->num_queues; i++)
+		blockif_set_wce(blk->queues[i].bc, wce);
+}
+
 static void
 virtio_blk_reset(void *vdev)
 {
 	struct virtio_blk *blk = vdev;
+	int i;
 
 	DPRINTF(("virtio_blk: device reset requested !\n"));
+	/* keep submissions and completions off the rings being reset */
+	for (i = 0; i < blk->num_queues; i++)
+		pthread_mutex_lock(&blk->queues[i].mtx);
 	virtio_reset_dev(&blk->base);
+	for (i = blk->num_queues - 1; i >= 0; i--)
+		pthread_mutex_unlock(&blk->queues[i].mtx);
 	/* Reset virtio-blk device only on valid bctxt*/
 	if (!blk->dummy_bctxt)
-		blockif_set_wce(blk->bc, blk->original_wce);
+		virtio_blk_set_wce(blk, blk->original_wce);
 }
 
 static void
 virtio_blk_done(struct blockif_req *br, int err)
 {
 	struct virtio_blk_ioreq *io = br->param;
-	struct virtio_blk *blk = io->blk;
+	struct virtio_blk_queue *q = io->q;
 
 	if (err)
 		DPRINTF(("virtio_blk: done with error = %d\n\r", err));
@@ -211,11 +252,14 @@ virtio_blk_done(struct blockif_req *br, int err)
 	/*
 	 * Return the descriptor back to the host.
 	 * We wrote 1 byte (our status) to host.
+	 * A request that completes after a reset has no ring to go back to.
 	 */
-	pthread_mutex_lock(&blk->mtx);
-	vq_relchain(&blk->vq, io->idx, 1);
-	vq_endchains(&blk->vq, !vq_has_descs(&blk->vq));
-	pthread_mutex_unlock(&blk->mtx);
+	pthread_mutex_lock(&q->mtx);
+	if (vq_ring_ready(q->vq)) {
+		vq_relchain(q->vq, io->idx, 1);
+		vq_endchains(q->vq, !vq_has_descs(q->vq));
+	}
+	pthread_mutex_unlock(&q->mtx);
 }
 
 static void
@@ -228,19 +272,23 @@ virtio_blk_abort(struct virtio_vq_info *vq, uint16_t idx)
 }
 
 static void
-virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
+virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq,
+		struct vq_chain *chain)
 {
 	struct virtio_blk_hdr *vbh;
+	struct virtio_blk_queue *q;
 	struct virtio_blk_ioreq *io;
 	int i, n;
 	int err;
 	ssize_t iolen;
 	int writeop, type;
-	struct iovec iov[BLOCKIF_IOV_MAX + 2];
-	uint16_t idx, flags[BLOCKIF_IOV_MAX + 2];
+	struct iovec *iov;
+	uint16_t idx, *flags;
 
-	idx = vq->qsize;
-	n = vq_getchain(vq, &idx, iov, BLOCKIF_IOV_MAX + 2, flags);
+	idx = chain->idx;
+	n = chain->niov;
+	iov = chain->iov;
+	flags = chain->flags;
 
 	/*
 	 * The first descriptor will be the read-only fixed header,
@@ -256,7 +304,8 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		return;
 	}
 
-	io = &blk->ios[idx];
+	q = &blk->queues[vq->num];
+	io = &q->ios[idx];
 	if ((flags[0] & VRING_DESC_F_WRITE) != 0) {
 		WPRINTF(("%s: the type for hdr should not be VRING_DESC_F_WRITE\n", __func__));
 		virtio_blk_abort(vq, idx);
@@ -296,7 +345,7 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		return;
 	}
 
-	if (writeop && blockif_is_ro(blk->bc)) {
+	if (writeop && blockif_is_ro(q->bc)) {
 		WPRINTF(("Cannot write to a read-only storage!\n"));
 		virtio_blk_done(&io->req, EROFS);
 		return;
@@ -347,14 +396,14 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		}
 
 		err = ((type == VBH_OP_READ) ? blockif_read : blockif_write)
-				(blk->bc, &io->req);
+				(q->bc, &io->req);
 		break;
 	case VBH_OP_DISCARD:
-		err = blockif_discard(blk->bc, &io->req);
+		err = blockif_discard(q->bc, &io->req);
 		break;
 	case VBH_OP_FLUSH:
 	case VBH_OP_FLUSH_OUT:
-		err = blockif_flush(blk->bc, &io->req);
+		err = blockif_flush(q->bc, &io->req);
 		break;
 	case VBH_OP_IDENT:
 		/* Assume a single buffer */
@@ -376,9 +425,49 @@ static void
 virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_blk *blk = vdev;
+	struct virtio_blk_queue *q = &blk->queues[vq->num];
+	struct blockif_ctxt *bc;
+	struct vq_chain chains[VIRTIO_BLK_BATCH];
+	struct iovec iov[BLOCKIF_IOV_MAX + 2];
+	uint16_t flags[BLOCKIF_IOV_MAX + 2];
+	int i, n;
 
-	while (vq_has_descs(vq))
-		virtio_blk_proc(blk, vq);
+	/*
+	 * Notifications come in without the device lock (see
+	 * VIRTIO_QNOTIFY_UNLOCKED), the queue is owned by q->mtx and the
+	 * other queues are submitted in parallel. Reset and rescan take
+	 * q->mtx too, so the ring and q->bc are stable from here on.
+	 */
+	pthread_mutex_lock(&q->mtx);
+	if (!vq_ring_ready(vq)) {
+		pthread_mutex_unlock(&q->mtx);
+		return;
+	}
+	bc = blk->dummy_bctxt ? NULL : q->bc;
+
+	/* submit all requests of this notification as one batch */
+	if (bc != NULL)
+		blockif_plug(bc);
+	while (vq_has_descs(vq)) {
+		n = vq_getchains(vq, chains, VIRTIO_BLK_BATCH, iov,
+			BLOCKIF_IOV_MAX + 2, flags);
+		if (n < 0) {
+			WPRINTF(("%s: vq_getchains failed\n", __func__));
+			virtio_blk_abort(vq, chains[0].idx);
+			/* a chain we could not consume stays in the ring */
+			if (chains[0].idx >= vq->qsize)
+				break;
+			continue;
+		}
+		if (n == 0)
+			break;
+		for (i = 0; i < n; i++)
+			virtio_blk_proc(blk, vq, &chains[i]);
+	}
+	if (bc != NULL)
+		blockif_unplug(bc);
+
+	pthread_mutex_unlock(&q->mtx);
 }
 
 static uint64_t
@@ -396,6 +485,9 @@ virtio_blk_get_caps(struct virtio_blk *blk, bool wb)
 	if (blockif_is_ro(blk->bc))
 		caps |= VIRTIO_BLK_F_RO;
 
+	if (blk->num_queues > 1)
+		caps |= VIRTIO_BLK_F_MQ;
+
 	return caps;
 }
 
@@ -423,6 +515,7 @@ virtio_blk_update_config_space(struct virtio_blk *blk)
 	    (sto != 0) ? ((sts - sto) / sectsz) : 0;
 	blk->cfg.topology.min_io_size = 0;
 	blk->cfg.writeback = blockif_get_wce(blk->bc);
+	blk->cfg.num_queues = blk->num_queues;
 	blk->original_wce = blk->cfg.writeback; /* save for reset */
 	if (blockif_candiscard(blk->bc)) {
 		blk->cfg.max_discard_sectors = blockif_max_discard_sectors(blk->bc);
@@ -432,6 +525,85 @@ virtio_blk_update_config_space(struct virtio_blk *blk)
 	blk->base.device_caps =
 		virtio_blk_get_caps(blk, !!blk->cfg.writeback);
 }
+/*
+ * Parse and strip the "num_queues=<n>" option, which is not a blockif
+ * option. Without it, one virtqueue per guest vCPU is provided.
+ */
+static int
+virtio_blk_parse_num_queues(char *opts, int *num_queues)
+{
+	char *cp, *end;
+	int n;
+
+	n = guest_ncpus;
+	cp = strstr(opts, ",num_queues=");
+	if (cp != NULL) {
+		if (dm_strtoi(cp + strlen(",num_queues="), &end, 10, &n) ||
+			(*end != ',' && *end != '\0') || n < 1) {
+			pr_err("virtio_blk: invalid num_queues option\n");
+			return -1;
+		}
+		memmove(cp, end, strlen(end) + 1);
+	}
+
+	if (n < 1)
+		n = 1;
+	else if (n > VIRTIO_BLK_MAX_QUEUES)
+		n = VIRTIO_BLK_MAX_QUEUES;
+	*num_queues = n;
+	return 0;
+}
+
+/*
+ * Give every virtqueue its own blockif submission context on the backing
+ * file. If a context can't be created, the queue shares the first one.
+ */
+static void
+virtio_blk_open_queues(struct vmctx *ctx, struct virtio_blk *blk,
+		struct blockif_ctxt *bctxt, const char *bident)
+{
+	char qident[16];
+	struct iovec guest_mem[2];
+	struct blockif_ctxt *bc;
+	int i;
+
+	/* let the io_uring engine use guest memory as fixed buffers */
+	guest_mem[0].iov_base = ctx->baseaddr;
+	guest_mem[0].iov_len = ctx->lowmem;
+	guest_mem[1].iov_base = ctx->baseaddr + ctx->highmem_gpa_base;
+	guest_mem[1].iov_len = ctx->highmem;
+
+	blk->bc = bctxt;
+	for (i = 0; i < blk->num_queues; i++) {
+		bc = NULL;
+		if (i > 0) {
+			snprintf(qident, sizeof(qident), "%s.%d", bident, i);
+			bc = blockif_clone(bctxt, qident);
+		}
+		if (bc == NULL)
+			bc = bctxt;
+		else
+			blockif_register_mem(bc, guest_mem,
+					ctx->highmem ? 2 : 1);
+		blk->queues[i].bc = bc;
+	}
+	blockif_register_mem(bctxt, guest_mem, ctx->highmem ? 2 : 1);
+}
+
+static void
+virtio_blk_close_queues(struct virtio_blk *blk)
+{
+	int i;
+
+	/* the clones go first, they share the fd of blk->bc */
+	for (i = 0; i < blk->num_queues; i++) {
+		if (blk->queues[i].bc != blk->bc)
+			blockif_close(blk->queues[i].bc);
+		blk->queues[i].bc = NULL;
+	}
+	blockif_close(blk->bc);
+}
+
 static int
 virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
@@ -441,7 +613,7 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	MD5_CTX mdctx;
 	u_char digest[16];
 	struct virtio_blk *blk;
-	int i;
+	int i, j, num_queues;
 	pthread_mutexattr_t attr;
 	int rc;
 
@@ -454,6 +626,9 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return -1;
 	}
 
+	if (virtio_blk_parse_num_queues(opts, &num_queues) < 0)
+		return -1;
+
 	/*
 	 * The supplied backing file has to exist
 	 */
@@ -480,21 +655,25 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	blk = calloc(1, sizeof(struct virtio_blk));
 	if (!blk) {
 		WPRINTF(("virtio_blk: calloc returns NULL\n"));
+		if (bctxt)
+			blockif_close(bctxt);
+		return -1;
+	}
+
+	blk->num_queues = num_queues;
+	blk->queues = calloc(num_queues, sizeof(struct virtio_blk_queue));
+	if (!blk->queues) {
+		WPRINTF(("virtio_blk: calloc returns NULL\n"));
+		if (bctxt)
+			blockif_close(bctxt);
+		free(blk);
 		return -1;
 	}
 
-	blk->bc = bctxt;
 	/* Update virtio-blk device struct of dummy ctxt*/
 	blk->dummy_bctxt = dummy_bctxt;
-
-	for (i = 0; i < VIRTIO_BLK_RINGSZ; i++) {
-		struct virtio_blk_ioreq *io = &blk->ios[i];
-
-		io->req.callback = virtio_blk_done;
-		io->req.param = io;
-		io->blk = blk;
-		io->idx = i;
-	}
+	if (!dummy_bctxt)
+		virtio_blk_open_queues(ctx, blk, bctxt, bident);
 
 	/* init mutex attribute properly to avoid deadlock */
 	rc = pthread_mutexattr_init(&attr);
@@ -510,12 +689,35 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		DPRINTF(("virtio_blk: pthread_mutex_init failed with "
 					"error %d!\n", rc));
 
+	for (i = 0; i < num_queues; i++) {
+		struct virtio_blk_queue *q = &blk->queues[i];
+
+		rc = pthread_mutex_init(&q->mtx, &attr);
+		if (rc)
+			DPRINTF(("virtio_blk: pthread_mutex_init failed with "
+						"error %d!\n", rc));
+		q->vq = &blk->vqs[i];
+		for (j = 0; j < VIRTIO_BLK_RINGSZ; j++) {
+			struct virtio_blk_ioreq *io = &q->ios[j];
+
+			io->req.callback = virtio_blk_done;
+			io->req.param = io;
+			io->q = q;
+			io->idx = j;
+		}
+	}
+
 	/* init virtio struct and virtqueues */
-	virtio_linkup(&blk->base, &virtio_blk_ops, blk, dev, &blk->vq, BACKEND_VBSU);
+	blk->ops = virtio_blk_ops;
+	blk->ops.nvq = num_queues;
+	virtio_linkup(&blk->base, &blk->ops, blk, dev, blk->vqs, BACKEND_VBSU);
 	blk->base.mtx = &blk->mtx;
+	/* virtio_blk_notify serializes on the queue lock instead */
+	blk->base.flags |= VIRTIO_QNOTIFY_UNLOCKED;
 
-	blk->vq.qsize = VIRTIO_BLK_RINGSZ;
-	/* blk->vq.vq_notify = we have no per-queue notify */
+	for (i = 0; i < num_queues; i++)
+		blk->vqs[i].qsize = VIRTIO_BLK_RINGSZ;
+	/* blk->vqs[i].vq_notify = we have no per-queue notify */
 
 	/*
 	 * Create an identifier for the backing file. Use parts of the
@@ -533,6 +735,8 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	/* Setup virtio block config space only for valid backend file*/
 	if (!blk->dummy_bctxt)
 		virtio_blk_update_config_space(blk);
+	else
+		blk->base.device_caps = VIRTIO_BLK_S_MODERNCAPS;
 
 	/*
 	 * Should we move some of this into virtio.c?  Could
@@ -551,12 +755,23 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (virtio_interrupt_init(&blk->base, virtio_uses_msix())) {
 		/* call close only for valid bctxt */
 		if (!blk->dummy_bctxt)
-			blockif_close(blk->bc);
+			virtio_blk_close_queues(blk);
+		free(blk->queues);
 		free(blk);
 		return -1;
 	}
 	virtio_set_io_bar(&blk->base, 0);
 
+	/* BAR 4 carries the virtio 1.0 interface */
+	if (virtio_set_modern_bar(&blk->base, false)) {
+		pr_err("%s: failed to set the modern bar\n", __func__);
+		if (!blk->dummy_bctxt)
+			virtio_blk_close_queues(blk);
+		free(blk->queues);
+		free(blk);
+		return -1;
+	}
+
 	/*
 	 * Register ops for virtio-blk Rescan
 	 */
@@ -585,8 +800,9 @@ virtio_blk_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			bctxt = blk->bc;
 			if (blockif_flush_all(bctxt))
 				WPRINTF(("vrito_blk: Failed to flush before close\n"));
-			blockif_close(bctxt);
+			virtio_blk_close_queues(blk);
 		}
+		free(blk->queues);
 		free(blk);
 	}
 }
@@ -605,7 +821,7 @@ virtio_blk_cfgwrite(void *vdev, int offset, int size, uint32_t value)
 		memcpy(ptr, &value, size);
 		/* Update write cache enable only on valid bctxt*/
 		if (!blk->dummy_bctxt)
-			blockif_set_wce(blk->bc, blkcfg->writeback);
+			virtio_blk_set_wce(blk, blkcfg->writeback);
 		if (blkcfg->writeback)
 			blk->base.device_caps |= VIRTIO_BLK_F_FLUSH;
 		else
@@ -652,6 +868,7 @@ virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 	char bident[16];
 	struct blockif_ctxt *bctxt;
 	struct virtio_blk *blk = (struct virtio_blk *) dev->arg;
+	int i;
 
 	if (!blk) {
 		pr_err("Invalid virtio_blk device!\n");
@@ -692,8 +909,13 @@ virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 		goto end;
 	}
 
-	blk->bc = bctxt;
+	/* the queues may be notified while their contexts are swapped in */
+	for (i = 0; i < blk->num_queues; i++)
+		pthread_mutex_lock(&blk->queues[i].mtx);
+	virtio_blk_open_queues(ctx, blk, bctxt, bident);
 	blk->dummy_bctxt = false;
+	for (i = blk->num_queues - 1; i >= 0; i--)
+		pthread_mutex_unlock(&blk->queues[i].mtx);
 
 	/* Update virtio-blk device configuration on valid file*/
 	virtio_blk_update_config_space(blk);
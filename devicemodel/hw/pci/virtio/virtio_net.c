@@ -49,6 +49,8 @@
 
 #define VIRTIO_NET_RINGSZ	1024
 #define VIRTIO_NET_MAXSEGS	256
+#define VIRTIO_NET_BATCH	16	/* chains fetched per vq_getchains */
+#define VIRTIO_NET_RX_BUDGET	256	/* frames received per wakeup */
 
 /*
  * Host capabilities.  Note that we only offer a few of these.
@@ -72,6 +74,7 @@
 #define	VIRTIO_NET_F_CTRL_VLAN	(1 << 19) /* control channel VLAN filtering */
 #define	VIRTIO_NET_F_GUEST_ANNOUNCE \
 				(1 << 21) /* guest can send gratuitous pkts */
+#define	VIRTIO_NET_F_MQ		(1 << 22) /* multiple rx/tx queue pairs */
 #define	VHOST_NET_F_VIRTIO_NET_HDR \
 				(1 << 27) /* vhost provides virtio_net_hdr */
 
@@ -79,6 +82,13 @@
 	(VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS | \
 	(1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC))
 
+/*
+ * Offered on the virtio 1.0 interface only, which the device provides
+ * next to the legacy one unless vhost is used.
+ */
+#define VIRTIO_NET_S_MODERNCAPS      \
+	((1UL << VIRTIO_F_VERSION_1) | (1UL << VIRTIO_F_RING_PACKED))
+
 #define VIRTIO_NET_S_VHOSTCAPS      \
 	((1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
 	(1 << VIRTIO_RING_F_EVENT_IDX) | VIRTIO_NET_F_MRG_RXBUF | \
@@ -93,16 +103,32 @@
 struct virtio_net_config {
 	uint8_t  mac[6];
 	uint16_t status;
+	uint16_t max_virtqueue_pairs;	/* valid with VIRTIO_NET_F_MQ */
 } __attribute__((packed));
 
 /*
- * Queue definitions.
+ * Queue definitions.  Queue pair n uses virtqueues 2n (rx) and
+ * 2n + 1 (tx); the control queue follows the last pair.
  */
 #define VIRTIO_NET_RXQ	0
 #define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2	/* NB: not yet supported */
+#define VIRTIO_NET_CTLQ	2
+
+#define VIRTIO_NET_MAX_PAIRS	8
+#define VIRTIO_NET_MAXQ	(VIRTIO_NET_MAX_PAIRS * 2 + 1)
+
+/*
+ * Control queue commands
+ */
+struct virtio_net_ctrl_hdr {
+#define	VIRTIO_NET_CTRL_MQ		4
+#define	VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET	0
+	uint8_t		class;
+	uint8_t		cmd;
+} __attribute__((packed));
 
-#define VIRTIO_NET_MAXQ	3
+#define	VIRTIO_NET_OK	0
+#define	VIRTIO_NET_ERR	1
 
 /*
  * Fixed network header size
@@ -129,50 +155,78 @@ static int virtio_net_debug;
  */
 struct vhost_net {
 	struct vhost_dev vdev;
-	struct vhost_vq vqs[VIRTIO_NET_MAXQ - 1];
+	struct vhost_vq vqs[2];
 	int tapfd;
 	bool vhost_started;
 };
 
+struct virtio_net;
+
 /*
- * Per-device struct
+ * One frame handed to the backend for transmission
  */
-struct virtio_net {
-	struct virtio_base base;
-	struct virtio_vq_info queues[VIRTIO_NET_MAXQ - 1];
-	pthread_mutex_t mtx;
+struct virtio_net_frame {
+	struct iovec	*iov;
+	int		iovcnt;
+	int		len;
+};
+
+/*
+ * Per queue pair struct, each with its own tap queue and tx thread
+ */
+struct virtio_net_qpair {
+	struct virtio_net *net;
+	int		idx;		/* pair number */
 	struct mevent	*mevp;
 
 	int		tapfd;
 
 	int		rx_ready;
 
+	pthread_mutex_t	rx_mtx;
+	int		rx_in_progress;
+	pthread_t	tx_tid;
+	pthread_mutex_t	tx_mtx;
+	pthread_cond_t	tx_cond;
+	int		tx_in_progress;
+};
+
+/*
+ * Per-device struct
+ */
+struct virtio_net {
+	struct virtio_base base;
+	struct virtio_ops ops;		/* nvq depends on num_pairs */
+	struct virtio_vq_info queues[VIRTIO_NET_MAXQ];
+	pthread_mutex_t mtx;
+
+	struct virtio_net_qpair pairs[VIRTIO_NET_MAX_PAIRS];
+	int		num_pairs;	/* queue pairs provided */
+	int		curr_pairs;	/* queue pairs enabled by the guest */
+	int		ctlq;		/* control queue index, if any */
+	int		teardown_refs;	/* mevents not torn down yet */
+
 	volatile int	resetting;	/* set and checked outside lock */
-	volatile int	closing;	/* stop the tx i/o thread */
+	volatile int	closing;	/* stop the tx i/o threads */
 
 	uint64_t	features;	/* negotiated features */
 
 	struct virtio_net_config config;
 
-	pthread_mutex_t	rx_mtx;
-	int		rx_in_progress;
 	int		rx_vhdrlen;
 	int		rx_merge;	/* merged rx bufs in use */
-	pthread_t	tx_tid;
-	pthread_mutex_t	tx_mtx;
-	pthread_cond_t	tx_cond;
-	int		tx_in_progress;
 
-	void (*virtio_net_rx)(struct virtio_net *net);
-	void (*virtio_net_tx)(struct virtio_net *net, struct iovec *iov,
-			     int iovcnt, int len);
+	void (*virtio_net_rx)(struct virtio_net_qpair *qp);
+	void (*virtio_net_tx)(struct virtio_net_qpair *qp,
+			     struct virtio_net_frame *frames, int n);
+	bool		loopback;	/* tx frames come back on rx */
 
 	struct vhost_net *vhost_net;
 	bool		use_vhost;
 };
 
 static void virtio_net_reset(void *vdev);
-static void virtio_net_tx_stop(struct virtio_net *net);
+static void virtio_net_tx_stop(struct virtio_net_qpair *qp);
 static int virtio_net_cfgread(void *vdev, int offset, int size,
 	uint32_t *retval);
 static int virtio_net_cfgwrite(void *vdev, int offset, int size,
@@ -188,7 +242,7 @@ static int vhost_net_stop(struct vhost_net *vhost_net);
 
 static struct virtio_ops virtio_net_ops = {
 	"vtnet",			/* our name */
-	VIRTIO_NET_MAXQ - 1,		/* we currently support 2 virtqueues */
+	2,				/* rx/tx, more with VIRTIO_NET_F_MQ */
 	sizeof(struct virtio_net_config), /* config reg size */
 	virtio_net_reset,		/* reset */
 	NULL,				/* device-wide qnotify -- not used */
@@ -233,36 +287,62 @@ ether_aton(const char *a, struct ether_addr *e)
  * If the transmit thread is active then stall until it is done.
  */
 static void
-virtio_net_txwait(struct virtio_net *net)
+virtio_net_txwait(struct virtio_net_qpair *qp)
 {
-	pthread_mutex_lock(&net->tx_mtx);
-	while (net->tx_in_progress) {
-		pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	while (qp->tx_in_progress) {
+		pthread_mutex_unlock(&qp->tx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
  * If the receive thread is active then stall until it is done.
  */
 static void
-virtio_net_rxwait(struct virtio_net *net)
+virtio_net_rxwait(struct virtio_net_qpair *qp)
 {
-	pthread_mutex_lock(&net->rx_mtx);
-	while (net->rx_in_progress) {
-		pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	while (qp->rx_in_progress) {
+		pthread_mutex_unlock(&qp->rx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->rx_mtx);
+		pthread_mutex_lock(&qp->rx_mtx);
 	}
-	pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_unlock(&qp->rx_mtx);
+}
+
+/*
+ * Let the tap deliver frames to the first npairs queues only, so
+ * that nothing lands on a queue pair the guest has not enabled.
+ */
+static void
+virtio_net_set_pairs(struct virtio_net *net, int npairs)
+{
+	struct ifreq ifr;
+	int i;
+
+	if (net->num_pairs > 1) {
+		for (i = 1; i < net->num_pairs; i++) {
+			if (net->pairs[i].tapfd < 0)
+				continue;
+			memset(&ifr, 0, sizeof(ifr));
+			ifr.ifr_flags = i < npairs ?
+				IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+			if (ioctl(net->pairs[i].tapfd, TUNSETQUEUE, &ifr) < 0)
+				WPRINTF(("vtnet: TUNSETQUEUE on queue %d "
+					"failed: %d\n", i, errno));
+		}
+	}
+	net->curr_pairs = npairs;
 }
 
 static void
 virtio_net_reset(void *vdev)
 {
 	struct virtio_net *net = vdev;
+	int i;
 
 	DPRINTF(("vtnet: device reset requested !\n"));
 
@@ -272,13 +352,18 @@ virtio_net_reset(void *vdev)
 	 * Wait for the transmit and receive threads to finish their
 	 * processing.
 	 */
-	virtio_net_txwait(net);
-	virtio_net_rxwait(net);
+	for (i = 0; i < net->num_pairs; i++) {
+		virtio_net_txwait(&net->pairs[i]);
+		virtio_net_rxwait(&net->pairs[i]);
+		net->pairs[i].rx_ready = 0;
+	}
 
-	net->rx_ready = 0;
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
 
+	/* only the first queue pair is used until the guest says otherwise */
+	virtio_net_set_pairs(net, 1);
+
 	/* now reset rings, MSI-X vectors, and negotiated capabilities */
 	virtio_reset_dev(&net->base);
 
@@ -290,43 +375,51 @@ virtio_net_reset(void *vdev)
  * Send signal to tx I/O thread and wait till it exits
  */
 static void
-virtio_net_tx_stop(struct virtio_net *net)
+virtio_net_tx_stop(struct virtio_net_qpair *qp)
 {
 	void *jval;
 
-	pthread_mutex_lock(&net->tx_mtx);
-	net->closing = 1;
-	pthread_cond_broadcast(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	qp->net->closing = 1;
+	pthread_cond_broadcast(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 
-	pthread_join(net->tx_tid, &jval);
+	pthread_join(qp->tx_tid, &jval);
 }
 
 /*
- * Called to send a buffer chain out to the tap device
+ * Called to send a batch of frames out to the tap device.  A tap
+ * takes exactly one frame per write, so this is one writev each.
  */
 static void
-virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
-		  int len)
+virtio_net_tap_tx(struct virtio_net_qpair *qp, struct virtio_net_frame *frames,
+		  int n)
 {
 	static char pad[60]; /* all zero bytes */
+	struct iovec *iov;
+	int i, iovcnt;
 	ssize_t ret;
 
-	if (net->tapfd == -1)
+	if (qp->tapfd == -1)
 		return;
 
-	/*
-	 * If the length is < 60, pad out to that and add the
-	 * extra zero'd segment to the iov. It is guaranteed that
-	 * there is always an extra iov available by the caller.
-	 */
-	if (len < 60) {
-		iov[iovcnt].iov_base = pad;
-		iov[iovcnt].iov_len = 60 - len;
-		iovcnt++;
+	for (i = 0; i < n; i++) {
+		iov = frames[i].iov;
+		iovcnt = frames[i].iovcnt;
+
+		/*
+		 * If the length is < 60, pad out to that and add the
+		 * extra zero'd segment to the iov. It is guaranteed that
+		 * there is always an extra iov available by the caller.
+		 */
+		if (frames[i].len < 60) {
+			iov[iovcnt].iov_base = pad;
+			iov[iovcnt].iov_len = 60 - frames[i].len;
+			iovcnt++;
+		}
+		ret = writev(qp->tapfd, iov, iovcnt);
+		(void)ret; /*avoid compiler warning*/
 	}
-	ret = writev(net->tapfd, iov, iovcnt);
-	(void)ret; /*avoid compiler warning*/
 }
 
 /*
@@ -338,21 +431,26 @@ virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
  */
 static uint8_t dummybuf[2048];
 
+/*
+ * Skip the virtio-net header at the start of a chain. It has a segment of
+ * its own with legacy drivers, but may share one with the packet data once
+ * VIRTIO_F_VERSION_1 is negotiated.
+ */
 static inline struct iovec *
-rx_iov_trim(struct iovec *iov, int *niov, int tlen)
+iov_trim_hdr(struct iovec *iov, int *niov, int tlen)
 {
 	struct iovec *riov;
 
 	/* XXX short-cut: assume first segment is >= tlen */
 	if (iov[0].iov_len < tlen) {
-		WPRINTF(("vtnet: rx_iov_trim: iov_len=%lu, tlen=%d\n", iov[0].iov_len, tlen));
+		WPRINTF(("vtnet: iov_trim_hdr: iov_len=%lu, tlen=%d\n", iov[0].iov_len, tlen));
 		return NULL;
 	}
 
 	iov[0].iov_len -= tlen;
 	if (iov[0].iov_len == 0) {
 		if (*niov <= 1) {
-			WPRINTF(("vtnet: rx_iov_trim: *niov=%d\n", *niov));
+			WPRINTF(("vtnet: iov_trim_hdr: *niov=%d\n", *niov));
 			return NULL;
 		}
 		*niov -= 1;
@@ -366,19 +464,20 @@ rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 }
 
 static void
-virtio_net_tap_rx(struct virtio_net *net)
+virtio_net_tap_rx(struct virtio_net_qpair *qp)
 {
+	struct virtio_net *net = qp->net;
 	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
+	struct vq_chain chains[VIRTIO_NET_BATCH], *c;
 	struct virtio_vq_info *vq;
 	void *vrx;
-	int len, n;
-	uint16_t idx;
+	int len, n, i, niov, budget;
 	ssize_t ret;
 
 	/*
 	 * Should never be called without a valid tap fd
 	 */
-	if (net->tapfd == -1) {
+	if (qp->tapfd == -1) {
 		WPRINTF(("vtnet: tapfd == -1\n"));
 		return;
 	}
@@ -387,11 +486,11 @@ virtio_net_tap_rx(struct virtio_net *net)
 	 * But, will be called when the rx ring hasn't yet
 	 * been set up or the guest is resetting the device.
 	 */
-	if (!net->rx_ready || net->resetting) {
+	if (!qp->rx_ready || net->resetting) {
 		/*
 		 * Drop the packet and try later.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
+		ret = read(qp->tapfd, dummybuf, sizeof(dummybuf));
 		(void)ret; /*avoid compiler warning*/
 
 		return;
@@ -400,82 +499,202 @@ virtio_net_tap_rx(struct virtio_net *net)
 	/*
 	 * Check for available rx buffers
 	 */
-	vq = &net->queues[VIRTIO_NET_RXQ];
+	vq = &net->queues[qp->idx * 2 + VIRTIO_NET_RXQ];
 	if (!vq_has_descs(vq)) {
 		/*
 		 * Drop the packet and try later.  Interrupt on
 		 * empty, if that's negotiated.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
+		ret = read(qp->tapfd, dummybuf, sizeof(dummybuf));
 		(void)ret; /*avoid compiler warning*/
 
 		vq_endchains(vq, 1);
 		return;
 	}
 
+	/*
+	 * Drain up to a budget of frames per wakeup and report them with
+	 * one interrupt decision.  The tap fd stays readable if frames are
+	 * left, so we come back right after the other queue pairs.
+	 */
+	budget = VIRTIO_NET_RX_BUDGET;
 	do {
 		/*
-		 * Get descriptor chain.
+		 * Get a batch of descriptor chains.
 		 */
-		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-		if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
-			WPRINTF(("vtnet: virtio_net_tap_rx: vq_getchain = %d\n", n));
+		n = vq_getchains(vq, chains, MIN(budget, VIRTIO_NET_BATCH),
+			iov, VIRTIO_NET_MAXSEGS, NULL);
+		if (n < 1) {
+			WPRINTF(("vtnet: virtio_net_tap_rx: vq_getchains = %d\n", n));
 			return;
 		}
-		/*
-		 * Get a pointer to the rx header, and use the
-		 * data immediately following it for the packet buffer.
-		 */
-		vrx = iov[0].iov_base;
-		riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
-		if (riov == NULL)
-			return;
 
-		len = readv(net->tapfd, riov, n);
+		for (i = 0; i < n; i++) {
+			c = &chains[i];
+			niov = c->niov;
+			if (niov < 1 || niov > VIRTIO_NET_MAXSEGS) {
+				WPRINTF(("vtnet: virtio_net_tap_rx: vq_getchain = %d\n", niov));
+				riov = NULL;
+			} else {
+				/*
+				 * Get a pointer to the rx header, and use the
+				 * data immediately following it for the packet
+				 * buffer.
+				 */
+				vrx = c->iov[0].iov_base;
+				riov = iov_trim_hdr(c->iov, &niov,
+					net->rx_vhdrlen);
+			}
+			if (riov == NULL) {
+				/*
+				 * Give the bad chain back empty along with the
+				 * filled ones, and the rest back to the ring.
+				 */
+				c->iolen = 0;
+				vq_relchains(vq, chains, i + 1);
+				vq_retchains(vq, &chains[i + 1], n - i - 1);
+				vq_endchains(vq, 0);
+				return;
+			}
+
+			len = readv(qp->tapfd, riov, niov);
+
+			if (len < 0 && errno == EWOULDBLOCK) {
+				/*
+				 * No more packets, but still some avail ring
+				 * entries.  Interrupt if needed/appropriate.
+				 */
+				vq_relchains(vq, chains, i);
+				vq_retchains(vq, &chains[i], n - i);
+				vq_endchains(vq, 0);
+				return;
+			}
 
-		if (len < 0 && errno == EWOULDBLOCK) {
 			/*
-			 * No more packets, but still some avail ring
-			 * entries.  Interrupt if needed/appropriate.
+			 * The only valid field in the rx packet header is the
+			 * number of buffers if merged rx bufs were negotiated.
 			 */
-			vq_retchain(vq);
-			vq_endchains(vq, 0);
-			return;
-		}
+			memset(vrx, 0, net->rx_vhdrlen);
 
-		/*
-		 * The only valid field in the rx packet header is the
-		 * number of buffers if merged rx bufs were negotiated.
-		 */
-		memset(vrx, 0, net->rx_vhdrlen);
+			if (net->rx_merge) {
+				struct virtio_net_rxhdr *vrxh;
 
-		if (net->rx_merge) {
-			struct virtio_net_rxhdr *vrxh;
+				vrxh = vrx;
+				vrxh->vrh_bufs = 1;
+			}
 
-			vrxh = vrx;
-			vrxh->vrh_bufs = 1;
+			c->iolen = len + net->rx_vhdrlen;
 		}
 
 		/*
-		 * Release this chain and handle more chains.
+		 * Release this batch and handle more chains.
 		 */
-		vq_relchain(vq, idx, len + net->rx_vhdrlen);
-	} while (vq_has_descs(vq));
+		vq_relchains(vq, chains, n);
+		budget -= n;
+	} while (budget > 0 && vq_has_descs(vq));
 
 	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
-	vq_endchains(vq, 1);
+	vq_endchains(vq, !vq_has_descs(vq));
+}
+
+/*
+ * Copy one frame into a guest rx chain, returning the length to
+ * report back to the guest.
+ */
+static uint32_t
+virtio_net_loopback_copy(struct virtio_net *net, struct vq_chain *c,
+			 struct virtio_net_frame *f)
+{
+	struct iovec *riov;
+	void *vrx;
+	size_t off, soff, len, copied;
+	int niov, i, j;
+
+	niov = c->niov;
+	if (niov < 1 || niov > VIRTIO_NET_MAXSEGS)
+		return 0;
+
+	vrx = c->iov[0].iov_base;
+	riov = iov_trim_hdr(c->iov, &niov, net->rx_vhdrlen);
+	if (riov == NULL)
+		return 0;
+
+	memset(vrx, 0, net->rx_vhdrlen);
+	if (net->rx_merge)
+		((struct virtio_net_rxhdr *)vrx)->vrh_bufs = 1;
+
+	copied = 0;
+	for (i = 0, j = 0, off = 0, soff = 0; i < f->iovcnt && j < niov;) {
+		len = MIN(f->iov[i].iov_len - soff, riov[j].iov_len - off);
+		memcpy((uint8_t *)riov[j].iov_base + off,
+		       (uint8_t *)f->iov[i].iov_base + soff, len);
+		copied += len;
+		soff += len;
+		off += len;
+		if (soff == f->iov[i].iov_len) {
+			i++;
+			soff = 0;
+		}
+		if (off == riov[j].iov_len) {
+			j++;
+			off = 0;
+		}
+	}
+
+	return copied + net->rx_vhdrlen;
+}
+
+/*
+ * Software loopback backend: frames sent on a queue pair are received
+ * back on the same pair, without any tap or NIC involved.  Meant for
+ * measuring the virtqueue path itself.  Frames are dropped when the
+ * guest has no rx buffers posted.
+ */
+static void
+virtio_net_loopback_tx(struct virtio_net_qpair *qp,
+		       struct virtio_net_frame *frames, int n)
+{
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq;
+	struct iovec iov[VIRTIO_NET_MAXSEGS];
+	struct vq_chain chains[VIRTIO_NET_BATCH];
+	int i, got, done;
+
+	vq = &net->queues[qp->idx * 2 + VIRTIO_NET_RXQ];
+
+	pthread_mutex_lock(&qp->rx_mtx);
+	if (!qp->rx_ready || net->resetting) {
+		pthread_mutex_unlock(&qp->rx_mtx);
+		return;
+	}
+	qp->rx_in_progress = 1;
+
+	for (done = 0; done < n && vq_has_descs(vq); done += got) {
+		got = vq_getchains(vq, chains, MIN(n - done, VIRTIO_NET_BATCH),
+			iov, VIRTIO_NET_MAXSEGS, NULL);
+		if (got < 1)
+			break;
+		for (i = 0; i < got; i++)
+			chains[i].iolen = virtio_net_loopback_copy(net,
+				&chains[i], &frames[done + i]);
+		vq_relchains(vq, chains, got);
+	}
+	vq_endchains(vq, !vq_has_descs(vq));
+
+	qp->rx_in_progress = 0;
+	pthread_mutex_unlock(&qp->rx_mtx);
 }
 
 static void
 virtio_net_rx_callback(int fd, enum ev_type type, void *param)
 {
-	struct virtio_net *net = param;
+	struct virtio_net_qpair *qp = param;
 
-	pthread_mutex_lock(&net->rx_mtx);
-	net->rx_in_progress = 1;
-	net->virtio_net_rx(net);
-	net->rx_in_progress = 0;
-	pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	qp->rx_in_progress = 1;
+	qp->net->virtio_net_rx(qp);
+	qp->rx_in_progress = 0;
+	pthread_mutex_unlock(&qp->rx_mtx);
 
 }
 
@@ -483,52 +702,80 @@ static void
 virtio_net_ping_rxq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_qpair *qp = &net->pairs[vq->num / 2];
 
 	/*
 	 * A qnotify means that the rx process can now begin
 	 */
-	if (net->rx_ready == 0) {
-		net->rx_ready = 1;
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+	if (qp->rx_ready == 0) {
+		qp->rx_ready = 1;
+		vq_set_used_ring_flags(&net->base, vq);
 	}
 }
 
 static void
-virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
+virtio_net_proctx(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
 {
 	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
-	int i, n;
-	int plen, tlen;
-	uint16_t idx;
+	struct vq_chain chains[VIRTIO_NET_BATCH], *c;
+	struct virtio_net_frame frames[VIRTIO_NET_BATCH], *f;
+	struct iovec *tiov;
+	int i, j, n, niov, nframes;
 
 	/*
-	 * Obtain chain of descriptors.  The first one is
-	 * really the header descriptor, so we need to sum
-	 * up two lengths: packet length and transfer length.
+	 * Obtain a batch of descriptor chains.  Each chain starts
+	 * with the header, so we need to sum up two lengths: packet
+	 * length and transfer length.
 	 */
-	n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-	if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
+	n = vq_getchains(vq, chains, VIRTIO_NET_BATCH, iov,
+		VIRTIO_NET_MAXSEGS, NULL);
+	if (n < 1) {
 		WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n", n));
 		return;
 	}
-	plen = 0;
-	tlen = iov[0].iov_len;
-	for (i = 1; i < n; i++) {
-		plen += iov[i].iov_len;
-		tlen += iov[i].iov_len;
+
+	/*
+	 * Size every chain before sending any: the tx routine may use
+	 * the iovec right after a frame for padding, which is the
+	 * header of the next chain in the batch.
+	 */
+	for (i = 0, nframes = 0; i < n; i++) {
+		c = &chains[i];
+		niov = c->niov;
+		tiov = NULL;
+		if (niov < 1 || niov > VIRTIO_NET_MAXSEGS)
+			WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n",
+				niov));
+		else
+			tiov = iov_trim_hdr(c->iov, &niov, qp->net->rx_vhdrlen);
+		if (tiov == NULL) {
+			/* not sent, but still given back to the guest */
+			c->iolen = 0;
+			continue;
+		}
+		f = &frames[nframes++];
+		f->iov = tiov;
+		f->iovcnt = niov;
+		f->len = 0;
+		for (j = 0; j < niov; j++)
+			f->len += tiov[j].iov_len;
+		c->iolen = qp->net->rx_vhdrlen + f->len;
+		DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r",
+			f->len, niov));
 	}
 
-	DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
-	net->virtio_net_tx(net, &iov[1], n - 1, plen);
+	if (nframes > 0 && qp->net->virtio_net_tx)
+		qp->net->virtio_net_tx(qp, frames, nframes);
 
-	/* chain is processed, release it and set tlen */
-	vq_relchain(vq, idx, tlen);
+	/* chains are processed, release them with their tlen */
+	vq_relchains(vq, chains, n);
 }
 
 static void
 virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_qpair *qp = &net->pairs[vq->num / 2];
 
 	/*
 	 * Any ring entries to process?
@@ -537,11 +784,11 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 		return;
 
 	/* Signal the tx thread for processing */
-	pthread_mutex_lock(&net->tx_mtx);
-	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-	if (net->tx_in_progress == 0)
-		pthread_cond_signal(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	vq_set_used_ring_flags(&net->base, vq);
+	if (qp->tx_in_progress == 0)
+		pthread_cond_signal(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
@@ -550,27 +797,28 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 static void *
 virtio_net_tx_thread(void *param)
 {
-	struct virtio_net *net = param;
-	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_TXQ];
+	struct virtio_net_qpair *qp = param;
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq = &net->queues[qp->idx * 2 + VIRTIO_NET_TXQ];
 
 	/*
 	 * Let us wait till the tx queue pointers get initialised &
 	 * first tx signaled
 	 */
-	pthread_mutex_lock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
 
 	while (!net->closing && !vq_ring_ready(vq))
-		pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+		pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 	if (net->closing) {
 		WPRINTF(("vtnet tx thread closing...\n"));
-		pthread_mutex_unlock(&net->tx_mtx);
+		pthread_mutex_unlock(&qp->tx_mtx);
 		return NULL;
 	}
 
 	for (;;) {
 		/* note - tx mutex is locked here */
-		net->tx_in_progress = 0;
+		qp->tx_in_progress = 0;
 
 		/*
 		 * Checking the avail ring here serves two purposes:
@@ -584,18 +832,18 @@ virtio_net_tx_thread(void *param)
 			if (!net->resetting && vq_has_descs(vq))
 				break;
 
-			pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+			pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 			if (net->closing) {
 				WPRINTF(("vtnet tx thread closing...\n"));
-				pthread_mutex_unlock(&net->tx_mtx);
+				pthread_mutex_unlock(&qp->tx_mtx);
 				return NULL;
 			}
 		}
 
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-		net->tx_in_progress = 1;
-		pthread_mutex_unlock(&net->tx_mtx);
+		vq_set_used_ring_flags(&net->base, vq);
+		qp->tx_in_progress = 1;
+		pthread_mutex_unlock(&qp->tx_mtx);
 
 		do {
 			/*
@@ -603,7 +851,7 @@ virtio_net_tx_thread(void *param)
 			 * iovecs and sending when an end-of-packet
 			 * is found
 			 */
-			virtio_net_proctx(net, vq);
+			virtio_net_proctx(qp, vq);
 		} while (vq_has_descs(vq));
 
 		/*
@@ -611,17 +859,92 @@ virtio_net_tx_thread(void *param)
 		 */
 		vq_endchains(vq, 1);
 
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
+	}
+}
+
+static uint8_t
+virtio_net_ctl_mq(struct virtio_net *net, uint8_t cmd, struct iovec *iov,
+		  int n)
+{
+	uint16_t npairs;
+
+	if (cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET || n < 1 ||
+	    iov[0].iov_len < sizeof(npairs) ||
+	    (net->features & VIRTIO_NET_F_MQ) == 0)
+		return VIRTIO_NET_ERR;
+
+	memcpy(&npairs, iov[0].iov_base, sizeof(npairs));
+	if (npairs < 1 || npairs > net->num_pairs) {
+		WPRINTF(("vtnet: invalid number of queue pairs %u\n", npairs));
+		return VIRTIO_NET_ERR;
 	}
+
+	DPRINTF(("vtnet: %u queue pairs enabled\n\r", npairs));
+	virtio_net_set_pairs(net, npairs);
+	return VIRTIO_NET_OK;
 }
 
-#ifdef notyet
+/*
+ * Each control command is a read-only header, optional read-only
+ * data and a one byte writable ack.
+ */
 static void
 virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq)
 {
-	DPRINTF(("vtnet: control qnotify!\n\r"));
+	struct virtio_net *net = vdev;
+	struct virtio_net_ctrl_hdr *hdr;
+	struct iovec iov[4];
+	uint16_t idx, flags[4];
+	uint8_t *ack;
+	int n;
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, 4, flags);
+		if (n < 0)
+			break;
+		if (n < 2 || n > 4 || iov[0].iov_len < sizeof(*hdr) ||
+		    (flags[0] & VRING_DESC_F_WRITE) != 0 ||
+		    iov[n - 1].iov_len < 1 ||
+		    (flags[n - 1] & VRING_DESC_F_WRITE) == 0) {
+			WPRINTF(("vtnet: malformed control command\n"));
+			vq_relchain(vq, idx, 0);
+			continue;
+		}
+
+		hdr = iov[0].iov_base;
+		ack = iov[n - 1].iov_base;
+		if (hdr->class == VIRTIO_NET_CTRL_MQ)
+			*ack = virtio_net_ctl_mq(net, hdr->cmd, &iov[1], n - 2);
+		else
+			*ack = VIRTIO_NET_ERR;
+
+		vq_relchain(vq, idx, 1);
+	}
+
+	vq_endchains(vq, 1);
+}
+
+/*
+ * Hook up queue notifications: rx and tx alternate, and the control
+ * queue (if negotiated) sits after the last queue pair in use.
+ */
+static void
+virtio_net_setup_queues(struct virtio_net *net)
+{
+	int i;
+
+	for (i = 0; i < net->ops.nvq; i++)
+		net->queues[i].notify = (i % 2 == VIRTIO_NET_RXQ) ?
+			virtio_net_ping_rxq : virtio_net_ping_txq;
+
+	net->ctlq = -1;
+	if (net->features & VIRTIO_NET_F_CTRL_VQ) {
+		net->ctlq = (net->features & VIRTIO_NET_F_MQ) ?
+			net->num_pairs * 2 : VIRTIO_NET_CTLQ;
+		net->queues[net->ctlq].notify = virtio_net_ping_ctlq;
+	}
 }
-#endif
 
 static int
 virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
@@ -649,7 +972,7 @@ virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
 }
 
 static int
-virtio_net_tap_open(char *devname)
+virtio_net_tap_open(char *devname, bool mq)
 {
 	int tunfd, rc;
 	struct ifreq ifr;
@@ -663,6 +986,8 @@ virtio_net_tap_open(char *devname)
 
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	if (mq)
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
 
 	if (*devname) {
 		strncpy(ifr.ifr_name, devname, IFNAMSIZ);
@@ -681,12 +1006,30 @@ virtio_net_tap_open(char *devname)
 	return tunfd;
 }
 
+/*
+ * Close the tap queues of pairs first and above that have no mevent
+ * to do it for us.
+ */
+static void
+virtio_net_tap_close(struct virtio_net *net, int first)
+{
+	int i;
+
+	for (i = first; i < net->num_pairs; i++) {
+		if (net->pairs[i].tapfd >= 0) {
+			close(net->pairs[i].tapfd);
+			net->pairs[i].tapfd = -1;
+		}
+	}
+}
+
 static void
 virtio_net_tap_setup(struct virtio_net *net, char *devname)
 {
 	char tbuf[IFNAMSIZ];
+	struct virtio_net_qpair *qp;
 	int vhost_fd = -1;
-	int rc;
+	int rc, i;
 
 	rc = snprintf(tbuf, IFNAMSIZ, "%s", devname);
 	if (rc < 0 || rc >= IFNAMSIZ) /* give warning if error or truncation happens */
@@ -695,10 +1038,18 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	net->virtio_net_rx = virtio_net_tap_rx;
 	net->virtio_net_tx = virtio_net_tap_tx;
 
-	net->tapfd = virtio_net_tap_open(tbuf);
-	if (net->tapfd == -1) {
-		WPRINTF(("open of tap device %s failed\n", tbuf));
-		return;
+	/*
+	 * With several queue pairs, every pair gets its own queue of a
+	 * multi-queue tap device.
+	 */
+	for (i = 0; i < net->num_pairs; i++) {
+		qp = &net->pairs[i];
+		qp->tapfd = virtio_net_tap_open(tbuf, net->num_pairs > 1);
+		if (qp->tapfd == -1) {
+			WPRINTF(("open of tap device %s queue %d failed\n",
+				tbuf, i));
+			goto fail;
+		}
 	}
 	DPRINTF(("open of tap device %s success!\n", tbuf));
 
@@ -708,10 +1059,11 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	 */
 	int opt = 1;
 
-	if (ioctl(net->tapfd, FIONBIO, &opt) < 0) {
-		WPRINTF(("tap device O_NONBLOCK failed\n"));
-		close(net->tapfd);
-		net->tapfd = -1;
+	for (i = 0; i < net->num_pairs; i++) {
+		if (ioctl(net->pairs[i].tapfd, FIONBIO, &opt) < 0) {
+			WPRINTF(("tap device O_NONBLOCK failed\n"));
+			goto fail;
+		}
 	}
 
 	if (net->use_vhost) {
@@ -720,7 +1072,7 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 			WPRINTF(("open of vhost-net failed\n"));
 		else {
 			net->vhost_net = vhost_net_init(&net->base, vhost_fd,
-				net->tapfd, 0);
+				net->pairs[0].tapfd, 0);
 			if (!net->vhost_net) {
 				WPRINTF(("vhost_net_init failed, fallback "
 					"to userspace virtio\n"));
@@ -731,15 +1083,28 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	}
 
 	if (vhost_fd < 0) {
-		net->mevp = mevent_add(net->tapfd, EVF_READ,
-				       virtio_net_rx_callback, net,
-				       virtio_net_teardown, net);
-		if (net->mevp == NULL) {
-			WPRINTF(("Could not register event\n"));
-			close(net->tapfd);
-			net->tapfd = -1;
+		for (i = 0; i < net->num_pairs; i++) {
+			qp = &net->pairs[i];
+			qp->mevp = mevent_add(qp->tapfd, EVF_READ,
+					       virtio_net_rx_callback, qp,
+					       virtio_net_teardown, qp);
+			if (qp->mevp == NULL) {
+				WPRINTF(("Could not register event\n"));
+				/* keep the queue pairs that are working */
+				virtio_net_tap_close(net, i);
+				if (i > 0)
+					net->num_pairs = i;
+				break;
+			}
 		}
 	}
+
+	/* only the first queue pair receives until the guest enables more */
+	virtio_net_set_pairs(net, 1);
+	return;
+
+fail:
+	virtio_net_tap_close(net, 0);
 }
 
 static int
@@ -755,7 +1120,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *opt;
 	int mac_provided;
 	pthread_mutexattr_t attr;
-	int rc;
+	struct virtio_net_qpair *qp;
+	int rc, i;
 
 	net = calloc(1, sizeof(struct virtio_net));
 	if (!net) {
@@ -782,6 +1148,7 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	 */
 	mac_provided = 0;
 	net->vhost_net = NULL;
+	net->num_pairs = 1;
 	if (opts != NULL) {
 		int err;
 
@@ -797,7 +1164,18 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		while ((opt = strsep(&vtopts, ",")) != NULL) {
 			if (strcmp("vhost", opt) == 0)
 				net->use_vhost = true;
-			else {
+			else if (strncmp("num_queues=", opt, 11) == 0) {
+				if (dm_strtoi(opt + 11, NULL, 10,
+					&net->num_pairs) != 0 ||
+				    net->num_pairs < 1 ||
+				    net->num_pairs > VIRTIO_NET_MAX_PAIRS) {
+					pr_err("Invalid num_queues %s\n",
+						opt + 11);
+					free(devname);
+					free(net);
+					return -1;
+				}
+			} else {
 				err = virtio_net_parsemac(opt,
 					net->config.mac);
 				if (err != 0) {
@@ -810,25 +1188,22 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		}
 	}
 
-	virtio_linkup(&net->base, &virtio_net_ops, net, dev, net->queues,
-		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
-	net->base.mtx = &net->mtx;
-	net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
+	/* vhost-net only drives a single queue pair */
+	if (net->use_vhost && net->num_pairs > 1) {
+		WPRINTF(("vtnet: num_queues ignored with vhost\n"));
+		net->num_pairs = 1;
+	}
 
-	net->queues[VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
-	net->queues[VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
-#ifdef notyet
-	net->queues[VIRTIO_NET_CTLQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_CTLQ].notify = virtio_net_ping_ctlq;
-#endif
+	for (i = 0; i < VIRTIO_NET_MAX_PAIRS; i++) {
+		qp = &net->pairs[i];
+		qp->net = net;
+		qp->idx = i;
+		qp->tapfd = -1;
+	}
 
 	/*
 	 * Attempt to open the tap device
 	 */
-	net->tapfd = -1;
-
 	if (!devname) {
 		WPRINTF(("virtio_net: devname NULL\n"));
 		free(net);
@@ -838,9 +1213,36 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (strncmp(devname, "tap", 3) == 0 ||
 	    strncmp(devname, "vmnet", 5) == 0)
 		virtio_net_tap_setup(net, devname);
+	else if (strcmp(devname, "loopback") == 0 && !net->use_vhost) {
+		net->virtio_net_tx = virtio_net_loopback_tx;
+		net->loopback = true;
+	}
 
 	free(devname);
 
+	/*
+	 * The number of queues is only known once the tap queues are
+	 * open; the control queue comes last and is only offered along
+	 * with multiple queue pairs.
+	 */
+	net->ops = virtio_net_ops;
+	net->ops.nvq = net->num_pairs * 2;
+	if (net->num_pairs > 1)
+		net->ops.nvq++;
+	virtio_linkup(&net->base, &net->ops, net, dev, net->queues,
+		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
+	net->base.mtx = &net->mtx;
+	net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
+	if (!net->use_vhost)
+		net->base.device_caps |= VIRTIO_NET_S_MODERNCAPS;
+	if (net->num_pairs > 1)
+		net->base.device_caps |= VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ;
+	net->config.max_virtqueue_pairs = net->num_pairs;
+
+	for (i = 0; i < net->ops.nvq; i++)
+		net->queues[i].qsize = VIRTIO_NET_RINGSZ;
+	virtio_net_setup_queues(net);
+
 	/*
 	 * The default MAC address is the standard NetApp OUI of 00-a0-98,
 	 * followed by an MD5 of the PCI slot/func number and dev name
@@ -872,7 +1274,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
 	/* Link is up if we managed to open tap device */
-	net->config.status = (opts == NULL || net->tapfd >= 0);
+	net->config.status = (opts == NULL || net->pairs[0].tapfd >= 0 ||
+		net->loopback);
 
 	/* use BAR 1 to map MSI-X table and PBA, if we're using MSI-X */
 	if (virtio_interrupt_init(&net->base, virtio_uses_msix())) {
@@ -884,27 +1287,41 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	/* use BAR 0 to map config regs in IO space */
 	virtio_set_io_bar(&net->base, 0);
 
+	/* and BAR 4 for the virtio 1.0 interface, vhost only does legacy */
+	if (!net->use_vhost && virtio_set_modern_bar(&net->base, false)) {
+		pr_err("%s: failed to set the modern bar\n", __func__);
+		free(net);
+		return -1;
+	}
+
 	net->resetting = 0;
 	net->closing = 0;
 
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
-	net->rx_in_progress = 0;
-	pthread_mutex_init(&net->rx_mtx, NULL);
 
 	/*
-	 * Initialize tx semaphore & spawn TX processing thread.
-	 * As of now, only one thread for TX desc processing is
-	 * spawned.
+	 * Initialize rx/tx locks & spawn one TX processing thread
+	 * per queue pair.
 	 */
-	net->tx_in_progress = 0;
-	pthread_mutex_init(&net->tx_mtx, NULL);
-	pthread_cond_init(&net->tx_cond, NULL);
-	pthread_create(&net->tx_tid, NULL, virtio_net_tx_thread,
-		       (void *)net);
-	snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", dev->slot,
-		 dev->func);
-	pthread_setname_np(net->tx_tid, tname);
+	for (i = 0; i < net->num_pairs; i++) {
+		qp = &net->pairs[i];
+		qp->rx_in_progress = 0;
+		pthread_mutex_init(&qp->rx_mtx, NULL);
+
+		qp->tx_in_progress = 0;
+		pthread_mutex_init(&qp->tx_mtx, NULL);
+		pthread_cond_init(&qp->tx_cond, NULL);
+		pthread_create(&qp->tx_tid, NULL, virtio_net_tx_thread,
+			       (void *)qp);
+		if (net->num_pairs > 1)
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx%d",
+				 dev->slot, dev->func, i);
+		else
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx",
+				 dev->slot, dev->func);
+		pthread_setname_np(qp->tx_tid, tname);
+	}
 
 	return 0;
 }
@@ -951,11 +1368,16 @@ virtio_net_neg_features(void *vdev, uint64_t negotiated_features)
 
 	net->features = negotiated_features;
 
-	if (!(net->features & VIRTIO_NET_F_MRG_RXBUF)) {
+	/* virtio 1.0 always has the num_buffers field, set to 1 */
+	if (!(net->features & VIRTIO_NET_F_MRG_RXBUF) &&
+	    !(net->features & (1UL << VIRTIO_F_VERSION_1))) {
 		net->rx_merge = 0;
 		/* non-merge rx header is 2 bytes shorter */
 		net->rx_vhdrlen -= 2;
 	}
+
+	/* the control queue index depends on VIRTIO_NET_F_MQ */
+	virtio_net_setup_queues(net);
 }
 
 static void
@@ -969,8 +1391,8 @@ virtio_net_set_status(void *vdev, uint64_t status)
 
 	if (!net->vhost_net->vhost_started &&
 		(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
-		if (net->mevp)
-			mevent_disable(net->mevp);
+		if (net->pairs[0].mevp)
+			mevent_disable(net->pairs[0].mevp);
 
 		rc = vhost_net_start(net->vhost_net);
 		if (rc < 0) {
@@ -985,33 +1407,42 @@ virtio_net_set_status(void *vdev, uint64_t status)
 	}
 }
 
+/*
+ * Called for each queue pair once its tap event is gone; the last
+ * one frees the device.
+ */
 static void
 virtio_net_teardown(void *param)
 {
+	struct virtio_net_qpair *qp;
 	struct virtio_net *net;
 
-	net = (struct virtio_net *)param;
-	if (!net)
+	qp = (struct virtio_net_qpair *)param;
+	if (!qp)
 		return;
 
-	if (net->tapfd >= 0) {
-		close(net->tapfd);
-		net->tapfd = -1;
+	net = qp->net;
+	if (qp->tapfd >= 0) {
+		close(qp->tapfd);
+		qp->tapfd = -1;
 	} else
-		pr_err("net->tapfd is -1!\n");
+		pr_err("qp->tapfd is -1!\n");
 
-	free(net);
+	if (__sync_sub_and_fetch(&net->teardown_refs, 1) == 0)
+		free(net);
 }
 
 static void
 virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_net *net;
+	int i, n;
 
 	if (dev->arg) {
 		net = (struct virtio_net *) dev->arg;
 
-		virtio_net_tx_stop(net);
+		for (i = 0; i < net->num_pairs; i++)
+			virtio_net_tx_stop(&net->pairs[i]);
 
 		if (net->vhost_net) {
 			vhost_net_stop(net->vhost_net);
@@ -1020,10 +1451,18 @@ virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			net->vhost_net = NULL;
 		}
 
-		if (net->mevp != NULL)
-			mevent_delete(net->mevp);
-		else
-			virtio_net_teardown(net);
+		/*
+		 * Pairs without an mevent are torn down right here, the
+		 * others from the mevent thread; whoever is last frees net.
+		 */
+		n = net->num_pairs;
+		net->teardown_refs = n;
+		for (i = 0; i < n; i++) {
+			if (net->pairs[i].mevp != NULL)
+				mevent_delete(net->pairs[i].mevp);
+			else
+				virtio_net_teardown(&net->pairs[i]);
+		}
 
 		DPRINTF(("%s: done\n", __func__));
 	} else
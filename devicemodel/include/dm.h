@@ -49,6 +49,7 @@ extern char *mac_seed;
 extern bool lapic_pt;
 extern bool is_rtvm;
 extern bool is_winvm;
+extern int guest_ncpus;
 
 int vmexit_task_switch(struct vmctx *ctx, struct vhm_request *vhm_req,
 		       int *vcpu);
@@ -67,4 +68,11 @@ int  virtio_uses_msix(void);
 size_t high_bios_size(void);
 void init_debugexit(void);
 void deinit_debugexit(void);
+
+/*
+ * Serialize the emulation of devices which can't handle accesses from
+ * several ioreq workers at once. No-op without --ioreq_workers.
+ */
+void ioreq_serial_lock(void);
+void ioreq_serial_unlock(void);
 #endif
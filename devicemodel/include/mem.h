@@ -47,8 +47,9 @@ struct mem_range {
 #define	MEM_F_WRITE		0x2
 #define	MEM_F_RW		(MEM_F_READ | MEM_F_WRITE)
 #define	MEM_F_IMMUTABLE		0x4	/* mem_range cannot be unregistered */
+#define	MEM_F_CONCURRENT	0x8	/* handler may run on several vCPUs at once */
 
-int	emulate_mem(struct vmctx *ctx, struct mmio_request *mmio_req);
+int	emulate_mem(struct vmctx *ctx, int vcpu, struct mmio_request *mmio_req);
 int	register_mem(struct mem_range *memp);
 int	register_mem_fallback(struct mem_range *memp);
 int	unregister_mem(struct mem_range *memp);
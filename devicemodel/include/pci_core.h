@@ -171,6 +171,9 @@ struct pci_vdev {
 
 	void	*arg;		/* devemu-private data */
 
+	/* vdev_barread/vdev_barwrite may run on several vCPUs at once */
+	bool	bar_concurrent;
+
 	uint8_t	cfgdata[PCI_REGMAX + 1];
 	struct pcibar bar[PCI_BARMAX + 1];
 };
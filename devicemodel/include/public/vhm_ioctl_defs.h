@@ -75,6 +75,7 @@
 #define IC_CREATE_VCPU                 _IC_ID(IC_ID, IC_ID_VM_BASE + 0x04)
 #define IC_RESET_VM                    _IC_ID(IC_ID, IC_ID_VM_BASE + 0x05)
 #define IC_SET_VCPU_REGS               _IC_ID(IC_ID, IC_ID_VM_BASE + 0x06)
+#define IC_GET_VCPU_EXIT_STATS         _IC_ID(IC_ID, IC_ID_VM_BASE + 0x07)
 
 /* IRQ and Interrupts */
 #define IC_ID_IRQ_BASE                 0x20UL
@@ -133,6 +133,36 @@
 #include "types.h"
 #include "timer.h"
 
+/*
+ * Packed virtqueue layout (virtio 1.1, section 2.7).  Older kernel
+ * headers do not carry these, so provide them here.
+ */
+#ifndef VIRTIO_F_RING_PACKED
+#define VIRTIO_F_RING_PACKED		34
+#endif
+
+#ifndef VRING_PACKED_DESC_F_AVAIL
+#define VRING_PACKED_DESC_F_AVAIL	7
+#define VRING_PACKED_DESC_F_USED	15
+
+#define VRING_PACKED_EVENT_FLAG_ENABLE	0x0
+#define VRING_PACKED_EVENT_FLAG_DISABLE	0x1
+#define VRING_PACKED_EVENT_FLAG_DESC	0x2
+#define VRING_PACKED_EVENT_F_WRAP_CTR	15
+
+struct vring_packed_desc_event {
+	uint16_t off_wrap;
+	uint16_t flags;
+};
+
+struct vring_packed_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t id;
+	uint16_t flags;
+};
+#endif
+
 /**
  * @brief virtio API
  *
@@ -283,10 +313,15 @@ struct virtio_vq_info;
  *
  * The BROKED flag ("this thing done gone and broked") is for future
  * use.
+ *
+ * A device which serializes each of its queues on a lock of its own sets
+ * QNOTIFY_UNLOCKED: its queue notifications are then dispatched without
+ * the device lock, so the queues are processed in parallel.
  */
 #define	VIRTIO_USE_MSIX		0x01
 #define	VIRTIO_EVENT_IDX	0x02	/* use the event-index values */
 #define	VIRTIO_BROKED		0x08	/* ??? */
+#define	VIRTIO_QNOTIFY_UNLOCKED	0x10	/* notify without the device lock */
 
 /*
  * virtio pci device bar layout
@@ -385,7 +420,9 @@ struct virtio_ops {
 	void	(*reset)(void *);
 				/**< called on virtual device reset */
 	void	(*qnotify)(void *, struct virtio_vq_info *);
-				/**< called on QNOTIFY if no VQ notify */
+				/**< called on QNOTIFY if no VQ notify,
+				 * with the device lock held unless
+				 * VIRTIO_QNOTIFY_UNLOCKED is set */
 	int	(*cfgread)(void *, int, int, uint32_t *);
 				/**< to read config regs */
 	int	(*cfgwrite)(void *, int, int, uint32_t);
@@ -398,6 +435,7 @@ struct virtio_ops {
 
 #define	VQ_ALLOC	0x01	/* set once we have a pfn */
 #define	VQ_BROKED	0x02	/* ??? */
+#define	VQ_PACKED	0x04	/* ring uses the packed layout */
 /**
  * @brief Virtqueue data structure
  *
@@ -444,6 +482,32 @@ struct virtio_vq_info {
 	uint32_t gpa_avail[2];	/**< gpa of avail_ring */
 	uint32_t gpa_used[2];	/**< gpa of used_ring */
 	bool enabled;		/**< whether the virtqueue is enabled */
+
+	/* packed ring state, only valid when VQ_PACKED is set */
+	volatile struct vring_packed_desc *pdesc;
+				/**< packed descriptor ring */
+	volatile struct vring_packed_desc_event *driver_event;
+				/**< driver event suppression area */
+	volatile struct vring_packed_desc_event *device_event;
+				/**< device event suppression area */
+	uint16_t used_idx;	/**< next used slot in the packed ring */
+	bool avail_wrap;	/**< driver ring wrap counter */
+	bool used_wrap;		/**< device ring wrap counter */
+	uint16_t last_ndesc;	/**< ring slots of last chain fetched */
+	uint16_t used_since_event;
+				/**< slots used since last vq_endchains */
+	uint16_t *chain_ndesc;	/**< ring slots taken by each buffer id */
+};
+
+/**
+ * @brief One descriptor chain of a vq_getchains() batch
+ */
+struct vq_chain {
+	uint16_t idx;		/**< chain head (or buffer id) for vq_relchains */
+	int	niov;		/**< number of descriptors in the chain */
+	struct iovec *iov;	/**< first iovec of the chain */
+	uint16_t *flags;	/**< first descriptor flags, if requested */
+	uint32_t iolen;		/**< bytes to report back, set by the driver */
 };
 
 /* as noted above, these are sort of backwards, name-wise */
@@ -477,8 +541,17 @@ vq_ring_ready(struct virtio_vq_info *vq)
 static inline bool
 vq_has_descs(struct virtio_vq_info *vq)
 {
-	return (vq_ring_ready(vq) && vq->last_avail !=
-	    vq->avail->idx);
+	uint16_t flags;
+
+	if (!vq_ring_ready(vq))
+		return false;
+
+	if ((vq->flags & VQ_PACKED) == 0)
+		return vq->last_avail != vq->avail->idx;
+
+	flags = vq->pdesc[vq->last_avail].flags;
+	return !!(flags & (1 << VRING_PACKED_DESC_F_AVAIL)) == vq->avail_wrap &&
+	    !!(flags & (1 << VRING_PACKED_DESC_F_USED)) != vq->avail_wrap;
 }
 
 /**
@@ -655,6 +728,52 @@ void vq_retchain(struct virtio_vq_info *vq);
  */
 void vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen);
 
+/**
+ * @brief Fetch a batch of request chains.
+ *
+ * Like vq_getchain(), but reads the available ring once for up to n
+ * chains.  The descriptors of all fetched chains are laid out back to
+ * back in iov[] (and flags[]), see struct vq_chain.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param chains Array of at least n chains filled in on return.
+ * @param n Maximum number of chains to fetch.
+ * @param iov Pointer to iov[] array shared by all chains.
+ * @param n_iov Size of iov[] array.
+ * @param flags Pointer to a uint16_t array of n_iov entries, or NULL.
+ *
+ * @return number of chains fetched, 0 if none, -1 if the first is invalid.
+ */
+int vq_getchains(struct virtio_vq_info *vq, struct vq_chain *chains, int n,
+		 struct iovec *iov, int n_iov, uint16_t *flags);
+
+/**
+ * @brief Return the most recently fetched chains to the available ring.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param chains Chains to return, as handed out by vq_getchains().
+ * @param n Number of chains to return.
+ *
+ * @return None
+ */
+void vq_retchains(struct virtio_vq_info *vq, const struct vq_chain *chains,
+		  int n);
+
+/**
+ * @brief Return a batch of request chains to the guest.
+ *
+ * Each chain is reported with its iolen field.  The used entries are
+ * published together; call vq_endchains() afterwards as usual.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param chains Chains to release.
+ * @param n Number of chains.
+ *
+ * @return None
+ */
+void vq_relchains(struct virtio_vq_info *vq, const struct vq_chain *chains,
+		  int n);
+
 /**
  * @brief Driver has finished processing "available" chains and calling
  * vq_relchain on each one.
@@ -682,6 +801,20 @@ void vq_endchains(struct virtio_vq_info *vq, int used_all_avail);
  */
 void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq);
 
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * Asks the guest not to notify us on new available buffers.  Drivers
+ * should use this instead of touching the used ring directly so that
+ * both split and packed rings are handled.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return None
+ */
+void vq_set_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq);
+
 /**
  * @brief Handle PCI configuration space reads.
  *
@@ -113,6 +113,60 @@ static bool check_vm_clos_config(uint16_t vm_id)
 	return ret;
 }
 
+#ifdef CONFIG_SCHED_BALANCE
+static inline bool is_rt_vm_config(const struct acrn_vm_config *vm_config)
+{
+	return ((vm_config->guest_flags & (GUEST_FLAG_LAPIC_PASSTHROUGH | GUEST_FLAG_RT)) != 0UL) ||
+		(vm_config->severity == (uint8_t)SEVERITY_RTVM);
+}
+
+/*
+ * Get the pCPUs of the VMs which are configured as RT or LAPIC passthrough.
+ */
+static uint64_t get_rt_pcpu_bitmap(void)
+{
+	uint64_t rt_pcpu_bitmap = 0UL;
+	uint16_t vm_id, vcpu_id;
+	struct acrn_vm_config *vm_config;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm_config = get_vm_config(vm_id);
+		if (is_rt_vm_config(vm_config)) {
+			for (vcpu_id = 0U; vcpu_id < vm_config->vcpu_num; vcpu_id++) {
+				rt_pcpu_bitmap |= vm_config->vcpu_affinity[vcpu_id];
+			}
+		}
+	}
+
+	return rt_pcpu_bitmap;
+}
+
+/*
+ * A vCPU has one prefer pCPU, except that a vCPU of a post-launched VM which
+ * is neither RT nor LAPIC passthrough may have more. The scheduler is allowed
+ * to migrate it among them, so none of them may be a pCPU of an RT or LAPIC
+ * passthrough VM.
+ */
+static bool is_vcpu_affinity_valid(const struct acrn_vm_config *vm_config, uint64_t affinity,
+		uint64_t rt_pcpu_bitmap)
+{
+	return (bitmap_weight(affinity) == 1U) || ((affinity != 0UL) &&
+		(vm_config->load_order == POST_LAUNCHED_VM) && !is_rt_vm_config(vm_config) &&
+		((affinity & rt_pcpu_bitmap) == 0UL));
+}
+#else
+static inline uint64_t get_rt_pcpu_bitmap(void)
+{
+	return 0UL;
+}
+
+static bool is_vcpu_affinity_valid(__unused const struct acrn_vm_config *vm_config, uint64_t affinity,
+		__unused uint64_t rt_pcpu_bitmap)
+{
+	return (bitmap_weight(affinity) == 1U);
+}
+#endif
+
 /**
  * @pre vm_config != NULL
  */
@@ -120,7 +174,8 @@ bool sanitize_vm_config(void)
 {
 	bool ret = true;
 	uint16_t vm_id, vcpu_id, vuart_idx, nr;
-	uint64_t sos_pcpu_bitmap, pre_launch_pcpu_bitmap = 0U, vm_pcpu_bitmap;
+	uint64_t sos_pcpu_bitmap, pre_launch_pcpu_bitmap = 0U, vm_pcpu_bitmap, home_pcpu_bitmap;
+	uint64_t rt_pcpu_bitmap = get_rt_pcpu_bitmap();
 	struct acrn_vm_config *vm_config;
 
 	sos_pcpu_bitmap = (uint64_t)((((uint64_t)1U) << get_pcpu_nums()) - 1U);
@@ -133,18 +188,21 @@ bool sanitize_vm_config(void)
 	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
 		vm_config = get_vm_config(vm_id);
 		vm_pcpu_bitmap = 0U;
+		home_pcpu_bitmap = 0U;
 		if (vm_config->load_order != SOS_VM) {
 			for (vcpu_id = 0U; vcpu_id < vm_config->vcpu_num; vcpu_id++) {
-				if (bitmap_weight(vm_config->vcpu_affinity[vcpu_id]) != 1U) {
-					pr_err("%s: vm%u vcpu%u should have only one prefer pcpu!",
+				if (!is_vcpu_affinity_valid(vm_config, vm_config->vcpu_affinity[vcpu_id], rt_pcpu_bitmap)) {
+					pr_err("%s: vm%u vcpu%u has invalid pcpu affinity!",
 							__func__, vm_id, vcpu_id);
 					ret = false;
 					break;
 				}
 				vm_pcpu_bitmap |= vm_config->vcpu_affinity[vcpu_id];
+				/* a vCPU is created on the first pCPU of its affinity */
+				home_pcpu_bitmap |= 1UL << ffs64(vm_config->vcpu_affinity[vcpu_id]);
 			}
 
-			if ((bitmap_weight(vm_pcpu_bitmap) != vm_config->vcpu_num)) {
+			if ((bitmap_weight(home_pcpu_bitmap) != vm_config->vcpu_num)) {
 				pr_err("%s: One VM cannot have multiple vcpus share one pcpu!", __func__);
 				ret = false;
 			}
@@ -258,11 +258,10 @@ void init_pcpu_post(uint16_t pcpu_id)
 		}
 
 		/*
-		 * Reserve memory from platform E820 for EPT 4K pages for all VMs
+		 * Set up the pool of EPT page-table pages for all VMs, from platform E820
+		 * with CONFIG_LAST_LEVEL_EPT_AT_BOOT
 		 */
-#ifdef CONFIG_LAST_LEVEL_EPT_AT_BOOT
-		reserve_buffer_for_ept_pages();
-#endif
+		init_ept_page_pool();
 		/* Start all secondary cores */
 		startup_paddr = prepare_trampoline();
 		if (!start_pcpus(AP_MASK)) {
@@ -34,6 +34,7 @@
 static struct cpu_capability {
 	uint8_t apicv_features;
 	uint8_t ept_features;
+	bool pml_supported;
 
 	uint32_t vmx_ept;
 	uint32_t vmx_vpid;
@@ -159,6 +160,9 @@ static void detect_ept_cap(void)
 		if (is_ctrl_setting_allowed(msr_val, VMX_PROCBASED_CTLS2_EPT)) {
 			cpu_caps.ept_features = 1U;
 		}
+		if (is_ctrl_setting_allowed(msr_val, VMX_PROCBASED_CTLS2_PML)) {
+			cpu_caps.pml_supported = true;
+		}
 	}
 }
 
@@ -325,6 +329,12 @@ bool pcpu_has_vmx_ept_cap(uint32_t bit_mask)
 	return ((cpu_caps.vmx_ept & bit_mask) != 0U);
 }
 
+/* PML logs guest physical addresses when EPT dirty flags get set, so it needs the EPT A/D flags too */
+bool is_pml_supported(void)
+{
+	return (cpu_caps.pml_supported && pcpu_has_vmx_ept_cap(VMX_EPT_AD));
+}
+
 bool pcpu_has_vmx_vpid_cap(uint32_t bit_mask)
 {
 	return ((cpu_caps.vmx_vpid & bit_mask) != 0U);
@@ -49,40 +49,6 @@ static struct acrn_vcpu *is_single_destination(struct acrn_vm *vm, const struct
 	return vcpu;
 }
 
-/*
- * lookup a ptdev entry by sid
- * Before adding a ptdev remapping, should lookup by physical sid to check
- * whether the resource has been token by others.
- * When updating a ptdev remapping, should lookup by virtual sid to check
- * whether this resource is valid.
- * @pre: vm must be NULL when lookup by physical sid, otherwise,
- * vm must not be NULL when lookup by virtual sid.
- */
-static inline struct ptirq_remapping_info *
-ptirq_lookup_entry_by_sid(uint32_t intr_type,
-		const union source_id *sid, const struct acrn_vm *vm)
-{
-	uint16_t idx;
-	struct ptirq_remapping_info *entry;
-	struct ptirq_remapping_info *entry_found = NULL;
-
-	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
-		entry = &ptirq_entries[idx];
-		if (!is_entry_active(entry)) {
-			continue;
-		}
-		if ((intr_type == entry->intr_type) &&
-			((vm == NULL) ?
-			(sid->value == entry->phys_sid.value) :
-			((vm == entry->vm) &&
-			(sid->value == entry->virt_sid.value)))) {
-			entry_found = entry;
-			break;
-		}
-	}
-	return entry_found;
-}
-
 static uint32_t calculate_logical_dest_mask(uint64_t pdmask)
 {
 	uint32_t dest_mask = 0UL;
@@ -316,10 +282,8 @@ static struct ptirq_remapping_info *add_msix_remapping(struct acrn_vm *vm,
 		if (ptirq_lookup_entry_by_sid(PTDEV_INTR_MSI, &virt_sid, vm) != NULL) {
 			pr_err("MSIX re-add vbdf%x", virt_bdf);
 		} else {
-			entry = ptirq_alloc_entry(vm, PTDEV_INTR_MSI);
+			entry = ptirq_alloc_entry(vm, PTDEV_INTR_MSI, &phys_sid, &virt_sid);
 			if (entry != NULL) {
-				entry->phys_sid.value = phys_sid.value;
-				entry->virt_sid.value = virt_sid.value;
 				entry->release_cb = ptirq_free_irte;
 
 				/* update msi source and active entry */
@@ -331,8 +295,7 @@ static struct ptirq_remapping_info *add_msix_remapping(struct acrn_vm *vm,
 		}
 	} else if (entry->vm != vm) {
 		if (is_sos_vm(entry->vm)) {
-			entry->vm = vm;
-			entry->virt_sid.msi_id.bdf = virt_bdf;
+			ptirq_change_owner(entry, vm, &virt_sid);
 		} else {
 			pr_err("MSIX pbdf%x idx=%d already in vm%d with vbdf%x, not able to add into vm%d with vbdf%x",
 				entry->phys_sid.msi_id.bdf, entry->phys_sid.msi_id.entry_nr, entry->vm->vm_id,
@@ -398,10 +361,8 @@ static struct ptirq_remapping_info *add_intx_remapping(struct acrn_vm *vm, uint3
 	entry = ptirq_lookup_entry_by_sid(PTDEV_INTR_INTX, &phys_sid, NULL);
 	if (entry == NULL) {
 		if (ptirq_lookup_entry_by_sid(PTDEV_INTR_INTX, &virt_sid, vm) == NULL) {
-			entry = ptirq_alloc_entry(vm, PTDEV_INTR_INTX);
+			entry = ptirq_alloc_entry(vm, PTDEV_INTR_INTX, &phys_sid, &virt_sid);
 			if (entry != NULL) {
-				entry->phys_sid.value = phys_sid.value;
-				entry->virt_sid.value = virt_sid.value;
 				entry->release_cb = ptirq_free_irte;
 
 				/* activate entry */
@@ -415,8 +376,7 @@ static struct ptirq_remapping_info *add_intx_remapping(struct acrn_vm *vm, uint3
 		}
 	} else if (entry->vm != vm) {
 		if (is_sos_vm(entry->vm)) {
-			entry->vm = vm;
-			entry->virt_sid.value = virt_sid.value;
+			ptirq_change_owner(entry, vm, &virt_sid);
 			entry->polarity = 0U;
 		} else {
 			pr_err("INTX gsi%d already in vm%d with vgsi%d, not able to add into vm%d with vgsi%d",
@@ -769,7 +729,7 @@ int32_t ptirq_intx_pin_remap(struct acrn_vm *vm, uint32_t virt_gsi, enum intx_ct
 
 					entry = ptirq_lookup_entry_by_sid(PTDEV_INTR_INTX, &alt_virt_sid, vm);
 					if (entry != NULL) {
-						entry->virt_sid.value = virt_sid.value;
+						ptirq_change_owner(entry, vm, &virt_sid);
 						dev_dbg(DBG_LEVEL_IRQ,
 								"IOAPIC gsi=%hhu pirq=%u vgsi=%d switch from %s to %s for vm%d",
 								entry->phys_sid.intx_id.gsi,
@@ -846,14 +806,20 @@ void ptirq_remove_intx_remapping(const struct acrn_vm *vm, uint32_t virt_gsi, bo
 /*
  * @pre vm != NULL
  */
-void ptirq_remove_msix_remapping(const struct acrn_vm *vm, uint16_t virt_bdf,
+void ptirq_remove_msix_remapping(const struct acrn_vm *vm, uint16_t virt_bdf, uint16_t phys_bdf,
 		uint32_t vector_count)
 {
+	struct dmar_qi_batch *batch;
+	union pci_bdf pbdf;
 	uint32_t i;
 
+	pbdf.value = phys_bdf;
+	/* the IRTEs freed are invalidated together, the batch is taken inside ptdev_lock as by dmar_free_irte() */
+	spinlock_obtain(&ptdev_lock);
+	batch = dmar_qi_batch_begin((uint8_t)pbdf.bits.b, pbdf.fields.devfun);
 	for (i = 0U; i < vector_count; i++) {
-		spinlock_obtain(&ptdev_lock);
 		remove_msix_remapping(vm, virt_bdf, i);
-		spinlock_release(&ptdev_lock);
 	}
+	dmar_qi_batch_commit(batch);
+	spinlock_release(&ptdev_lock);
 }
@@ -15,6 +15,10 @@
 #include <vtd.h>
 #include <logmsg.h>
 #include <trace.h>
+#include <per_cpu.h>
+#include <cpu_caps.h>
+#include <bits.h>
+#include <atomic.h>
 
 #define DBG_LEVEL_EPT	6U
 
@@ -30,6 +34,59 @@ bool ept_is_mr_valid(const struct acrn_vm *vm, uint64_t base, uint64_t size)
 	return valid;
 }
 
+/* run on the pcpus of a VM in the notification IRQ context, see ept_sync_pcpus() and ept_flush_all() */
+static void ept_invept_cb(void *data)
+{
+	struct acrn_vm *vm = (struct acrn_vm *)data;
+
+	invept(vm->arch_vm.nworld_eptp);
+	if (vm->sworld_control.flag.active != 0UL) {
+		invept(vm->arch_vm.sworld_eptp);
+	}
+}
+
+/*
+ * Flush the EPT of vm on every pcpu, not only on those of its vcpus: vcpus of
+ * the VM may have run on other pcpus before, and the VPID/EPTP tagged TLB
+ * entries outlive them there. The range [gpa, gpa + size) of the IOMMU domain
+ * of the VM is flushed as well.
+ * The pcpus of LAPIC passthrough vcpus can't be reached by smp_call_function(),
+ * their own VM doesn't fold any page (see ept_coalesce_mr()), and no other VM
+ * runs on them. This pcpu flushes itself rather than sending an IPI to itself:
+ * it may be in the idle thread with IRQs disabled, see shutdown_vm_from_idle().
+ *
+ * @pre vm != NULL
+ */
+static void ept_flush_all(struct acrn_vm *vm, uint64_t gpa, uint64_t size)
+{
+	uint64_t mask = get_active_pcpu_bitmap();
+	struct acrn_vm *lapic_pt_vm;
+	struct acrn_vcpu *vcpu;
+	uint16_t vm_id, i;
+
+	bitmap_clear_nolock(get_pcpu_id(), &mask);
+	ept_invept_cb(vm);
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		lapic_pt_vm = get_vm_from_vmid(vm_id);
+		if (is_lapic_pt_configured(lapic_pt_vm)) {
+			foreach_vcpu(i, lapic_pt_vm, vcpu) {
+				if (is_lapic_pt_enabled(vcpu)) {
+					bitmap_clear_nolock(pcpuid_from_vcpu(vcpu), &mask);
+				}
+			}
+		}
+	}
+
+	if (mask != 0UL) {
+		smp_call_function(mask, ept_invept_cb, vm);
+	}
+
+	if (vm->iommu != NULL) {
+		iommu_flush_domain_range(vm->iommu, gpa, size);
+	}
+}
+
 void destroy_ept(struct acrn_vm *vm)
 {
 	/* Destroy secure world */
@@ -39,7 +96,12 @@ void destroy_ept(struct acrn_vm *vm)
 
 	if (vm->arch_vm.nworld_eptp != NULL) {
 		(void)memset(vm->arch_vm.nworld_eptp, 0U, PAGE_SIZE);
+		/* No pcpu or IOMMU may walk the pages once they are back in the pool */
+		ept_flush_all(vm, 0UL, vm->arch_vm.ept_mem_ops.info->ept.top_address_space);
+		vm->arch_vm.nworld_eptp = NULL;
 	}
+	/* Return the page-table pages, and the share set aside, to the EPT page pool */
+	free_ept_pages(&vm->arch_vm.ept_mem_ops);
 }
 
 /**
@@ -106,66 +168,290 @@ int32_t ept_misconfig_vmexit_handler(__unused struct acrn_vcpu *vcpu)
 	return status;
 }
 
-void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page,
-	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+/*
+ * Run func on the pcpus of the vcpus of vm, and wait for it to be done. The
+ * vcpus in the guest are kicked out of it, and go through their pending
+ * requests before getting back to it.
+ *
+ * @pre vm != NULL
+ */
+static void ept_sync_pcpus(struct acrn_vm *vm, smp_call_func_t func)
 {
+	struct acrn_vcpu *vcpu;
+	uint64_t mask = 0UL;
 	uint16_t i;
+
+	foreach_vcpu(i, vm, vcpu) {
+		bitmap_set_nolock(pcpuid_from_vcpu(vcpu), &mask);
+	}
+
+	if (mask != 0UL) {
+		smp_call_function(mask, func, vm);
+	}
+}
+
+/*
+ * Large page re-coalescing
+ *
+ * Modifying or deleting part of a large page splits it into a page of the
+ * next level (see split_large_page()). Once later edits leave the 512 entries
+ * of such a page mapping one contiguous, aligned range with the same
+ * attributes again, the page is folded back into a large page, and is kept
+ * by the VM as a spare page (see the EPT page pool in page.c). A/D flags
+ * are not compared, the dirty flags are carried over to the large page.
+ *
+ * The normal world range edited while the EPT lock is held is recorded, and
+ * folded once, when the lock is released, or at ept_commit_update() in an
+ * update. The folded pages are sealed before the lock is released. Once it is,
+ * the EPT is flushed on all pcpus and the IOMMU domain of the VM is flushed,
+ * and only then may the VM take the sealed pages again: no vcpu or device can
+ * still walk them by then. Pages which could be folded
+ * only by taking away the execute right (the workaround of "Machine Check
+ * Error on Page Size Change") are left as they are, and so is all of the EPT
+ * while the dirty pages are being logged.
+ */
+
+/*
+ * Return the large page entry mapping what the 512 entries of table map, or
+ * 0 if there is none. pse is PAGE_PSE if the entries have to be large pages
+ * themselves, 0 if they have to be 4K pages.
+ */
+static uint64_t ept_coalesced_entry(const uint64_t *table, uint64_t entry_size, uint64_t pse,
+		const struct memory_ops *mem_ops)
+{
+	uint64_t paddr = table[0] & PDE_PFN_MASK;
+	uint64_t prot = table[0] & ~(PDE_PFN_MASK | EPT_ACCESSED | EPT_DIRTY);
+	uint64_t large_prot = prot | PAGE_PSE;
+	uint64_t dirty = 0UL, large = 0UL;
+	uint64_t entry, i;
+	bool uniform;
+
+	mem_ops->tweak_exe_right(&large_prot);
+	uniform = ((prot & PAGE_PSE) == pse) && (large_prot == (prot | PAGE_PSE)) &&
+		mem_aligned_check(paddr, entry_size * PTRS_PER_PTE);
+
+	for (i = 0UL; uniform && (i < PTRS_PER_PTE); i++) {
+		entry = table[i];
+		uniform = (mem_ops->pgentry_present(entry) != 0UL) && ((entry & PDE_PFN_MASK) == paddr) &&
+			((entry & ~(PDE_PFN_MASK | EPT_ACCESSED | EPT_DIRTY)) == prot);
+		dirty |= entry & EPT_DIRTY;
+		paddr += entry_size;
+	}
+
+	if (uniform) {
+		large = (table[0] & PDE_PFN_MASK) | large_prot | dirty;
+	}
+
+	return large;
+}
+
+/*
+ * @pre *entry points to a page of the next level of the EPT
+ */
+static bool ept_coalesce_table(uint64_t *entry, uint64_t entry_size, uint64_t pse, const struct memory_ops *mem_ops)
+{
+	uint64_t *table = hpa2hva(*entry & PDE_PFN_MASK);
+	uint64_t large = ept_coalesced_entry(table, entry_size, pse, mem_ops);
+
+	if (large != 0UL) {
+		set_pgentry(entry, large, mem_ops);
+		mem_ops->free_page(mem_ops->info, (struct page *)table);
+		mem_ops->large_page_stats->merged++;
+	}
+
+	return (large != 0UL);
+}
+
+/*
+ * Fold the pages of the EPT under [gpa, gpa + size) back into large pages where
+ * possible, and return whether any of them was folded.
+ *
+ * @pre vm != NULL && pml4_page != NULL
+ * @pre this pcpu holds the EPT lock of vm
+ */
+static bool ept_coalesce_mr(const struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
+{
+	const struct memory_ops *mem_ops = &vm->arch_vm.ept_mem_ops;
+	/* the PD pages are shared by the EPT of the secure world, but not the PDPT pages */
+	bool fold_pd = (vm->sworld_control.flag.active == 0UL);
+	uint64_t addr = gpa & PDE_MASK;
+	uint64_t end = gpa + size;
+	uint64_t addr_next;
+	uint64_t *pml4e, *pdpte, *pde;
+	bool folded = false;
+
+	/* smp_call_function() can't reach the pcpus of LAPIC passthrough vcpus */
+	if (mem_ops->large_page_enabled && !vm->arch_vm.dirty_log_enabled && !is_lapic_pt_configured(vm)) {
+		while (addr < end) {
+			addr_next = (addr & PDPTE_MASK) + PDPTE_SIZE;
+			pml4e = pml4e_offset(pml4_page, addr);
+			if (mem_ops->pgentry_present(*pml4e) != 0UL) {
+				pdpte = pdpte_offset(pml4e, addr);
+				if ((mem_ops->pgentry_present(*pdpte) != 0UL) && (pdpte_large(*pdpte) == 0UL)) {
+					for (; (addr < addr_next) && (addr < end); addr += PDE_SIZE) {
+						pde = pde_offset(pdpte, addr);
+						if ((mem_ops->pgentry_present(*pde) != 0UL) && (pde_large(*pde) == 0UL)) {
+							folded = ept_coalesce_table(pde, PTE_SIZE, 0UL, mem_ops) || folded;
+						}
+					}
+					if (fold_pd) {
+						folded = ept_coalesce_table(pdpte, PDE_SIZE, PAGE_PSE, mem_ops) || folded;
+					}
+				}
+			}
+			addr = addr_next;
+		}
+	}
+
+	return folded;
+}
+
+static inline bool is_ept_update_owner(const struct acrn_vm *vm)
+{
+	/* ept_update_pcpu can't change to the id of this pcpu behind its back */
+	return (vm->ept_update_pcpu == get_pcpu_id());
+}
+
+static void ept_flush_vcpus(struct acrn_vm *vm)
+{
 	struct acrn_vcpu *vcpu;
+	uint16_t i;
+
+	foreach_vcpu(i, vm, vcpu) {
+		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+	}
+}
+
+static void ept_edit_begin(struct acrn_vm *vm)
+{
+	if (!is_ept_update_owner(vm)) {
+		spinlock_obtain(&vm->ept_lock);
+	}
+}
+
+/*
+ * Coalesce the range edited under the EPT lock, release the lock and flush
+ * the EPT of the vcpus. Pages folded back are taken again only after a
+ * synchronous flush, which is done without holding the lock.
+ *
+ * @pre this pcpu holds the EPT lock of vm
+ */
+static void ept_release_and_flush(struct acrn_vm *vm)
+{
+	uint64_t start = vm->ept_touched_start;
+	uint64_t end = vm->ept_touched_end;
+	uint64_t gen = 0UL;
+
+	vm->ept_touched_end = 0UL;
+	if ((end != 0UL) && ept_coalesce_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, start, end - start)) {
+		gen = seal_retired_ept_pages(&vm->arch_vm.ept_mem_ops);
+	}
+	spinlock_release(&vm->ept_lock);
+
+	if (gen != 0UL) {
+		/* the pages folded are all in the range coalesced */
+		ept_flush_all(vm, start, end - start);
+		recycle_retired_ept_pages(&vm->arch_vm.ept_mem_ops, gen);
+	}
+	ept_flush_vcpus(vm);
+}
+
+static void ept_edit_end(struct acrn_vm *vm, const uint64_t *pml4_page, uint64_t gpa, uint64_t size)
+{
+	/* only the normal world EPT takes its pages from the pool */
+	if (pml4_page == vm->arch_vm.nworld_eptp) {
+		if (vm->ept_touched_end == 0UL) {
+			vm->ept_touched_start = gpa;
+			vm->ept_touched_end = gpa + size;
+		} else {
+			vm->ept_touched_start = min(vm->ept_touched_start, gpa);
+			vm->ept_touched_end = max(vm->ept_touched_end, gpa + size);
+		}
+	}
+
+	if (is_ept_update_owner(vm)) {
+		vm->ept_flush_pending = true;
+	} else {
+		ept_release_and_flush(vm);
+	}
+}
+
+/**
+ * @pre vm != NULL
+ * @pre this pcpu is not in an EPT update of vm
+ */
+void ept_begin_update(struct acrn_vm *vm)
+{
+	spinlock_obtain(&vm->ept_lock);
+	vm->ept_update_pcpu = get_pcpu_id();
+	vm->ept_flush_pending = false;
+}
+
+/**
+ * @pre vm != NULL
+ * @pre this pcpu is in an EPT update of vm
+ */
+void ept_commit_update(struct acrn_vm *vm)
+{
+	vm->ept_update_pcpu = INVALID_CPU_ID;
+	if (vm->ept_flush_pending) {
+		ept_release_and_flush(vm);
+	} else {
+		spinlock_release(&vm->ept_lock);
+	}
+}
+
+int32_t ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page,
+	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+{
 	uint64_t prot = prot_orig;
+	int32_t ret;
 
 	dev_dbg(DBG_LEVEL_EPT, "%s, vm[%d] hpa: 0x%016lx gpa: 0x%016lx size: 0x%016lx prot: 0x%016x\n",
 			__func__, vm->vm_id, hpa, gpa, size, prot);
 
-	spinlock_obtain(&vm->ept_lock);
+	ept_edit_begin(vm);
 
-	mmu_add(pml4_page, hpa, gpa, size, prot, &vm->arch_vm.ept_mem_ops);
+	ret = mmu_add(pml4_page, hpa, gpa, size, prot, &vm->arch_vm.ept_mem_ops);
 
-	spinlock_release(&vm->ept_lock);
+	ept_edit_end(vm, pml4_page, gpa, size);
 
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
-	}
+	return ret;
 }
 
-void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
+int32_t ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
 		uint64_t gpa, uint64_t size,
 		uint64_t prot_set, uint64_t prot_clr)
 {
-	struct acrn_vcpu *vcpu;
-	uint16_t i;
 	uint64_t local_prot = prot_set;
+	int32_t ret;
 
 	dev_dbg(DBG_LEVEL_EPT, "%s,vm[%d] gpa 0x%lx size 0x%lx\n", __func__, vm->vm_id, gpa, size);
 
-	spinlock_obtain(&vm->ept_lock);
+	ept_edit_begin(vm);
 
-	mmu_modify_or_del(pml4_page, gpa, size, local_prot, prot_clr, &(vm->arch_vm.ept_mem_ops), MR_MODIFY);
+	ret = mmu_modify_or_del(pml4_page, gpa, size, local_prot, prot_clr, &(vm->arch_vm.ept_mem_ops), MR_MODIFY);
 
-	spinlock_release(&vm->ept_lock);
+	ept_edit_end(vm, pml4_page, gpa, size);
 
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
-	}
+	return ret;
 }
 /**
  * @pre [gpa,gpa+size) has been mapped into host physical memory region
  */
-void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
+int32_t ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
 {
-	struct acrn_vcpu *vcpu;
-	uint16_t i;
+	int32_t ret;
 
 	dev_dbg(DBG_LEVEL_EPT, "%s,vm[%d] gpa 0x%lx size 0x%lx\n", __func__, vm->vm_id, gpa, size);
 
-	spinlock_obtain(&vm->ept_lock);
+	ept_edit_begin(vm);
 
-	mmu_modify_or_del(pml4_page, gpa, size, 0UL, 0UL, &vm->arch_vm.ept_mem_ops, MR_DEL);
+	ret = mmu_modify_or_del(pml4_page, gpa, size, 0UL, 0UL, &vm->arch_vm.ept_mem_ops, MR_DEL);
 
-	spinlock_release(&vm->ept_lock);
+	ept_edit_end(vm, pml4_page, gpa, size);
 
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
-	}
+	return ret;
 }
 
 /**
@@ -203,16 +489,15 @@ void *get_ept_entry(struct acrn_vm *vm)
 }
 
 /**
- * @pre vm != NULL && cb != NULL.
+ * @pre mem_ops != NULL && pml4_page != NULL && cb != NULL.
  */
-void walk_ept_table(struct acrn_vm *vm, pge_handler cb)
+static void walk_ept_pml4(const struct memory_ops *mem_ops, uint64_t *pml4_page, pge_handler cb)
 {
-	const struct memory_ops *mem_ops = &vm->arch_vm.ept_mem_ops;
 	uint64_t *pml4e, *pdpte, *pde, *pte;
 	uint64_t i, j, k, m;
 
 	for (i = 0UL; i < PTRS_PER_PML4E; i++) {
-		pml4e = pml4e_offset((uint64_t *)get_ept_entry(vm), i << PML4E_SHIFT);
+		pml4e = pml4e_offset(pml4_page, i << PML4E_SHIFT);
 		if (mem_ops->pgentry_present(*pml4e) == 0UL) {
 			continue;
 		}
@@ -244,3 +529,277 @@ void walk_ept_table(struct acrn_vm *vm, pge_handler cb)
 		}
 	}
 }
+
+/**
+ * @pre vm != NULL && cb != NULL.
+ */
+void walk_ept_table(struct acrn_vm *vm, pge_handler cb)
+{
+	walk_ept_pml4(&vm->arch_vm.ept_mem_ops, (uint64_t *)get_ept_entry(vm), cb);
+}
+
+/*
+ * Dirty page logging
+ *
+ * With the EPT accessed and dirty flags enabled, the processor sets the dirty
+ * flag of an EPT leaf entry on the first write through it, and PML has the
+ * GPA of the write put into the log of the vcpu. The logs are flushed into
+ * the dirty bitmap of the VM when they get full, when a vcpu is switched out,
+ * and before the bitmap is fetched. A dirty flag is set once for a leaf
+ * entry, so a large page is dirty as a whole once written to.
+ *
+ * Writes through the mappings of the VM memory in the Service VM, e.g. by
+ * the device model or by DMA of passthrough devices, are not logged.
+ */
+
+/* Dirty bitmap words fetched and copied to the Service VM at a time */
+#define DIRTY_LOG_CHUNK_WORDS	32U
+
+/* Pages covered by one word of the dirty bitmap */
+#define DIRTY_WORD_PAGES	64UL
+
+static inline uint64_t *get_dirty_bitmap(const struct acrn_vm *vm)
+{
+	return vm->arch_vm.ept_mem_ops.info->ept.dirty_bitmap;
+}
+
+static inline uint64_t get_dirty_bitmap_words(const struct acrn_vm *vm)
+{
+	return DIRTY_BITMAP_WORDS(vm->arch_vm.ept_mem_ops.info->ept.top_address_space);
+}
+
+/**
+ * @pre vm != NULL && get_dirty_bitmap(vm) != NULL
+ */
+static void ept_mark_dirty(struct acrn_vm *vm, uint64_t gpa)
+{
+	uint64_t *bitmap = get_dirty_bitmap(vm);
+	const uint64_t *pgentry;
+	uint64_t pg_size = PTE_SIZE;
+	uint64_t page, end;
+
+	pgentry = lookup_address((uint64_t *)vm->arch_vm.nworld_eptp, gpa, &pg_size, &vm->arch_vm.ept_mem_ops);
+	if (pgentry == NULL) {
+		/* unmapped since it was logged */
+		pg_size = PTE_SIZE;
+	}
+
+	page = (gpa & ~(pg_size - 1UL)) >> PAGE_SHIFT;
+	end = min(page + (pg_size >> PAGE_SHIFT), get_dirty_bitmap_words(vm) * DIRTY_WORD_PAGES);
+	while (page < end) {
+		if (((page % DIRTY_WORD_PAGES) == 0UL) && ((end - page) >= DIRTY_WORD_PAGES)) {
+			(void)atomic_swap64(&bitmap[page / DIRTY_WORD_PAGES], ~0UL);
+			page += DIRTY_WORD_PAGES;
+		} else {
+			bitmap_set_lock((uint16_t)(page % DIRTY_WORD_PAGES), &bitmap[page / DIRTY_WORD_PAGES]);
+			page++;
+		}
+	}
+}
+
+/**
+ * @pre vcpu != NULL
+ * @pre the VMCS of vcpu is the current VMCS
+ */
+void ept_flush_pml(struct acrn_vcpu *vcpu)
+{
+	uint16_t index;
+	uint32_t i;
+
+	if (vcpu->arch.pml_enabled) {
+		/* the index counts down from the last entry, and wraps around once the log is full */
+		index = exec_vmread16(VMX_GUEST_PML_INDEX);
+		if (index != (uint16_t)(PML_ENTITY_NUM - 1U)) {
+			if (index >= PML_ENTITY_NUM) {
+				i = 0U;
+			} else {
+				i = (uint32_t)index + 1U;
+			}
+			for (; i < PML_ENTITY_NUM; i++) {
+				ept_mark_dirty(vcpu->vm, vcpu->arch.pml_buf[i]);
+			}
+			exec_vmwrite16(VMX_GUEST_PML_INDEX, (uint16_t)(PML_ENTITY_NUM - 1U));
+		}
+	}
+}
+
+int32_t pml_full_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	ept_flush_pml(vcpu);
+
+	/* the write which found the log full is done once the guest is resumed */
+	vcpu_retain_rip(vcpu);
+
+	return 0;
+}
+
+static void ept_clear_dirty(uint64_t *pgentry, __unused uint64_t size)
+{
+	bitmap_clear_lock(EPT_DIRTY_SHIFT, pgentry);
+}
+
+/*
+ * Clear the dirty flags of the pages set in one word of the dirty bitmap
+ *
+ * @pre vm != NULL
+ * @pre vm->ept_lock is held
+ */
+static void ept_clear_dirty_word(struct acrn_vm *vm, uint64_t first_page, uint64_t word)
+{
+	const uint64_t *pgentry;
+	uint64_t pg_size = 0UL;
+	uint64_t bits = word;
+	uint16_t bit;
+
+	while (bits != 0UL) {
+		bit = ffs64(bits);
+		pgentry = lookup_address((uint64_t *)vm->arch_vm.nworld_eptp, (first_page + bit) << PAGE_SHIFT,
+				&pg_size, &vm->arch_vm.ept_mem_ops);
+		if (pgentry != NULL) {
+			bitmap_clear_lock(EPT_DIRTY_SHIFT, (uint64_t *)pgentry);
+		}
+
+		if ((pgentry != NULL) && (pg_size >= (DIRTY_WORD_PAGES << PAGE_SHIFT))) {
+			/* the pages of a word are all mapped by one large page */
+			bits = 0UL;
+		} else {
+			bitmap_clear_nolock(bit, &bits);
+		}
+	}
+}
+
+/*
+ * Set the dirty bits of one word of the dirty bitmap again, for a chunk which
+ * could not be handed to the Service VM. Writes logged meanwhile are kept.
+ */
+static void ept_restore_dirty_word(uint64_t *word, uint64_t bits)
+{
+	uint64_t rest = bits;
+	uint16_t bit;
+
+	while (rest != 0UL) {
+		bit = ffs64(rest);
+		bitmap_set_lock(bit, word);
+		bitmap_clear_nolock(bit, &rest);
+	}
+}
+
+/* Check that the buffer the bitmap is copied to is all mapped in the Service VM */
+static bool is_dirty_log_buffer_mapped(struct acrn_vm *sos_vm, uint64_t gpa, uint64_t size)
+{
+	uint64_t page = gpa & PAGE_MASK;
+	bool mapped = true;
+
+	while ((page < (gpa + size)) && mapped) {
+		mapped = (gpa2hpa(sos_vm, page) != INVALID_HPA);
+		page += PAGE_SIZE;
+	}
+
+	return mapped;
+}
+
+/* run on the pcpus of a VM in the notification IRQ context, see ept_sync_pcpus() */
+static void ept_flush_pml_cb(void *data)
+{
+	struct acrn_vm *vm = (struct acrn_vm *)data;
+	struct acrn_vcpu *vcpu;
+	uint16_t i;
+
+	foreach_vcpu(i, vm, vcpu) {
+		/* the logs of the other vcpus were flushed when they were switched out */
+		if (get_cpu_var(vmcs_run) == (void *)vcpu->arch.vmcs) {
+			ept_flush_pml(vcpu);
+		}
+	}
+}
+
+/**
+ * @pre vm != NULL
+ */
+int32_t ept_set_dirty_log(struct acrn_vm *vm, bool enable)
+{
+	uint64_t *bitmap = get_dirty_bitmap(vm);
+	struct acrn_vcpu *vcpu;
+	uint16_t i;
+	int32_t ret = -ENODEV;
+
+	/* smp_call_function() can't reach the pcpus of LAPIC passthrough vcpus */
+	if ((bitmap != NULL) && is_pml_supported() && !is_lapic_pt_configured(vm)) {
+		spinlock_obtain(&vm->ept_lock);
+		if (enable) {
+			(void)memset(bitmap, 0U, get_dirty_bitmap_words(vm) * sizeof(uint64_t));
+			walk_ept_pml4(&vm->arch_vm.ept_mem_ops, (uint64_t *)vm->arch_vm.nworld_eptp, ept_clear_dirty);
+		}
+		vm->arch_vm.dirty_log_enabled = enable;
+		spinlock_release(&vm->ept_lock);
+
+		foreach_vcpu(i, vm, vcpu) {
+			vcpu_make_request(vcpu, ACRN_REQUEST_DIRTY_LOG);
+		}
+		ept_sync_pcpus(vm, NULL);
+		ret = 0;
+	}
+
+	return ret;
+}
+
+/**
+ * @pre vm != NULL && sos_vm != NULL && log != NULL
+ */
+int32_t ept_get_dirty_log(struct acrn_vm *vm, struct acrn_vm *sos_vm, const struct acrn_dirty_log *log)
+{
+	uint64_t *bitmap = get_dirty_bitmap(vm);
+	uint64_t nr_words = get_dirty_bitmap_words(vm);
+	uint64_t chunk[DIRTY_LOG_CHUNK_WORDS];
+	uint64_t first, count, done, n, j;
+	uint64_t bitmap_gpa = log->bitmap_gpa;
+	int32_t ret = -EINVAL;
+
+	first = log->gpa >> PAGE_SHIFT;
+	count = log->nr_pages;
+	if (vm->arch_vm.dirty_log_enabled && ((log->gpa & PAGE_MASK) == log->gpa) &&
+			((first % DIRTY_WORD_PAGES) == 0UL) && ((count % DIRTY_WORD_PAGES) == 0UL)) {
+		first /= DIRTY_WORD_PAGES;
+		count /= DIRTY_WORD_PAGES;
+		if ((count != 0UL) && (first < nr_words) && (count <= (nr_words - first))) {
+			ret = 0;
+		}
+	}
+
+	/* nothing is cleared unless it can be handed over */
+	if ((ret == 0) && !is_dirty_log_buffer_mapped(sos_vm, bitmap_gpa, count * sizeof(uint64_t))) {
+		ret = -EFAULT;
+	}
+
+	if (ret == 0) {
+		ept_sync_pcpus(vm, ept_flush_pml_cb);
+
+		done = 0UL;
+		while ((done < count) && (ret == 0)) {
+			n = min(count - done, (uint64_t)DIRTY_LOG_CHUNK_WORDS);
+
+			spinlock_obtain(&vm->ept_lock);
+			for (j = 0UL; j < n; j++) {
+				chunk[j] = atomic_readandclear64(&bitmap[first + done + j]);
+				if (chunk[j] != 0UL) {
+					ept_clear_dirty_word(vm, (first + done + j) * DIRTY_WORD_PAGES, chunk[j]);
+				}
+			}
+			spinlock_release(&vm->ept_lock);
+
+			if (copy_to_gpa(sos_vm, chunk, bitmap_gpa, (uint32_t)(n * sizeof(uint64_t))) != 0) {
+				/* keep the pages dirty for the next fetch; the rest of the range is untouched */
+				for (j = 0UL; j < n; j++) {
+					ept_restore_dirty_word(&bitmap[first + done + j], chunk[j]);
+				}
+				ret = -EFAULT;
+			}
+			bitmap_gpa += n * sizeof(uint64_t);
+			done += n;
+		}
+
+		ept_sync_pcpus(vm, ept_invept_cb);
+	}
+
+	return ret;
+}
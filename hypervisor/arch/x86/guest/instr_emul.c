@@ -2198,6 +2198,56 @@ static int32_t local_decode_instruction(enum vm_cpu_mode cpu_mode,
 	return ret;
 }
 
+/*
+ * Decoding depends on nothing but the instruction bytes, the CPU mode and
+ * CS.D, so the decoded instruction is kept and reused whenever the same
+ * bytes are fetched again in the same mode. The bytes are still fetched
+ * from the guest on every exit, which keeps the cache right when guest
+ * code or its mapping changes.
+ */
+static struct instr_emul_cache_entry *get_decode_cache_entry(struct instr_emul_ctxt *ctxt)
+{
+	uint64_t head;
+
+	(void)memcpy_s(&head, sizeof(head), ctxt->vie.inst, sizeof(head));
+	head ^= (uint64_t)ctxt->vie.num_valid;
+
+	return &ctxt->cache[(head * 0x9E3779B97F4A7C15UL) >> (64U - VIE_CACHE_SHIFT)];
+}
+
+static bool lookup_decode_cache(struct instr_emul_ctxt *ctxt, enum vm_cpu_mode cpu_mode, bool cs_d)
+{
+	const struct instr_emul_cache_entry *entry = get_decode_cache_entry(ctxt);
+	bool hit = false;
+	uint8_t i;
+
+	if ((entry->vie.num_valid == ctxt->vie.num_valid) && (entry->cpu_mode == (uint8_t)cpu_mode) &&
+			(entry->cs_d == cs_d)) {
+		hit = true;
+		for (i = 0U; i < entry->vie.num_valid; i++) {
+			if (entry->vie.inst[i] != ctxt->vie.inst[i]) {
+				hit = false;
+				break;
+			}
+		}
+	}
+
+	if (hit) {
+		ctxt->vie = entry->vie;
+	}
+
+	return hit;
+}
+
+static void update_decode_cache(struct instr_emul_ctxt *ctxt, enum vm_cpu_mode cpu_mode, bool cs_d)
+{
+	struct instr_emul_cache_entry *entry = get_decode_cache_entry(ctxt);
+
+	entry->vie = ctxt->vie;
+	entry->cpu_mode = (uint8_t)cpu_mode;
+	entry->cs_d = cs_d;
+}
+
 /* for instruction MOVS/STO, check the gva gotten from DI/SI. */
 static int32_t instr_check_di(struct acrn_vcpu *vcpu)
 {
@@ -2306,6 +2356,7 @@ int32_t decode_instruction(struct acrn_vcpu *vcpu)
 	uint32_t csar;
 	int32_t retval;
 	enum vm_cpu_mode cpu_mode;
+	bool cs_d;
 
 	emul_ctxt = &vcpu->inst_ctxt;
 	retval = vie_init(&emul_ctxt->vie, vcpu);
@@ -2317,8 +2368,16 @@ int32_t decode_instruction(struct acrn_vcpu *vcpu)
 	} else {
 		csar = exec_vmread32(VMX_GUEST_CS_ATTR);
 		cpu_mode = get_vcpu_mode(vcpu);
+		cs_d = seg_desc_def32(csar);
 
-		retval = local_decode_instruction(cpu_mode, seg_desc_def32(csar), &emul_ctxt->vie);
+		if (lookup_decode_cache(emul_ctxt, cpu_mode, cs_d)) {
+			retval = 0;
+		} else {
+			retval = local_decode_instruction(cpu_mode, cs_d, &emul_ctxt->vie);
+			if (retval == 0) {
+				update_decode_cache(emul_ctxt, cpu_mode, cs_d);
+			}
+		}
 
 		if (retval != 0) {
 			pr_err("decode instruction failed @ 0x%016lx:", vcpu_get_rip(vcpu));
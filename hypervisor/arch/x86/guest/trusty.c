@@ -5,6 +5,7 @@
  */
 
 #include <types.h>
+#include <errno.h>
 #include <bits.h>
 #include <crypto_api.h>
 #include <trusty.h>
@@ -14,6 +15,7 @@
 #include <ept.h>
 #include <vm.h>
 #include <vmx.h>
+#include <vmcs.h>
 #include <security.h>
 #include <logmsg.h>
 #include <seed.h>
@@ -51,8 +53,10 @@ struct trusty_mem {
  * @param size LK size (16M by default)
  * @param gpa_rebased gpa rebased to offset xxx (511G_OFFSET)
  *
+ * @retval 0 on success
+ * @retval -ENOMEM the EPT page pool of the VM is exhausted
  */
-static void create_secure_world_ept(struct acrn_vm *vm, uint64_t gpa_orig,
+static int32_t create_secure_world_ept(struct acrn_vm *vm, uint64_t gpa_orig,
 		uint64_t size, uint64_t gpa_rebased)
 {
 	uint64_t nworld_pml4e;
@@ -63,58 +67,62 @@ static void create_secure_world_ept(struct acrn_vm *vm, uint64_t gpa_orig,
 	uint64_t pdpte, *dest_pdpte_p, *src_pdpte_p;
 	void *sub_table_addr, *pml4_base;
 	uint16_t i;
+	int32_t ret;
 
 	hpa = gpa2hpa(vm, gpa_orig);
 
 	/* Unmap gpa_orig~gpa_orig+size from guest normal world ept mapping */
-	ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, gpa_orig, size);
-
-	/* Copy PDPT entries from Normal world to Secure world
-	 * Secure world can access Normal World's memory,
-	 * but Normal World can not access Secure World's memory.
-	 * The PML4/PDPT for Secure world are separated from
-	 * Normal World.PD/PT are shared in both Secure world's EPT
-	 * and Normal World's EPT
-	 */
-	pml4_base = vm->arch_vm.ept_mem_ops.info->ept.sworld_pgtable_base;
-	(void)memset(pml4_base, 0U, PAGE_SIZE);
-	vm->arch_vm.sworld_eptp = pml4_base;
-	sanitize_pte((uint64_t *)vm->arch_vm.sworld_eptp, &vm->arch_vm.ept_mem_ops);
+	ret = ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, gpa_orig, size);
+	if (ret == 0) {
+		/* Copy PDPT entries from Normal world to Secure world
+		 * Secure world can access Normal World's memory,
+		 * but Normal World can not access Secure World's memory.
+		 * The PML4/PDPT for Secure world are separated from
+		 * Normal World.PD/PT are shared in both Secure world's EPT
+		 * and Normal World's EPT
+		 */
+		pml4_base = vm->arch_vm.ept_mem_ops.info->ept.sworld_pgtable_base;
+		(void)memset(pml4_base, 0U, PAGE_SIZE);
+		vm->arch_vm.sworld_eptp = pml4_base;
+		sanitize_pte((uint64_t *)vm->arch_vm.sworld_eptp, &vm->arch_vm.ept_mem_ops);
 
-	/* The trusty memory is remapped to guest physical address
-	 * of gpa_rebased to gpa_rebased + size
-	 */
-	sub_table_addr = vm->arch_vm.ept_mem_ops.info->ept.sworld_pgtable_base +
-									TRUSTY_PML4_PAGE_NUM(TRUSTY_EPT_REBASE_GPA);
-	(void)memset(sub_table_addr, 0U, PAGE_SIZE);
-	sworld_pml4e = hva2hpa(sub_table_addr) | table_present;
-	set_pgentry((uint64_t *)pml4_base, sworld_pml4e, &vm->arch_vm.ept_mem_ops);
+		/* The trusty memory is remapped to guest physical address
+		 * of gpa_rebased to gpa_rebased + size
+		 */
+		sub_table_addr = vm->arch_vm.ept_mem_ops.info->ept.sworld_pgtable_base +
+										TRUSTY_PML4_PAGE_NUM(TRUSTY_EPT_REBASE_GPA);
+		(void)memset(sub_table_addr, 0U, PAGE_SIZE);
+		sworld_pml4e = hva2hpa(sub_table_addr) | table_present;
+		set_pgentry((uint64_t *)pml4_base, sworld_pml4e, &vm->arch_vm.ept_mem_ops);
+
+		nworld_pml4e = get_pgentry((uint64_t *)vm->arch_vm.nworld_eptp);
+
+		/*
+		 * copy PTPDEs from normal world EPT to secure world EPT,
+		 * and remove execute access attribute in these entries
+		 */
+		dest_pdpte_p = pml4e_page_vaddr(sworld_pml4e);
+		src_pdpte_p = pml4e_page_vaddr(nworld_pml4e);
+		for (i = 0U; i < (uint16_t)(PTRS_PER_PDPTE - 1UL); i++) {
+			pdpte = get_pgentry(src_pdpte_p);
+			if ((pdpte & table_present) != 0UL) {
+				pdpte &= ~EPT_EXE;
+				set_pgentry(dest_pdpte_p, pdpte, &vm->arch_vm.ept_mem_ops);
+			}
+			src_pdpte_p++;
+			dest_pdpte_p++;
+		}
 
-	nworld_pml4e = get_pgentry((uint64_t *)vm->arch_vm.nworld_eptp);
+		/* Map [gpa_rebased, gpa_rebased + size) to secure ept mapping */
+		ret = ept_add_mr(vm, (uint64_t *)vm->arch_vm.sworld_eptp, hpa, gpa_rebased, size, EPT_RWX | EPT_WB);
 
-	/*
-	 * copy PTPDEs from normal world EPT to secure world EPT,
-	 * and remove execute access attribute in these entries
-	 */
-	dest_pdpte_p = pml4e_page_vaddr(sworld_pml4e);
-	src_pdpte_p = pml4e_page_vaddr(nworld_pml4e);
-	for (i = 0U; i < (uint16_t)(PTRS_PER_PDPTE - 1UL); i++) {
-		pdpte = get_pgentry(src_pdpte_p);
-		if ((pdpte & table_present) != 0UL) {
-			pdpte &= ~EPT_EXE;
-			set_pgentry(dest_pdpte_p, pdpte, &vm->arch_vm.ept_mem_ops);
-		}
-		src_pdpte_p++;
-		dest_pdpte_p++;
+		/* Backup secure world info, will be used when destroy secure world and suspend UOS */
+		vm->sworld_control.sworld_memory.base_gpa_in_uos = gpa_orig;
+		vm->sworld_control.sworld_memory.base_hpa = hpa;
+		vm->sworld_control.sworld_memory.length = size;
 	}
 
-	/* Map [gpa_rebased, gpa_rebased + size) to secure ept mapping */
-	ept_add_mr(vm, (uint64_t *)vm->arch_vm.sworld_eptp, hpa, gpa_rebased, size, EPT_RWX | EPT_WB);
-
-	/* Backup secure world info, will be used when destroy secure world and suspend UOS */
-	vm->sworld_control.sworld_memory.base_gpa_in_uos = gpa_orig;
-	vm->sworld_control.sworld_memory.base_hpa = hpa;
-	vm->sworld_control.sworld_memory.length = size;
+	return ret;
 }
 
 void destroy_secure_world(struct acrn_vm *vm, bool need_clr_mem)
@@ -131,13 +139,15 @@ void destroy_secure_world(struct acrn_vm *vm, bool need_clr_mem)
 			clac();
 		}
 
-		ept_del_mr(vm, vm->arch_vm.sworld_eptp, gpa_uos, size);
+		(void)ept_del_mr(vm, vm->arch_vm.sworld_eptp, gpa_uos, size);
 		/* sanitize trusty ept page-structures */
 		sanitize_pte((uint64_t *)vm->arch_vm.sworld_eptp, &vm->arch_vm.ept_mem_ops);
 		vm->arch_vm.sworld_eptp = NULL;
 
 		/* Restore memory to guest normal world */
-		ept_add_mr(vm, vm->arch_vm.nworld_eptp, hpa, gpa_uos, size, EPT_RWX | EPT_WB);
+		if (ept_add_mr(vm, vm->arch_vm.nworld_eptp, hpa, gpa_uos, size, EPT_RWX | EPT_WB) != 0) {
+			pr_err("%s: failed to give trusty memory back to normal world", __func__);
+		}
 	} else {
 		pr_err("sworld eptp is NULL, it's not created");
 	}
@@ -280,16 +290,14 @@ void switch_world(struct acrn_vcpu *vcpu, int32_t next_world)
 	if (next_world == NORMAL_WORLD) {
 		/* load EPTP for next world */
 		exec_vmwrite64(VMX_EPT_POINTER_FULL,
-			hva2hpa(vcpu->vm->arch_vm.nworld_eptp) |
-			(3UL << 3U) | 0x6UL);
+			get_vmcs_eptp(vcpu, vcpu->vm->arch_vm.nworld_eptp));
 
 #ifndef CONFIG_L1D_FLUSH_VMENTRY_ENABLED
 		cpu_l1d_flush();
 #endif
 	} else {
 		exec_vmwrite64(VMX_EPT_POINTER_FULL,
-			hva2hpa(vcpu->vm->arch_vm.sworld_eptp) |
-			(3UL << 3U) | 0x6UL);
+			get_vmcs_eptp(vcpu, vcpu->vm->arch_vm.sworld_eptp));
 	}
 
 	/* Update world index */
@@ -414,25 +422,29 @@ bool initialize_trusty(struct acrn_vcpu *vcpu, struct trusty_boot_param *boot_pa
 			success = false;
 		} else {
 			trusty_mem_size = boot_param->mem_size;
-			create_secure_world_ept(vm, trusty_base_gpa, trusty_mem_size,
-								TRUSTY_EPT_REBASE_GPA);
-			trusty_base_hpa = vm->sworld_control.sworld_memory.base_hpa;
+			if (create_secure_world_ept(vm, trusty_base_gpa, trusty_mem_size,
+								TRUSTY_EPT_REBASE_GPA) != 0) {
+				pr_err("%s: failed to create secure world EPT", __func__);
+				success = false;
+			} else {
+				trusty_base_hpa = vm->sworld_control.sworld_memory.base_hpa;
 
-			exec_vmwrite64(VMX_EPT_POINTER_FULL,
-					hva2hpa(vm->arch_vm.sworld_eptp) | (3UL << 3U) | 0x6UL);
+				exec_vmwrite64(VMX_EPT_POINTER_FULL,
+						hva2hpa(vm->arch_vm.sworld_eptp) | (3UL << 3U) | 0x6UL);
 
-			/* save Normal World context */
-			save_world_ctx(vcpu, &vcpu->arch.contexts[NORMAL_WORLD].ext_ctx);
+				/* save Normal World context */
+				save_world_ctx(vcpu, &vcpu->arch.contexts[NORMAL_WORLD].ext_ctx);
 
-			/* init secure world environment */
-			if (init_secure_world_env(vcpu,
-				(trusty_entry_gpa - trusty_base_gpa) + TRUSTY_EPT_REBASE_GPA,
-				trusty_base_hpa, trusty_mem_size, rpmb_key)) {
+				/* init secure world environment */
+				if (init_secure_world_env(vcpu,
+					(trusty_entry_gpa - trusty_base_gpa) + TRUSTY_EPT_REBASE_GPA,
+					trusty_base_hpa, trusty_mem_size, rpmb_key)) {
 
-				/* switch to Secure World */
-				vcpu->arch.cur_context = SECURE_WORLD;
-			} else {
-				success = false;
+					/* switch to Secure World */
+					vcpu->arch.cur_context = SECURE_WORLD;
+				} else {
+					success = false;
+				}
 			}
 		}
 	}
@@ -451,10 +463,12 @@ void restore_sworld_context(struct acrn_vcpu *vcpu)
 	struct secure_world_control *sworld_ctl =
 		&vcpu->vm->sworld_control;
 
-	create_secure_world_ept(vcpu->vm,
+	if (create_secure_world_ept(vcpu->vm,
 		sworld_ctl->sworld_memory.base_gpa_in_uos,
 		sworld_ctl->sworld_memory.length,
-		TRUSTY_EPT_REBASE_GPA);
+		TRUSTY_EPT_REBASE_GPA) != 0) {
+		pr_err("%s: failed to re-create secure world EPT", __func__);
+	}
 
 	(void)memcpy_s((void *)&vcpu->arch.contexts[SECURE_WORLD], sizeof(struct guest_cpu_context),
 			(void *)&vcpu->vm->sworld_snapshot, sizeof(struct guest_cpu_context));
@@ -15,6 +15,7 @@
 #include <init.h>
 #include <vm.h>
 #include <vmcs.h>
+#include <ept.h>
 #include <mmu.h>
 #include <sprintf.h>
 
@@ -200,6 +201,8 @@ static void vcpu_reset_internal(struct acrn_vcpu *vcpu, enum reset_mode mode)
 	struct acrn_vlapic *vlapic;
 
 	vcpu->launched = false;
+	vcpu->vmcs_cleared = false;
+	vcpu->timer_migrated = false;
 	vcpu->running = false;
 	vcpu->arch.nr_sipi = 0U;
 
@@ -499,27 +502,29 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 		 */
 		vcpu->arch.pid.control.bits.nv = POSTED_INTR_VECTOR + vm->vm_id;
 
-		/* ACRN does not support vCPU migration, one vCPU always runs on
-		 * the same pCPU, so PI's ndst is never changed after startup.
+		/* PI's ndst only changes when the scheduler migrates the vCPU,
+		 * see vcpu_migrate().
 		 */
 		vcpu->arch.pid.control.bits.ndst = per_cpu(lapic_id, pcpu_id);
 
 		/* Create per vcpu vlapic */
-		vlapic_create(vcpu, pcpu_id);
-
-		if (!vm_hide_mtrr(vm)) {
-			init_vmtrr(vcpu);
-		}
+		ret = vlapic_create(vcpu, pcpu_id);
+		if (ret == 0) {
+			if (!vm_hide_mtrr(vm)) {
+				init_vmtrr(vcpu);
+			}
 
-		/* Populate the return handle */
-		*rtn_vcpu_handle = vcpu;
-		vcpu->state = VCPU_INIT;
+			/* Populate the return handle */
+			*rtn_vcpu_handle = vcpu;
+			vcpu->state = VCPU_INIT;
 
-		init_xsave(vcpu);
-		vcpu_reset_internal(vcpu, POWER_ON_RESET);
-		(void)memset((void *)&vcpu->req, 0U, sizeof(struct io_request));
-		vm->hw.created_vcpus++;
-		ret = 0;
+			init_xsave(vcpu);
+			vcpu_reset_internal(vcpu, POWER_ON_RESET);
+			(void)memset((void *)&vcpu->req, 0U, sizeof(struct io_request));
+			vm->hw.created_vcpus++;
+		} else {
+			per_cpu(vcpu_array, pcpu_id)[vm->vm_id] = NULL;
+		}
 	} else {
 		pr_err("%s, vcpu id is invalid!\n", __func__);
 		ret = -EINVAL;
@@ -625,8 +630,17 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 		/* Mitigation for MDS vulnerability, overwrite CPU internal buffers */
 		cpu_internal_buffers_clear();
 
-		/* Resume the VM */
-		status = vmx_vmrun(ctx, VM_RESUME, ibrs_type);
+		if (vcpu->vmcs_cleared) {
+			/* The VMCS was cleared to migrate this vcpu, launch it on the new pcpu */
+			vcpu->vmcs_cleared = false;
+			if (ibrs_type == IBRS_RAW) {
+				msr_write(MSR_IA32_PRED_CMD, PRED_SET_IBPB);
+			}
+			status = vmx_vmrun(ctx, VM_LAUNCH, ibrs_type);
+		} else {
+			/* Resume the VM */
+			status = vmx_vmrun(ctx, VM_RESUME, ibrs_type);
+		}
 	}
 
 	vcpu->reg_cached = 0UL;
@@ -662,13 +676,44 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
  *  @pre vcpu != NULL
  *  @pre vcpu->state == VCPU_ZOMBIE
  */
+/* run on the pcpu of an offlined vcpu in the notification IRQ context, see offline_vcpu() */
+static void vcpu_clear_vmcs_cb(void *data)
+{
+	struct acrn_vcpu *vcpu = (struct acrn_vcpu *)data;
+	void **vmcs_ptr = &get_cpu_var(vmcs_run);
+	uint64_t vmcs_pa = hva2hpa(vcpu->arch.vmcs);
+
+	exec_vmclear((void *)&vmcs_pa);
+	if (*vmcs_ptr == (void *)vcpu->arch.vmcs) {
+		*vmcs_ptr = NULL;
+	}
+}
+
 void offline_vcpu(struct acrn_vcpu *vcpu)
 {
+	uint16_t pcpu_id = pcpuid_from_vcpu(vcpu);
+
 	vlapic_free(vcpu);
-	per_cpu(ever_run_vcpu, pcpuid_from_vcpu(vcpu)) = NULL;
+	if (per_cpu(ever_run_vcpu, pcpu_id) == vcpu) {
+		per_cpu(ever_run_vcpu, pcpu_id) = NULL;
+	}
+
+	/*
+	 * A migrated vcpu leaves its VMCS active on the pcpu it was moved to, while
+	 * it is created again on its first pcpu (see prepare_vcpu()). Clear the VMCS
+	 * on the pcpu it is on, so that it is never active on two pcpus. That may
+	 * be this pcpu, with IRQs disabled in the idle thread: clear it directly.
+	 */
+	if ((vcpu->thread_obj.migrate != NULL) && vcpu->launched) {
+		if (pcpu_id == get_pcpu_id()) {
+			vcpu_clear_vmcs_cb(vcpu);
+		} else {
+			smp_call_function(1UL << pcpu_id, vcpu_clear_vmcs_cb, vcpu);
+		}
+	}
 
 	/* This operation must be atomic to avoid contention with posted interrupt handler */
-	per_cpu(vcpu_array, pcpuid_from_vcpu(vcpu))[vcpu->vm->vm_id] = NULL;
+	per_cpu(vcpu_array, pcpu_id)[vcpu->vm->vm_id] = NULL;
 
 	vcpu->state = VCPU_OFFLINE;
 }
@@ -721,7 +766,7 @@ void reset_vcpu(struct acrn_vcpu *vcpu, enum reset_mode mode)
 
 void pause_vcpu(struct acrn_vcpu *vcpu, enum vcpu_state new_state)
 {
-	uint16_t pcpu_id = pcpuid_from_vcpu(vcpu);
+	uint16_t pcpu_id;
 
 	pr_dbg("vcpu%hu paused, new state: %d",	vcpu->vcpu_id, new_state);
 
@@ -732,6 +777,8 @@ void pause_vcpu(struct acrn_vcpu *vcpu, enum vcpu_state new_state)
 		if (vcpu->prev_state == VCPU_RUNNING) {
 			sleep_thread(&vcpu->thread_obj);
 		}
+		/* a sleeping vcpu is not migrated any more, see sched_balance() */
+		pcpu_id = pcpuid_from_vcpu(vcpu);
 		if (pcpu_id != get_pcpu_id()) {
 			while (vcpu->running) {
 				asm_pause();
@@ -788,6 +835,9 @@ static void context_switch_out(struct thread_object *prev)
 
 	save_xsave_area(ectx);
 
+	/* the log is flushed by the pcpu the VMCS is current on, see ept_get_dirty_log() */
+	ept_flush_pml(vcpu);
+
 	vcpu->running = false;
 }
 
@@ -795,9 +845,17 @@ static void context_switch_in(struct thread_object *next)
 {
 	struct acrn_vcpu *vcpu = container_of(next, struct acrn_vcpu, thread_obj);
 	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
+	struct hv_timer *timer = &vcpu_vlapic(vcpu)->vtimer.timer;
 
 	load_vmcs(vcpu);
 
+	if (vcpu->timer_migrated) {
+		vcpu->timer_migrated = false;
+		if (!timer_is_started(timer)) {
+			(void)add_timer(timer);
+		}
+	}
+
 	msr_write(MSR_IA32_STAR, ectx->ia32_star);
 	msr_write(MSR_IA32_LSTAR, ectx->ia32_lstar);
 	msr_write(MSR_IA32_FMASK, ectx->ia32_fmask);
@@ -809,6 +867,99 @@ static void context_switch_in(struct thread_object *next)
 }
 
 
+/*
+ * Update the notification destination of the posted interrupt descriptor.
+ * ON may be set by other pcpus meanwhile (see apicv_set_intr_ready()), so
+ * the whole control word is replaced atomically.
+ */
+static void vcpu_set_pi_ndst(struct acrn_vcpu *vcpu, uint32_t ndst)
+{
+	uint64_t old, cur, new;
+
+	old = vcpu->arch.pid.control.value;
+	do {
+		cur = old;
+		new = (cur & 0xFFFFFFFFUL) | (((uint64_t)ndst) << 32U);
+		old = atomic_cmpxchg64(&vcpu->arch.pid.control.value, cur, new);
+	} while (old != cur);
+}
+
+/*
+ * The configuration keeps the pcpus of RT and LAPIC passthrough VMs out of the
+ * affinity of migrated vcpus (see sanitize_vm_config()), but the DM may still
+ * make a post-launched VM RT when creating it.
+ */
+static bool has_rt_vcpu(uint16_t pcpu_id)
+{
+	const struct acrn_vcpu *other;
+	uint16_t vm_id;
+	bool ret = false;
+
+	for (vm_id = 0U; (vm_id < CONFIG_MAX_VM_NUM) && !ret; vm_id++) {
+		other = per_cpu(vcpu_array, pcpu_id)[vm_id];
+		ret = (other != NULL) && (is_rt_vm(other->vm) || is_lapic_pt_configured(other->vm));
+	}
+
+	return ret;
+}
+
+/*
+ * @brief Hand a switched out vcpu over to another pcpu
+ *
+ * Called on the pcpu the vcpu is on, with the schedule locks of both pcpus
+ * held. The VMCS is cleared here so that it can be loaded and launched on
+ * the new pcpu. The posted interrupt vector of a VM is per pcpu, so a vcpu
+ * is never moved to a pcpu which has another vcpu of its VM, nor to one which
+ * has a vcpu of an RT VM.
+ */
+static bool vcpu_migrate(struct thread_object *obj, uint16_t pcpu_id)
+{
+	struct acrn_vcpu *vcpu = container_of(obj, struct acrn_vcpu, thread_obj);
+	uint16_t vm_id = vcpu->vm->vm_id;
+	uint16_t from = pcpuid_from_vcpu(vcpu);
+	struct hv_timer *timer = &vcpu_vlapic(vcpu)->vtimer.timer;
+	void **vmcs_ptr = &per_cpu(vmcs_run, from);
+	uint64_t vmcs_pa;
+	bool ret = false;
+
+	if ((from == get_pcpu_id()) && (vcpu->state == VCPU_RUNNING) && vcpu->launched &&
+			!vcpu->running && (per_cpu(vcpu_array, pcpu_id)[vm_id] == NULL) && !has_rt_vcpu(pcpu_id)) {
+		vmcs_pa = hva2hpa(vcpu->arch.vmcs);
+		exec_vmclear((void *)&vmcs_pa);
+		if (*vmcs_ptr == (void *)vcpu->arch.vmcs) {
+			*vmcs_ptr = NULL;
+		}
+		vcpu->vmcs_cleared = true;
+
+		/* timers are per pcpu, add the vlapic timer again once switched in */
+		if (timer_is_started(timer)) {
+			del_timer(timer);
+			vcpu->timer_migrated = true;
+		}
+
+		per_cpu(vcpu_array, from)[vm_id] = NULL;
+		per_cpu(vcpu_array, pcpu_id)[vm_id] = vcpu;
+		if (per_cpu(ever_run_vcpu, from) == vcpu) {
+			per_cpu(ever_run_vcpu, from) = NULL;
+		}
+		per_cpu(ever_run_vcpu, pcpu_id) = vcpu;
+		vcpu_set_pi_ndst(vcpu, per_cpu(lapic_id, pcpu_id));
+		vcpu->arch.msr_area.host[MSR_AREA_TSC_AUX].value = pcpu_id;
+
+		/*
+		 * Drop the mappings it may have left on the new pcpu and sync the
+		 * interrupts posted meanwhile. It isn't running, so no kick needed.
+		 */
+		bitmap_set_lock(ACRN_REQUEST_VPID_FLUSH, &vcpu->arch.pending_req);
+		bitmap_set_lock(ACRN_REQUEST_EPT_FLUSH, &vcpu->arch.pending_req);
+		bitmap_set_lock(ACRN_REQUEST_EVENT, &vcpu->arch.pending_req);
+
+		ret = true;
+	}
+
+	return ret;
+}
+
 /**
  * @pre vcpu != NULL
  * @pre vcpu->state == VCPU_INIT
@@ -841,6 +992,11 @@ int32_t prepare_vcpu(struct acrn_vm *vm, uint16_t pcpu_id)
 		vcpu->thread_obj.host_sp = build_stack_frame(vcpu);
 		vcpu->thread_obj.switch_out = context_switch_out;
 		vcpu->thread_obj.switch_in = context_switch_in;
+		/* RT and LAPIC passthrough vCPUs always stay on their pCPUs */
+		if (is_postlaunched_vm(vm) && !is_rt_vm(vm) && !is_lapic_pt_configured(vm)) {
+			vcpu->thread_obj.pcpu_mask = get_vm_config(vm->vm_id)->vcpu_affinity[vcpu->vcpu_id];
+			vcpu->thread_obj.migrate = vcpu_migrate;
+		}
 		init_thread_data(&vcpu->thread_obj);
 		for (i = 0; i < VCPU_EVENT_NUM; i++) {
 			init_event(&vcpu->events[i]);
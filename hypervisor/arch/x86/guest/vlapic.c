@@ -2123,25 +2123,31 @@ int32_t vlapic_x2apic_write(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t val)
 }
 
 /**
+ *  @retval 0 on success
+ *  @retval -ENOMEM the APIC-access page can't be mapped
+ *
  *  @pre vcpu != NULL
  */
-void vlapic_create(struct acrn_vcpu *vcpu, uint16_t pcpu_id)
+int32_t vlapic_create(struct acrn_vcpu *vcpu, uint16_t pcpu_id)
 {
 	struct acrn_vlapic *vlapic = vcpu_vlapic(vcpu);
+	int32_t ret = 0;
 
 	if (is_vcpu_bsp(vcpu)) {
 		uint64_t *pml4_page =
 			(uint64_t *)vcpu->vm->arch_vm.nworld_eptp;
 		/* only need unmap it from SOS as UOS never mapped it */
 		if (is_sos_vm(vcpu->vm)) {
-			ept_del_mr(vcpu->vm, pml4_page,
+			ret = ept_del_mr(vcpu->vm, pml4_page,
 				DEFAULT_APIC_BASE, PAGE_SIZE);
 		}
 
-		ept_add_mr(vcpu->vm, pml4_page,
-			vlapic_apicv_get_apic_access_addr(),
-			DEFAULT_APIC_BASE, PAGE_SIZE,
-			EPT_WR | EPT_RD | EPT_UNCACHED);
+		if (ret == 0) {
+			ret = ept_add_mr(vcpu->vm, pml4_page,
+				vlapic_apicv_get_apic_access_addr(),
+				DEFAULT_APIC_BASE, PAGE_SIZE,
+				EPT_WR | EPT_RD | EPT_UNCACHED);
+		}
 	}
 
 	vlapic_init_timer(vlapic);
@@ -2158,6 +2164,8 @@ void vlapic_create(struct acrn_vcpu *vcpu, uint16_t pcpu_id)
 	}
 
 	dev_dbg(DBG_LEVEL_VLAPIC, "vlapic APIC ID : 0x%04x", vlapic->vapic_id);
+
+	return ret;
 }
 
 /*
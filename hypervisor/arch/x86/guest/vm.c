@@ -224,14 +224,18 @@ static inline uint16_t get_vm_bsp_pcpu_id(const struct acrn_vm_config *vm_config
 }
 
 /**
+ * @retval 0 on success
+ * @retval -ENOMEM no page-table page left to the VM
+ *
  * @pre vm != NULL && vm_config != NULL
  */
-static void prepare_prelaunched_vm_memmap(struct acrn_vm *vm, const struct acrn_vm_config *vm_config)
+static int32_t prepare_prelaunched_vm_memmap(struct acrn_vm *vm, const struct acrn_vm_config *vm_config)
 {
 	bool is_hpa1 = true;
 	uint64_t base_hpa = vm_config->memory.start_hpa;
 	uint64_t remaining_hpa_size = vm_config->memory.size;
 	uint32_t i;
+	int32_t ret = 0;
 
 	for (i = 0U; i < vm->e820_entry_num; i++) {
 		const struct e820_entry *entry = &(vm->e820_entries[i]);
@@ -242,8 +246,10 @@ static void prepare_prelaunched_vm_memmap(struct acrn_vm *vm, const struct acrn_
 
 		/* Do EPT mapping for GPAs that are backed by physical memory */
 		if ((entry->type == E820_TYPE_RAM) && (remaining_hpa_size >= entry->length)) {
-			ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, base_hpa, entry->baseaddr,
-				entry->length, EPT_RWX | EPT_WB);
+			if (ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, base_hpa, entry->baseaddr,
+					entry->length, EPT_RWX | EPT_WB) != 0) {
+				ret = -ENOMEM;
+			}
 
 			base_hpa += entry->length;
 			remaining_hpa_size -= entry->length;
@@ -255,8 +261,10 @@ static void prepare_prelaunched_vm_memmap(struct acrn_vm *vm, const struct acrn_
 		/* GPAs under 1MB are always backed by physical memory */
 		if ((entry->type != E820_TYPE_RAM) && (entry->baseaddr < (uint64_t)MEM_1M) &&
 			(remaining_hpa_size >= entry->length)) {
-			ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, base_hpa, entry->baseaddr,
-				entry->length, EPT_RWX | EPT_UNCACHED);
+			if (ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, base_hpa, entry->baseaddr,
+					entry->length, EPT_RWX | EPT_UNCACHED) != 0) {
+				ret = -ENOMEM;
+			}
 
 			base_hpa += entry->length;
 			remaining_hpa_size -= entry->length;
@@ -268,20 +276,24 @@ static void prepare_prelaunched_vm_memmap(struct acrn_vm *vm, const struct acrn_
 			remaining_hpa_size = vm_config->memory.size_hpa2;
 		}
 	}
+
+	return ret;
 }
 
 /**
  * @param[inout] vm pointer to a vm descriptor
  *
  * @retval 0 on success
+ * @retval -ENOMEM no page-table page left to the VM
  *
  * @pre vm != NULL
  * @pre is_sos_vm(vm) == true
  */
-static void prepare_sos_vm_memmap(struct acrn_vm *vm)
+static int32_t prepare_sos_vm_memmap(struct acrn_vm *vm)
 {
 	uint16_t vm_id;
 	uint32_t i;
+	int32_t ret;
 	uint64_t attr_uc = (EPT_RWX | EPT_UNCACHED);
 	uint64_t hv_hpa;
 	struct acrn_vm_config *vm_config;
@@ -301,14 +313,15 @@ static void prepare_sos_vm_memmap(struct acrn_vm *vm)
 	}
 
 	/* create real ept map for all ranges with UC */
-	ept_add_mr(vm, pml4_page, p_mem_range_info->mem_bottom, p_mem_range_info->mem_bottom,
+	ret = ept_add_mr(vm, pml4_page, p_mem_range_info->mem_bottom, p_mem_range_info->mem_bottom,
 			(p_mem_range_info->mem_top - p_mem_range_info->mem_bottom), attr_uc);
 
 	/* update ram entries to WB attr */
 	for (i = 0U; i < entries_count; i++) {
 		entry = p_e820 + i;
-		if (entry->type == E820_TYPE_RAM) {
-			ept_modify_mr(vm, pml4_page, entry->baseaddr, entry->length, EPT_WB, EPT_MT_MASK);
+		if ((entry->type == E820_TYPE_RAM) &&
+				(ept_modify_mr(vm, pml4_page, entry->baseaddr, entry->length, EPT_WB, EPT_MT_MASK) != 0)) {
+			ret = -ENOMEM;
 		}
 	}
 
@@ -325,19 +338,24 @@ static void prepare_sos_vm_memmap(struct acrn_vm *vm)
 	 */
 	epc_secs = get_phys_epc();
 	for (i = 0U; (i < MAX_EPC_SECTIONS) && (epc_secs[i].size != 0UL); i++) {
-		ept_del_mr(vm, pml4_page, epc_secs[i].base, epc_secs[i].size);
+		if (ept_del_mr(vm, pml4_page, epc_secs[i].base, epc_secs[i].size) != 0) {
+			ret = -ENOMEM;
+		}
 	}
 
 	/* unmap hypervisor itself for safety
 	 * will cause EPT violation if sos accesses hv memory
 	 */
 	hv_hpa = hva2hpa((void *)(get_hv_image_base()));
-	ept_del_mr(vm, pml4_page, hv_hpa, CONFIG_HV_RAM_SIZE);
+	if (ept_del_mr(vm, pml4_page, hv_hpa, CONFIG_HV_RAM_SIZE) != 0) {
+		ret = -ENOMEM;
+	}
 	/* unmap prelaunch VM memory */
 	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
 		vm_config = get_vm_config(vm_id);
-		if (vm_config->load_order == PRE_LAUNCHED_VM) {
-			ept_del_mr(vm, pml4_page, vm_config->memory.start_hpa, vm_config->memory.size);
+		if ((vm_config->load_order == PRE_LAUNCHED_VM) &&
+				(ept_del_mr(vm, pml4_page, vm_config->memory.start_hpa, vm_config->memory.size) != 0)) {
+			ret = -ENOMEM;
 		}
 	}
 
@@ -347,25 +365,36 @@ static void prepare_sos_vm_memmap(struct acrn_vm *vm)
 	 * mode will ensure the base address of tramploline
 	 * code be page-aligned.
 	 */
-	ept_del_mr(vm, pml4_page, get_ap_trampoline_buf(), CONFIG_LOW_RAM_SIZE);
+	if (ept_del_mr(vm, pml4_page, get_ap_trampoline_buf(), CONFIG_LOW_RAM_SIZE) != 0) {
+		ret = -ENOMEM;
+	}
 
 	/* unmap PCIe MMCONFIG region since it's owned by hypervisor */
-	ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, get_mmcfg_base(), PCI_MMCONFIG_SIZE);
+	if (ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, get_mmcfg_base(), PCI_MMCONFIG_SIZE) != 0) {
+		ret = -ENOMEM;
+	}
+
+	return ret;
 }
 
 /* Add EPT mapping of EPC reource for the VM */
-static void prepare_epc_vm_memmap(struct acrn_vm *vm)
+static int32_t prepare_epc_vm_memmap(struct acrn_vm *vm)
 {
 	struct epc_map* vm_epc_maps;
 	uint32_t i;
+	int32_t ret = 0;
 
 	if (is_vsgx_supported(vm->vm_id)) {
 		vm_epc_maps = get_epc_mapping(vm->vm_id);
 		for (i = 0U; (i < MAX_EPC_SECTIONS) && (vm_epc_maps[i].size != 0UL); i++) {
-			ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, vm_epc_maps[i].hpa,
-				vm_epc_maps[i].gpa, vm_epc_maps[i].size, EPT_RWX | EPT_WB);
+			if (ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, vm_epc_maps[i].hpa,
+					vm_epc_maps[i].gpa, vm_epc_maps[i].size, EPT_RWX | EPT_WB) != 0) {
+				ret = -ENOMEM;
+			}
 		}
 	}
+
+	return ret;
 }
 
 /**
@@ -409,50 +438,66 @@ int32_t create_vm(uint16_t vm_id, struct acrn_vm_config *vm_config, struct acrn_
 	(void)memset((void *)vm, 0U, sizeof(struct acrn_vm));
 	vm->vm_id = vm_id;
 	vm->hw.created_vcpus = 0U;
+	vm->ept_update_pcpu = INVALID_CPU_ID;
 
-	init_ept_mem_ops(&vm->arch_vm.ept_mem_ops, vm->vm_id);
-	vm->arch_vm.nworld_eptp = vm->arch_vm.ept_mem_ops.get_pml4_page(vm->arch_vm.ept_mem_ops.info);
-	sanitize_pte((uint64_t *)vm->arch_vm.nworld_eptp, &vm->arch_vm.ept_mem_ops);
+	status = init_ept_mem_ops(&vm->arch_vm.ept_mem_ops, vm->vm_id);
+	if (status == 0) {
+		vm->arch_vm.nworld_eptp = vm->arch_vm.ept_mem_ops.get_pml4_page(vm->arch_vm.ept_mem_ops.info);
+		if (vm->arch_vm.nworld_eptp == NULL) {
+			status = -ENOMEM;
+		} else {
+			sanitize_pte((uint64_t *)vm->arch_vm.nworld_eptp, &vm->arch_vm.ept_mem_ops);
+		}
+	}
 
 	(void)memcpy_s(&vm->uuid[0], sizeof(vm->uuid),
 		&vm_config->uuid[0], sizeof(vm_config->uuid));
 
-	if (is_sos_vm(vm)) {
-		/* Only for SOS_VM */
-		create_sos_vm_e820(vm);
-		prepare_sos_vm_memmap(vm);
+	if (status == 0) {
+		if (is_sos_vm(vm)) {
+			/* Only for SOS_VM */
+			create_sos_vm_e820(vm);
+			status = prepare_sos_vm_memmap(vm);
+			if (status == 0) {
+				status = init_vm_boot_info(vm);
+			}
+		} else {
+			/* For PRE_LAUNCHED_VM and POST_LAUNCHED_VM */
+			if ((vm_config->guest_flags & GUEST_FLAG_SECURE_WORLD_ENABLED) != 0U) {
+				vm->sworld_control.flag.supported = 1U;
+			}
+			if (vm->sworld_control.flag.supported != 0UL) {
+				struct memory_ops *ept_mem_ops = &vm->arch_vm.ept_mem_ops;
 
-		status = init_vm_boot_info(vm);
-	} else {
-		/* For PRE_LAUNCHED_VM and POST_LAUNCHED_VM */
-		if ((vm_config->guest_flags & GUEST_FLAG_SECURE_WORLD_ENABLED) != 0U) {
-			vm->sworld_control.flag.supported = 1U;
-		}
-		if (vm->sworld_control.flag.supported != 0UL) {
-			struct memory_ops *ept_mem_ops = &vm->arch_vm.ept_mem_ops;
+				status = ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
+					hva2hpa(ept_mem_ops->get_sworld_memory_base(ept_mem_ops->info)),
+					TRUSTY_EPT_REBASE_GPA, TRUSTY_RAM_SIZE, EPT_WB | EPT_RWX);
+			}
+			if (vm_config->name[0] == '\0') {
+				/* if VM name is not configured, specify with VM ID */
+				snprintf(vm_config->name, 16, "ACRN VM_%d", vm_id);
+			}
 
-			ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
-				hva2hpa(ept_mem_ops->get_sworld_memory_base(ept_mem_ops->info)),
-				TRUSTY_EPT_REBASE_GPA, TRUSTY_RAM_SIZE, EPT_WB | EPT_RWX);
-		}
-		if (vm_config->name[0] == '\0') {
-			/* if VM name is not configured, specify with VM ID */
-			snprintf(vm_config->name, 16, "ACRN VM_%d", vm_id);
+			if ((status == 0) && (vm_config->load_order == PRE_LAUNCHED_VM)) {
+				create_prelaunched_vm_e820(vm);
+				status = prepare_prelaunched_vm_memmap(vm, vm_config);
+				if (status == 0) {
+					status = init_vm_boot_info(vm);
+				}
+			}
 		}
-
-		 if (vm_config->load_order == PRE_LAUNCHED_VM) {
-			create_prelaunched_vm_e820(vm);
-			prepare_prelaunched_vm_memmap(vm, vm_config);
-			status = init_vm_boot_info(vm);
-		 }
 	}
 
 	if (status == 0) {
-		prepare_epc_vm_memmap(vm);
+		status = prepare_epc_vm_memmap(vm);
+	}
 
+	if (status == 0) {
 		spinlock_init(&vm->vm_lock);
 		spinlock_init(&vm->ept_lock);
 		spinlock_init(&vm->emul_mmio_lock);
+		spinlock_init(&vm->ioeventfd_lock);
+		vm->nr_ioeventfds = 0U;
 
 		vm->arch_vm.vlapic_state = VM_VLAPIC_XAPIC;
 		vm->intr_inject_delay_delta = 0UL;
@@ -485,17 +530,20 @@ int32_t create_vm(uint16_t vm_id, struct acrn_vm_config *vm_config, struct acrn_
 
 		/* Init full emulated vIOAPIC instance */
 		if (!is_lapic_pt_configured(vm)) {
-			vioapic_init(vm);
+			status = vioapic_init(vm);
 		}
 
 		/* Populate return VM handle */
 		*rtn_vm = vm;
 		vm->sw.io_shared_page = NULL;
+		vm->sw.ioeventfd_ring = NULL;
 		if ((vm_config->load_order == POST_LAUNCHED_VM) && ((vm_config->guest_flags & GUEST_FLAG_IO_COMPLETION_POLLING) != 0U)) {
 			/* enable IO completion polling mode per its guest flags in vm_config. */
 			vm->sw.is_polling_ioreq = true;
 		}
-		status = set_vcpuid_entries(vm);
+		if (status == 0) {
+			status = set_vcpuid_entries(vm);
+		}
 		if (status == 0) {
 			vm->state = VM_CREATED;
 		}
@@ -515,8 +563,8 @@ int32_t create_vm(uint16_t vm_id, struct acrn_vm_config *vm_config, struct acrn_
 		}
 	}
 
-	if ((status != 0) && (vm->arch_vm.nworld_eptp != NULL)) {
-		(void)memset(vm->arch_vm.nworld_eptp, 0U, PAGE_SIZE);
+	if (status != 0) {
+		destroy_ept(vm);
 	}
 
 	return status;
@@ -668,12 +716,14 @@ int32_t reset_vm(struct acrn_vm *vm)
 	 * Set VM vLAPIC state to VM_VLAPIC_XAPIC
 	 */
 	vm->arch_vm.vlapic_state = VM_VLAPIC_XAPIC;
+	vm->arch_vm.dirty_log_enabled = false;
 
 	if (is_sos_vm(vm)) {
 		(void)vm_sw_loader(vm);
 	}
 
 	reset_vm_ioreqs(vm);
+	reset_vm_ioeventfds(vm);
 	reset_vioapics(vm);
 	destroy_secure_world(vm, false);
 	vm->sworld_control.flag.active = 0UL;
@@ -108,6 +108,13 @@ static int32_t dispatch_sos_hypercall(const struct acrn_vcpu *vcpu)
 		}
 		break;
 
+	case HC_GET_VCPU_EXIT_STATS:
+		/* param1: relative vmid to sos, vm_id: absolute vmid */
+		if (vmid_is_valid) {
+			ret = hcall_get_vcpu_exit_stats(sos_vm, vm_id, param2);
+		}
+		break;
+
 	case HC_SET_IRQLINE:
 		/* param1: relative vmid to sos, vm_id: absolute vmid */
 		if (vmid_is_valid) {
@@ -141,6 +148,29 @@ static int32_t dispatch_sos_hypercall(const struct acrn_vcpu *vcpu)
 		}
 		break;
 
+	case HC_SET_IOEVENTFD_RING:
+		/* param1: relative vmid to sos, vm_id: absolute vmid */
+		if (vmid_is_valid) {
+			spinlock_obtain(&vmm_hypercall_lock);
+			ret = hcall_set_ioeventfd_ring(sos_vm, vm_id, param2);
+			spinlock_release(&vmm_hypercall_lock);
+		}
+		break;
+
+	case HC_ASSIGN_IOEVENTFD:
+		/* param1: relative vmid to sos, vm_id: absolute vmid */
+		if (vmid_is_valid) {
+			ret = hcall_set_ioeventfd(sos_vm, vm_id, param2, true);
+		}
+		break;
+
+	case HC_DEASSIGN_IOEVENTFD:
+		/* param1: relative vmid to sos, vm_id: absolute vmid */
+		if (vmid_is_valid) {
+			ret = hcall_set_ioeventfd(sos_vm, vm_id, param2, false);
+		}
+		break;
+
 	case HC_VM_SET_MEMORY_REGIONS:
 		ret = hcall_set_vm_memory_regions(sos_vm, param1);
 		break;
@@ -167,6 +197,20 @@ static int32_t dispatch_sos_hypercall(const struct acrn_vcpu *vcpu)
 		}
 		break;
 
+	case HC_VM_SET_DIRTY_LOG:
+		/* param1: relative vmid to sos, vm_id: absolute vmid */
+		if (vmid_is_valid) {
+			ret = hcall_set_dirty_log(sos_vm, vm_id, param2);
+		}
+		break;
+
+	case HC_VM_GET_DIRTY_LOG:
+		/* param1: relative vmid to sos, vm_id: absolute vmid */
+		if (vmid_is_valid) {
+			ret = hcall_get_dirty_log(sos_vm, vm_id, param2);
+		}
+		break;
+
 	case HC_ASSIGN_PCIDEV:
 		/* param1: relative vmid to sos, vm_id: absolute vmid */
 		if (vmid_is_valid) {
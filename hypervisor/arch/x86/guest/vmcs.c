@@ -13,6 +13,8 @@
 #include <vmx.h>
 #include <gdt.h>
 #include <pgtable.h>
+#include <ept.h>
+#include <mmu.h>
 #include <per_cpu.h>
 #include <cpu_caps.h>
 #include <cpufeatures.h>
@@ -360,7 +362,7 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	 * TODO: introduce API to make this data driven based
 	 * on VMX_EPT_VPID_CAP
 	 */
-	value64 = hva2hpa(vm->arch_vm.nworld_eptp) | (3UL << 3U) | 6UL;
+	value64 = get_vmcs_eptp(vcpu, vm->arch_vm.nworld_eptp);
 	exec_vmwrite64(VMX_EPT_POINTER_FULL, value64);
 	pr_dbg("VMX_EPT_POINTER: 0x%016lx ", value64);
 
@@ -521,6 +523,9 @@ void init_vmcs(struct acrn_vcpu *vcpu)
 	/* Log message */
 	pr_dbg("Initializing VMCS");
 
+	/* the VMCS is built with dirty page logging off, see the end of this function */
+	vcpu->arch.pml_enabled = false;
+
 	/* Obtain the VM Rev ID from HW and populate VMCS page with it */
 	vmx_rev_id = msr_read(MSR_IA32_VMX_BASIC);
 	(void)memcpy_s(vcpu->arch.vmcs, 4U, (void *)&vmx_rev_id, 4U);
@@ -541,6 +546,72 @@ void init_vmcs(struct acrn_vcpu *vcpu)
 	init_guest_state(vcpu);
 	init_entry_ctrl(vcpu);
 	init_exit_ctrl(vcpu);
+
+	if (vcpu->vm->arch_vm.dirty_log_enabled) {
+		update_vmcs_dirty_log(vcpu);
+	}
+}
+
+/**
+ * @pre vcpu != NULL && pml4_page != NULL
+ *
+ * Return the EPT pointer of the EPT hierarchy at pml4_page for the VMCS of
+ * vcpu, with the EPT accessed and dirty flags enabled while the vcpu logs
+ * dirty pages.
+ */
+uint64_t get_vmcs_eptp(const struct acrn_vcpu *vcpu, const void *pml4_page)
+{
+	uint64_t eptp = hva2hpa(pml4_page) | VMX_EPTP_PWL_4 | VMX_EPTP_MT_WB;
+
+	if (vcpu->arch.pml_enabled) {
+		eptp |= VMX_EPTP_AD_ENABLE_BIT;
+	}
+
+	return eptp;
+}
+
+/**
+ * @pre vcpu != NULL
+ * @pre the VMCS of vcpu is the current VMCS
+ *
+ * Turn PML and the EPT accessed and dirty flags of vcpu on or off, following
+ * whether dirty page logging is on for its VM. Both are turned on or off together:
+ * a dirty flag set without the GPA being logged would hide later writes to
+ * the page from the log.
+ */
+void update_vmcs_dirty_log(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	bool enable = vm->arch_vm.dirty_log_enabled;
+	uint32_t value32;
+	void *eptp;
+
+	/* GPAs logged so far may be from after the dirty flags were cleared, keep them */
+	ept_flush_pml(vcpu);
+
+	value32 = exec_vmread32(VMX_PROC_VM_EXEC_CONTROLS2);
+	if (enable) {
+		exec_vmwrite64(VMX_PML_ADDR_FULL, hva2hpa(vcpu->arch.pml_buf));
+		exec_vmwrite16(VMX_GUEST_PML_INDEX, (uint16_t)(PML_ENTITY_NUM - 1U));
+		value32 |= VMX_PROCBASED_CTLS2_PML;
+	} else {
+		value32 &= ~VMX_PROCBASED_CTLS2_PML;
+	}
+	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS2, value32);
+	vcpu->arch.pml_enabled = enable;
+
+	if (vcpu->arch.cur_context == SECURE_WORLD) {
+		eptp = vm->arch_vm.sworld_eptp;
+	} else {
+		eptp = vm->arch_vm.nworld_eptp;
+	}
+	exec_vmwrite64(VMX_EPT_POINTER_FULL, get_vmcs_eptp(vcpu, eptp));
+
+	/* drop the translations cached with the dirty flags set, so that writes get logged again */
+	invept(vm->arch_vm.nworld_eptp);
+	if (vm->sworld_control.flag.active != 0UL) {
+		invept(vm->arch_vm.sworld_eptp);
+	}
 }
 
 /**
@@ -555,6 +626,11 @@ void load_vmcs(const struct acrn_vcpu *vcpu)
 		vmcs_pa = hva2hpa(vcpu->arch.vmcs);
 		exec_vmptrld((void *)&vmcs_pa);
 		*vmcs_ptr = (void *)vcpu->arch.vmcs;
+
+		/* a VMCS cleared for migration still has the host state of the old pcpu */
+		if (vcpu->vmcs_cleared) {
+			init_host_state();
+		}
 	}
 }
 
@@ -160,7 +160,10 @@ static void update_ept(struct acrn_vm *vm, uint64_t start,
 		break;
 	}
 
-	ept_modify_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, start, size, attr, EPT_MT_MASK);
+	if (ept_modify_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, start, size, attr, EPT_MT_MASK) != 0) {
+		pr_err("%s: [vm%hu] failed to set memory type of 0x%lx-0x%lx", __func__,
+			vm->vm_id, start, start + size);
+	}
 }
 
 static void update_ept_mem_type(const struct acrn_vmtrr *vmtrr)
@@ -114,14 +114,13 @@ int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 	/*caused by instruction fetch */
 	if ((exit_qual & 0x4UL) != 0UL) {
 		if (vcpu->arch.cur_context == NORMAL_WORLD) {
-			ept_modify_mr(vcpu->vm, (uint64_t *)vcpu->vm->arch_vm.nworld_eptp,
+			status = ept_modify_mr(vcpu->vm, (uint64_t *)vcpu->vm->arch_vm.nworld_eptp,
 				gpa & PAGE_MASK, PAGE_SIZE, EPT_EXE, 0UL);
 		} else {
-			ept_modify_mr(vcpu->vm, (uint64_t *)vcpu->vm->arch_vm.sworld_eptp,
+			status = ept_modify_mr(vcpu->vm, (uint64_t *)vcpu->vm->arch_vm.sworld_eptp,
 				gpa & PAGE_MASK, PAGE_SIZE, EPT_EXE, 0UL);
 		}
 		vcpu_retain_rip(vcpu);
-		status = 0;
 	} else {
 
 		io_req->io_type = REQ_MMIO;
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: BSD-3-Clause
  */
 #include <types.h>
+#include <errno.h>
 #include <rtl.h>
 #include <pgtable.h>
 #include <page.h>
@@ -12,6 +13,10 @@
 #include <vtd.h>
 #include <security.h>
 #include <vm.h>
+#include <e820.h>
+#include <bits.h>
+#include <spinlock.h>
+#include <logmsg.h>
 
 #define LINEAR_ADDRESS_SPACE_48_BIT	(1UL << 48U)
 
@@ -79,28 +84,17 @@ const struct memory_ops ppt_mem_ops = {
 	.recover_exe_right = nop_recover_exe_right,
 };
 
-static struct page sos_vm_pml4_pages[SOS_VM_NUM][PML4_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE))];
-static struct page sos_vm_pdpt_pages[SOS_VM_NUM][PDPT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE))];
-static struct page sos_vm_pd_pages[SOS_VM_NUM][PD_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE))];
-/* pre_uos_nworld_pml4_pages */
-static struct page pre_uos_nworld_pml4_pages[PRE_VM_NUM][PML4_PAGE_NUM(PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page pre_uos_nworld_pdpt_pages[PRE_VM_NUM][PDPT_PAGE_NUM(PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page pre_uos_nworld_pd_pages[PRE_VM_NUM][PD_PAGE_NUM(PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-
-/* post_uos_nworld_pml4_pages */
-static struct page post_uos_nworld_pml4_pages[MAX_POST_VM_NUM][PML4_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page post_uos_nworld_pdpt_pages[MAX_POST_VM_NUM][PDPT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page post_uos_nworld_pd_pages[MAX_POST_VM_NUM][PD_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-
 static struct page post_uos_sworld_pgtable_pages[MAX_POST_VM_NUM][TRUSTY_PGTABLE_PAGE_NUM(TRUSTY_RAM_SIZE)];
 /* pre-assumption: TRUSTY_RAM_SIZE is 2M aligned */
 static struct page post_uos_sworld_memory[MAX_POST_VM_NUM][TRUSTY_RAM_SIZE >> PAGE_SHIFT] __aligned(MEM_2M);
 
+/* dirty page logging is supported for post-launched VMs only */
+static uint64_t post_uos_dirty_bitmap[MAX_POST_VM_NUM][DIRTY_BITMAP_WORDS(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
+
 /* ept: extended page table*/
 static union pgtable_pages_info ept_pages_info[CONFIG_MAX_VM_NUM];
+static struct large_page_stats ept_large_page_stats[CONFIG_MAX_VM_NUM];
 
-
-#ifdef CONFIG_LAST_LEVEL_EPT_AT_BOOT
 /* Array with address space size for each type of load order of VM */
 static const uint64_t vm_address_space_size[MAX_LOAD_ORDER] = {
 	PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE), /* for Pre-Launched VM */
@@ -109,28 +103,325 @@ static const uint64_t vm_address_space_size[MAX_LOAD_ORDER] = {
 };
 
 /*
- * @brief Reserve space for EPT 4K pages from platform E820 table
+ * The page-table pages of the normal world EPTs of all VMs are taken from one
+ * pool on demand, rather than being reserved for the whole address space of
+ * every VM. Each VM may hold a share of the pool in proportion to its address
+ * space, so a VM can't keep the others from getting their shares. A VM which
+ * can't map its memory with large pages (an RTVM with the "Machine Check Error
+ * on Page Size Change" workaround) is given its whole worst case instead, set
+ * aside when it is created, so it never runs short. Once a VM runs out of its
+ * share, mapping more of its memory fails with -ENOMEM: a page-table page is
+ * never shared, not even by the mappings of one VM.
+ *
+ * The pages folded back into large pages stay with their VM as spare pages,
+ * and are taken again by that VM only. A software walker of the EPT (e.g.
+ * gpa2hpa()) which doesn't hold the EPT lock may still be in such a page when
+ * it is taken, but it can't be led into the memory of another VM that way.
+ * The pages go back to the pool only when the EPT of the VM is destroyed.
+ */
+#define EPT_PAGE_POOL_NUM	(((uint64_t)CONFIG_EPT_PAGE_POOL_SIZE) >> PAGE_SHIFT)
+#define EPT_PAGE_POOL_WORDS	((EPT_PAGE_POOL_NUM + 63UL) >> 6U)
+
+struct ept_page_pool {
+	spinlock_t lock;
+	struct page *pages;
+	uint64_t used[EPT_PAGE_POOL_WORDS];
+	/* freed pages which may still be walked until the EPT of their VM is flushed */
+	uint64_t retired[EPT_PAGE_POOL_WORDS];
+	/* generation a retired page was sealed in, 0 if not sealed yet */
+	uint64_t retire_gen[EPT_PAGE_POOL_NUM];
+	/* retired pages flushed since, which only their VM may take again */
+	uint64_t spare[EPT_PAGE_POOL_WORDS];
+	uint16_t owner[EPT_PAGE_POOL_NUM];
+	uint64_t hint;
+	uint64_t nr_free;
+	/* pages set aside for the VMs given their worst case, not taken by them yet */
+	uint64_t nr_reserved;
+	uint64_t nr_used[CONFIG_MAX_VM_NUM];
+	uint64_t quota[CONFIG_MAX_VM_NUM];
+	/* share in proportion to the address space, and worst case, of each VM */
+	uint64_t share[CONFIG_MAX_VM_NUM];
+	uint64_t worst[CONFIG_MAX_VM_NUM];
+	bool worst_reserved[CONFIG_MAX_VM_NUM];
+	uint64_t gen[CONFIG_MAX_VM_NUM];
+};
+
+static struct ept_page_pool ept_page_pool;
+
+#ifndef CONFIG_LAST_LEVEL_EPT_AT_BOOT
+static struct page ept_page_pool_pages[EPT_PAGE_POOL_NUM];
+#endif
+
+/*
+ * @brief Set up the pool of EPT page-table pages and the share of each VM
+ *
+ * With CONFIG_LAST_LEVEL_EPT_AT_BOOT, the pool is reserved from the platform
+ * E820 table instead of the hypervisor image.
  */
-void reserve_buffer_for_ept_pages(void)
+void init_ept_page_pool(void)
 {
-	uint64_t pt_base;
+	uint64_t total = 0UL;
+	uint64_t i;
 	uint16_t vm_id;
-	uint32_t offset = 0U;
 	struct acrn_vm_config *vm_config;
 
-	pt_base = e820_alloc_memory(TOTAL_EPT_4K_PAGES_SIZE, ~0UL);
-	hv_access_memory_region_update(pt_base, TOTAL_EPT_4K_PAGES_SIZE);
+#ifdef CONFIG_LAST_LEVEL_EPT_AT_BOOT
+	uint64_t pool_base = e820_alloc_memory(CONFIG_EPT_PAGE_POOL_SIZE, ~0UL);
+
+	hv_access_memory_region_update(pool_base, CONFIG_EPT_PAGE_POOL_SIZE);
+	ept_page_pool.pages = (struct page *)hpa2hva(pool_base);
+#else
+	ept_page_pool.pages = ept_page_pool_pages;
+#endif
+	spinlock_init(&ept_page_pool.lock);
+
+	/* the bits past the end of the pool are never free */
+	for (i = EPT_PAGE_POOL_NUM; i < (EPT_PAGE_POOL_WORDS << 6U); i++) {
+		bitmap_set_nolock((uint16_t)(i & 0x3FUL), &ept_page_pool.used[i >> 6U]);
+	}
+
+	ept_page_pool.nr_free = EPT_PAGE_POOL_NUM;
+
 	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
 		vm_config = get_vm_config(vm_id);
-		ept_pages_info[vm_id].ept.nworld_pt_base = (struct page *)(void *)(pt_base + offset);
-		offset += PT_PAGE_NUM(vm_address_space_size[vm_config->load_order])*MEM_4K;
+		ept_page_pool.worst[vm_id] = EPT_PGTABLE_PAGE_NUM(vm_address_space_size[vm_config->load_order]);
+		total += ept_page_pool.worst[vm_id];
+	}
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		ept_page_pool.share[vm_id] = (EPT_PAGE_POOL_NUM * ept_page_pool.worst[vm_id]) / total;
+	}
+
+	if (total > EPT_PAGE_POOL_NUM) {
+		pr_info("EPT page pool: %lu pages, %lu KB of memory saved", EPT_PAGE_POOL_NUM,
+				(total - EPT_PAGE_POOL_NUM) << (PAGE_SHIFT - 10U));
+	} else {
+		pr_info("EPT page pool: %lu pages, no less than the worst case of all VMs (%lu pages)",
+				EPT_PAGE_POOL_NUM, total);
 	}
 }
-#else
-static struct page sos_vm_pt_pages[SOS_VM_NUM][PT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE))];
-static struct page pre_uos_nworld_pt_pages[PRE_VM_NUM][PT_PAGE_NUM(PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page post_uos_nworld_pt_pages[MAX_POST_VM_NUM][PT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-#endif
+
+static inline bool is_ept_pool_page(const struct page *page)
+{
+	return (page >= ept_page_pool.pages) && (page < (ept_page_pool.pages + EPT_PAGE_POOL_NUM));
+}
+
+/*
+ * @pre the caller holds the lock of the pool
+ */
+static struct page *ept_take_spare_page(uint16_t vm_id)
+{
+	struct page *page = NULL;
+	uint64_t i, idx, bits;
+	uint16_t bit;
+
+	for (i = 0UL; (i < EPT_PAGE_POOL_WORDS) && (page == NULL); i++) {
+		bits = ept_page_pool.spare[i];
+		while ((bits != 0UL) && (page == NULL)) {
+			bit = ffs64(bits);
+			bitmap_clear_nolock(bit, &bits);
+			idx = (i << 6U) + bit;
+			if (ept_page_pool.owner[idx] == vm_id) {
+				bitmap_clear_nolock(bit, &ept_page_pool.spare[i]);
+				page = ept_page_pool.pages + idx;
+			}
+		}
+	}
+
+	return page;
+}
+
+/*
+ * Set the share of a VM when it is created: its worst case if it can't use
+ * large pages, which has to be set aside from the pool at once.
+ */
+static int32_t ept_set_quota(uint16_t vm_id, bool large_page_enabled)
+{
+	int32_t ret = 0;
+
+	spinlock_obtain(&ept_page_pool.lock);
+	if (large_page_enabled) {
+		ept_page_pool.quota[vm_id] = ept_page_pool.share[vm_id];
+	} else if ((ept_page_pool.nr_free - ept_page_pool.nr_reserved) >= ept_page_pool.worst[vm_id]) {
+		ept_page_pool.quota[vm_id] = ept_page_pool.worst[vm_id];
+		ept_page_pool.nr_reserved += ept_page_pool.worst[vm_id];
+		ept_page_pool.worst_reserved[vm_id] = true;
+	} else {
+		pr_err("VM%hu needs %lu pages of the EPT page pool, %lu left, check CONFIG_EPT_PAGE_POOL_SIZE",
+				vm_id, ept_page_pool.worst[vm_id], ept_page_pool.nr_free - ept_page_pool.nr_reserved);
+		ret = -ENOMEM;
+	}
+	spinlock_release(&ept_page_pool.lock);
+
+	return ret;
+}
+
+/*
+ * Take a page of the VM: a spare one, or a free one of the pool within the
+ * share of the VM. The pages set aside for other VMs are left to them.
+ * Return NULL if there is none.
+ */
+static struct page *ept_alloc_page(const union pgtable_pages_info *info)
+{
+	uint16_t vm_id = info->ept.vm_id;
+	struct page *page;
+	uint64_t i, loop, idx;
+	bool can_take;
+
+	spinlock_obtain(&ept_page_pool.lock);
+	page = ept_take_spare_page(vm_id);
+	can_take = (page == NULL) && (ept_page_pool.nr_used[vm_id] < ept_page_pool.quota[vm_id]);
+	if (can_take && ept_page_pool.worst_reserved[vm_id]) {
+		ept_page_pool.nr_reserved--;
+	} else if (can_take) {
+		can_take = (ept_page_pool.nr_free > ept_page_pool.nr_reserved);
+	} else {
+		/* a spare page, or none */
+	}
+
+	if (can_take) {
+		for (loop = 0UL; loop < EPT_PAGE_POOL_WORDS; loop++) {
+			i = (ept_page_pool.hint + loop) % EPT_PAGE_POOL_WORDS;
+			if (ept_page_pool.used[i] != ~0UL) {
+				idx = (i << 6U) + ffz64(ept_page_pool.used[i]);
+				bitmap_set_nolock((uint16_t)(idx & 0x3FUL), &ept_page_pool.used[i]);
+				ept_page_pool.owner[idx] = vm_id;
+				ept_page_pool.nr_used[vm_id]++;
+				ept_page_pool.nr_free--;
+				ept_page_pool.hint = i;
+				page = ept_page_pool.pages + idx;
+				break;
+			}
+		}
+	}
+	spinlock_release(&ept_page_pool.lock);
+
+	if (page == NULL) {
+		pr_err("VM%hu is out of its share of the EPT page pool", vm_id);
+	} else {
+		(void)memset(page, 0U, PAGE_SIZE);
+	}
+
+	return page;
+}
+
+/*
+ * Put a page-table page no longer linked into the EPT aside. It is sealed by
+ * seal_retired_ept_pages(), and becomes a spare page of its VM with
+ * recycle_retired_ept_pages() once the EPT has been flushed after that.
+ */
+static void ept_free_page(__unused const union pgtable_pages_info *info, struct page *page)
+{
+	uint64_t idx;
+
+	if (is_ept_pool_page(page)) {
+		idx = (uint64_t)(page - ept_page_pool.pages);
+		spinlock_obtain(&ept_page_pool.lock);
+		bitmap_set_nolock((uint16_t)(idx & 0x3FUL), &ept_page_pool.retired[idx >> 6U]);
+		ept_page_pool.retire_gen[idx] = 0UL;
+		spinlock_release(&ept_page_pool.lock);
+	}
+}
+
+/*
+ * Return all of the pages of the VM to the pool, or make the retired ones
+ * sealed in generation gen or before spare pages of the VM.
+ */
+static void ept_release_pages(uint16_t vm_id, bool retired_only, uint64_t gen)
+{
+	uint64_t i, idx, bits;
+	uint16_t bit;
+
+	spinlock_obtain(&ept_page_pool.lock);
+	if (!retired_only && ept_page_pool.worst_reserved[vm_id]) {
+		/* give back the pages set aside and not taken */
+		ept_page_pool.nr_reserved -= ept_page_pool.quota[vm_id] - ept_page_pool.nr_used[vm_id];
+		ept_page_pool.worst_reserved[vm_id] = false;
+	}
+
+	for (i = 0UL; i < EPT_PAGE_POOL_WORDS; i++) {
+		bits = retired_only ? ept_page_pool.retired[i] : ept_page_pool.used[i];
+		while (bits != 0UL) {
+			bit = ffs64(bits);
+			bitmap_clear_nolock(bit, &bits);
+			idx = (i << 6U) + bit;
+			if ((idx < EPT_PAGE_POOL_NUM) && (ept_page_pool.owner[idx] == vm_id) &&
+					(!retired_only || ((ept_page_pool.retire_gen[idx] != 0UL) &&
+					(ept_page_pool.retire_gen[idx] <= gen)))) {
+				bitmap_clear_nolock(bit, &ept_page_pool.retired[i]);
+				if (retired_only) {
+					bitmap_set_nolock(bit, &ept_page_pool.spare[i]);
+				} else {
+					bitmap_clear_nolock(bit, &ept_page_pool.used[i]);
+					bitmap_clear_nolock(bit, &ept_page_pool.spare[i]);
+					ept_page_pool.nr_used[vm_id]--;
+					ept_page_pool.nr_free++;
+					if (ept_page_pool.worst_reserved[vm_id]) {
+						/* still set aside for the VM */
+						ept_page_pool.nr_reserved++;
+					}
+				}
+			}
+		}
+	}
+	spinlock_release(&ept_page_pool.lock);
+}
+
+/**
+ * @brief Seal the pages of a VM retired so far
+ *
+ * @return the generation to pass to recycle_retired_ept_pages() once the EPT
+ * has been flushed, 0 if no page was retired
+ *
+ * @pre mem_ops is the EPT memory_ops of a VM
+ * @pre the caller holds the EPT lock of the VM
+ */
+uint64_t seal_retired_ept_pages(const struct memory_ops *mem_ops)
+{
+	uint16_t vm_id = mem_ops->info->ept.vm_id;
+	uint64_t i, idx, bits, gen = 0UL;
+	uint16_t bit;
+
+	spinlock_obtain(&ept_page_pool.lock);
+	for (i = 0UL; i < EPT_PAGE_POOL_WORDS; i++) {
+		bits = ept_page_pool.retired[i];
+		while (bits != 0UL) {
+			bit = ffs64(bits);
+			bitmap_clear_nolock(bit, &bits);
+			idx = (i << 6U) + bit;
+			if ((ept_page_pool.owner[idx] == vm_id) && (ept_page_pool.retire_gen[idx] == 0UL)) {
+				if (gen == 0UL) {
+					ept_page_pool.gen[vm_id]++;
+					gen = ept_page_pool.gen[vm_id];
+				}
+				ept_page_pool.retire_gen[idx] = gen;
+			}
+		}
+	}
+	spinlock_release(&ept_page_pool.lock);
+
+	return gen;
+}
+
+/**
+ * @brief Let a VM take its pages sealed in generation gen or before again
+ *
+ * @pre mem_ops is the EPT memory_ops of a VM, and its EPT has been flushed on
+ * every pcpu and IOMMU since gen was sealed
+ */
+void recycle_retired_ept_pages(const struct memory_ops *mem_ops, uint64_t gen)
+{
+	ept_release_pages(mem_ops->info->ept.vm_id, true, gen);
+}
+
+/**
+ * @pre mem_ops is the EPT memory_ops of a VM, and its EPT is not in use any
+ * more, and has been flushed on every pcpu and IOMMU
+ */
+void free_ept_pages(const struct memory_ops *mem_ops)
+{
+	ept_release_pages(mem_ops->info->ept.vm_id, false, 0UL);
+}
 
 void *get_reserve_sworld_memory_base(void)
 {
@@ -154,28 +445,24 @@ static inline void ept_clflush_pagewalk(const void* etry)
 
 static inline struct page *ept_get_pml4_page(const union pgtable_pages_info *info)
 {
-	struct page *pml4_page = info->ept.nworld_pml4_base;
-	(void)memset(pml4_page, 0U, PAGE_SIZE);
-	return pml4_page;
+	return ept_alloc_page(info);
 }
 
-static inline struct page *ept_get_pdpt_page(const union pgtable_pages_info *info, uint64_t gpa)
+static inline struct page *ept_get_pdpt_page(const union pgtable_pages_info *info, __unused uint64_t gpa)
 {
-	struct page *pdpt_page = info->ept.nworld_pdpt_base + (gpa >> PML4E_SHIFT);
-	(void)memset(pdpt_page, 0U, PAGE_SIZE);
-	return pdpt_page;
+	return ept_alloc_page(info);
 }
 
 static inline struct page *ept_get_pd_page(const union pgtable_pages_info *info, uint64_t gpa)
 {
 	struct page *pd_page;
 	if (gpa < TRUSTY_EPT_REBASE_GPA) {
-		pd_page = info->ept.nworld_pd_base + (gpa >> PDPTE_SHIFT);
+		pd_page = ept_alloc_page(info);
 	} else {
 		pd_page = info->ept.sworld_pgtable_base + TRUSTY_PML4_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) +
 			TRUSTY_PDPT_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) + ((gpa - TRUSTY_EPT_REBASE_GPA) >> PDPTE_SHIFT);
+		(void)memset(pd_page, 0U, PAGE_SIZE);
 	}
-	(void)memset(pd_page, 0U, PAGE_SIZE);
 	return pd_page;
 }
 
@@ -183,13 +470,13 @@ static inline struct page *ept_get_pt_page(const union pgtable_pages_info *info,
 {
 	struct page *pt_page;
 	if (gpa < TRUSTY_EPT_REBASE_GPA) {
-		pt_page = info->ept.nworld_pt_base + (gpa >> PDE_SHIFT);
+		pt_page = ept_alloc_page(info);
 	} else {
 		pt_page = info->ept.sworld_pgtable_base + TRUSTY_PML4_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) +
 			TRUSTY_PDPT_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) + TRUSTY_PD_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) +
 			((gpa - TRUSTY_EPT_REBASE_GPA) >> PDE_SHIFT);
+		(void)memset(pt_page, 0U, PAGE_SIZE);
 	}
-	(void)memset(pt_page, 0U, PAGE_SIZE);
 	return pt_page;
 }
 
@@ -212,48 +499,40 @@ static inline void ept_recover_exe_right(uint64_t *entry)
 	*entry |= EPT_EXE;
 }
 
-void init_ept_mem_ops(struct memory_ops *mem_ops, uint16_t vm_id)
+/**
+ * @retval 0 on success
+ * @retval -ENOMEM the EPT page pool can't hold the worst case of a VM which
+ *                 can't use large pages
+ */
+int32_t init_ept_mem_ops(struct memory_ops *mem_ops, uint16_t vm_id)
 {
 	struct acrn_vm *vm = get_vm_from_vmid(vm_id);
 
+	ept_pages_info[vm_id].ept.vm_id = vm_id;
 	if (is_sos_vm(vm)) {
 		ept_pages_info[vm_id].ept.top_address_space = EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE);
-		ept_pages_info[vm_id].ept.nworld_pml4_base = sos_vm_pml4_pages[0U];
-		ept_pages_info[vm_id].ept.nworld_pdpt_base = sos_vm_pdpt_pages[0U];
-		ept_pages_info[vm_id].ept.nworld_pd_base = sos_vm_pd_pages[0U];
-#ifndef CONFIG_LAST_LEVEL_EPT_AT_BOOT
-		ept_pages_info[vm_id].ept.nworld_pt_base = sos_vm_pt_pages[0U];
-#endif
 	} else if (is_prelaunched_vm(vm)) {
 		ept_pages_info[vm_id].ept.top_address_space = PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE);
-		ept_pages_info[vm_id].ept.nworld_pml4_base = pre_uos_nworld_pml4_pages[vm_id];
-		ept_pages_info[vm_id].ept.nworld_pdpt_base = pre_uos_nworld_pdpt_pages[vm_id];
-		ept_pages_info[vm_id].ept.nworld_pd_base = pre_uos_nworld_pd_pages[vm_id];
-#ifndef CONFIG_LAST_LEVEL_EPT_AT_BOOT
-		ept_pages_info[vm_id].ept.nworld_pt_base = pre_uos_nworld_pt_pages[vm_id];
-#endif
 	} else {
 		uint16_t sos_vm_id = (get_sos_vm())->vm_id;
 		uint16_t page_idx = vmid_2_rel_vmid(sos_vm_id, vm_id) - 1U;
 
 		ept_pages_info[vm_id].ept.top_address_space = EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE);
-		ept_pages_info[vm_id].ept.nworld_pml4_base = post_uos_nworld_pml4_pages[page_idx];
-		ept_pages_info[vm_id].ept.nworld_pdpt_base = post_uos_nworld_pdpt_pages[page_idx];
-		ept_pages_info[vm_id].ept.nworld_pd_base = post_uos_nworld_pd_pages[page_idx];
-#ifndef CONFIG_LAST_LEVEL_EPT_AT_BOOT
-		ept_pages_info[vm_id].ept.nworld_pt_base = post_uos_nworld_pt_pages[page_idx];
-#endif
 		ept_pages_info[vm_id].ept.sworld_pgtable_base = post_uos_sworld_pgtable_pages[page_idx];
 		ept_pages_info[vm_id].ept.sworld_memory_base = post_uos_sworld_memory[page_idx];
+		ept_pages_info[vm_id].ept.dirty_bitmap = post_uos_dirty_bitmap[page_idx];
 		mem_ops->get_sworld_memory_base = ept_get_sworld_memory_base;
 	}
 	mem_ops->info = &ept_pages_info[vm_id];
+	(void)memset(&ept_large_page_stats[vm_id], 0U, sizeof(struct large_page_stats));
+	mem_ops->large_page_stats = &ept_large_page_stats[vm_id];
 	mem_ops->get_default_access_right = ept_get_default_access_right;
 	mem_ops->pgentry_present = ept_pgentry_present;
 	mem_ops->get_pml4_page = ept_get_pml4_page;
 	mem_ops->get_pdpt_page = ept_get_pdpt_page;
 	mem_ops->get_pd_page = ept_get_pd_page;
 	mem_ops->get_pt_page = ept_get_pt_page;
+	mem_ops->free_page = ept_free_page;
 	mem_ops->clflush_pagewalk = ept_clflush_pagewalk;
 	mem_ops->large_page_enabled = true;
 
@@ -269,4 +548,6 @@ void init_ept_mem_ops(struct memory_ops *mem_ops, uint16_t vm_id)
 		mem_ops->tweak_exe_right = nop_tweak_exe_right;
 		mem_ops->recover_exe_right = nop_recover_exe_right;
 	}
+
+	return ept_set_quota(vm_id, mem_ops->large_page_enabled);
 }
@@ -46,42 +46,120 @@ static void tsc_deadline_handler(__unused uint32_t irq, __unused void *data)
 
 static inline void update_physical_timer(struct per_cpu_timers *cpu_timer)
 {
-	struct hv_timer *timer = NULL;
-
-	/* find the next event timer */
-	if (!list_empty(&cpu_timer->timer_list)) {
-		timer = container_of((&cpu_timer->timer_list)->next,
-			struct hv_timer, node);
+	struct hv_timer *timer = cpu_timer->timer_heap;
 
+	/* the next event timer is on the heap root */
+	if (timer != NULL) {
 		/* it is okay to program a expired time */
 		msr_write(MSR_IA32_TSC_DEADLINE, timer->fire_tsc);
 	}
 }
 
 /*
- * return true if we add the timer on the timer_list head
+ * Meld two timer heaps, the root with the smaller fire_tsc becomes the root
+ * of the result and the other one becomes its leftmost child.
+ */
+static struct hv_timer *timer_heap_meld(struct hv_timer *a, struct hv_timer *b)
+{
+	struct hv_timer *root, *child;
+
+	if (a == NULL) {
+		root = b;
+	} else if (b == NULL) {
+		root = a;
+	} else {
+		if (b->fire_tsc < a->fire_tsc) {
+			root = b;
+			child = a;
+		} else {
+			root = a;
+			child = b;
+		}
+
+		child->sibling = root->child;
+		if (root->child != NULL) {
+			root->child->prev = child;
+		}
+		child->prev = root;
+		root->child = child;
+		root->sibling = NULL;
+		root->prev = NULL;
+	}
+
+	return root;
+}
+
+/*
+ * Two-pass merge of the sibling list starting at \p first: meld the siblings in
+ * pairs from left to right, then meld the pairs from right to left.
+ */
+static struct hv_timer *timer_heap_merge_pairs(struct hv_timer *first)
+{
+	struct hv_timer *a = first, *b, *next, *pairs = NULL, *root = NULL;
+
+	/* the pairs are linked through sibling in reversed order */
+	while (a != NULL) {
+		b = a->sibling;
+		next = (b != NULL) ? b->sibling : NULL;
+		a->sibling = NULL;
+		if (b != NULL) {
+			b->sibling = NULL;
+		}
+		a = timer_heap_meld(a, b);
+		a->sibling = pairs;
+		pairs = a;
+		a = next;
+	}
+
+	while (pairs != NULL) {
+		next = pairs->sibling;
+		pairs->sibling = NULL;
+		root = timer_heap_meld(root, pairs);
+		pairs = next;
+	}
+
+	return root;
+}
+
+/*
+ * return true if the timer becomes the timer heap root
  */
 static bool local_add_timer(struct per_cpu_timers *cpu_timer,
 			struct hv_timer *timer)
 {
-	struct list_head *pos, *prev;
-	struct hv_timer *tmp;
-	uint64_t tsc = timer->fire_tsc;
-
-	prev = &cpu_timer->timer_list;
-	list_for_each(pos, &cpu_timer->timer_list) {
-		tmp = container_of(pos, struct hv_timer, node);
-		if (tmp->fire_tsc < tsc) {
-			prev = &tmp->node;
+	timer->child = NULL;
+	timer->sibling = NULL;
+	timer->prev = NULL;
+	timer->cpu_timer = cpu_timer;
+	cpu_timer->timer_heap = timer_heap_meld(cpu_timer->timer_heap, timer);
+
+	return (cpu_timer->timer_heap == timer);
+}
+
+static void local_del_timer(struct per_cpu_timers *cpu_timer,
+			struct hv_timer *timer)
+{
+	struct hv_timer *subheap = timer_heap_merge_pairs(timer->child);
+
+	if (cpu_timer->timer_heap == timer) {
+		cpu_timer->timer_heap = subheap;
+	} else {
+		/* cut the timer out of its sibling list and meld its children back */
+		if (timer->prev->child == timer) {
+			timer->prev->child = timer->sibling;
+		} else {
+			timer->prev->sibling = timer->sibling;
 		}
-		else {
-			break;
+		if (timer->sibling != NULL) {
+			timer->sibling->prev = timer->prev;
 		}
+		cpu_timer->timer_heap = timer_heap_meld(cpu_timer->timer_heap, subheap);
 	}
 
-	list_add(&timer->node, prev);
-
-	return (prev == &cpu_timer->timer_list);
+	timer->child = NULL;
+	timer->sibling = NULL;
+	timer->prev = NULL;
+	timer->cpu_timer = NULL;
 }
 
 int32_t add_timer(struct hv_timer *timer)
@@ -94,7 +172,7 @@ int32_t add_timer(struct hv_timer *timer)
 	if ((timer == NULL) || (timer->func == NULL) || (timer->fire_tsc == 0UL)) {
 		ret = -EINVAL;
 	} else {
-		ASSERT(list_empty(&timer->node), "add timer again!\n");
+		ASSERT(!timer_is_started(timer), "add timer again!\n");
 
 		/* limit minimal periodic timer cycle period */
 		if (timer->mode == TICK_MODE_PERIODIC) {
@@ -105,7 +183,7 @@ int32_t add_timer(struct hv_timer *timer)
 		cpu_timer = &per_cpu(cpu_timers, pcpu_id);
 
 		CPU_INT_ALL_DISABLE(&rflags);
-		/* update the physical timer if we're on the timer_list head */
+		/* update the physical timer if we're on the timer heap root */
 		if (local_add_timer(cpu_timer, timer)) {
 			update_physical_timer(cpu_timer);
 		}
@@ -123,8 +201,8 @@ void del_timer(struct hv_timer *timer)
 	uint64_t rflags;
 
 	CPU_INT_ALL_DISABLE(&rflags);
-	if ((timer != NULL) && !list_empty(&timer->node)) {
-		list_del_init(&timer->node);
+	if ((timer != NULL) && timer_is_started(timer)) {
+		local_del_timer(timer->cpu_timer, timer);
 	}
 	CPU_INT_ALL_RESTORE(rflags);
 }
@@ -134,7 +212,7 @@ static void init_percpu_timer(uint16_t pcpu_id)
 	struct per_cpu_timers *cpu_timer;
 
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
-	INIT_LIST_HEAD(&cpu_timer->timer_list);
+	cpu_timer->timer_heap = NULL;
 }
 
 static void init_tsc_deadline_timer(void)
@@ -154,9 +232,9 @@ static void timer_softirq(uint16_t pcpu_id)
 {
 	struct per_cpu_timers *cpu_timer;
 	struct hv_timer *timer;
-	struct list_head *pos, *n;
 	uint32_t tries = MAX_TIMER_ACTIONS;
 	uint64_t current_tsc = rdtsc();
+	uint64_t rflags;
 
 	/* handle passed timer */
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
@@ -167,8 +245,8 @@ static void timer_softirq(uint16_t pcpu_id)
 	 * inside func(), it will infinitely loop here, because new added timer
 	 * already passed due to previously func()'s delay.
 	 */
-	list_for_each_safe(pos, n, &cpu_timer->timer_list) {
-		timer = container_of(pos, struct hv_timer, node);
+	timer = cpu_timer->timer_heap;
+	while (timer != NULL) {
 		/* timer expried */
 		tries--;
 		if ((timer->fire_tsc <= current_tsc) && (tries != 0U)) {
@@ -179,11 +257,14 @@ static void timer_softirq(uint16_t pcpu_id)
 			if (timer->mode == TICK_MODE_PERIODIC) {
 				/* update periodic timer fire tsc */
 				timer->fire_tsc += timer->period_in_cycle;
+				CPU_INT_ALL_DISABLE(&rflags);
 				(void)local_add_timer(cpu_timer, timer);
+				CPU_INT_ALL_RESTORE(rflags);
 			}
 		} else {
 			break;
 		}
+		timer = cpu_timer->timer_heap;
 	}
 
 	/* update nearest timer */
@@ -10,6 +10,7 @@
 #include <bits.h>
 #include <errno.h>
 #include <spinlock.h>
+#include <cpu.h>
 #include <page.h>
 #include <pgtable.h>
 #include <irq.h>
@@ -88,6 +89,10 @@ static inline uint64_t dmar_set_bitslice(uint64_t var, uint64_t mask, uint32_t p
 
 #define DMAR_INVALIDATION_QUEUE_SIZE	4096U
 #define DMAR_QI_INV_ENTRY_SIZE		16U
+/* Max invalidation descriptors completed by one wait descriptor */
+#define DMAR_QI_BATCH_MAX_DESC		32U
+/* Max page-selective IOTLB invalidations for a range, a larger one is flushed domain-selectively */
+#define DMAR_PSI_MAX_DESC		8U
 #define DMAR_NUM_IR_ENTRIES_PER_PAGE	256U
 
 #define DMAR_INV_STATUS_WRITE_SHIFT	5U
@@ -119,6 +124,23 @@ enum dmar_iirg_type {
 	DMAR_IIRG_PAGE
 };
 
+struct dmar_drhd_rt;
+
+/*
+ * Invalidation descriptors collected for one dmar unit, they are posted to
+ * the invalidation queue together and completed with one wait descriptor.
+ * A batch is held by one pcpu from dmar_qi_batch_open() to the matching
+ * dmar_qi_batch_close(), the pcpu may open it again meanwhile.
+ */
+struct dmar_qi_batch {
+	spinlock_t lock;
+	struct dmar_drhd_rt *dmar_unit;
+	uint16_t owner;		/* pcpu holding the batch, valid while depth != 0 */
+	uint16_t depth;
+	uint32_t num;
+	struct dmar_entry descs[DMAR_QI_BATCH_MAX_DESC];
+};
+
 /* dmar unit runtime data */
 struct dmar_drhd_rt {
 	uint32_t index;
@@ -143,6 +165,8 @@ struct dmar_drhd_rt {
 	uint16_t cap_fault_reg_offset;
 	uint16_t ecap_iotlb_offset;
 	uint32_t fault_state[IOMMU_FAULT_REGISTER_STATE_NUM]; /* 32bit registers */
+
+	struct dmar_qi_batch qi_batch;
 };
 
 struct context_table {
@@ -432,6 +456,9 @@ static int32_t dmar_register_hrhd(struct dmar_drhd_rt *dmar_unit)
 	dev_dbg(DBG_LEVEL_IOMMU, "Register dmar uint [%d] @0x%lx", dmar_unit->index, dmar_unit->drhd->reg_base_addr);
 
 	spinlock_init(&dmar_unit->lock);
+	spinlock_init(&dmar_unit->qi_batch.lock);
+	dmar_unit->qi_batch.dmar_unit = dmar_unit;
+	dmar_unit->qi_batch.owner = INVALID_CPU_ID;
 
 	dmar_unit->cap = iommu_read64(dmar_unit, DMAR_CAP_REG);
 	dmar_unit->ecap = iommu_read64(dmar_unit, DMAR_ECAP_REG);
@@ -547,37 +574,122 @@ static struct dmar_drhd_rt *device_to_dmaru(uint8_t bus, uint8_t devfun)
 	return dmaru;
 }
 
-static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_entry invalidate_desc)
+/*
+ * Post all the descriptors in \p batch plus one wait descriptor to the
+ * invalidation queue, then wait until the hardware finishes all of them.
+ *
+ * @pre this pcpu holds \p batch
+ */
+static void dmar_qi_batch_submit(struct dmar_qi_batch *batch)
 {
+	struct dmar_drhd_rt *dmar_unit = batch->dmar_unit;
 	struct dmar_entry *invalidate_desc_ptr;
 	uint32_t qi_status = 0U;
+	uint32_t i;
 	__unused uint64_t start;
 
-	invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
-
-	invalidate_desc_ptr->hi_64 = invalidate_desc.hi_64;
-	invalidate_desc_ptr->lo_64 = invalidate_desc.lo_64;
-	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
+	if (batch->num != 0U) {
+		spinlock_obtain(&(dmar_unit->lock));
 
-	invalidate_desc_ptr++;
+		for (i = 0U; i < batch->num; i++) {
+			invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
+			invalidate_desc_ptr->hi_64 = batch->descs[i].hi_64;
+			invalidate_desc_ptr->lo_64 = batch->descs[i].lo_64;
+			dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
+		}
 
-	invalidate_desc_ptr->hi_64 = hva2hpa(&qi_status);
-	invalidate_desc_ptr->lo_64 = DMAR_INV_WAIT_DESC_LOWER;
-	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
+		invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
+		invalidate_desc_ptr->hi_64 = hva2hpa(&qi_status);
+		invalidate_desc_ptr->lo_64 = DMAR_INV_WAIT_DESC_LOWER;
+		dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
 
-	qi_status = DMAR_INV_STATUS_INCOMPLETE;
-	iommu_write32(dmar_unit, DMAR_IQT_REG, dmar_unit->qi_tail);
+		qi_status = DMAR_INV_STATUS_INCOMPLETE;
+		iommu_write32(dmar_unit, DMAR_IQT_REG, dmar_unit->qi_tail);
 
-	start = rdtsc();
-	while (qi_status == DMAR_INV_STATUS_INCOMPLETE) {
-		if (qi_status == DMAR_INV_STATUS_COMPLETED) {
-			break;
-		}
-		if ((rdtsc() - start) > CYCLES_PER_MS) {
-			pr_err("DMAR OP Timeout! @ %s", __func__);
+		start = rdtsc();
+		while (qi_status == DMAR_INV_STATUS_INCOMPLETE) {
+			if (qi_status == DMAR_INV_STATUS_COMPLETED) {
+				break;
+			}
+			if ((rdtsc() - start) > CYCLES_PER_MS) {
+				pr_err("DMAR OP Timeout! @ %s", __func__);
+			}
+			asm_pause();
 		}
-		asm_pause();
+
+		spinlock_release(&(dmar_unit->lock));
+
+		batch->num = 0U;
+	}
+}
+
+/*
+ * Take the invalidation batch of \p dmar_unit, or nest into it if this pcpu
+ * holds it already, e.g. an IRTE update inside dmar_qi_batch_begin().
+ */
+static struct dmar_qi_batch *dmar_qi_batch_open(struct dmar_drhd_rt *dmar_unit)
+{
+	struct dmar_qi_batch *batch = &dmar_unit->qi_batch;
+	uint16_t pcpu_id = get_pcpu_id();
+
+	/* only this pcpu sets the owner to its own id */
+	if ((batch->depth == 0U) || (batch->owner != pcpu_id)) {
+		spinlock_obtain(&batch->lock);
+		batch->owner = pcpu_id;
+	}
+	batch->depth++;
+
+	return batch;
+}
+
+/*
+ * Leave the invalidation batch, the outermost close submits it and waits for
+ * all the descriptors collected.
+ *
+ * @pre this pcpu holds \p batch
+ */
+static void dmar_qi_batch_close(struct dmar_qi_batch *batch)
+{
+	batch->depth--;
+	if (batch->depth == 0U) {
+		dmar_qi_batch_submit(batch);
+		batch->owner = INVALID_CPU_ID;
+		spinlock_release(&batch->lock);
+	}
+}
+
+struct dmar_qi_batch *dmar_qi_batch_begin(uint8_t bus, uint8_t devfun)
+{
+	struct dmar_drhd_rt *dmar_unit = device_to_dmaru(bus, devfun);
+	struct dmar_qi_batch *batch = NULL;
+
+	if ((dmar_unit != NULL) && (!dmar_unit->drhd->ignore)) {
+		batch = dmar_qi_batch_open(dmar_unit);
+	}
+
+	return batch;
+}
+
+void dmar_qi_batch_commit(struct dmar_qi_batch *batch)
+{
+	if (batch != NULL) {
+		dmar_qi_batch_close(batch);
+	}
+}
+
+/*
+ * Add one invalidation descriptor to \p batch, the batch is submitted first if it's full.
+ *
+ * @pre this pcpu holds \p batch
+ */
+static void dmar_qi_batch_add(struct dmar_qi_batch *batch, struct dmar_entry invalidate_desc)
+{
+	if (batch->num == DMAR_QI_BATCH_MAX_DESC) {
+		dmar_qi_batch_submit(batch);
 	}
+
+	batch->descs[batch->num] = invalidate_desc;
+	batch->num++;
 }
 
 /*
@@ -586,7 +698,7 @@ static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_en
  * fm: function mask
  * cirg: cache-invalidation request granularity
  */
-static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit,
+static void dmar_qi_batch_context_cache(struct dmar_qi_batch *batch,
 	uint16_t did, uint16_t sid, uint8_t fm, enum dmar_cirg_type cirg)
 {
 	struct dmar_entry invalidate_desc;
@@ -610,20 +722,11 @@ static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit,
 	}
 
 	if (invalidate_desc.lo_64 != 0UL) {
-		spinlock_obtain(&(dmar_unit->lock));
-
-		dmar_issue_qi_request(dmar_unit, invalidate_desc);
-
-		spinlock_release(&(dmar_unit->lock));
+		dmar_qi_batch_add(batch, invalidate_desc);
 	}
 }
 
-static void dmar_invalid_context_cache_global(struct dmar_drhd_rt *dmar_unit)
-{
-	dmar_invalid_context_cache(dmar_unit, 0U, 0U, 0U, DMAR_CIRG_GLOBAL);
-}
-
-static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uint64_t address, uint8_t am,
+static void dmar_qi_batch_iotlb(struct dmar_qi_batch *batch, uint16_t did, uint64_t address, uint8_t am,
 			       bool hint, enum dmar_iirg_type iirg)
 {
 	/* set Drain Reads & Drain Writes,
@@ -657,24 +760,10 @@ static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uin
 	}
 
 	if (invalidate_desc.lo_64 != 0UL) {
-		spinlock_obtain(&(dmar_unit->lock));
-
-		dmar_issue_qi_request(dmar_unit, invalidate_desc);
-
-		spinlock_release(&(dmar_unit->lock));
+		dmar_qi_batch_add(batch, invalidate_desc);
 	}
 }
 
-/* Invalidate IOTLB globally,
- * all iotlb entries are invalidated,
- * all PASID-cache entries are invalidated,
- * all paging-structure-cache entries are invalidated.
- */
-static void dmar_invalid_iotlb_global(struct dmar_drhd_rt *dmar_unit)
-{
-	dmar_invalid_iotlb(dmar_unit, 0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
-}
-
 static void dmar_set_intr_remap_table(struct dmar_drhd_rt *dmar_unit)
 {
 	uint64_t address;
@@ -702,7 +791,7 @@ static void dmar_set_intr_remap_table(struct dmar_drhd_rt *dmar_unit)
 	spinlock_release(&(dmar_unit->lock));
 }
 
-static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index,
+static void dmar_qi_batch_iec(struct dmar_qi_batch *batch, uint16_t intr_index,
 				uint8_t index_mask, bool is_global)
 {
 	struct dmar_entry invalidate_desc;
@@ -716,18 +805,35 @@ static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index
 		invalidate_desc.lo_64 |= DMAR_IECI_INDEXED | dma_iec_index(intr_index, index_mask);
 	}
 
-	if (invalidate_desc.lo_64 != 0UL) {
-		spinlock_obtain(&(dmar_unit->lock));
+	dmar_qi_batch_add(batch, invalidate_desc);
+}
 
-		dmar_issue_qi_request(dmar_unit, invalidate_desc);
+static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index,
+				uint8_t index_mask, bool is_global)
+{
+	struct dmar_qi_batch *batch = dmar_qi_batch_open(dmar_unit);
 
-		spinlock_release(&(dmar_unit->lock));
-	}
+	dmar_qi_batch_iec(batch, intr_index, index_mask, is_global);
+	dmar_qi_batch_close(batch);
 }
 
-static void dmar_invalid_iec_global(struct dmar_drhd_rt *dmar_unit)
+/*
+ * Invalidate all context-cache, IOTLB and interrupt entry cache entries of
+ * \p dmar_unit with one round trip.
+ */
+static void dmar_invalid_all_global(struct dmar_drhd_rt *dmar_unit)
 {
-	dmar_invalid_iec(dmar_unit, 0U, 0U, true);
+	struct dmar_qi_batch *batch = dmar_qi_batch_open(dmar_unit);
+
+	dmar_qi_batch_context_cache(batch, 0U, 0U, 0U, DMAR_CIRG_GLOBAL);
+	/* Invalidate IOTLB globally,
+	 * all iotlb entries are invalidated,
+	 * all PASID-cache entries are invalidated,
+	 * all paging-structure-cache entries are invalidated.
+	 */
+	dmar_qi_batch_iotlb(batch, 0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
+	dmar_qi_batch_iec(batch, 0U, 0U, true);
+	dmar_qi_batch_close(batch);
 }
 
 static void dmar_set_root_table(struct dmar_drhd_rt *dmar_unit)
@@ -930,6 +1036,7 @@ static void dmar_enable_qi(struct dmar_drhd_rt *dmar_unit)
 	dmar_unit->qi_queue = hva2hpa(get_qi_queue(dmar_unit->index));
 	iommu_write64(dmar_unit, DMAR_IQA_REG, dmar_unit->qi_queue);
 
+	dmar_unit->qi_tail = 0U;
 	iommu_write32(dmar_unit, DMAR_IQT_REG, 0U);
 
 	if ((dmar_unit->gcmd & DMA_GCMD_QIE) == 0U) {
@@ -968,9 +1075,7 @@ static void prepare_dmar(struct dmar_drhd_rt *dmar_unit)
 static void enable_dmar(struct dmar_drhd_rt *dmar_unit)
 {
 	dev_dbg(DBG_LEVEL_IOMMU, "enable dmar uint [0x%x]", dmar_unit->drhd->reg_base_addr);
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
-	dmar_invalid_iec_global(dmar_unit);
+	dmar_invalid_all_global(dmar_unit);
 	dmar_enable_translation(dmar_unit);
 }
 
@@ -986,9 +1091,7 @@ static void suspend_dmar(struct dmar_drhd_rt *dmar_unit)
 {
 	uint32_t i;
 
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
-	dmar_invalid_iec_global(dmar_unit);
+	dmar_invalid_all_global(dmar_unit);
 
 	disable_dmar(dmar_unit);
 
@@ -1019,6 +1122,7 @@ static int32_t iommu_attach_device(const struct iommu_domain *domain, uint8_t bu
 	struct dmar_entry *context;
 	struct dmar_entry *root_entry;
 	struct dmar_entry *context_entry;
+	struct dmar_qi_batch *batch;
 	uint64_t hi_64 = 0UL;
 	uint64_t lo_64 = 0UL;
 	int32_t ret = 0;
@@ -1098,6 +1202,16 @@ static int32_t iommu_attach_device(const struct iommu_domain *domain, uint8_t bu
 				context_entry->hi_64 = hi_64;
 				context_entry->lo_64 = lo_64;
 				iommu_flush_cache(context_entry, sizeof(struct dmar_entry));
+
+				/* a unit in caching mode may cache not-present entries too */
+				if ((iommu_cap_caching_mode(dmar_unit->cap) != 0U) && ((dmar_unit->gcmd & DMA_GCMD_QIE) != 0U)) {
+					batch = dmar_qi_batch_open(dmar_unit);
+					dmar_qi_batch_context_cache(batch, vmid_to_domainid(domain->vm_id), sid.value, 0U,
+									DMAR_CIRG_DEVICE);
+					dmar_qi_batch_iotlb(batch, vmid_to_domainid(domain->vm_id), 0UL, 0U, false,
+									DMAR_IIRG_DOMAIN);
+					dmar_qi_batch_close(batch);
+				}
 			}
 		}
 	}
@@ -1113,6 +1227,7 @@ static int32_t iommu_detach_device(const struct iommu_domain *domain, uint8_t bu
 	struct dmar_entry *context;
 	struct dmar_entry *root_entry;
 	struct dmar_entry *context_entry;
+	struct dmar_qi_batch *batch;
 	/* source id */
 	union pci_bdf sid;
 	int32_t ret = 0;
@@ -1155,10 +1270,13 @@ static int32_t iommu_detach_device(const struct iommu_domain *domain, uint8_t bu
 				context_entry->hi_64 = 0UL;
 				iommu_flush_cache(context_entry, sizeof(struct dmar_entry));
 
-				dmar_invalid_context_cache(dmar_unit, vmid_to_domainid(domain->vm_id), sid.value, 0U,
+				/* invalidate context-cache and IOTLB with one round trip */
+				batch = dmar_qi_batch_open(dmar_unit);
+				dmar_qi_batch_context_cache(batch, vmid_to_domainid(domain->vm_id), sid.value, 0U,
 								DMAR_CIRG_DEVICE);
-				dmar_invalid_iotlb(dmar_unit, vmid_to_domainid(domain->vm_id), 0UL, 0U, false,
+				dmar_qi_batch_iotlb(batch, vmid_to_domainid(domain->vm_id), 0UL, 0U, false,
 								DMAR_IIRG_DOMAIN);
+				dmar_qi_batch_close(batch);
 			}
 		}
 	}
@@ -1213,12 +1331,108 @@ struct iommu_domain *create_iommu_domain(uint16_t vm_id, uint64_t translation_ta
 	return domain;
 }
 
+/*
+ * Address mask of the next page-selective invalidation of [addr, end): the
+ * largest naturally aligned block at addr which doesn't pass end.
+ */
+static uint8_t dmar_psi_next_am(uint64_t addr, uint64_t end, uint8_t max_am)
+{
+	uint8_t am = 0U;
+
+	while ((am < max_am) && ((addr & ((PAGE_SIZE << (am + 1U)) - 1UL)) == 0UL) &&
+			((addr + (PAGE_SIZE << (am + 1U))) <= end)) {
+		am++;
+	}
+
+	return am;
+}
+
+/*
+ * Number of page-selective invalidations for [start, end), stops counting
+ * past DMAR_PSI_MAX_DESC.
+ */
+static uint32_t dmar_psi_count(uint64_t start, uint64_t end, uint8_t max_am)
+{
+	uint64_t addr = start;
+	uint32_t count = 0U;
+
+	while ((addr < end) && (count <= DMAR_PSI_MAX_DESC)) {
+		addr += PAGE_SIZE << dmar_psi_next_am(addr, end, max_am);
+		count++;
+	}
+
+	return count;
+}
+
+/**
+ * @pre domain != NULL
+ */
+void iommu_flush_domain_range(const struct iommu_domain *domain, uint64_t gpa, uint64_t size)
+{
+	struct dmar_drhd_rt *dmar_unit;
+	struct dmar_qi_batch *batch;
+	uint64_t start = round_page_down(gpa);
+	uint64_t end = round_page_up(gpa + size);
+	uint64_t addr;
+	uint16_t did = vmid_to_domainid(domain->vm_id);
+	uint8_t max_am, am;
+	uint32_t i;
+
+	/* a destroyed domain was flushed by destroy_iommu_domain() */
+	if ((domain->trans_table_ptr != 0UL) && (end > start)) {
+		for (i = 0U; i < platform_dmar_info->drhd_count; i++) {
+			dmar_unit = &dmar_drhd_units[i];
+			if ((!dmar_unit->drhd->ignore) && ((dmar_unit->gcmd & DMA_GCMD_QIE) != 0U)) {
+				max_am = iommu_cap_max_amask_val(dmar_unit->cap);
+				batch = dmar_qi_batch_open(dmar_unit);
+				if ((iommu_cap_pgsel_inv(dmar_unit->cap) != 0U) &&
+						(dmar_psi_count(start, end, max_am) <= DMAR_PSI_MAX_DESC)) {
+					/* the paging-structure caches of the range go too, as the hint is not set */
+					addr = start;
+					while (addr < end) {
+						am = dmar_psi_next_am(addr, end, max_am);
+						dmar_qi_batch_iotlb(batch, did, addr, am, false, DMAR_IIRG_PAGE);
+						addr += PAGE_SIZE << am;
+					}
+				} else {
+					dmar_qi_batch_iotlb(batch, did, 0UL, 0U, false, DMAR_IIRG_DOMAIN);
+				}
+				dmar_qi_batch_close(batch);
+			}
+		}
+	}
+}
+
+/**
+ * @pre domain != NULL
+ */
+void iommu_flush_domain(const struct iommu_domain *domain)
+{
+	struct dmar_drhd_rt *dmar_unit;
+	struct dmar_qi_batch *batch;
+	uint32_t i;
+
+	/* a destroyed domain was flushed by destroy_iommu_domain() */
+	if (domain->trans_table_ptr != 0UL) {
+		for (i = 0U; i < platform_dmar_info->drhd_count; i++) {
+			dmar_unit = &dmar_drhd_units[i];
+			if ((!dmar_unit->drhd->ignore) && ((dmar_unit->gcmd & DMA_GCMD_QIE) != 0U)) {
+				batch = dmar_qi_batch_open(dmar_unit);
+				dmar_qi_batch_iotlb(batch, vmid_to_domainid(domain->vm_id), 0UL, 0U, false,
+								DMAR_IIRG_DOMAIN);
+				dmar_qi_batch_close(batch);
+			}
+		}
+	}
+}
+
 /**
  * @pre domain != NULL
  */
 void destroy_iommu_domain(struct iommu_domain *domain)
 {
 	/* TODO: check if any device assigned to this domain */
+	iommu_flush_domain(domain);
 	(void)memset(domain, 0U, sizeof(*domain));
 }
 
@@ -1230,10 +1444,13 @@ int32_t move_pt_device(const struct iommu_domain *from_domain, const struct iomm
 {
 	int32_t status = 0;
 	uint16_t bus_local = bus;
+	struct dmar_qi_batch *batch;
 
 	/* TODO: check if the device assigned */
 
 	if (bus_local < CONFIG_IOMMU_BUS_NUM) {
+		/* the invalidations of the detach and the attach are completed together */
+		batch = dmar_qi_batch_begin(bus, devfun);
 		if (from_domain != NULL) {
 			status = iommu_detach_device(from_domain, bus, devfun);
 		}
@@ -1241,6 +1458,7 @@ int32_t move_pt_device(const struct iommu_domain *from_domain, const struct iomm
 		if ((status == 0) && (to_domain != NULL)) {
 			status = iommu_attach_device(to_domain, bus, devfun);
 		}
+		dmar_qi_batch_commit(batch);
 	} else {
 		status = -EINVAL;
 	}
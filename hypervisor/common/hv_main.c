@@ -15,10 +15,28 @@
 #include <trace.h>
 #include <logmsg.h>
 
+/*
+ * Count one VM exit into the handling time histogram of its basic exit
+ * reason, in log2 buckets of TSC cycles.
+ */
+static inline void vcpu_account_exit(struct acrn_vcpu *vcpu, uint32_t basic_exit_reason, uint64_t cycles)
+{
+	uint64_t scaled = cycles >> ACRN_EXIT_HIST_SHIFT;
+	uint32_t bucket = 0U;
+
+	if (basic_exit_reason < ACRN_EXIT_REASON_NUM) {
+		if (scaled != 0UL) {
+			bucket = min((uint32_t)fls64(scaled) + 1U, ACRN_EXIT_HIST_BUCKETS - 1U);
+		}
+		vcpu->arch.exit_hist[basic_exit_reason][bucket]++;
+	}
+}
+
 void vcpu_thread(struct thread_object *obj)
 {
 	struct acrn_vcpu *vcpu = container_of(obj, struct acrn_vcpu, thread_obj);
 	uint32_t basic_exit_reason = 0U;
+	uint64_t exit_tsc;
 	int32_t ret = 0;
 
 	do {
@@ -62,7 +80,9 @@ void vcpu_thread(struct thread_object *obj)
 			CPU_IRQ_ENABLE();
 		}
 		/* Dispatch handler */
+		exit_tsc = rdtsc();
 		ret = vmexit_handler(vcpu);
+		vcpu_account_exit(vcpu, basic_exit_reason, rdtsc() - exit_tsc);
 		if (ret < 0) {
 			pr_fatal("dispatch VM exit handler failed for reason"
 				" %d, ret = %d!", basic_exit_reason, ret);
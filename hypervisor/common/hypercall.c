@@ -22,6 +22,9 @@
 
 #define DBG_LEVEL_HYCALL	6U
 
+/* Memory regions applied per EPT update, bounding how long the EPT lock is held */
+#define SET_REGIONS_BATCH	16U
+
 bool is_hypercall_from_ring0(void)
 {
 	uint16_t cs_sel;
@@ -325,6 +328,57 @@ int32_t hcall_set_vcpu_regs(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 	return ret;
 }
 
+/**
+ * @brief get the VM exit statistics of a vcpu
+ *
+ * Report the number of VM exits of a vcpu and the histogram of their
+ * handling time per basic exit reason. The statistics are collected all
+ * the time and are never reset, the caller diffs two reports to look at
+ * an interval.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_vcpu_exit_stats
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_vcpu_exit_stats(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_vcpu *vcpu;
+	uint16_t vcpu_id;
+	uint32_t tsc_khz;
+	uint64_t nr_exits;
+	int32_t ret = -1;
+
+	if (!is_poweroff_vm(target_vm) && (param != 0U)) {
+		if (copy_from_gpa(vm, &vcpu_id, param, sizeof(vcpu_id)) != 0) {
+			pr_err("%s: Unable to copy param from vm\n", __func__);
+			ret = -EFAULT;
+		} else if (vcpu_id >= target_vm->hw.created_vcpus) {
+			pr_err("%s: invalid vcpu_id %hu\n", __func__, vcpu_id);
+		} else {
+			vcpu = vcpu_from_vid(target_vm, vcpu_id);
+			tsc_khz = get_tsc_khz();
+			nr_exits = vcpu->arch.nrexits;
+
+			/* copied field by field, the histogram is too big for the stack */
+			if ((copy_to_gpa(vm, &tsc_khz, param + offsetof(struct acrn_vcpu_exit_stats, tsc_khz),
+					sizeof(tsc_khz)) == 0) &&
+				(copy_to_gpa(vm, &nr_exits, param + offsetof(struct acrn_vcpu_exit_stats, nr_exits),
+					sizeof(nr_exits)) == 0)) {
+				ret = copy_to_gpa(vm, vcpu->arch.exit_hist,
+					param + offsetof(struct acrn_vcpu_exit_stats, hist),
+					sizeof(vcpu->arch.exit_hist));
+			}
+		}
+	}
+
+	return ret;
+}
+
 /**
  * @brief set or clear IRQ line
  *
@@ -553,6 +607,82 @@ int32_t hcall_notify_ioreq_finish(uint16_t vmid, uint16_t vcpu_id)
 	return ret;
 }
 
+/**
+ * @brief set the ioeventfd notification ring
+ *
+ * Set the ring that the hypervisor posts matched ioeventfd cookies to.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page-aligned
+ *              struct acrn_ioeventfd_ring, 0 to disable the ring
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_ioeventfd_ring(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	uint64_t hpa;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	int32_t ret = -1;
+
+	if (is_created_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		if (param == 0UL) {
+			set_ioeventfd_ring(target_vm, NULL);
+			ret = 0;
+		} else if ((param & PAGE_MASK) == param) {
+			hpa = gpa2hpa(vm, param);
+			if (hpa == INVALID_HPA) {
+				pr_err("%s,vm[%hu] gpa 0x%lx,GPA is unmapping.",
+					__func__, vm->vm_id, param);
+			} else {
+				set_ioeventfd_ring(target_vm, (struct acrn_ioeventfd_ring *)hpa2hva(hpa));
+				ret = 0;
+			}
+		} else {
+			pr_err("%s: ring gpa 0x%lx isn't page aligned", __func__, param);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief assign or deassign an ioeventfd
+ *
+ * Writes of the VM that match the ioeventfd are completed in the hypervisor
+ * by posting its cookie to the notification ring.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_hv_ioeventfd
+ * @param assign true to assign, false to deassign
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_ioeventfd(struct acrn_vm *vm, uint16_t vmid, uint64_t param, bool assign)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_hv_ioeventfd args;
+	int32_t ret = -1;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		if (copy_from_gpa(vm, &args, param, sizeof(args)) == 0) {
+			if (assign) {
+				ret = assign_ioeventfd(target_vm, &args);
+			} else {
+				ret = deassign_ioeventfd(target_vm, &args);
+			}
+		}
+	}
+
+	return ret;
+}
+
 /**
  *@pre Pointer vm shall point to SOS_VM
  */
@@ -599,9 +729,8 @@ static int32_t add_vm_memory_region(struct acrn_vm *vm, struct acrn_vm *target_v
 				prot |= EPT_UNCACHED;
 			}
 			/* create gpa to hpa EPT mapping */
-			ept_add_mr(target_vm, pml4_page, hpa,
+			ret = ept_add_mr(target_vm, pml4_page, hpa,
 					region->gpa, region->size, prot);
-			ret = 0;
 		}
 	}
 
@@ -637,9 +766,8 @@ static int32_t set_vm_memory_region(struct acrn_vm *vm,
 			if (region->type != MR_DEL) {
 				ret = add_vm_memory_region(vm, target_vm, region, pml4_page);
 			} else {
-				ept_del_mr(target_vm, pml4_page,
+				ret = ept_del_mr(target_vm, pml4_page,
 						region->gpa, region->size);
-				ret = 0;
 			}
 		}
 	}
@@ -660,9 +788,9 @@ static int32_t set_vm_memory_region(struct acrn_vm *vm,
 int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param)
 {
 	struct set_regions regions;
-	struct vm_memory_region mr;
+	struct vm_memory_region mr[SET_REGIONS_BATCH];
 	struct acrn_vm *target_vm = NULL;
-	uint32_t idx;
+	uint32_t idx, i, num;
 	int32_t ret = -1;
 
 	if (copy_from_gpa(vm, &regions, param, sizeof(regions)) == 0) {
@@ -675,16 +803,31 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param)
 		if ((target_vm != NULL) && !is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
 			idx = 0U;
 			while (idx < regions.mr_num) {
-				if (copy_from_gpa(vm, &mr, regions.regions_gpa + idx * sizeof(mr), sizeof(mr)) != 0) {
+				num = min(regions.mr_num - idx, SET_REGIONS_BATCH);
+				/* mr_num is up to the SOS: copy each batch before taking the EPT lock */
+				if (copy_from_gpa(vm, mr, regions.regions_gpa + (idx * sizeof(mr[0])),
+						num * (uint32_t)sizeof(mr[0])) != 0) {
 					pr_err("%s: Copy mr entry fail from vm\n", __func__);
 					break;
 				}
 
-				ret = set_vm_memory_region(vm, target_vm, &mr);
+				/*
+				 * One EPT flush per batch. The hardware walks the EPT without
+				 * the lock, so vcpus can still see the edits one at a time.
+				 */
+				ept_begin_update(target_vm);
+				for (i = 0U; i < num; i++) {
+					ret = set_vm_memory_region(vm, target_vm, &mr[i]);
+					if (ret < 0) {
+						break;
+					}
+				}
+				ept_commit_update(target_vm);
+
 				if (ret < 0) {
 					break;
 				}
-				idx++;
+				idx += num;
 			}
 		} else {
 			pr_err("%p %s:target_vm is invalid or Targeting to service vm", target_vm, __func__);
@@ -726,9 +869,8 @@ static int32_t write_protect_page(struct acrn_vm *vm,const struct wp_data *wp)
 				prot_set = (wp->set != 0U) ? 0UL : EPT_WR;
 				prot_clr = (wp->set != 0U) ? EPT_WR : 0UL;
 
-				ept_modify_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
+				ret = ept_modify_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
 					wp->gpa, PAGE_SIZE, prot_set, prot_clr);
-				ret = 0;
 			}
 		}
 	}
@@ -801,6 +943,58 @@ int32_t hcall_gpa_to_hpa(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 	return ret;
 }
 
+/**
+ * @brief turn dirty page logging of a VM on or off
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param 1 to turn dirty page logging on, 0 to turn it off
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_dirty_log(__unused struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	int32_t ret = -1;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		ret = ept_set_dirty_log(target_vm, (param != 0UL));
+	} else {
+		pr_err("%p %s: target_vm is invalid", target_vm, __func__);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief fetch and clear the dirty page bitmap of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_dirty_log
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_dirty_log(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_dirty_log log;
+	int32_t ret = -1;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		if (copy_from_gpa(vm, &log, param, sizeof(log)) == 0) {
+			ret = ept_get_dirty_log(target_vm, vm, &log);
+		}
+	} else {
+		pr_err("%p %s: target_vm is invalid", target_vm, __func__);
+	}
+
+	return ret;
+}
+
 /**
  * @brief Assign one PCI dev to a VM.
  *
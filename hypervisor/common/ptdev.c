@@ -12,10 +12,65 @@
 #include <logmsg.h>
 
 #define PTIRQ_BITMAP_ARRAY_SIZE	INT_DIV_ROUNDUP(CONFIG_MAX_PT_IRQ_ENTRIES, 64U)
+#define PTIRQ_ENTRY_HASHBITS	9U
+#define PTIRQ_ENTRY_HASHSIZE	(1U << PTIRQ_ENTRY_HASHBITS)
+
 struct ptirq_remapping_info ptirq_entries[CONFIG_MAX_PT_IRQ_ENTRIES];
 static uint64_t ptirq_entry_bitmaps[PTIRQ_BITMAP_ARRAY_SIZE];
 spinlock_t ptdev_lock;
 
+/*
+ * Hash indexes of the allocated entries, by physical sid and by
+ * (vm, virtual sid). Buckets and links hold entry id + 1, so that a
+ * zeroed bucket or entry reads as the end of a chain.
+ */
+static uint16_t ptirq_phys_sid_hash[PTIRQ_ENTRY_HASHSIZE];
+static uint16_t ptirq_virt_sid_hash[PTIRQ_ENTRY_HASHSIZE];
+
+static inline uint32_t ptirq_sid_hash(const union source_id *sid, const struct acrn_vm *vm)
+{
+	uint64_t key = sid->value;
+
+	if (vm != NULL) {
+		key += ((uint64_t)vm->vm_id + 1UL) << 40U;
+	}
+
+	return (uint32_t)((key * 0x9E3779B97F4A7C15UL) >> (64U - PTIRQ_ENTRY_HASHBITS));
+}
+
+static void ptirq_hash_add(uint16_t *bucket, uint16_t *link, uint16_t id)
+{
+	*link = *bucket;
+	*bucket = id + 1U;
+}
+
+static void ptirq_hash_del(uint16_t *bucket, uint16_t id, bool virt)
+{
+	uint16_t *pos = bucket;
+	struct ptirq_remapping_info *entry;
+
+	while (*pos != 0U) {
+		entry = &ptirq_entries[*pos - 1U];
+		if (entry->ptdev_entry_id == id) {
+			*pos = virt ? entry->virt_sid_link : entry->phys_sid_link;
+			break;
+		}
+		pos = virt ? &entry->virt_sid_link : &entry->phys_sid_link;
+	}
+}
+
+static void ptirq_hash_virt_sid(struct ptirq_remapping_info *entry)
+{
+	ptirq_hash_add(&ptirq_virt_sid_hash[ptirq_sid_hash(&entry->virt_sid, entry->vm)],
+			&entry->virt_sid_link, entry->ptdev_entry_id);
+}
+
+static void ptirq_unhash_virt_sid(const struct ptirq_remapping_info *entry)
+{
+	ptirq_hash_del(&ptirq_virt_sid_hash[ptirq_sid_hash(&entry->virt_sid, entry->vm)],
+			entry->ptdev_entry_id, true);
+}
+
 static inline uint16_t ptirq_alloc_entry_id(void)
 {
 	uint16_t id = (uint16_t)ffz64_ex(ptirq_entry_bitmaps, CONFIG_MAX_PT_IRQ_ENTRIES);
@@ -78,7 +133,8 @@ struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id)
 	return entry;
 }
 
-struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr_type)
+struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr_type,
+		const union source_id *phys_sid, const union source_id *virt_sid)
 {
 	struct ptirq_remapping_info *entry = NULL;
 	uint16_t ptirq_id = ptirq_alloc_entry_id();
@@ -89,6 +145,8 @@ struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr
 		entry->ptdev_entry_id = ptirq_id;
 		entry->intr_type = intr_type;
 		entry->vm = vm;
+		entry->phys_sid.value = phys_sid->value;
+		entry->virt_sid.value = virt_sid->value;
 		entry->intr_count = 0UL;
 
 		INIT_LIST_HEAD(&entry->softirq_node);
@@ -96,6 +154,10 @@ struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr
 		initialize_timer(&entry->intr_delay_timer, ptirq_intr_delay_callback, entry, 0UL, 0, 0UL);
 
 		entry->active = false;
+
+		ptirq_hash_add(&ptirq_phys_sid_hash[ptirq_sid_hash(phys_sid, NULL)],
+				&entry->phys_sid_link, ptirq_id);
+		ptirq_hash_virt_sid(entry);
 	} else {
 		pr_err("Alloc ptdev irq entry failed");
 	}
@@ -112,12 +174,58 @@ void ptirq_release_entry(struct ptirq_remapping_info *entry)
 	del_timer(&entry->intr_delay_timer);
 	CPU_INT_ALL_RESTORE(rflags);
 
+	ptirq_hash_del(&ptirq_phys_sid_hash[ptirq_sid_hash(&entry->phys_sid, NULL)],
+			entry->ptdev_entry_id, false);
+	ptirq_unhash_virt_sid(entry);
+
 	bitmap_clear_nolock((entry->ptdev_entry_id) & 0x3FU,
-		&ptirq_entry_bitmaps[((entry->ptdev_entry_id) & 0x3FU) >> 6U]);
+		&ptirq_entry_bitmaps[(entry->ptdev_entry_id) >> 6U]);
 
 	(void)memset((void *)entry, 0U, sizeof(struct ptirq_remapping_info));
 }
 
+void ptirq_change_owner(struct ptirq_remapping_info *entry, struct acrn_vm *vm,
+		const union source_id *virt_sid)
+{
+	ptirq_unhash_virt_sid(entry);
+	entry->vm = vm;
+	entry->virt_sid.value = virt_sid->value;
+	ptirq_hash_virt_sid(entry);
+}
+
+struct ptirq_remapping_info *ptirq_lookup_entry_by_sid(uint32_t intr_type,
+		const union source_id *sid, const struct acrn_vm *vm)
+{
+	struct ptirq_remapping_info *entry;
+	struct ptirq_remapping_info *entry_found = NULL;
+	uint16_t link, steps;
+
+	if (vm == NULL) {
+		link = ptirq_phys_sid_hash[ptirq_sid_hash(sid, NULL)];
+	} else {
+		link = ptirq_virt_sid_hash[ptirq_sid_hash(sid, vm)];
+	}
+
+	/*
+	 * Some lookups are done without ptdev_lock, so bound the walk in
+	 * case the chain is being changed under us.
+	 */
+	for (steps = 0U; (link != 0U) && (steps < CONFIG_MAX_PT_IRQ_ENTRIES); steps++) {
+		entry = &ptirq_entries[link - 1U];
+		if (is_entry_active(entry) && (intr_type == entry->intr_type) &&
+			((vm == NULL) ?
+			(sid->value == entry->phys_sid.value) :
+			((vm == entry->vm) &&
+			(sid->value == entry->virt_sid.value)))) {
+			entry_found = entry;
+			break;
+		}
+		link = (vm == NULL) ? entry->phys_sid_link : entry->virt_sid_link;
+	}
+
+	return entry_found;
+}
+
 /* interrupt context */
 static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
 {
@@ -113,30 +113,86 @@ static int64_t get_svt(struct thread_object *obj)
 	return svt;
 }
 
-static void sched_tick_handler(void *param)
+/*
+ * @brief Pick the queued thread object with the latest evt which is allowed
+ * to run on one of the pCPUs in mask, the running one is never picked. The
+ * last thread object in the runqueue stays, or two pCPUs going idle would
+ * pass it back and forth without ever running it.
+ * @pre ctl != NULL
+ * @pre ctl->priv != NULL
+ */
+static struct thread_object *sched_bvt_pick_migrate(struct sched_control *ctl, uint64_t mask)
+{
+	struct sched_bvt_control *bvt_ctl = (struct sched_bvt_control *)ctl->priv;
+	struct thread_object *obj, *picked = NULL;
+	struct list_head *pos;
+
+	for (pos = bvt_ctl->runqueue.prev; pos != bvt_ctl->runqueue.next; pos = pos->prev) {
+		obj = container_of(pos, struct thread_object, data);
+		if ((obj != ctl->curr_obj) && ((obj->pcpu_mask & mask) != 0UL)) {
+			picked = obj;
+			break;
+		}
+	}
+
+	return picked;
+}
+
+/*
+ * @brief Get the tsc to fire the slice timer at, 0 for no timer
+ */
+static uint64_t slice_timer_deadline(const struct sched_bvt_control *bvt_ctl, __unused uint64_t now_tsc)
+{
+	uint64_t fire_tsc = bvt_ctl->slice_end;
+
+#ifdef CONFIG_SCHED_BALANCE
+	/* while others are waiting, check each mcu whether one can go to an idle pCPU */
+	if (fire_tsc != 0UL) {
+		fire_tsc = min(fire_tsc, now_tsc + (BVT_MCU_MS * CYCLES_PER_MS));
+	}
+#endif
+
+	return fire_tsc;
+}
+
+/*
+ * @pre bvt_ctl->slice_timer is on the current pCPU if it is started
+ */
+static void arm_slice_timer(struct sched_bvt_control *bvt_ctl, uint64_t fire_tsc)
+{
+	struct hv_timer *timer = &bvt_ctl->slice_timer;
+
+	del_timer(timer);
+	if (fire_tsc != 0UL) {
+		timer->fire_tsc = fire_tsc;
+		(void)add_timer(timer);
+	}
+}
+
+static void sched_slice_handler(void *param)
 {
 	struct sched_control  *ctl = (struct sched_control *)param;
 	struct sched_bvt_control *bvt_ctl = (struct sched_bvt_control *)ctl->priv;
-	struct sched_bvt_data *data;
 	struct thread_object *current;
 	uint16_t pcpu_id = get_pcpu_id();
+	uint64_t now_tsc = rdtsc();
 	uint64_t rflags;
 
 	obtain_schedule_lock(pcpu_id, &rflags);
 	current = ctl->curr_obj;
 
-	if (current != NULL ) {
-		data = (struct sched_bvt_data *)current->data;
-		/* only non-idle thread need to consume run_countdown */
-		if (!is_idle_thread(current)) {
-			data->run_countdown -= 1U;
-			if (data->run_countdown == 0U) {
-				make_reschedule_request(pcpu_id, DEL_MODE_IPI);
-			}
+	/* the timer is only armed for a non-idle thread which has others waiting */
+	if ((current != NULL) && !is_idle_thread(current)) {
+		if (now_tsc >= bvt_ctl->slice_end) {
+			make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+#ifdef CONFIG_SCHED_BALANCE
+		} else if ((sched_idle_pcpus(pcpu_id) != 0UL) &&
+				(sched_bvt_pick_migrate(ctl, sched_idle_pcpus(pcpu_id)) != NULL)) {
+			/* schedule() pushes a waiting thread object to an idle pCPU */
+			make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+#endif
 		} else {
-			if (!list_empty(&bvt_ctl->runqueue)) {
-				make_reschedule_request(pcpu_id, DEL_MODE_IPI);
-			}
+			arm_slice_timer(bvt_ctl, slice_timer_deadline(bvt_ctl, now_tsc));
 		}
 	}
 	release_schedule_lock(pcpu_id, rflags);
@@ -148,30 +204,24 @@ static void sched_tick_handler(void *param)
 static int sched_bvt_init(struct sched_control *ctl)
 {
 	struct sched_bvt_control *bvt_ctl = &per_cpu(sched_bvt_ctl, ctl->pcpu_id);
-	uint64_t tick_period = BVT_MCU_MS * CYCLES_PER_MS;
-	int ret = 0;
 
 	ASSERT(ctl->pcpu_id == get_pcpu_id(), "Init scheduler on wrong CPU!");
 
 	ctl->priv = bvt_ctl;
 	INIT_LIST_HEAD(&bvt_ctl->runqueue);
 
-	/* The tick_timer is periodically */
-	initialize_timer(&bvt_ctl->tick_timer, sched_tick_handler, ctl,
-			rdtsc() + tick_period, TICK_MODE_PERIODIC, tick_period);
-
-	if (add_timer(&bvt_ctl->tick_timer) < 0) {
-		pr_err("Failed to add schedule tick timer!");
-		ret = -1;
-	}
+	/* The slice_timer is one-shot, armed by pick_next only when needed */
+	bvt_ctl->slice_end = 0UL;
+	initialize_timer(&bvt_ctl->slice_timer, sched_slice_handler, ctl,
+			0UL, TICK_MODE_ONESHOT, 0UL);
 
-	return ret;
+	return 0;
 }
 
 static void sched_bvt_deinit(struct sched_control *ctl)
 {
 	struct sched_bvt_control *bvt_ctl = (struct sched_bvt_control *)ctl->priv;
-	del_timer(&bvt_ctl->tick_timer);
+	del_timer(&bvt_ctl->slice_timer);
 }
 
 static void sched_bvt_init_data(struct thread_object *obj)
@@ -244,13 +294,12 @@ static struct thread_object *sched_bvt_pick_next(struct sched_control *ctl)
 		first_data = (struct sched_bvt_data *)first_obj->data;
 
 		/* The run_countdown is used to store how may mcu the next thread
-		 * can run for. It is set in pick_next handler, and decreases in
-		 * tick handler. Normally, the next thread can run until its AVT
+		 * can run for. Normally, the next thread can run until its AVT
 		 * is ahead of the next runnable thread for one CSA
-		 * (context switch allowance). But when there is only one object
-		 * in runqueue, it can run forever. so, set a very very large
-		 * number to it so that it can run for a long time. Here,
-		 * UINT64_MAX can make it run for >100 years before rescheduled.
+		 * (context switch allowance), the slice timer is armed to fire
+		 * right then. But when there is only one object in runqueue, it
+		 * can run forever, UINT64_MAX is set and no timer is armed, it
+		 * runs until another thread object is woken up.
 		 */
 		if (sec != NULL) {
 			second_obj = container_of(sec, struct thread_object, data);
@@ -262,9 +311,18 @@ static struct thread_object *sched_bvt_pick_next(struct sched_control *ctl)
 		}
 		first_data->start_tsc = now_tsc;
 		next = first_obj;
+
+		if (first_data->run_countdown < ((UINT64_MAX - now_tsc) / first_data->mcu)) {
+			bvt_ctl->slice_end = now_tsc + (first_data->run_countdown * first_data->mcu);
+		} else {
+			bvt_ctl->slice_end = 0UL;
+		}
 	} else {
 		next = &get_cpu_var(idle);
+		/* nothing to preempt the idle thread for until a wakeup */
+		bvt_ctl->slice_end = 0UL;
 	}
+	arm_slice_timer(bvt_ctl, slice_timer_deadline(bvt_ctl, now_tsc));
 
 	return next;
 }
@@ -298,5 +356,6 @@ struct acrn_scheduler sched_bvt = {
 	.pick_next	= sched_bvt_pick_next,
 	.sleep		= sched_bvt_sleep,
 	.wake		= sched_bvt_wake,
+	.pick_migrate	= sched_bvt_pick_migrate,
 	.deinit		= sched_bvt_deinit,
 };
@@ -57,6 +57,24 @@ static struct acrn_scheduler *get_scheduler(uint16_t pcpu_id)
 	return ctl->scheduler;
 }
 
+/*
+ * Obtain the schedule lock of the pCPU which obj is on. obj may be migrated
+ * before the lock is held, so check its pCPU again under the lock.
+ */
+static uint16_t obtain_thread_lock(const struct thread_object *obj, uint64_t *rflag)
+{
+	uint16_t pcpu_id = obj->pcpu_id;
+
+	obtain_schedule_lock(pcpu_id, rflag);
+	while (obj->pcpu_id != pcpu_id) {
+		release_schedule_lock(pcpu_id, *rflag);
+		pcpu_id = obj->pcpu_id;
+		obtain_schedule_lock(pcpu_id, rflag);
+	}
+
+	return pcpu_id;
+}
+
 /**
  * @pre obj != NULL
  */
@@ -155,6 +173,75 @@ bool need_reschedule(uint16_t pcpu_id)
 	return bitmap_test(NEED_RESCHEDULE, &ctl->flags);
 }
 
+#ifdef CONFIG_SCHED_BALANCE
+/* pCPUs which picked their idle thread, the targets of load balancing */
+static uint64_t idle_pcpu_bitmap = 0UL;
+
+/*
+ * @brief Get the pCPUs other than pcpu_id which are idle
+ */
+uint64_t sched_idle_pcpus(uint16_t pcpu_id)
+{
+	return idle_pcpu_bitmap & ~(1UL << pcpu_id);
+}
+
+/*
+ * Push one queued thread object of this pCPU to an idle pCPU it is allowed
+ * to run on. Only thread objects which are not running are picked, they are
+ * completely switched out, so obj->migrate() can hand their context over
+ * from this pCPU. The two schedule locks are always taken in pCPU id order.
+ */
+static void sched_balance(uint16_t pcpu_id)
+{
+	struct sched_control *ctl = &per_cpu(sched_ctl, pcpu_id);
+	struct sched_control *to_ctl;
+	struct thread_object *obj = NULL;
+	uint64_t idle = sched_idle_pcpus(pcpu_id);
+	uint64_t rflag, to_rflag;
+	uint16_t to;
+
+	if ((idle != 0UL) && (ctl->scheduler->pick_migrate != NULL)) {
+		obtain_schedule_lock(pcpu_id, &rflag);
+		obj = ctl->scheduler->pick_migrate(ctl, idle);
+		release_schedule_lock(pcpu_id, rflag);
+	}
+
+	if ((obj != NULL) && (obj->migrate != NULL)) {
+		to = ffs64(obj->pcpu_mask & idle);
+		to_ctl = &per_cpu(sched_ctl, to);
+
+		if (to < pcpu_id) {
+			obtain_schedule_lock(to, &to_rflag);
+			obtain_schedule_lock(pcpu_id, &rflag);
+		} else {
+			obtain_schedule_lock(pcpu_id, &rflag);
+			obtain_schedule_lock(to, &to_rflag);
+		}
+
+		/* both pCPUs may have changed while no lock was held */
+		if ((obj->pcpu_id == pcpu_id) && is_runnable(obj) && (obj != ctl->curr_obj) &&
+				is_idle_thread(to_ctl->curr_obj) && !need_reschedule(to) &&
+				obj->migrate(obj, to)) {
+			ctl->scheduler->sleep(obj);
+			obj->pcpu_id = to;
+			obj->sched_ctl = to_ctl;
+			to_ctl->scheduler->wake(obj);
+
+			bitmap_clear_lock(to, &idle_pcpu_bitmap);
+			make_reschedule_request(to, DEL_MODE_IPI);
+		}
+
+		if (to < pcpu_id) {
+			release_schedule_lock(pcpu_id, rflag);
+			release_schedule_lock(to, to_rflag);
+		} else {
+			release_schedule_lock(to, to_rflag);
+			release_schedule_lock(pcpu_id, rflag);
+		}
+	}
+}
+#endif
+
 void schedule(void)
 {
 	uint16_t pcpu_id = get_pcpu_id();
@@ -163,11 +250,22 @@ void schedule(void)
 	struct thread_object *prev = ctl->curr_obj;
 	uint64_t rflag;
 
+#ifdef CONFIG_SCHED_BALANCE
+	sched_balance(pcpu_id);
+#endif
+
 	obtain_schedule_lock(pcpu_id, &rflag);
 	if (ctl->scheduler->pick_next != NULL) {
 		next = ctl->scheduler->pick_next(ctl);
 	}
 	bitmap_clear_lock(NEED_RESCHEDULE, &ctl->flags);
+#ifdef CONFIG_SCHED_BALANCE
+	if (is_idle_thread(next)) {
+		bitmap_set_lock(pcpu_id, &idle_pcpu_bitmap);
+	} else {
+		bitmap_clear_lock(pcpu_id, &idle_pcpu_bitmap);
+	}
+#endif
 
 	/* Don't change prev object's status if it's not running */
 	if (is_running(prev)) {
@@ -193,11 +291,12 @@ void schedule(void)
 
 void sleep_thread(struct thread_object *obj)
 {
-	uint16_t pcpu_id = obj->pcpu_id;
-	struct acrn_scheduler *scheduler = get_scheduler(pcpu_id);
+	uint16_t pcpu_id;
+	struct acrn_scheduler *scheduler;
 	uint64_t rflag;
 
-	obtain_schedule_lock(pcpu_id, &rflag);
+	pcpu_id = obtain_thread_lock(obj, &rflag);
+	scheduler = get_scheduler(pcpu_id);
 	if (scheduler->sleep != NULL) {
 		scheduler->sleep(obj);
 	}
@@ -214,11 +313,11 @@ void sleep_thread(struct thread_object *obj)
 
 void wake_thread(struct thread_object *obj)
 {
-	uint16_t pcpu_id = obj->pcpu_id;
+	uint16_t pcpu_id;
 	struct acrn_scheduler *scheduler;
 	uint64_t rflag;
 
-	obtain_schedule_lock(pcpu_id, &rflag);
+	pcpu_id = obtain_thread_lock(obj, &rflag);
 	if (is_blocked(obj)) {
 		scheduler = get_scheduler(pcpu_id);
 		if (scheduler->wake != NULL) {
@@ -232,10 +331,10 @@ void wake_thread(struct thread_object *obj)
 
 void kick_thread(const struct thread_object *obj)
 {
-	uint16_t pcpu_id = obj->pcpu_id;
+	uint16_t pcpu_id;
 	uint64_t rflag;
 
-	obtain_schedule_lock(pcpu_id, &rflag);
+	pcpu_id = obtain_thread_lock(obj, &rflag);
 	if (is_running(obj)) {
 		if (get_pcpu_id() != pcpu_id) {
 			if (obj->notify_mode == SCHED_NOTIFY_IPI) {
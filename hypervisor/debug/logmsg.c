@@ -6,6 +6,7 @@
 
 #include <types.h>
 #include <atomic.h>
+#include <bits.h>
 #include <sprintf.h>
 #include <spinlock.h>
 #include <per_cpu.h>
@@ -25,17 +26,229 @@ struct acrn_logmsg_ctl {
 
 static struct acrn_logmsg_ctl logmsg_ctl;
 
+/* format strings used in binary mode, indexed by format id */
+static uint64_t log_fmt_table[LOG_FMT_TABLE_SIZE];
+
 void init_logmsg(uint32_t flags)
 {
 	logmsg_ctl.flags = flags;
 	logmsg_ctl.seq = 0;
 }
 
+/*
+ * Put a message of len bytes into the log sbuf of pcpu_id, keeping track
+ * of the laps around the sbuf to know when formats must be sent again.
+ */
+static void log_sbuf_put(uint16_t pcpu_id, uint8_t *buf, uint32_t len)
+{
+	struct shared_buf *sbuf = per_cpu(sbuf, pcpu_id)[ACRN_HVLOG];
+	uint32_t i, nr_entries = ((len - 1U) / LOG_ENTRY_SIZE) + 1U;
+	uint32_t ele_num;
+
+	for (i = 0U; i < nr_entries; i++) {
+		(void)sbuf_put(sbuf, buf + (i * LOG_ENTRY_SIZE));
+	}
+
+	stac();
+	ele_num = sbuf->ele_num;
+	clac();
+
+	per_cpu(logbuf_entries, pcpu_id) += nr_entries;
+	if (per_cpu(logbuf_entries, pcpu_id) >= ele_num) {
+		per_cpu(logbuf_entries, pcpu_id) = 0U;
+		(void)memset(per_cpu(logfmt_sent, pcpu_id), 0U, sizeof(per_cpu(logfmt_sent, pcpu_id)));
+	}
+}
+
+/*
+ * Get the id of a format string, registering it on first use. The
+ * table is keyed by the address of the string, which is constant for
+ * the lifetime of the hypervisor. Returns LOG_FMT_TABLE_SIZE when the
+ * table is full.
+ */
+static uint16_t log_fmt_id(const char *fmt)
+{
+	uint64_t key = (uint64_t)fmt;
+	uint64_t cur;
+	uint16_t slot = (uint16_t)((key * 0x9E3779B97F4A7C15UL) >> 54U);
+	uint16_t i, id = (uint16_t)LOG_FMT_TABLE_SIZE;
+
+	for (i = 0U; i < LOG_FMT_TABLE_SIZE; i++) {
+		cur = log_fmt_table[slot];
+		if (cur == 0UL) {
+			cur = atomic_cmpxchg64(&log_fmt_table[slot], 0UL, key);
+			if (cur == 0UL) {
+				cur = key;
+			}
+		}
+		if (cur == key) {
+			id = slot;
+			break;
+		}
+		slot = (slot + 1U) & (uint16_t)(LOG_FMT_TABLE_SIZE - 1U);
+	}
+
+	return id;
+}
+
+static inline bool is_fmt_spec_char(char ch)
+{
+	return ((ch >= '0') && (ch <= '9')) || (ch == '#') || (ch == '-') ||
+		(ch == ' ') || (ch == '+') || (ch == '.');
+}
+
+static uint32_t log_pack_u64(uint8_t *buf, uint32_t size, uint32_t pos, uint64_t val)
+{
+	uint32_t next = pos;
+
+	if ((pos + sizeof(val)) <= size) {
+		(void)memcpy_s(buf + pos, sizeof(val), &val, sizeof(val));
+		next += (uint32_t)sizeof(val);
+	}
+
+	return next;
+}
+
+/*
+ * Store the arguments of fmt in buf, following the conversions that
+ * do_print() supports. Arguments that do not fit are dropped.
+ */
+static uint32_t log_pack_args(uint8_t *buf, uint32_t size, const char *fmt, va_list args)
+{
+	const char *s = fmt;
+	const char *str;
+	uint32_t pos = 0U;
+	uint16_t len;
+	bool is_long;
+	char ch;
+
+	while (*s != '\0') {
+		if (*s != '%') {
+			s++;
+			continue;
+		}
+
+		s++;
+		while (is_fmt_spec_char(*s)) {
+			s++;
+		}
+		is_long = false;
+		if (*s == 'h') {
+			s++;
+			if (*s == 'h') {
+				s++;
+			}
+		} else if (*s == 'l') {
+			is_long = true;
+			s++;
+			if (*s == 'l') {
+				s++;
+			}
+		} else {
+			/* no length modifier */
+		}
+
+		ch = *s;
+		if (ch != '\0') {
+			s++;
+		}
+
+		if ((ch == 'd') || (ch == 'i')) {
+			if (is_long) {
+				pos = log_pack_u64(buf, size, pos, (uint64_t)__builtin_va_arg(args, int64_t));
+			} else {
+				pos = log_pack_u64(buf, size, pos, (uint64_t)(int64_t)__builtin_va_arg(args, int32_t));
+			}
+		} else if ((ch == 'u') || (ch == 'x') || (ch == 'X')) {
+			if (is_long) {
+				pos = log_pack_u64(buf, size, pos, __builtin_va_arg(args, uint64_t));
+			} else {
+				pos = log_pack_u64(buf, size, pos, (uint64_t)__builtin_va_arg(args, uint32_t));
+			}
+		} else if (ch == 'c') {
+			pos = log_pack_u64(buf, size, pos, (uint64_t)(int64_t)__builtin_va_arg(args, int32_t));
+		} else if (ch == 's') {
+			str = __builtin_va_arg(args, const char *);
+			if (str == NULL) {
+				str = "(null)";
+			}
+			if ((pos + sizeof(len)) < size) {
+				len = (uint16_t)strnlen_s(str, size - (pos + (uint32_t)sizeof(len)));
+				(void)memcpy_s(buf + pos, sizeof(len), &len, sizeof(len));
+				pos += (uint32_t)sizeof(len);
+				(void)memcpy_s(buf + pos, size - pos, str, len);
+				pos += len;
+			}
+		} else {
+			/* '%' or a conversion do_print() does not know, no argument */
+		}
+	}
+
+	return pos;
+}
+
+/*
+ * Log a message as a binary record: format id plus raw arguments, no
+ * formatting. Returns false if the message has to go out as text.
+ */
+static bool log_bin_msg(uint16_t pcpu_id, uint32_t severity, uint32_t seq, uint64_t tsc,
+		const char *fmt, va_list args)
+{
+	uint8_t *buf = (uint8_t *)per_cpu(logbuf, pcpu_id);
+	uint8_t *payload = buf + sizeof(struct log_bin_hdr);
+	uint32_t size = LOG_MESSAGE_MAX_SIZE - (uint32_t)sizeof(struct log_bin_hdr);
+	struct log_bin_hdr hdr;
+	uint32_t tsc_khz, len;
+	uint16_t id = log_fmt_id(fmt);
+	bool done = false;
+
+	if (id < LOG_FMT_TABLE_SIZE) {
+		(void)memset(&hdr, 0U, sizeof(hdr));
+		hdr.marker = LOG_BIN_MARKER;
+		hdr.severity = (uint8_t)severity;
+		hdr.pcpu_id = pcpu_id;
+		hdr.fmt_id = id;
+		hdr.tsc = tsc;
+
+		/* define the format in this sbuf before its first use */
+		if (!bitmap_test(id & 0x3FU, &per_cpu(logfmt_sent, pcpu_id)[id >> 6U])) {
+			tsc_khz = get_tsc_khz();
+			(void)memcpy_s(payload, size, &tsc_khz, sizeof(tsc_khz));
+			len = (uint32_t)strnlen_s(fmt, size - (uint32_t)sizeof(tsc_khz));
+			(void)memcpy_s(payload + sizeof(tsc_khz), size - (uint32_t)sizeof(tsc_khz), fmt, len);
+			len += (uint32_t)sizeof(tsc_khz);
+
+			hdr.type = LOG_BIN_FMT;
+			hdr.len = (uint16_t)len;
+			len += (uint32_t)sizeof(hdr);
+			hdr.nr_entries = (uint8_t)(((len - 1U) / LOG_ENTRY_SIZE) + 1U);
+			(void)memcpy_s(buf, LOG_MESSAGE_MAX_SIZE, &hdr, sizeof(hdr));
+			log_sbuf_put(pcpu_id, buf, len);
+
+			bitmap_set_nolock(id & 0x3FU, &per_cpu(logfmt_sent, pcpu_id)[id >> 6U]);
+		}
+
+		len = log_pack_args(payload, size, fmt, args);
+		hdr.type = LOG_BIN_MSG;
+		hdr.seq = seq;
+		hdr.len = (uint16_t)len;
+		len += (uint32_t)sizeof(hdr);
+		hdr.nr_entries = (uint8_t)(((len - 1U) / LOG_ENTRY_SIZE) + 1U);
+		(void)memcpy_s(buf, LOG_MESSAGE_MAX_SIZE, &hdr, sizeof(hdr));
+		log_sbuf_put(pcpu_id, buf, len);
+
+		done = true;
+	}
+
+	return done;
+}
+
 void do_logmsg(uint32_t severity, const char *fmt, ...)
 {
 	va_list args;
-	uint64_t timestamp, rflags;
+	uint64_t tsc, timestamp, rflags;
 	uint16_t pcpu_id;
+	uint32_t seq;
 	bool do_console_log;
 	bool do_mem_log;
 	bool do_npk_log;
@@ -51,20 +264,38 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 	}
 
 	/* Get time-stamp value */
-	timestamp = rdtsc();
-
-	/* Scale time-stamp appropriately */
-	timestamp = ticks_to_us(timestamp);
+	tsc = rdtsc();
 
 	/* Get CPU ID */
 	pcpu_id = get_pcpu_id();
+	seq = (uint32_t)atomic_inc_return(&logmsg_ctl.seq);
+
+	/* Binary records skip the formatting, which is done by the SOS */
+	if (do_mem_log && ((logmsg_ctl.flags & LOG_FLAG_BINARY) != 0U)) {
+		/* If sbuf is not ready, we just drop the massage */
+		if (per_cpu(sbuf, pcpu_id)[ACRN_HVLOG] == NULL) {
+			do_mem_log = false;
+		} else {
+			va_start(args, fmt);
+			do_mem_log = !log_bin_msg(pcpu_id, severity, seq, tsc, fmt, args);
+			va_end(args);
+		}
+
+		if (!do_console_log && !do_mem_log && !do_npk_log) {
+			return;
+		}
+	}
+
+	/* Scale time-stamp appropriately */
+	timestamp = ticks_to_us(tsc);
+
 	buffer = per_cpu(logbuf, pcpu_id);
 	current = sched_get_current(pcpu_id);
 
 	(void)memset(buffer, 0U, LOG_MESSAGE_MAX_SIZE);
 	/* Put time-stamp, CPU ID and severity into buffer */
 	snprintf(buffer, LOG_MESSAGE_MAX_SIZE, "[%luus][cpu=%hu][%s][sev=%u][seq=%u]:",
-			timestamp, pcpu_id, current->name, severity, atomic_inc_return(&logmsg_ctl.seq));
+			timestamp, pcpu_id, current->name, severity, seq);
 
 	/* Put message into remaining portion of local buffer */
 	va_start(args, fmt);
@@ -90,18 +321,9 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 
 	/* Check if flags specify to output to memory */
 	if (do_mem_log) {
-		uint32_t i, msg_len;
-		struct shared_buf *sbuf = per_cpu(sbuf, pcpu_id)[ACRN_HVLOG];
-
 		/* If sbuf is not ready, we just drop the massage */
-		if (sbuf != NULL) {
-			msg_len = strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE);
-
-			for (i = 0U; i < (((msg_len - 1U) / LOG_ENTRY_SIZE) + 1U);
-					i++) {
-				(void)sbuf_put(sbuf, (uint8_t *)buffer +
-							(i * LOG_ENTRY_SIZE));
-			}
+		if (per_cpu(sbuf, pcpu_id)[ACRN_HVLOG] != NULL) {
+			log_sbuf_put(pcpu_id, (uint8_t *)buffer, strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE));
 		}
 	}
 }
@@ -45,6 +45,8 @@ static int32_t shell_to_vm_console(int32_t argc, char **argv);
 static int32_t shell_show_cpu_int(__unused int32_t argc, __unused char **argv);
 static int32_t shell_show_ptdev_info(__unused int32_t argc, __unused char **argv);
 static int32_t shell_show_vioapic_info(int32_t argc, char **argv);
+static int32_t shell_show_ioreq_poll(int32_t argc, char **argv);
+static int32_t shell_show_ept_pages(int32_t argc, char **argv);
 static int32_t shell_show_ioapic_info(__unused int32_t argc, __unused char **argv);
 static int32_t shell_loglevel(int32_t argc, char **argv);
 static int32_t shell_cpuid(int32_t argc, char **argv);
@@ -119,6 +121,18 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_VIOAPIC_HELP,
 		.fcn		= shell_show_vioapic_info,
 	},
+	{
+		.str		= SHELL_CMD_IOREQ_POLL,
+		.cmd_param	= SHELL_CMD_IOREQ_POLL_PARAM,
+		.help_str	= SHELL_CMD_IOREQ_POLL_HELP,
+		.fcn		= shell_show_ioreq_poll,
+	},
+	{
+		.str		= SHELL_CMD_EPT_PAGES,
+		.cmd_param	= SHELL_CMD_EPT_PAGES_PARAM,
+		.help_str	= SHELL_CMD_EPT_PAGES_HELP,
+		.fcn		= shell_show_ept_pages,
+	},
 	{
 		.str		= SHELL_CMD_IOAPIC,
 		.cmd_param	= SHELL_CMD_IOAPIC_PARAM,
@@ -1244,6 +1258,67 @@ static int32_t shell_show_vioapic_info(int32_t argc, char **argv)
 	return -EINVAL;
 }
 
+static void get_ioreq_poll_info(char *str_arg, size_t str_max, uint16_t vmid)
+{
+	struct acrn_vm *vm = get_vm_from_vmid(vmid);
+	const struct ioreq_poll_info *poll = &vm->ioreq_poll;
+
+	if (is_poweroff_vm(vm)) {
+		snprintf(str_arg, str_max, "\r\nvm is not exist for vmid %hu\r\n", vmid);
+	} else {
+		snprintf(str_arg, str_max, "\r\nPOLL_HITS\tPOLL_MISSES\tSLEEPS\r\n%llu\t\t%llu\t\t%llu\r\n",
+				poll->poll_hits, poll->poll_misses, poll->sleeps);
+	}
+}
+
+static int32_t shell_show_ioreq_poll(int32_t argc, char **argv)
+{
+	int32_t ret = -EINVAL;
+
+	if (argc == 2) {
+		ret = strtol_deci(argv[1]);
+		if (ret >= 0) {
+			get_ioreq_poll_info(shell_log_buf, SHELL_LOG_BUF_SIZE, sanitize_vmid((uint16_t)ret));
+			shell_puts(shell_log_buf);
+			ret = 0;
+		} else {
+			ret = -EINVAL;
+		}
+	}
+
+	return ret;
+}
+
+static void get_ept_pages_info(char *str_arg, size_t str_max, uint16_t vmid)
+{
+	struct acrn_vm *vm = get_vm_from_vmid(vmid);
+	const struct large_page_stats *stats = vm->arch_vm.ept_mem_ops.large_page_stats;
+
+	if (is_poweroff_vm(vm)) {
+		snprintf(str_arg, str_max, "\r\nvm is not exist for vmid %hu\r\n", vmid);
+	} else {
+		snprintf(str_arg, str_max, "\r\nSPLIT\t\tMERGED\r\n%llu\t\t%llu\r\n", stats->split, stats->merged);
+	}
+}
+
+static int32_t shell_show_ept_pages(int32_t argc, char **argv)
+{
+	int32_t ret = -EINVAL;
+
+	if (argc == 2) {
+		ret = strtol_deci(argv[1]);
+		if (ret >= 0) {
+			get_ept_pages_info(shell_log_buf, SHELL_LOG_BUF_SIZE, sanitize_vmid((uint16_t)ret));
+			shell_puts(shell_log_buf);
+			ret = 0;
+		} else {
+			ret = -EINVAL;
+		}
+	}
+
+	return ret;
+}
+
 /**
  * @brief Get information of ioapic
  *
@@ -89,6 +89,14 @@ struct shell {
 #define SHELL_CMD_VIOAPIC_PARAM		"<vm id>"
 #define SHELL_CMD_VIOAPIC_HELP		"Show virtual IOAPIC (vIOAPIC) information for a specific VM"
 
+#define SHELL_CMD_IOREQ_POLL		"ioreq_poll"
+#define SHELL_CMD_IOREQ_POLL_PARAM	"<vm id>"
+#define SHELL_CMD_IOREQ_POLL_HELP	"Show how often polling caught the I/O request completions of a specific VM"
+
+#define SHELL_CMD_EPT_PAGES		"ept_pages"
+#define SHELL_CMD_EPT_PAGES_PARAM	"<vm id>"
+#define SHELL_CMD_EPT_PAGES_HELP	"Show how many large pages in the EPT of a specific VM were split and coalesced back"
+
 #define SHELL_CMD_LOG_LVL		"loglevel"
 #define SHELL_CMD_LOG_LVL_PARAM		"[<console_loglevel> [<mem_loglevel> [npk_loglevel]]]"
 #define SHELL_CMD_LOG_LVL_HELP		"No argument: get the level of logging for the console, memory and npk. Set "\
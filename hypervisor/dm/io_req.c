@@ -62,6 +62,7 @@ void reset_vm_ioreqs(struct acrn_vm *vm)
 	for (i = 0U; i < VHM_REQUEST_MAX; i++) {
 		set_vhm_req_state(vm, i, REQ_STATE_FREE);
 	}
+	(void)memset(&vm->ioreq_poll, 0U, sizeof(vm->ioreq_poll));
 }
 
 static inline bool has_complete_ioreq(const struct acrn_vcpu *vcpu)
@@ -69,6 +70,116 @@ static inline bool has_complete_ioreq(const struct acrn_vcpu *vcpu)
 	return (get_vhm_req_state(vcpu->vm, vcpu->vcpu_id) == REQ_STATE_COMPLETE);
 }
 
+/*
+ * A request reset to FREE (see reset_vm_ioreqs()) is not in flight any more,
+ * it will never be completed.
+ */
+static inline bool is_ioreq_in_flight(const struct acrn_vcpu *vcpu)
+{
+	uint32_t state = get_vhm_req_state(vcpu->vm, vcpu->vcpu_id);
+
+	return ((state == REQ_STATE_PENDING) || (state == REQ_STATE_PROCESSING));
+}
+
+/*
+ * @pre io_req->io_type is REQ_PORTIO, REQ_MMIO or REQ_WP
+ */
+static struct ioreq_poll_range *get_ioreq_poll_range(struct acrn_vm *vm, const struct io_request *io_req)
+{
+	struct ioreq_poll_range *range;
+	uint64_t key;
+
+	if (io_req->io_type == REQ_PORTIO) {
+		key = (io_req->reqs.pio.address & ~0x7UL) | 0x1UL;
+	} else {
+		key = io_req->reqs.mmio.address & PAGE_MASK;
+	}
+
+	/* one range per slot, a new range just takes the slot over */
+	range = &vm->ioreq_poll.ranges[((key >> 3U) * 0x9E3779B97F4A7C15UL) >> 58U];
+	if (atomic_load64(&range->key) != key) {
+		atomic_store64(&range->key, key);
+		atomic_store64(&range->avg_cycles, 0UL);
+	}
+
+	return range;
+}
+
+/*
+ * @brief Wait for the I/O request delivered to VHM to complete
+ *
+ * Poll for up to 1.5 times the average completion time of the device range,
+ * limited to CONFIG_IOREQ_POLL_MAX_US, then sleep. Ranges slower than that
+ * are slept for at once, and ranges without history are polled for the
+ * limit. VHM notifies every completion, so a notification left over from a
+ * request which completed while polling only makes the vCPU check again.
+ *
+ * Only completions caught by polling are sampled, since a sleep adds the
+ * wakeup latency. A miss counts as twice the window, and every sleep decays
+ * the average, so a slow range is probed again every dozen requests or so.
+ * The average is shared by the vCPUs of the VM, without a lock.
+ *
+ * The vCPU sleeps again only while the request is still in flight: a VM reset
+ * frees the request and wakes the vCPU up, which must then not wait for it.
+ */
+static void wait_ioreq_completion(struct acrn_vcpu *vcpu, const struct io_request *io_req, uint64_t start_tsc)
+{
+	struct ioreq_poll_info *poll = &vcpu->vm->ioreq_poll;
+	struct ioreq_poll_range *range = get_ioreq_poll_range(vcpu->vm, io_req);
+	uint64_t max_cycles = us_to_ticks(CONFIG_IOREQ_POLL_MAX_US);
+	uint64_t avg = atomic_load64(&range->avg_cycles);
+	uint64_t window, sample;
+	bool done = false;
+
+	if (avg == 0UL) {
+		window = max_cycles;
+	} else if (avg > max_cycles) {
+		window = 0UL;
+	} else {
+		window = min(avg + (avg >> 1U), max_cycles);
+	}
+
+	while (window != 0UL) {
+		if (has_complete_ioreq(vcpu)) {
+			done = true;
+			break;
+		}
+		/* give the pCPU up at once if another thread wants it */
+		if (((rdtsc() - start_tsc) >= window) || need_reschedule(pcpuid_from_vcpu(vcpu))) {
+			break;
+		}
+		asm_pause();
+	}
+
+	if (done) {
+		atomic_inc64(&poll->poll_hits);
+		sample = rdtsc() - start_tsc;
+		if (avg > max_cycles) {
+			/* a slow range completed while being probed */
+			avg = 0UL;
+		}
+	} else if (window != 0UL) {
+		atomic_inc64(&poll->poll_misses);
+		sample = window << 1U;
+	} else {
+		atomic_inc64(&poll->sleeps);
+		sample = 0UL;
+		avg -= avg >> 4U;
+	}
+
+	if (sample != 0UL) {
+		/* 1/8 weight for the new sample */
+		avg = (avg == 0UL) ? sample : ((avg - (avg >> 3U)) + (sample >> 3U));
+	}
+	atomic_store64(&range->avg_cycles, avg);
+
+	if (!done) {
+		while (is_ioreq_in_flight(vcpu) && (vcpu->state != VCPU_ZOMBIE)) {
+			wait_event(&vcpu->events[VCPU_EVENT_IOREQ]);
+		}
+	}
+}
+
 /**
  * @brief Deliver \p io_req to SOS and suspend \p vcpu till its completion
  *
@@ -82,6 +193,7 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 	union vhm_request_buffer *req_buf = NULL;
 	struct vhm_request *vhm_req;
 	bool is_polling = false;
+	uint64_t start_tsc;
 	int32_t ret = 0;
 	uint16_t cur;
 
@@ -114,6 +226,7 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 		set_vhm_req_state(vcpu->vm, vcpu->vcpu_id, REQ_STATE_PENDING);
 
 		/* signal VHM */
+		start_tsc = rdtsc();
 		arch_fire_vhm_interrupt();
 
 		/* Polling completion of the request in polling mode */
@@ -129,7 +242,7 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 				}
 			}
 		} else {
-			wait_event(&vcpu->events[VCPU_EVENT_IOREQ]);
+			wait_ioreq_completion(vcpu, io_req, start_tsc);
 		}
 	} else {
 		ret = -EINVAL;
@@ -177,6 +290,140 @@ void set_vhm_req_state(struct acrn_vm *vm, uint16_t vhm_req_id, uint32_t state)
 	}
 }
 
+void set_ioeventfd_ring(struct acrn_vm *vm, struct acrn_ioeventfd_ring *ring)
+{
+	spinlock_obtain(&vm->ioeventfd_lock);
+	vm->sw.ioeventfd_ring = ring;
+	spinlock_release(&vm->ioeventfd_lock);
+}
+
+static inline bool ioeventfd_same_doorbell(const struct acrn_hv_ioeventfd *a, const struct acrn_hv_ioeventfd *b)
+{
+	return ((a->type == b->type) && (a->addr == b->addr) && (a->len == b->len) && (a->flags == b->flags)
+		&& (((a->flags & ACRN_HV_IOEVENTFD_FLAG_DATAMATCH) == 0U) || (a->data == b->data)));
+}
+
+int32_t assign_ioeventfd(struct acrn_vm *vm, const struct acrn_hv_ioeventfd *args)
+{
+	int32_t ret = 0;
+	uint16_t i;
+
+	if (((args->type != REQ_PORTIO) && (args->type != REQ_MMIO))
+		|| ((args->flags & ~ACRN_HV_IOEVENTFD_FLAG_DATAMATCH) != 0U) || (args->len > 8UL)) {
+		ret = -EINVAL;
+	} else {
+		spinlock_obtain(&vm->ioeventfd_lock);
+		for (i = 0U; i < vm->nr_ioeventfds; i++) {
+			if (ioeventfd_same_doorbell(&vm->ioeventfds[i], args)) {
+				ret = -EEXIST;
+				break;
+			}
+		}
+
+		if (ret == 0) {
+			if (vm->nr_ioeventfds < MAX_IOEVENTFD_NUM) {
+				vm->ioeventfds[vm->nr_ioeventfds] = *args;
+				vm->nr_ioeventfds++;
+			} else {
+				ret = -ENOSPC;
+			}
+		}
+		spinlock_release(&vm->ioeventfd_lock);
+	}
+
+	return ret;
+}
+
+int32_t deassign_ioeventfd(struct acrn_vm *vm, const struct acrn_hv_ioeventfd *args)
+{
+	int32_t ret = -ENOENT;
+	uint16_t i;
+
+	spinlock_obtain(&vm->ioeventfd_lock);
+	for (i = 0U; i < vm->nr_ioeventfds; i++) {
+		if (ioeventfd_same_doorbell(&vm->ioeventfds[i], args)) {
+			/* keep the table dense, the order doesn't matter */
+			vm->nr_ioeventfds--;
+			vm->ioeventfds[i] = vm->ioeventfds[vm->nr_ioeventfds];
+			ret = 0;
+			break;
+		}
+	}
+	spinlock_release(&vm->ioeventfd_lock);
+
+	return ret;
+}
+
+void reset_vm_ioeventfds(struct acrn_vm *vm)
+{
+	spinlock_obtain(&vm->ioeventfd_lock);
+	vm->nr_ioeventfds = 0U;
+	vm->sw.ioeventfd_ring = NULL;
+	spinlock_release(&vm->ioeventfd_lock);
+}
+
+/**
+ * @brief Complete a doorbell write by posting to the ioeventfd ring
+ *
+ * If \p io_req is a write to an assigned ioeventfd, post its cookie to the
+ * notification ring and kick SOS. The vCPU doesn't wait for SOS, since there
+ * is nothing to return to the guest for a write.
+ *
+ * @return true if the write was consumed, false if it goes the slow path.
+ *	   A full ring also falls back to the slow path, so no kick is lost.
+ */
+static bool ioeventfd_signal(struct acrn_vcpu *vcpu, const struct io_request *io_req)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_ioeventfd_ring *ring;
+	const struct acrn_hv_ioeventfd *p;
+	uint64_t addr, len, value;
+	uint32_t head, tail;
+	bool signaled = false;
+	uint16_t i;
+
+	if (io_req->io_type == REQ_PORTIO) {
+		addr = io_req->reqs.pio.address;
+		len = io_req->reqs.pio.size;
+		value = io_req->reqs.pio.value;
+	} else {
+		addr = io_req->reqs.mmio.address;
+		len = io_req->reqs.mmio.size;
+		value = io_req->reqs.mmio.value;
+	}
+
+	/* reads can't be completed without SOS, and most VMs have no ioeventfd */
+	if ((io_req->reqs.pio.direction == REQUEST_WRITE) && (vm->nr_ioeventfds != 0U)) {
+		spinlock_obtain(&vm->ioeventfd_lock);
+		ring = vm->sw.ioeventfd_ring;
+		for (i = 0U; (ring != NULL) && (i < vm->nr_ioeventfds); i++) {
+			p = &vm->ioeventfds[i];
+			if ((p->type == io_req->io_type) && (p->addr == addr) && ((p->len == 0UL) || (p->len == len))
+				&& (((p->flags & ACRN_HV_IOEVENTFD_FLAG_DATAMATCH) == 0U) || (p->data == value))) {
+				stac();
+				head = ring->head;
+				tail = ring->tail;
+				if ((tail - head) < ACRN_IOEVENTFD_RING_SIZE) {
+					ring->cookies[tail & (ACRN_IOEVENTFD_RING_SIZE - 1U)] = p->cookie;
+					/* publish the cookie before the new tail */
+					cpu_write_memory_barrier();
+					ring->tail = tail + 1U;
+					signaled = true;
+				}
+				clac();
+				break;
+			}
+		}
+		spinlock_release(&vm->ioeventfd_lock);
+
+		if (signaled) {
+			arch_fire_vhm_interrupt();
+		}
+	}
+
+	return signaled;
+}
+
 void set_vhm_notification_vector(uint32_t vector)
 {
 	acrn_vhm_notification_vector = vector;
@@ -445,6 +692,113 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	return status;
 }
 
+/**
+ * @brief Get the position of a MMIO range in the sorted MMIO index
+ *
+ * The index is sorted by range_start, and ranges starting at the same address
+ * by range_end, so that every registered range has a well-defined position.
+ *
+ * @param vm The VM whose emulated MMIO index is searched
+ * @param start The start of the range to search for
+ * @param end The end of the range to search for
+ *
+ * @return The number of registered MMIO nodes ordered before [start, end),
+ *         i.e. the position in vm->emul_mmio_index[] where a node with this
+ *         range is (or would be) placed.
+ *
+ * @pre vm->emul_mmio_lock is held
+ */
+static uint16_t mmio_index_lower_bound(const struct acrn_vm *vm, uint64_t start, uint64_t end)
+{
+	uint16_t low = 0U, high = vm->nr_emul_mmio_regions, mid;
+	const struct mem_io_node *node;
+
+	while (low < high) {
+		mid = low + ((high - low) >> 1U);
+		node = vm->emul_mmio_index[mid];
+		if ((node->range_start < start) || ((node->range_start == start) && (node->range_end < end))) {
+			low = mid + 1U;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+/**
+ * @brief Check whether any of the MMIO ranges registered to \p vm overlap
+ *
+ * The index is sorted by range_start, so the ranges are disjoint if and only
+ * if each one ends before the next one starts.
+ *
+ * @pre vm->emul_mmio_lock is held
+ */
+static void update_mmio_index_overlapped(struct acrn_vm *vm)
+{
+	uint16_t idx;
+
+	vm->emul_mmio_overlapped = false;
+	for (idx = 1U; idx < vm->nr_emul_mmio_regions; idx++) {
+		if (vm->emul_mmio_index[idx - 1U]->range_end > vm->emul_mmio_index[idx]->range_start) {
+			vm->emul_mmio_overlapped = true;
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Find the MMIO node which overlaps with the given access
+ *
+ * The last node hit by \p vcpu is checked first, then the sorted MMIO index
+ * of the VM is binary searched. As long as the registered MMIO ranges don't
+ * overlap, the only node which may overlap with [address, address + size) is
+ * the last one starting below (address + size). Otherwise, if that node
+ * doesn't cover the access, the index is scanned for a node which does.
+ *
+ * @return The overlapped MMIO node, or NULL if there's none.
+ *
+ * @pre vcpu->vm->emul_mmio_lock is held
+ */
+static struct mem_io_node *find_access_mmio_node(struct acrn_vcpu *vcpu, uint64_t address, uint64_t size)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct mem_io_node *mmio_node = vcpu->mmio_hint;
+	uint16_t pos;
+
+	/* The hint may be stale, it's still valid as long as the node covers the access */
+	if ((mmio_node == NULL) || (mmio_node->read_write == NULL) ||
+			(address < mmio_node->range_start) || ((address + size) > mmio_node->range_end)) {
+		mmio_node = NULL;
+		/* every node starting below address + size, the widest of equal starts last */
+		pos = mmio_index_lower_bound(vm, address + size, 0UL);
+		if (pos > 0U) {
+			mmio_node = vm->emul_mmio_index[pos - 1U];
+			if (mmio_node->range_end <= address) {
+				mmio_node = NULL;
+			} else if (mmio_node->range_start <= address) {
+				vcpu->mmio_hint = mmio_node;
+			} else {
+				/* the access spans multiple ranges, don't cache it */
+			}
+		}
+
+		if (vm->emul_mmio_overlapped && ((mmio_node == NULL) || (address < mmio_node->range_start)
+				|| ((address + size) > mmio_node->range_end))) {
+			for (pos = 0U; pos < vm->nr_emul_mmio_regions; pos++) {
+				if ((address >= vm->emul_mmio_index[pos]->range_start) &&
+						((address + size) <= vm->emul_mmio_index[pos]->range_end)) {
+					mmio_node = vm->emul_mmio_index[pos];
+					vcpu->mmio_hint = mmio_node;
+					break;
+				}
+			}
+		}
+	}
+
+	return mmio_node;
+}
+
 /**
  * Use registered MMIO handlers on the given request if it falls in the range of
  * any of them.
@@ -460,8 +814,7 @@ hv_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
 	int32_t status = -ENODEV;
 	bool hold_lock = true;
-	uint16_t idx;
-	uint64_t address, size, base, end;
+	uint64_t address, size;
 	struct mmio_request *mmio_req = &io_req->reqs.mmio;
 	struct mem_io_node *mmio_handler = NULL;
 	hv_mem_io_handler_t read_write = NULL;
@@ -475,25 +828,15 @@ hv_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	size = mmio_req->size;
 
 	spinlock_obtain(&vcpu->vm->emul_mmio_lock);
-	for (idx = 0U; idx <= vcpu->vm->max_emul_mmio_regions; idx++) {
-		mmio_handler = &(vcpu->vm->emul_mmio[idx]);
-		if (mmio_handler->read_write != NULL) {
-			base = mmio_handler->range_start;
-			end = mmio_handler->range_end;
-
-			if (((address + size) <= base) || (address >= end)) {
-				continue;
-			} else {
-				 if ((address >= base) && ((address + size) <= end)) {
-					hold_lock = mmio_handler->hold_lock;
-					read_write = mmio_handler->read_write;
-					handler_private_data = mmio_handler->handler_private_data;
-				} else {
-					pr_fatal("Err MMIO, address:0x%lx, size:%x", address, size);
-					status = -EIO;
-				}
-				break;
-			}
+	mmio_handler = find_access_mmio_node(vcpu, address, size);
+	if (mmio_handler != NULL) {
+		if ((address >= mmio_handler->range_start) && ((address + size) <= mmio_handler->range_end)) {
+			hold_lock = mmio_handler->hold_lock;
+			read_write = mmio_handler->read_write;
+			handler_private_data = mmio_handler->handler_private_data;
+		} else {
+			pr_fatal("Err MMIO, address:0x%lx, size:%x", address, size);
+			status = -EIO;
 		}
 	}
 
@@ -565,20 +908,26 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 		/*
 		 * No handler from HV side, search from VHM in Dom0
 		 *
-		 * ACRN insert request to VHM and inject upcall.
+		 * ACRN insert request to VHM and inject upcall, unless it is a
+		 * doorbell write that the ioeventfd ring can deliver without
+		 * suspending the vCPU.
 		 */
-		status = acrn_insert_request(vcpu, io_req);
-		if (status == 0) {
-			dm_emulate_io_complete(vcpu);
+		if (ioeventfd_signal(vcpu, io_req)) {
+			status = 0;
 		} else {
-			/* here for both IO & MMIO, the direction, address,
-			 * size definition is same
-			 */
-			struct pio_request *pio_req = &io_req->reqs.pio;
+			status = acrn_insert_request(vcpu, io_req);
+			if (status == 0) {
+				dm_emulate_io_complete(vcpu);
+			} else {
+				/* here for both IO & MMIO, the direction, address,
+				 * size definition is same
+				 */
+				struct pio_request *pio_req = &io_req->reqs.pio;
 
-			pr_fatal("%s Err: access dir %d, io_type %d, addr = 0x%lx, size=%lu", __func__,
-				pio_req->direction, io_req->io_type,
-				pio_req->address, pio_req->size);
+				pr_fatal("%s Err: access dir %d, io_type %d, addr = 0x%lx, size=%lu", __func__,
+					pio_req->direction, io_req->io_type,
+					pio_req->address, pio_req->size);
+			}
 		}
 	}
 
@@ -611,31 +960,26 @@ void register_pio_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
 /**
  * @brief Find match MMIO node
  *
- * This API find match MMIO node from \p vm.
+ * This API find match MMIO node from the sorted MMIO index of \p vm.
  *
  * @param vm The VM to which the MMIO node is belong to.
+ * @param pos The position of the MMIO node in vm->emul_mmio_index[] if found.
  *
  * @return If there's a match mmio_node return it, otherwise return NULL;
  */
 static inline struct mem_io_node *find_match_mmio_node(struct acrn_vm *vm,
-				uint64_t start, uint64_t end)
+				uint64_t start, uint64_t end, uint16_t *pos)
 {
-	bool found = false;
-	uint16_t idx;
-	struct mem_io_node *mmio_node;
+	struct mem_io_node *mmio_node = NULL;
+	uint16_t idx = mmio_index_lower_bound(vm, start, end);
 
-	for (idx = 0U; idx < CONFIG_MAX_EMULATED_MMIO_REGIONS; idx++) {
-		mmio_node = &(vm->emul_mmio[idx]);
-		if ((mmio_node->range_start == start) && (mmio_node->range_end == end)) {
-			found = true;
-			break;
-		}
-	}
-
-	if (!found) {
+	if ((idx < vm->nr_emul_mmio_regions) && (vm->emul_mmio_index[idx]->range_start == start)
+			&& (vm->emul_mmio_index[idx]->range_end == end)) {
+		mmio_node = vm->emul_mmio_index[idx];
+		*pos = idx;
+	} else {
 		pr_fatal("%s, vm[%d] no match mmio region [0x%lx, 0x%lx] is found",
 				__func__, vm->vm_id, start, end);
-		mmio_node = NULL;
 	}
 
 	return mmio_node;
@@ -653,15 +997,19 @@ static inline struct mem_io_node *find_match_mmio_node(struct acrn_vm *vm,
 static inline struct mem_io_node *find_free_mmio_node(struct acrn_vm *vm)
 {
 	uint16_t idx;
-	struct mem_io_node *mmio_node = find_match_mmio_node(vm, 0UL, 0UL);
+	struct mem_io_node *mmio_node = NULL;
 
-	if (mmio_node != NULL) {
-		idx = (uint16_t)(uint64_t)(mmio_node - &(vm->emul_mmio[0U]));
-		if (vm->max_emul_mmio_regions < idx) {
-			vm->max_emul_mmio_regions = idx;
+	for (idx = 0U; idx < CONFIG_MAX_EMULATED_MMIO_REGIONS; idx++) {
+		if (vm->emul_mmio[idx].read_write == NULL) {
+			mmio_node = &(vm->emul_mmio[idx]);
+			break;
 		}
 	}
 
+	if (mmio_node == NULL) {
+		pr_fatal("%s, vm[%d] no free mmio node is found", __func__, vm->vm_id);
+	}
+
 	return mmio_node;
 }
 
@@ -677,12 +1025,17 @@ static inline struct mem_io_node *find_free_mmio_node(struct acrn_vm *vm)
  * @param handler_private_data Handler-specific data which will be passed to \p read_write when called
  *
  * @return None
+ *
+ * @remark [start, end) shouldn't overlap with any MMIO range registered to \p vm,
+ *	   otherwise the lookup of every access missing the binary search falls
+ *	   back to a linear scan, until the overlap is gone.
  */
 void register_mmio_emulation_handler(struct acrn_vm *vm,
 	hv_mem_io_handler_t read_write, uint64_t start,
 	uint64_t end, void *handler_private_data, bool hold_lock)
 {
 	struct mem_io_node *mmio_node;
+	uint16_t pos, idx;
 
 	/* Ensure both a read/write handler and range check function exist */
 	if ((read_write != NULL) && (end > start)) {
@@ -695,6 +1048,20 @@ void register_mmio_emulation_handler(struct acrn_vm *vm,
 			mmio_node->handler_private_data = handler_private_data;
 			mmio_node->range_start = start;
 			mmio_node->range_end = end;
+
+			/* Insert it into the sorted MMIO index */
+			pos = mmio_index_lower_bound(vm, start, end);
+			for (idx = vm->nr_emul_mmio_regions; idx > pos; idx--) {
+				vm->emul_mmio_index[idx] = vm->emul_mmio_index[idx - 1U];
+			}
+			vm->emul_mmio_index[pos] = mmio_node;
+			vm->nr_emul_mmio_regions++;
+
+			update_mmio_index_overlapped(vm);
+			if (vm->emul_mmio_overlapped) {
+				pr_warn("%s, vm[%d] mmio region [0x%lx, 0x%lx) overlaps with another one",
+					__func__, vm->vm_id, start, end);
+			}
 		}
 		spinlock_release(&vm->emul_mmio_lock);
 	}
@@ -716,11 +1083,18 @@ void unregister_mmio_emulation_handler(struct acrn_vm *vm,
 					uint64_t start, uint64_t end)
 {
 	struct mem_io_node *mmio_node;
+	uint16_t pos = 0U, idx;
 
 	spinlock_obtain(&vm->emul_mmio_lock);
-	mmio_node = find_match_mmio_node(vm, start, end);
+	mmio_node = find_match_mmio_node(vm, start, end, &pos);
 	if (mmio_node != NULL) {
+		/* Remove it from the sorted MMIO index */
+		vm->nr_emul_mmio_regions--;
+		for (idx = pos; idx < vm->nr_emul_mmio_regions; idx++) {
+			vm->emul_mmio_index[idx] = vm->emul_mmio_index[idx + 1U];
+		}
 		(void)memset(mmio_node, 0U, sizeof(struct mem_io_node));
+		update_mmio_index_overlapped(vm);
 	}
 	spinlock_release(&vm->emul_mmio_lock);
 }
@@ -508,18 +508,23 @@ void reset_vioapics(const struct acrn_vm *vm)
 	}
 }
 
-void
+/**
+ * @retval 0 on success
+ * @retval -ENOMEM the vIOAPIC page can't be removed from the EPT
+ */
+int32_t
 vioapic_init(struct acrn_vm *vm)
 {
 	struct ioapic_info *platform_ioapic_info;
 	uint8_t platform_ioapic_num;
 	uint8_t vioapic_index;
 	struct acrn_single_vioapic *vioapic;
+	int32_t ret = 0;
 
 	if (is_sos_vm(vm)) {
 		platform_ioapic_num = get_platform_ioapic_info(&platform_ioapic_info);
 		vm->arch_vm.vioapics.ioapic_num = platform_ioapic_num;
-		for (vioapic_index = 0U; vioapic_index < platform_ioapic_num; vioapic_index++) {
+		for (vioapic_index = 0U; (vioapic_index < platform_ioapic_num) && (ret == 0); vioapic_index++) {
 			vioapic = &vm->arch_vm.vioapics.vioapic_array[vioapic_index];
 			spinlock_init(&(vioapic->mtx));
 			vioapic->nr_pins = platform_ioapic_info[vioapic_index].nr_pins;
@@ -534,7 +539,7 @@ vioapic_init(struct acrn_vm *vm)
 					(uint64_t)vioapic->base_addr,
 					(uint64_t)vioapic->base_addr + VIOAPIC_SIZE,
 					(void *)vioapic, false);
-			ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
+			ret = ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
 					(uint64_t)vioapic->base_addr, VIOAPIC_SIZE);
 			vioapic->ready = true;
 		}
@@ -560,12 +565,14 @@ vioapic_init(struct acrn_vm *vm)
 				(uint64_t)vioapic->base_addr,
 				(uint64_t)vioapic->base_addr + VIOAPIC_SIZE,
 				(void *)vioapic, false);
-		ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
+		ret = ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
 				(uint64_t)vioapic->base_addr, VIOAPIC_SIZE);
 		vioapic->ready = true;
 
 		vm->arch_vm.vioapics.nr_gsi = VIOAPIC_RTE_NUM;
 	}
+
+	return ret;
 }
 
 uint32_t
@@ -81,7 +81,9 @@ void vdev_pt_map_msix(struct pci_vdev *vdev, bool hold_lock)
 		addr_hi = round_page_up(addr_hi);
 		register_mmio_emulation_handler(vm, vmsix_handle_table_mmio_access,
 				addr_lo, addr_hi, vdev, hold_lock);
-		ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, addr_lo, addr_hi - addr_lo);
+		if (ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, addr_lo, addr_hi - addr_lo) != 0) {
+			pr_err("%s: [vm%hu] failed to unmap MSI-X table at 0x%lx", __func__, vm->vm_id, addr_lo);
+		}
 		msix->mmio_gpa = vbar->base_gpa;
 	}
 }
@@ -98,9 +100,11 @@ static void vdev_pt_unmap_mem_vbar(struct pci_vdev *vdev, uint32_t idx)
 	if (vbar->base_gpa != 0UL) {
 		struct acrn_vm *vm = vpci2vm(vdev->vpci);
 
-		ept_del_mr(vm, (uint64_t *)(vm->arch_vm.nworld_eptp),
+		if (ept_del_mr(vm, (uint64_t *)(vm->arch_vm.nworld_eptp),
 			vbar->base_gpa, /* GPA (old vbar) */
-			vbar->size);
+			vbar->size) != 0) {
+			pr_err("%s: [vm%hu] failed to unmap BAR%u", __func__, vm->vm_id, idx);
+		}
 	}
 
 	if ((has_msix_cap(vdev) && (idx == vdev->msix.table_bar))) {
@@ -120,11 +124,13 @@ static void vdev_pt_map_mem_vbar(struct pci_vdev *vdev, uint32_t idx)
 	if (vbar->base_gpa != 0UL) {
 		struct acrn_vm *vm = vpci2vm(vdev->vpci);
 
-		ept_add_mr(vm, (uint64_t *)(vm->arch_vm.nworld_eptp),
+		if (ept_add_mr(vm, (uint64_t *)(vm->arch_vm.nworld_eptp),
 			vbar->base_hpa, /* HPA (pbar) */
 			vbar->base_gpa, /* GPA (new vbar) */
 			vbar->size,
-			EPT_WR | EPT_RD | EPT_UNCACHED);
+			EPT_WR | EPT_RD | EPT_UNCACHED) != 0) {
+			pr_err("%s: [vm%hu] failed to map BAR%u", __func__, vm->vm_id, idx);
+		}
 	}
 
 	if (has_msix_cap(vdev) && (idx == vdev->msix.table_bar)) {
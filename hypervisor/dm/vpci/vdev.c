@@ -73,23 +73,104 @@ void pci_vdev_write_vcfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes,
 }
 
 /**
+ * @brief Position of a BDF in vpci->vdevs_by_bdf[], whether or not it is indexed.
+ *
  * @pre vpci != NULL
- * @pre vpci->pci_vdev_cnt <= CONFIG_MAX_PCI_DEV_NUM
  */
-struct pci_vdev *pci_find_vdev(struct acrn_vpci *vpci, union pci_bdf vbdf)
+static uint16_t pci_vdev_bdf_rank(const struct acrn_vpci *vpci, union pci_bdf bdf)
 {
-	struct pci_vdev *vdev, *tmp;
+	const uint64_t *bitmap = vpci->devfn_bitmap[bdf.bits.b];
+	uint32_t devfn = bdf.value & 0xffU;
+	uint32_t word = devfn >> 6U;
 	uint32_t i;
+	uint16_t rank = vpci->bus_start[bdf.bits.b];
+
+	for (i = 0U; i < word; i++) {
+		rank += bitmap_weight(bitmap[i]);
+	}
+
+	return rank + bitmap_weight(bitmap[word] & ((1UL << (devfn & 0x3fU)) - 1UL));
+}
+
+static inline bool pci_vdev_bdf_indexed(const struct acrn_vpci *vpci, union pci_bdf bdf)
+{
+	uint32_t devfn = bdf.value & 0xffU;
+
+	return ((vpci->devfn_bitmap[bdf.bits.b][devfn >> 6U] & (1UL << (devfn & 0x3fU))) != 0UL);
+}
+
+/**
+ * @brief Make vdev reachable by pci_find_vdev() under its current bdf.
+ *
+ * The first vdev added for a BDF wins, as with the former linear lookup.
+ *
+ * @pre vpci != NULL
+ * @pre vdev != NULL
+ * @pre vpci->bdf_indexed_cnt < CONFIG_MAX_PCI_DEV_NUM
+ */
+void pci_vdev_add_bdf(struct acrn_vpci *vpci, struct pci_vdev *vdev)
+{
+	union pci_bdf bdf = vdev->bdf;
+	uint32_t devfn = bdf.value & 0xffU;
+	uint16_t rank, i;
+	uint32_t bus;
+
+	if (!pci_vdev_bdf_indexed(vpci, bdf)) {
+		rank = pci_vdev_bdf_rank(vpci, bdf);
+		for (i = vpci->bdf_indexed_cnt; i > rank; i--) {
+			vpci->vdevs_by_bdf[i] = vpci->vdevs_by_bdf[i - 1U];
+		}
+		vpci->vdevs_by_bdf[rank] = vdev;
+		vpci->bdf_indexed_cnt++;
+
+		vpci->devfn_bitmap[bdf.bits.b][devfn >> 6U] |= (1UL << (devfn & 0x3fU));
+		for (bus = (uint32_t)bdf.bits.b + 1U; bus <= PCI_BUSMAX; bus++) {
+			vpci->bus_start[bus]++;
+		}
+	}
+}
 
-	vdev = NULL;
-	for (i = 0U; i < vpci->pci_vdev_cnt; i++) {
-		tmp = &(vpci->pci_vdevs[i]);
+/**
+ * @brief Drop vdev from the BDF index, if it is the one indexed under its bdf.
+ *
+ * @pre vpci != NULL
+ * @pre vdev != NULL
+ */
+void pci_vdev_del_bdf(struct acrn_vpci *vpci, const struct pci_vdev *vdev)
+{
+	union pci_bdf bdf = vdev->bdf;
+	uint32_t devfn = bdf.value & 0xffU;
+	uint16_t rank, i;
+	uint32_t bus;
+
+	if (pci_vdev_bdf_indexed(vpci, bdf)) {
+		rank = pci_vdev_bdf_rank(vpci, bdf);
+		if (vpci->vdevs_by_bdf[rank] == vdev) {
+			vpci->bdf_indexed_cnt--;
+			for (i = rank; i < vpci->bdf_indexed_cnt; i++) {
+				vpci->vdevs_by_bdf[i] = vpci->vdevs_by_bdf[i + 1U];
+			}
+			vpci->vdevs_by_bdf[vpci->bdf_indexed_cnt] = NULL;
 
-		if (bdf_is_equal(tmp->bdf, vbdf)) {
-			vdev = tmp;
-			break;
+			vpci->devfn_bitmap[bdf.bits.b][devfn >> 6U] &= ~(1UL << (devfn & 0x3fU));
+			for (bus = (uint32_t)bdf.bits.b + 1U; bus <= PCI_BUSMAX; bus++) {
+				vpci->bus_start[bus]--;
+			}
 		}
 	}
+}
+
+/**
+ * @pre vpci != NULL
+ * @pre vpci->pci_vdev_cnt <= CONFIG_MAX_PCI_DEV_NUM
+ */
+struct pci_vdev *pci_find_vdev(struct acrn_vpci *vpci, union pci_bdf vbdf)
+{
+	struct pci_vdev *vdev = NULL;
+
+	if (pci_vdev_bdf_indexed(vpci, vbdf)) {
+		vdev = vpci->vdevs_by_bdf[pci_vdev_bdf_rank(vpci, vbdf)];
+	}
 
 	return vdev;
 }
@@ -130,7 +130,7 @@ void write_vmsi_cfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint
 void deinit_vmsi(const struct pci_vdev *vdev)
 {
 	if (has_msi_cap(vdev)) {
-		ptirq_remove_msix_remapping(vpci2vm(vdev->vpci), vdev->bdf.value, 1U);
+		ptirq_remove_msix_remapping(vpci2vm(vdev->vpci), vdev->bdf.value, vdev->pdev->bdf.value, 1U);
 	}
 }
 
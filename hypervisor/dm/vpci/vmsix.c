@@ -266,7 +266,8 @@ void deinit_vmsix(const struct pci_vdev *vdev)
 {
 	if (has_msix_cap(vdev)) {
 		if (vdev->msix.table_count != 0U) {
-			ptirq_remove_msix_remapping(vpci2vm(vdev->vpci), vdev->bdf.value, vdev->msix.table_count);
+			ptirq_remove_msix_remapping(vpci2vm(vdev->vpci), vdev->bdf.value, vdev->pdev->bdf.value,
+				vdev->msix.table_count);
 		}
 	}
 }
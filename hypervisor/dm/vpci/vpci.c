@@ -620,6 +620,7 @@ struct pci_vdev *vpci_init_vdev(struct acrn_vpci *vpci, struct acrn_vm_pci_dev_c
 	vdev->pdev = dev_config->pdev;
 	vdev->pci_dev_config = dev_config;
 	vdev->phyfun = parent_pf_vdev;
+	pci_vdev_add_bdf(vpci, vdev);
 
 	if (dev_config->vdev_ops != NULL) {
 		vdev->vdev_ops = dev_config->vdev_ops;
@@ -783,7 +784,9 @@ int32_t vpci_assign_pcidev(struct acrn_vm *tgt_vm, struct acrn_assign_pcidev *pc
 			}
 
 			vdev->flags |= pcidev->type;
+			pci_vdev_del_bdf(vpci, vdev);
 			vdev->bdf.value = pcidev->virt_bdf;
+			pci_vdev_add_bdf(vpci, vdev);
 			spinlock_release(&tgt_vm->vpci.lock);
 			vdev_in_sos->new_owner = vdev;
 		}
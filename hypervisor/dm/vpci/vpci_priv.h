@@ -134,6 +134,8 @@ void write_sriov_cap_reg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes,
 uint32_t sriov_bar_offset(const struct pci_vdev *vdev, uint32_t bar_idx);
 
 uint32_t pci_vdev_read_vcfg(const struct pci_vdev *vdev, uint32_t offset, uint32_t bytes);
+void pci_vdev_add_bdf(struct acrn_vpci *vpci, struct pci_vdev *vdev);
+void pci_vdev_del_bdf(struct acrn_vpci *vpci, const struct pci_vdev *vdev);
 void pci_vdev_write_vcfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t val);
 
 uint32_t pci_vdev_read_vbar(const struct pci_vdev *vdev, uint32_t idx);
@@ -48,6 +48,7 @@ bool is_apicv_advanced_feature_supported(void);
 bool pcpu_has_cap(uint32_t bit);
 bool pcpu_has_vmx_ept_cap(uint32_t bit_mask);
 bool pcpu_has_vmx_vpid_cap(uint32_t bit_mask);
+bool is_pml_supported(void);
 bool is_apl_platform(void);
 bool has_core_cap(uint32_t bit_mask);
 void init_pcpu_capabilities(void);
@@ -10,6 +10,8 @@
 
 typedef void (*pge_handler)(uint64_t *pgentry, uint64_t size);
 
+struct acrn_dirty_log;
+
 /**
  * Invalid HPA is defined for error checking,
  * according to SDM vol.3A 4.1.4, the maximum
@@ -67,6 +69,33 @@ uint64_t local_gpa2hpa(struct acrn_vm *vm, uint64_t gpa, uint32_t *size);
  * @pre: the gpa and hpa are identical mapping in SOS.
  */
 uint64_t sos_vm_hpa2gpa(uint64_t hpa);
+/**
+ * @brief Begin an update of the EPT of a VM
+ *
+ * The EPT edits of ept_add_mr(), ept_modify_mr() and ept_del_mr() on this
+ * pcpu until ept_commit_update() are done under one hold of the EPT lock of
+ * the VM, and the vcpus of the VM flush their EPT translations once, at
+ * ept_commit_update(), instead of after each edit. The vcpus may see any
+ * of the edits before ept_commit_update(), but only until it returns.
+ *
+ * Updates can't be nested. Nothing else which takes the EPT lock of the VM
+ * shall be called in an update.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ *
+ * @return None
+ */
+void ept_begin_update(struct acrn_vm *vm);
+
+/**
+ * @brief Commit an update of the EPT of a VM
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ *
+ * @return None
+ */
+void ept_commit_update(struct acrn_vm *vm);
+
 /**
  * @brief Guest-physical memory region mapping
  *
@@ -80,9 +109,11 @@ uint64_t sos_vm_hpa2gpa(uint64_t hpa);
  *                 to be mapped
  * @param[in] prot_orig The specified memory access right and memory type
  *
- * @return None
+ * @retval 0 on success
+ * @retval -ENOMEM no page-table page left to the VM, the region is then only
+ *                 partly mapped
  */
-void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t hpa,
+int32_t ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t hpa,
 		uint64_t gpa, uint64_t size, uint64_t prot_orig);
 /**
  * @brief Guest-physical memory page access right or memory type updating
@@ -97,9 +128,11 @@ void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t hpa,
  * @param[in] prot_clr The specified memory access right and memory type
  *                     that will be cleared
  *
- * @return None
+ * @retval 0 on success
+ * @retval -ENOMEM no page-table page left to the VM to split a large page,
+ *                 the region is then only partly updated
  */
-void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
+int32_t ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 		uint64_t size, uint64_t prot_set, uint64_t prot_clr);
 /**
  * @brief Guest-physical memory region unmapping
@@ -110,11 +143,13 @@ void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
  *                physical memory region whoes mapping needs to be deleted
  * @param[in] size The size of guest physical memory region
  *
- * @return None
+ * @retval 0 on success
+ * @retval -ENOMEM no page-table page left to the VM to split a large page,
+ *                 the region is then only partly unmapped
  *
  * @pre [gpa,gpa+size) has been mapped into host physical memory region
  */
-void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
+int32_t ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 		uint64_t size);
 
 /**
@@ -160,6 +195,61 @@ void walk_ept_table(struct acrn_vm *vm, pge_handler cb);
  */
 int32_t ept_misconfig_vmexit_handler(__unused struct acrn_vcpu *vcpu);
 
+/**
+ * @brief Flush the page-modification log of a vcpu into the dirty bitmap of its VM
+ *
+ * @param[in] vcpu the pointer that points to vcpu data structure, its VMCS
+ *		shall be the current VMCS
+ *
+ * @return None
+ */
+void ept_flush_pml(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief Page-modification log full handling
+ *
+ * @param[in] vcpu the pointer that points to vcpu data structure
+ *
+ * @retval 0 Success to handle the page-modification log full
+ */
+int32_t pml_full_vmexit_handler(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief Turn dirty page logging of a VM on or off
+ *
+ * Turning it on clears the dirty bitmap and the EPT dirty flags of the VM,
+ * every write to the VM memory after this returns is logged.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] enable true to turn dirty page logging on, false to turn it off
+ *
+ * @retval 0 Success
+ * @retval -ENODEV the platform or the VM does not support dirty page logging
+ */
+int32_t ept_set_dirty_log(struct acrn_vm *vm, bool enable);
+
+/**
+ * @brief Fetch and clear the dirty bitmap of a range of VM memory
+ *
+ * The bitmap of the pages in [log->gpa, log->gpa + log->nr_pages * 4K) is
+ * copied to log->bitmap_gpa of the Service VM and cleared. The EPT dirty
+ * flags of the pages found dirty are cleared too, and the EPT translations
+ * cached with them are flushed before this returns: a write to these pages
+ * after this returns is logged again, and what was written before is seen
+ * by the caller.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] sos_vm the pointer that points to the Service VM data structure
+ * @param[in] log the range of VM memory and the buffer to copy the bitmap to
+ *
+ * @retval 0 Success
+ * @retval -EINVAL dirty page logging is off or the range is invalid
+ * @retval -EFAULT the bitmap can't be copied to the Service VM; the pages
+ *		not handed over are still set in the bitmap and fetched next time.
+ *		Nothing is cleared if the buffer isn't mapped in the Service VM.
+ */
+int32_t ept_get_dirty_log(struct acrn_vm *vm, struct acrn_vm *sos_vm, const struct acrn_dirty_log *log);
+
 /**
  * @}
  */
@@ -86,8 +86,19 @@ struct instr_emul_vie {
 	uint64_t	dst_gpa;	/* saved dst operand gpa. Only for movs */
 };
 
+/* Number of decoded instructions kept per vCPU, as a power of 2 */
+#define VIE_CACHE_SHIFT	4U
+#define VIE_CACHE_SIZE	(1U << VIE_CACHE_SHIFT)
+
+struct instr_emul_cache_entry {
+	struct instr_emul_vie vie;	/* decoded, num_valid is 0 if unused */
+	uint8_t		cpu_mode;	/* enum vm_cpu_mode decoded in */
+	bool		cs_d;		/* CS.D decoded with */
+};
+
 struct instr_emul_ctxt {
 	struct instr_emul_vie vie;
+	struct instr_emul_cache_entry cache[VIE_CACHE_SIZE];
 };
 
 int32_t emulate_instruction(struct acrn_vcpu *vcpu);
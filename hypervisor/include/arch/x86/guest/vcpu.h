@@ -93,6 +93,11 @@
  */
 #define ACRN_REQUEST_INIT_VMCS			8U
 
+/**
+ * @brief Request for turning dirty page logging on or off
+ */
+#define ACRN_REQUEST_DIRTY_LOG			9U
+
 /**
  * @}
  */
@@ -198,6 +203,9 @@ struct acrn_vcpu_arch {
 	/* MSR bitmap region for this vcpu, MUST be 4-Kbyte aligned */
 	uint8_t msr_bitmap[PAGE_SIZE];
 
+	/* Page-modification log of this vcpu, MUST be 4-Kbyte aligned */
+	uint64_t pml_buf[PML_ENTITY_NUM];
+
 	/* per vcpu lapic */
 	struct acrn_vlapic vlapic;
 
@@ -225,8 +233,12 @@ struct acrn_vcpu_arch {
 
 	uint8_t lapic_mask;
 	bool irq_window_enabled;
+	bool pml_enabled;
 	uint32_t nrexits;
 
+	/* VM exit handling time histogram, see struct acrn_vcpu_exit_stats */
+	uint32_t exit_hist[ACRN_EXIT_REASON_NUM][ACRN_EXIT_HIST_BUCKETS];
+
 	/* VCPU context state information */
 	uint32_t exit_reason;
 	uint32_t idt_vectoring_info;
@@ -262,10 +274,13 @@ struct acrn_vcpu {
 
 	struct thread_object thread_obj;
 	bool launched; /* Whether the vcpu is launched on target pcpu */
+	bool vmcs_cleared; /* VMCS cleared to migrate the vcpu, launch it again */
+	bool timer_migrated; /* vlapic timer to be added on the new pcpu */
 	volatile bool running; /* vcpu is picked up and run? */
 
 	struct instr_emul_ctxt inst_ctxt;
 	struct io_request req; /* used by io/ept emulation */
+	struct mem_io_node *mmio_hint; /* last emulated MMIO node hit by this vcpu */
 
 	uint64_t reg_cached;
 	uint64_t reg_updated;
@@ -172,7 +172,7 @@ static inline uint32_t vlapic_get_apicid(const struct acrn_vlapic *vlapic)
 	return vlapic->vapic_id;
 }
 
-void vlapic_create(struct acrn_vcpu *vcpu, uint16_t pcpu_id);
+int32_t vlapic_create(struct acrn_vcpu *vcpu, uint16_t pcpu_id);
 /*
  *  @pre vcpu != NULL
  */
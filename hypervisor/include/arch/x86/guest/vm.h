@@ -66,6 +66,8 @@ struct vm_sw_info {
 	struct sw_module_info ramdisk_info;
 	/* HVA to IO shared page */
 	void *io_shared_page;
+	/* HVA to ioeventfd notification ring */
+	struct acrn_ioeventfd_ring *ioeventfd_ring;
 	/* If enable IO completion polling mode */
 	bool is_polling_ioreq;
 };
@@ -114,6 +116,9 @@ struct vm_arch {
 #endif
 	enum vm_vlapic_state vlapic_state; /* Represents vLAPIC state across vCPUs*/
 
+	/* Dirty page logging into ept_mem_ops.info->ept.dirty_bitmap, see ept_set_dirty_log() */
+	bool dirty_log_enabled;
+
 	/* reference to virtual platform to come here (as needed) */
 } __aligned(PAGE_SIZE);
 
@@ -131,13 +136,27 @@ struct acrn_vm {
 	struct iommu_domain *iommu;	/* iommu domain of this VM */
 	spinlock_t vm_lock;	/* Spin-lock used to protect vlapic_state modifications for a VM */
 	spinlock_t ept_lock;	/* Spin-lock used to protect ept add/modify/remove for a VM */
+	uint16_t ept_update_pcpu;	/* pcpu in an EPT update, see ept_begin_update() */
+	bool ept_flush_pending;		/* EPT edited in the current EPT update */
+	uint64_t ept_touched_start;	/* normal world range edited under the EPT lock, */
+	uint64_t ept_touched_end;	/* to be coalesced on release; empty if end is 0 */
 
 	spinlock_t emul_mmio_lock;	/* Used to protect emulation mmio_node concurrent access for a VM */
-	uint16_t max_emul_mmio_regions;	/* max index of the emulated mmio_region */
+	uint16_t nr_emul_mmio_regions;	/* number of the registered emulated mmio_region */
 	struct mem_io_node emul_mmio[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	/* registered emulated mmio_region sorted by range_start, for binary search */
+	struct mem_io_node *emul_mmio_index[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	/* some registered mmio_regions overlap, e.g. with a guest programmed BAR */
+	bool emul_mmio_overlapped;
 
 	struct vm_io_handler_desc emul_pio[EMUL_PIO_IDX_MAX];
 
+	spinlock_t ioeventfd_lock;	/* Used to protect the ioeventfds and their ring */
+	uint16_t nr_ioeventfds;		/* number of the assigned ioeventfds */
+	struct acrn_hv_ioeventfd ioeventfds[MAX_IOEVENTFD_NUM];
+
+	struct ioreq_poll_info ioreq_poll;	/* completion polling of the requests to VHM */
+
 	uint8_t uuid[16];
 	struct secure_world_control sworld_control;
 
@@ -42,6 +42,8 @@ static inline uint64_t apic_access_offset(uint64_t qual)
 }
 void init_vmcs(struct acrn_vcpu *vcpu);
 void load_vmcs(const struct acrn_vcpu *vcpu);
+uint64_t get_vmcs_eptp(const struct acrn_vcpu *vcpu, const void *pml4_page);
+void update_vmcs_dirty_log(struct acrn_vcpu *vcpu);
 
 void switch_apicv_mode_x2apic(struct acrn_vcpu *vcpu);
 #endif /* ASSEMBLER */
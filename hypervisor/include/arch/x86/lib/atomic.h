@@ -33,6 +33,27 @@
 
 #define	BUS_LOCK	"lock ; "
 
+/* Plain aligned moves: single-copy atomic, with no ordering implied */
+#define build_atomic_load(name, size, type)		\
+static inline type name(const volatile type *ptr)	\
+{							\
+	type ret;					\
+	asm volatile("mov" size " %1,%0"		\
+			: "=r" (ret)			\
+			: "m" (*ptr));			\
+	return ret;					\
+}
+build_atomic_load(atomic_load64, "q", uint64_t)
+
+#define build_atomic_store(name, size, type)		\
+static inline void name(volatile type *ptr, type v)	\
+{							\
+	asm volatile("mov" size " %1,%0"		\
+			: "=m" (*ptr)			\
+			: "r" (v));			\
+}
+build_atomic_store(atomic_store64, "q", uint64_t)
+
 #define build_atomic_inc(name, size, type)		\
 static inline void name(type *ptr)			\
 {							\
@@ -38,11 +38,14 @@
 #define PTDEV_HI_MMIO_START		((CONFIG_UOS_RAM_SIZE > MEM_2G) ?	\
 			(CONFIG_UOS_RAM_SIZE + PLATFORM_LO_MMIO_SIZE) : (MEM_2G + PLATFORM_LO_MMIO_SIZE))
 
+/* The number of 64-bit words of a bitmap with one bit per 4K page of the address space */
+#define DIRTY_BITMAP_WORDS(size)	((size) >> (PAGE_SHIFT + 6U))
+
 #define PRE_VM_EPT_ADDRESS_SPACE(size)	(PTDEV_HI_MMIO_START + PTDEV_HI_MMIO_SIZE)
 
-#define TOTAL_EPT_4K_PAGES_SIZE		(PRE_VM_NUM*(PT_PAGE_NUM(PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))*MEM_4K)) + \
-						(SOS_VM_NUM*(PT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE))*MEM_4K)) + \
-						(MAX_POST_VM_NUM*(PT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))*MEM_4K))
+/* The number of page-table pages of an EPT mapping all of the address space with 4K pages */
+#define EPT_PGTABLE_PAGE_NUM(size)	\
+(PML4_PAGE_NUM(size) + PDPT_PAGE_NUM(size) + PD_PAGE_NUM(size) + PT_PAGE_NUM(size))
 
 #define TRUSTY_PML4_PAGE_NUM(size)	(1UL)
 #define TRUSTY_PDPT_PAGE_NUM(size)	(1UL)
@@ -66,24 +69,32 @@ union pgtable_pages_info {
 	} ppt;
 	struct {
 		uint64_t top_address_space;
-		struct page *nworld_pml4_base;
-		struct page *nworld_pdpt_base;
-		struct page *nworld_pd_base;
-		struct page *nworld_pt_base;
+		uint16_t vm_id;		/* owner of the pages taken from the EPT page pool */
 		struct page *sworld_pgtable_base;
 		struct page *sworld_memory_base;
+		/* one bit per 4K page of [0, top_address_space), NULL if dirty page logging is unsupported */
+		uint64_t *dirty_bitmap;
 	} ept;
 };
 
+/* Large pages of a page table split into, and coalesced back from, pages of the next level */
+struct large_page_stats {
+	uint64_t split;
+	uint64_t merged;
+};
+
 struct memory_ops {
 	union pgtable_pages_info *info;
 	bool large_page_enabled;
+	struct large_page_stats *large_page_stats;	/* NULL if not counted */
 	uint64_t (*get_default_access_right)(void);
 	uint64_t (*pgentry_present)(uint64_t pte);
 	struct page *(*get_pml4_page)(const union pgtable_pages_info *info);
 	struct page *(*get_pdpt_page)(const union pgtable_pages_info *info, uint64_t gpa);
 	struct page *(*get_pd_page)(const union pgtable_pages_info *info, uint64_t gpa);
 	struct page *(*get_pt_page)(const union pgtable_pages_info *info, uint64_t gpa);
+	/* NULL if page-table pages are never unlinked */
+	void (*free_page)(const union pgtable_pages_info *info, struct page *page);
 	void *(*get_sworld_memory_base)(const union pgtable_pages_info *info);
 	void (*clflush_pagewalk)(const void *p);
 	void (*tweak_exe_right)(uint64_t *entry);
@@ -91,10 +102,10 @@ struct memory_ops {
 };
 
 extern const struct memory_ops ppt_mem_ops;
-void init_ept_mem_ops(struct memory_ops *mem_ops, uint16_t vm_id);
+void init_ept_page_pool(void);
+int32_t init_ept_mem_ops(struct memory_ops *mem_ops, uint16_t vm_id);
+uint64_t seal_retired_ept_pages(const struct memory_ops *mem_ops);
+void recycle_retired_ept_pages(const struct memory_ops *mem_ops, uint64_t gen);
+void free_ept_pages(const struct memory_ops *mem_ops);
 void *get_reserve_sworld_memory_base(void);
-
-#ifdef CONFIG_LAST_LEVEL_EPT_AT_BOOT
-void reserve_buffer_for_ept_pages(void);
-#endif
 #endif /* PAGE_H */
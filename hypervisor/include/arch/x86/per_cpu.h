@@ -26,6 +26,8 @@ struct per_cpu_region {
 #ifdef HV_DEBUG
 	struct shared_buf *sbuf[ACRN_SBUF_ID_MAX];
 	char logbuf[LOG_MESSAGE_MAX_SIZE];
+	uint64_t logfmt_sent[LOG_FMT_TABLE_SIZE / 64U];
+	uint32_t logbuf_entries;
 	uint32_t npk_log_ref;
 #endif
 	uint64_t irq_count[NR_IRQS];
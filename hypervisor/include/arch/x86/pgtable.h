@@ -108,6 +108,11 @@
 /* End of ept_mem_type */
 
 #define EPT_MT_MASK		(7UL << EPT_MT_SHIFT)
+/* Accessed flag of EPT entries, set by the processor only with A/D flags enabled in the EPTP */
+#define EPT_ACCESSED		(1UL << 8U)
+/* Dirty flag of EPT leaf entries, set by the processor only with A/D flags enabled in the EPTP */
+#define EPT_DIRTY_SHIFT		9U
+#define EPT_DIRTY		(1UL << EPT_DIRTY_SHIFT)
 #define EPT_VE			(1UL << 63U)
 /* EPT leaf entry bits (bit 52 - bit 63) should be maksed  when calculate PFN */
 #define EPT_PFN_HIGH_MASK	0xFFF0000000000000UL
@@ -7,7 +7,7 @@
 #ifndef TIMER_H
 #define TIMER_H
 
-#include <list.h>
+#include <types.h>
 
 /**
  * @brief Timer
@@ -30,14 +30,20 @@ enum tick_mode {
  * @brief Definition of timers for per-cpu
  */
 struct per_cpu_timers {
-	struct list_head timer_list;	/**< it's for runtime active timer list */
+	struct hv_timer *timer_heap;	/**< root of the runtime active timer heap, i.e. the nearest timer */
 };
 
 /**
  * @brief Definition of timer
+ *
+ * The active timers of one pCPU are kept in a pairing heap ordered by
+ * fire_tsc, so adding a timer is O(1) and deleting one is O(log n) amortized.
  */
 struct hv_timer {
-	struct list_head node;		/**< link all timers */
+	struct hv_timer *child;		/**< leftmost child in the timer heap */
+	struct hv_timer *sibling;	/**< next sibling in the timer heap */
+	struct hv_timer *prev;		/**< previous sibling, or parent for the leftmost child */
+	struct per_cpu_timers *cpu_timer;	/**< per-cpu timers the timer is added to, NULL if not added */
 	enum tick_mode mode;		/**< timer mode: one-shot or periodic */
 	uint64_t fire_tsc;		/**< tsc deadline to interrupt */
 	uint64_t period_in_cycle;	/**< period of the periodic timer in unit of TSC cycles */
@@ -89,8 +95,8 @@ uint64_t rdtsc(void);
  * @param[in] mode timer mode.
  * @param[in] period_in_cycle period of the periodic timer in unit of TSC cycles.
  *
- * @remark Don't initialize a timer twice if it has been added to the timer list
- *         after calling add_timer. If you want to, delete the timer from the list first.
+ * @remark Don't initialize a timer twice if it has been added to the timer heap
+ *         after calling add_timer. If you want to, delete the timer from the heap first.
  *
  * @return None
  */
@@ -104,7 +110,10 @@ static inline void initialize_timer(struct hv_timer *timer,
 		timer->fire_tsc = fire_tsc;
 		timer->mode = mode;
 		timer->period_in_cycle = period_in_cycle;
-		INIT_LIST_HEAD(&timer->node);
+		timer->child = NULL;
+		timer->sibling = NULL;
+		timer->prev = NULL;
+		timer->cpu_timer = NULL;
 	}
 }
 
@@ -121,15 +130,15 @@ static inline bool timer_expired(const struct hv_timer *timer)
 }
 
 /**
- * @brief Check a timer whether in timer list.
+ * @brief Check a timer whether in timer heap.
  *
  * @param[in] timer Pointer to timer.
  *
- * @retval true if the timer is in timer list, false otherwise.
+ * @retval true if the timer is in timer heap, false otherwise.
  */
 static inline bool timer_is_started(const struct hv_timer *timer)
 {
-	return (!list_empty(&timer->node));
+	return (timer->cpu_timer != NULL);
 }
 
 /**
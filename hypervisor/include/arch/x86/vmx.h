@@ -20,6 +20,7 @@
 #define VMX_GUEST_LDTR_SEL    0x0000080cU
 #define VMX_GUEST_TR_SEL    0x0000080eU
 #define VMX_GUEST_INTR_STATUS 0x00000810U
+#define VMX_GUEST_PML_INDEX 0x00000812U
 /* 16-bit host-state fields */
 #define VMX_HOST_ES_SEL     0x00000c00U
 #define VMX_HOST_CS_SEL     0x00000c02U
@@ -43,6 +44,8 @@
 #define VMX_ENTRY_MSR_LOAD_ADDR_HIGH 0x0000200bU
 #define VMX_EXECUTIVE_VMCS_PTR_FULL     0x0000200cU
 #define VMX_EXECUTIVE_VMCS_PTR_HIGH     0x0000200dU
+#define VMX_PML_ADDR_FULL      0x0000200eU
+#define VMX_PML_ADDR_HIGH      0x0000200fU
 #define VMX_TSC_OFFSET_FULL    0x00002010U
 #define VMX_TSC_OFFSET_HIGH    0x00002011U
 #define VMX_VIRTUAL_APIC_PAGE_ADDR_FULL 0x00002012U
@@ -309,6 +312,7 @@
 #define VMX_PROCBASED_CTLS2_VM_FUNCS   (1U<<13U)
 #define VMX_PROCBASED_CTLS2_VMCS_SHADW (1U<<14U)
 #define VMX_PROCBASED_CTLS2_RDSEED     (1U<<16U)
+#define VMX_PROCBASED_CTLS2_PML        (1U<<17U)
 #define VMX_PROCBASED_CTLS2_EPT_VE     (1U<<18U)
 #define VMX_PROCBASED_CTLS2_XSVE_XRSTR (1U<<20U)
 
@@ -345,6 +349,9 @@
 #define VMX_EPTP_MT_WB  		0x6UL
 #define VMX_EPTP_MT_UC  		0x0UL
 
+/* Number of guest physical addresses a 4K page-modification log holds */
+#define PML_ENTITY_NUM			512U
+
 /* VMX exit control bits */
 #define VMX_EXIT_CTLS_SAVE_DBG         (1U<<2U)
 #define VMX_EXIT_CTLS_HOST_ADDR64      (1U<<9U)
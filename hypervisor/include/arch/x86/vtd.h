@@ -606,6 +606,34 @@ struct iommu_domain;
  */
 int32_t move_pt_device(const struct iommu_domain *from_domain, const struct iommu_domain *to_domain, uint8_t bus, uint8_t devfun);
 
+struct dmar_qi_batch;
+
+/**
+ * @brief Start batching the IOMMU invalidations of a device.
+ *
+ * Until the matching dmar_qi_batch_commit(), the invalidations this pcpu
+ * issues on the IOMMU of the device, e.g. by dmar_assign_irte(),
+ * dmar_free_irte() or move_pt_device(), are collected and completed together
+ * with one wait. They are not done before the commit, so a caller must not
+ * rely on them (e.g. unmask an interrupt whose IRTE it changed) until then.
+ * Other pcpus wait for the commit to invalidate on the same IOMMU, and the
+ * caller must not wait for another pcpu in between.
+ *
+ * @param[in] bus the 8-bit bus number of the device
+ * @param[in] devfun the 8-bit device(5-bit):function(3-bit) of the device
+ *
+ * @return the batch to pass to dmar_qi_batch_commit(), NULL if the device
+ *	   has no IOMMU to batch for
+ */
+struct dmar_qi_batch *dmar_qi_batch_begin(uint8_t bus, uint8_t devfun);
+
+/**
+ * @brief Complete the IOMMU invalidations collected since dmar_qi_batch_begin().
+ *
+ * @param[in] batch the batch returned by dmar_qi_batch_begin(), may be NULL
+ */
+void dmar_qi_batch_commit(struct dmar_qi_batch *batch);
+
 /**
  * @brief Create a iommu domain for a VM specified by vm_id.
  *
@@ -626,6 +654,35 @@ int32_t move_pt_device(const struct iommu_domain *from_domain, const struct iomm
  */
 struct iommu_domain *create_iommu_domain(uint16_t vm_id, uint64_t translation_table, uint32_t addr_width);
 
+/**
+ * @brief Flush the IOTLB of the specific iommu domain.
+ *
+ * Invalidate the IOTLB and paging-structure caches of the domain on all IOMMUs,
+ * after pages were unlinked from its translation table.
+ *
+ * @param[in] domain iommu domain to flush
+ *
+ * @pre domain != NULL
+ *
+ */
+void iommu_flush_domain(const struct iommu_domain *domain);
+
+/**
+ * @brief Flush the IOTLB of a range of the specific iommu domain.
+ *
+ * Invalidate the IOTLB and paging-structure cache entries for [gpa, gpa + size)
+ * on all IOMMUs with page-selective invalidations, or flush the whole domain
+ * if an IOMMU doesn't support them or the range takes too many of them.
+ *
+ * @param[in] domain iommu domain to flush
+ * @param[in] gpa start of the range
+ * @param[in] size size of the range
+ *
+ * @pre domain != NULL
+ *
+ */
+void iommu_flush_domain_range(const struct iommu_domain *domain, uint64_t gpa, uint64_t size);
+
 /**
  * @brief Destroy the specific iommu domain.
  *
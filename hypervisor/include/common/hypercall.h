@@ -208,6 +208,40 @@ int32_t hcall_set_ioreq_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param
  */
 int32_t hcall_notify_ioreq_finish(uint16_t vmid, uint16_t vcpu_id);
 
+/**
+ * @brief set the ioeventfd notification ring
+ *
+ * Set the ring that the hypervisor posts matched ioeventfd cookies to.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page-aligned
+ *              struct acrn_ioeventfd_ring, 0 to disable the ring
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_ioeventfd_ring(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief assign or deassign an ioeventfd
+ *
+ * Writes of the VM that match the ioeventfd are completed in the hypervisor
+ * by posting its cookie to the notification ring.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_hv_ioeventfd
+ * @param assign true to assign, false to deassign
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_ioeventfd(struct acrn_vm *vm, uint16_t vmid, uint64_t param, bool assign);
+
 /**
  * @brief setup ept memory mapping for multi regions
  *
@@ -248,6 +282,34 @@ int32_t hcall_write_protect_page(struct acrn_vm *vm, uint16_t vmid, uint64_t wp_
  */
 int32_t hcall_gpa_to_hpa(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
 
+/**
+ * @brief turn dirty page logging of a VM on or off
+ *
+ * Dirty page logging is supported for post-launched VMs without LAPIC
+ * passthrough, on platforms with PML and EPT accessed and dirty flags.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param 1 to turn dirty page logging on, 0 to turn it off
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_dirty_log(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief fetch and clear the dirty page bitmap of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_dirty_log
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_dirty_log(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief Assign one PCI dev to VM.
  *
@@ -327,6 +389,19 @@ int32_t hcall_debug(struct acrn_vm *vm, uint64_t param1, uint64_t param2, uint64
 
 int32_t hcall_get_cpu_pm_state(struct acrn_vm *vm, uint64_t cmd, uint64_t param);
 
+/**
+ * @brief Get the VM exit statistics of a vcpu.
+ *
+ * @param vm pointer to VM data structure
+ * @param vmid id of the VM
+ * @param param guest physical address. This gpa points to data structure of
+ *              acrn_vcpu_exit_stats
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_vcpu_exit_stats(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief Get VCPU a VM's interrupt count data.
  *
@@ -137,6 +137,8 @@ struct ptirq_remapping_info {
 	uint64_t intr_count;
 	struct hv_timer intr_delay_timer; /* used for delay intr injection */
 	ptirq_arch_release_fn_t release_cb;
+	uint16_t phys_sid_link;	/* next in phys sid hash chain, id + 1 */
+	uint16_t virt_sid_link;	/* next in virt sid hash chain, id + 1 */
 };
 
 static inline bool is_entry_active(const struct ptirq_remapping_info *entry)
@@ -217,14 +219,20 @@ struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id);
  * The total number of the entries is statically defined as CONFIG_MAX_PT_IRQ_ENTRIES.
  * Appropriate number should be configured on different platforms.
  *
+ * The entry is indexed by its physical sid and by its (vm, virtual sid) pair
+ * until it is released.
+ *
  * @param[in]    vm acrn_vm that the entry allocated for.
  * @param[in]    intr_type interrupt type: PTDEV_INTR_MSI or PTDEV_INTR_INTX
+ * @param[in]    phys_sid physical source id of the interrupt
+ * @param[in]    virt_sid virtual source id of the interrupt in \p vm
  *
  * @retval NULL when \p the number of entries allocated is CONFIG_MAX_PT_IRQ_ENTRIES
  * @retval !NULL when \p the number of entries allocated is less than CONFIG_MAX_PT_IRQ_ENTRIES
  *
  */
-struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr_type);
+struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr_type,
+		const union source_id *phys_sid, const union source_id *virt_sid);
 /**
  * @brief Release a ptirq_remapping_info entry.
  *
@@ -232,6 +240,36 @@ struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr
  *
  */
 void ptirq_release_entry(struct ptirq_remapping_info *entry);
+/**
+ * @brief Move a ptirq_remapping_info entry to a new owner or virtual sid.
+ *
+ * The virtual sid index is updated along with the entry.
+ *
+ * @param[in]    entry the ptirq_remapping_info entry to update.
+ * @param[in]    vm acrn_vm that owns the entry from now on.
+ * @param[in]    virt_sid new virtual source id of the interrupt in \p vm
+ *
+ * @pre ptdev_lock is held
+ */
+void ptirq_change_owner(struct ptirq_remapping_info *entry, struct acrn_vm *vm,
+		const union source_id *virt_sid);
+/**
+ * @brief Look up an active ptirq_remapping_info entry by source id.
+ *
+ * Before adding a ptdev remapping, lookup by physical sid to check whether
+ * the resource has been taken by others. When updating a ptdev remapping,
+ * lookup by virtual sid to check whether this resource is valid.
+ *
+ * @param[in]    intr_type interrupt type: PTDEV_INTR_MSI or PTDEV_INTR_INTX
+ * @param[in]    sid the physical sid if \p vm is NULL, the virtual sid otherwise
+ * @param[in]    vm acrn_vm the virtual sid belongs to, or NULL
+ *
+ * @retval NULL when \p no active entry matches
+ * @retval !NULL when \p the matching entry
+ *
+ */
+struct ptirq_remapping_info *ptirq_lookup_entry_by_sid(uint32_t intr_type,
+		const union source_id *sid, const struct acrn_vm *vm);
 /**
  * @brief Activate a irq for the associated passthrough device.
  *
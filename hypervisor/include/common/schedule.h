@@ -31,6 +31,7 @@ enum sched_notify_mode {
 struct thread_object;
 typedef void (*thread_entry_t)(struct thread_object *obj);
 typedef void (*switch_t)(struct thread_object *obj);
+typedef bool (*migrate_t)(struct thread_object *obj, uint16_t pcpu_id);
 struct thread_object {
 	char name[16];
 	uint16_t pcpu_id;
@@ -43,6 +44,11 @@ struct thread_object {
 	switch_t switch_out;
 	switch_t switch_in;
 
+	/* pCPUs the thread object may be migrated to, 0UL if it is pinned */
+	uint64_t pcpu_mask;
+	/* hand the thread object over to another pCPU, may refuse */
+	migrate_t migrate;
+
 	uint8_t data[THREAD_DATA_SIZE];
 };
 
@@ -73,6 +79,8 @@ struct acrn_scheduler {
 	void	(*yield)(struct sched_control *ctl);
 	/* prioritize the thread object */
 	void	(*prioritize)(struct thread_object *obj);
+	/* pick a queued, not running thread object allowed on one of the pCPUs in mask */
+	struct thread_object* (*pick_migrate)(struct sched_control *ctl, uint64_t mask);
 	/* deinit private data of scheduler */
 	void	(*deinit_data)(struct thread_object *obj);
 	/* deinit scheduler */
@@ -93,7 +101,10 @@ struct sched_iorr_control {
 extern struct acrn_scheduler sched_bvt;
 struct sched_bvt_control {
 	struct list_head runqueue;
-	struct hv_timer tick_timer;
+	/* one-shot timer ending the slice of the current thread object */
+	struct hv_timer slice_timer;
+	/* tsc when the current slice ends, 0 if it never ends */
+	uint64_t slice_end;
 };
 
 bool is_idle_thread(const struct thread_object *obj);
@@ -110,6 +121,7 @@ void deinit_thread_data(struct thread_object *obj);
 
 void make_reschedule_request(uint16_t pcpu_id, uint16_t delmode);
 bool need_reschedule(uint16_t pcpu_id);
+uint64_t sched_idle_pcpus(uint16_t pcpu_id);
 
 void run_thread(struct thread_object *obj);
 void sleep_thread(struct thread_object *obj);
@@ -21,12 +21,46 @@
 #define LOG_FLAG_STDOUT		0x00000001U
 #define LOG_FLAG_MEMORY		0x00000002U
 #define LOG_FLAG_NPK		0x00000004U
+#define LOG_FLAG_BINARY		0x00000008U	/* binary records in the memory log */
 #define LOG_ENTRY_SIZE	80U
 /* Size of buffer used to store a message being logged,
  * should align to LOG_ENTRY_SIZE.
  */
 #define LOG_MESSAGE_MAX_SIZE	(4U * LOG_ENTRY_SIZE)
 
+/*
+ * Binary memory log records, used with LOG_FLAG_BINARY. A record is a
+ * struct log_bin_hdr followed by len bytes of payload, spread over
+ * nr_entries sbuf entries. The first byte is LOG_BIN_MARKER, which a
+ * text record never starts with.
+ *
+ * LOG_BIN_FMT defines format fmt_id: the payload is the TSC frequency
+ * in kHz (uint32_t) and the format string. Each pcpu sends it to its own
+ * sbuf before its first use of the format, and again on every lap of the
+ * sbuf, so any sbuf can be decoded on its own.
+ *
+ * LOG_BIN_MSG is one message: the payload holds the arguments in format
+ * string order, integers as uint64_t and strings as a uint16_t length
+ * followed by the characters.
+ */
+#define LOG_BIN_MARKER		0xA5U
+#define LOG_BIN_FMT		1U
+#define LOG_BIN_MSG		2U
+#define LOG_FMT_TABLE_SIZE	1024U
+
+struct log_bin_hdr {
+	uint8_t marker;
+	uint8_t type;
+	uint8_t nr_entries;
+	uint8_t severity;
+	uint16_t pcpu_id;
+	uint16_t fmt_id;
+	uint32_t seq;
+	uint16_t len;
+	uint16_t reserved;
+	uint64_t tsc;
+} __packed;
+
 #define DBG_LEVEL_LAPICPT	5U
 #if defined(HV_DEBUG)
 
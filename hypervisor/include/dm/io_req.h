@@ -35,6 +35,31 @@ struct io_request {
 	union vhm_io_request reqs;
 };
 
+/* Max number of ioeventfds per VM */
+#define MAX_IOEVENTFD_NUM	64U
+
+/* Number of device ranges per VM to keep I/O request completion times for */
+#define IOREQ_POLL_RANGES	64U
+
+/**
+ * @brief Completion time of the I/O requests to one device range, which is
+ * a page of MMIO or 8 I/O ports, hashed into a small per-VM table.
+ */
+struct ioreq_poll_range {
+	uint64_t key;		/**< base address of the range, bit 0 set for port I/O */
+	uint64_t avg_cycles;	/**< moving average of the polled completion time, 0 if unknown */
+};
+
+/**
+ * @brief Adaptive polling for the I/O requests delivered to VHM
+ */
+struct ioreq_poll_info {
+	struct ioreq_poll_range ranges[IOREQ_POLL_RANGES];
+	uint64_t poll_hits;	/**< requests completed while polling */
+	uint64_t poll_misses;	/**< requests polled for, then slept for */
+	uint64_t sleeps;	/**< requests slept for without polling */
+};
+
 /**
  * @brief Definition of a IO port range
  */
@@ -206,6 +231,54 @@ uint32_t get_vhm_req_state(struct acrn_vm *vm, uint16_t vhm_req_id);
  */
 void set_vhm_req_state(struct acrn_vm *vm, uint16_t vhm_req_id, uint32_t state);
 
+/**
+ * @brief Set the ioeventfd notification ring of the VM
+ *
+ * @param vm Target VM context
+ * @param ring HVA of the ring in SOS memory, NULL to disable the fast path
+ *
+ * @return None
+ */
+void set_ioeventfd_ring(struct acrn_vm *vm, struct acrn_ioeventfd_ring *ring);
+
+/**
+ * @brief Assign an ioeventfd to the VM
+ *
+ * Writes matching \p args are completed in the hypervisor by posting
+ * args->cookie to the notification ring, instead of sending an I/O request.
+ *
+ * @param vm Target VM context
+ * @param args The doorbell to match
+ *
+ * @retval 0 on success
+ * @retval -EINVAL \p args is invalid
+ * @retval -EEXIST the same doorbell is already assigned
+ * @retval -ENOSPC no free ioeventfd slot
+ */
+int32_t assign_ioeventfd(struct acrn_vm *vm, const struct acrn_hv_ioeventfd *args);
+
+/**
+ * @brief Deassign an ioeventfd from the VM
+ *
+ * @param vm Target VM context
+ * @param args The doorbell to remove, matched on type, addr, len, flags and data
+ *
+ * @retval 0 on success
+ * @retval -ENOENT no such ioeventfd
+ */
+int32_t deassign_ioeventfd(struct acrn_vm *vm, const struct acrn_hv_ioeventfd *args);
+
+/**
+ * @brief Remove all ioeventfds and the ioeventfd ring of the VM
+ *
+ * SOS has to set the ring again with HC_SET_IOEVENTFD_RING after a reset.
+ *
+ * @param vm Target VM context
+ *
+ * @return None
+ */
+void reset_vm_ioeventfds(struct acrn_vm *vm);
+
 /**
  * @brief Set the vector for HV callback VHM
  *
@@ -77,7 +77,7 @@ struct acrn_vioapics {
 };
 
 void dump_vioapic(struct acrn_vm *vm);
-void vioapic_init(struct acrn_vm *vm);
+int32_t vioapic_init(struct acrn_vm *vm);
 void reset_vioapics(const struct acrn_vm *vm);
 
 
@@ -143,6 +143,17 @@ struct acrn_vpci {
 	uint64_t pci_mmcfg_base;
 	uint32_t pci_vdev_cnt;
 	struct pci_vdev pci_vdevs[CONFIG_MAX_PCI_DEV_NUM];
+
+	/*
+	 * BDF index of pci_vdevs[] for pci_find_vdev(): one devfn bitmap per
+	 * bus, and the vdevs sorted by BDF. A vdev's slot in vdevs_by_bdf[] is
+	 * the number of vdevs on lower buses (bus_start[]) plus the number of
+	 * bits below its devfn in its bus bitmap.
+	 */
+	uint64_t devfn_bitmap[PCI_BUSMAX + 1U][4];
+	uint16_t bus_start[PCI_BUSMAX + 1U];
+	uint16_t bdf_indexed_cnt;
+	struct pci_vdev *vdevs_by_bdf[CONFIG_MAX_PCI_DEV_NUM];
 };
 
 struct acrn_vm;
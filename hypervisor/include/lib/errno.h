@@ -9,6 +9,8 @@
 
 /** Indicates that operation not permitted. */
 #define EPERM		1
+/** Indicates that no such entry. */
+#define ENOENT		2
 /** Indicates that there is IO error. */
 #define EIO		5
 /** Indicates that not enough memory. */
@@ -19,10 +21,14 @@
 #define EFAULT		14
 /** Indicates that target is busy. */
 #define EBUSY		16
+/** Indicates that the entry already exists. */
+#define EEXIST		17
 /** Indicates that no such dev. */
 #define ENODEV		19
 /** Indicates that argument is not valid. */
 #define EINVAL		22
+/** Indicates that no space left. */
+#define ENOSPC		28
 /** Indicates that timeout occurs. */
 #define ETIMEDOUT	110
 
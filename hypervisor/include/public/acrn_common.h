@@ -469,6 +469,58 @@ struct acrn_set_ioreq_buffer {
 	uint64_t req_buf;
 } __aligned(8);
 
+/** The ioeventfd only matches writes of acrn_hv_ioeventfd.data */
+#define ACRN_HV_IOEVENTFD_FLAG_DATAMATCH	(1U << 0U)
+
+/**
+ * @brief Info to assign or deassign an ioeventfd for a VM
+ *
+ * the parameter for HC_ASSIGN_IOEVENTFD and HC_DEASSIGN_IOEVENTFD hypercalls
+ */
+struct acrn_hv_ioeventfd {
+	/** REQ_PORTIO or REQ_MMIO */
+	uint32_t type;
+
+	/** ACRN_HV_IOEVENTFD_FLAG_* */
+	uint32_t flags;
+
+	/** port address or guest physical address of the doorbell */
+	uint64_t addr;
+
+	/** width of the write in byte, 0 matches any width */
+	uint64_t len;
+
+	/** value to match when ACRN_HV_IOEVENTFD_FLAG_DATAMATCH is set */
+	uint64_t data;
+
+	/** opaque value posted to the notification ring on a match */
+	uint64_t cookie;
+} __aligned(8);
+
+/** Number of entries of the ioeventfd notification ring, a power of 2 */
+#define ACRN_IOEVENTFD_RING_SIZE	256U
+
+/**
+ * @brief Ring the hypervisor posts matched ioeventfd cookies to
+ *
+ * It lives in one page of SOS memory, set by HC_SET_IOEVENTFD_RING. The
+ * hypervisor is the producer of \p tail, SOS is the consumer of \p head.
+ * Both indexes are free running and wrap at ACRN_IOEVENTFD_RING_SIZE.
+ */
+struct acrn_ioeventfd_ring {
+	/** index of the next cookie for SOS to consume */
+	uint32_t head;
+
+	/** index of the next cookie for the hypervisor to post */
+	uint32_t tail;
+
+	/** reserved */
+	uint64_t reserved;
+
+	/** posted cookies */
+	uint64_t cookies[ACRN_IOEVENTFD_RING_SIZE];
+} __aligned(8);
+
 /** Operation types for setting IRQ line */
 #define GSI_SET_HIGH		0U
 #define GSI_SET_LOW		1U
@@ -654,6 +706,38 @@ struct acrn_intr_monitor {
 #define INTR_CMD_GET_DATA 0U
 #define INTR_CMD_DELAY_INT 1U
 
+/*
+ * VM exit handling time histogram: bucket 0 counts exits handled in less
+ * than (1 << ACRN_EXIT_HIST_SHIFT) TSC cycles, bucket n counts exits handled
+ * in [1 << (ACRN_EXIT_HIST_SHIFT + n - 1), 1 << (ACRN_EXIT_HIST_SHIFT + n))
+ * cycles, and the last bucket also counts everything slower.
+ */
+#define ACRN_EXIT_REASON_NUM	65U
+#define ACRN_EXIT_HIST_BUCKETS	16U
+#define ACRN_EXIT_HIST_SHIFT	8U
+
+/**
+ * @brief Info to get the VM exit statistics of a vCPU
+ *
+ * the parameter for HC_GET_VCPU_EXIT_STATS hypercall
+ */
+struct acrn_vcpu_exit_stats {
+	/** the vCPU to report, set by the caller */
+	uint16_t vcpu_id;
+
+	/** Reserved */
+	uint16_t reserved;
+
+	/** TSC frequency in kHz, to turn the buckets into time */
+	uint32_t tsc_khz;
+
+	/** total number of VM exits of the vCPU */
+	uint64_t nr_exits;
+
+	/** exit counts per basic exit reason and handling time bucket */
+	uint32_t hist[ACRN_EXIT_REASON_NUM][ACRN_EXIT_HIST_BUCKETS];
+} __aligned(8);
+
 /**
  * @}
  */
@@ -39,6 +39,7 @@
 #define HC_CREATE_VCPU              BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x04UL)
 #define HC_RESET_VM                 BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x05UL)
 #define HC_SET_VCPU_REGS            BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x06UL)
+#define HC_GET_VCPU_EXIT_STATS      BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x07UL)
 
 /* IRQ and Interrupts */
 #define HC_ID_IRQ_BASE              0x20UL
@@ -50,12 +51,17 @@
 #define HC_ID_IOREQ_BASE            0x30UL
 #define HC_SET_IOREQ_BUFFER         BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x00UL)
 #define HC_NOTIFY_REQUEST_FINISH    BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x01UL)
+#define HC_SET_IOEVENTFD_RING       BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x02UL)
+#define HC_ASSIGN_IOEVENTFD         BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x03UL)
+#define HC_DEASSIGN_IOEVENTFD       BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x04UL)
 
 /* Guest memory management */
 #define HC_ID_MEM_BASE              0x40UL
 #define HC_VM_GPA2HPA               BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x01UL)
 #define HC_VM_SET_MEMORY_REGIONS    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x02UL)
 #define HC_VM_WRITE_PROTECT_PAGE    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x03UL)
+#define HC_VM_SET_DIRTY_LOG         BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x04UL)
+#define HC_VM_GET_DIRTY_LOG         BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x05UL)
 
 /* PCI assignment*/
 #define HC_ID_PCI_BASE              0x50UL
@@ -174,6 +180,20 @@ struct wp_data {
 	uint64_t gpa;
 } __aligned(8);
 
+/**
+ * Dirty page bitmap of a range of VM memory, see HC_VM_GET_DIRTY_LOG
+ */
+struct acrn_dirty_log {
+	/** the guest physical address of the first page, 256K aligned */
+	uint64_t gpa;
+
+	/** the number of pages, a multiple of 64 */
+	uint64_t nr_pages;
+
+	/** the guest physical address of the bitmap, one bit per page */
+	uint64_t bitmap_gpa;
+} __aligned(8);
+
 /**
  * Setup parameter for share buffer, used for HC_SETUP_SBUF hypercall
  */
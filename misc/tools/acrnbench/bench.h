@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Helpers shared by the acrnbench programs. Each program models one
+ * hypervisor or device model fast path in user space, runs the old and the
+ * new variant on the same input, checks that they agree and prints the
+ * cost per operation.
+ */
+
+#ifndef ACRNBENCH_H
+#define ACRNBENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static inline uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+/* xorshift64*, deterministic so that every variant sees the same input */
+static inline uint64_t bench_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DUL;
+}
+
+/* keep the compiler from dropping a result nobody reads */
+#define BENCH_KEEP(x)	__asm__ volatile("" : : "g"(x) : "memory")
+
+static inline void bench_report(const char *name, uint64_t ns, uint64_t ops)
+{
+	printf("  %-44s %10.1f ns/op\n", name, (double)ns / (double)ops);
+}
+
+static inline void bench_fail(const char *what)
+{
+	fprintf(stderr, "MISMATCH: %s\n", what);
+	exit(1);
+}
+
+#endif /* ACRNBENCH_H */
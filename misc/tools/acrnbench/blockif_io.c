@@ -0,0 +1,443 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Block request engines of devicemodel/hw/block_if.c: the pool of
+ * BLOCKIF_NUMTHR worker threads doing one blocking pread/pwrite each against
+ * io_uring, where every batch of requests is handed to the kernel with one
+ * io_uring_enter() and a single reaper thread runs the completions.
+ *
+ * A submitter thread plays the virtio-blk notify: it keeps up to a queue
+ * depth of 4K requests on a page cache hot image file, queues every free
+ * slot as one batch and waits for completions. Reads check the block tag
+ * written at setup, writes rewrite the same tag and the whole image is
+ * checked afterwards. Voluntary and involuntary context switches of the
+ * process are reported per request along with the time.
+ */
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "bench.h"
+
+#define BLK_SIZE	4096U
+#define NR_BLKS		8192U		/* 32M image */
+#define NR_REQS		(1U << 16)
+#define MAX_QD		64U
+#define NUMTHR		8U		/* BLOCKIF_NUMTHR */
+#define URING_ENTRIES	128U		/* BLOCKIF_URING_ENTRIES */
+
+struct req {
+	struct req *next;
+	uint64_t blk;
+	bool write;
+	char *buf;
+	int err;
+};
+
+/* per engine: submit a batch of requests, completions call req_done() */
+struct engine {
+	const char *name;
+	int (*start)(void);
+	void (*submit)(struct req **batch, uint32_t n);
+	void (*stop)(void);
+};
+
+static int img_fd;
+static char *bufs;
+static struct req reqs[MAX_QD];
+
+/* the virtio queue side: free slots and completion count */
+static pthread_mutex_t vq_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vq_cond = PTHREAD_COND_INITIALIZER;
+static struct req *free_reqs;
+static uint32_t nr_done;
+static bool mismatch;
+
+static void req_done(struct req *r, int err)
+{
+	pthread_mutex_lock(&vq_mtx);
+	if ((err != 0) || (!r->write && (*(uint64_t *)r->buf != r->blk))) {
+		mismatch = true;
+	}
+	r->next = free_reqs;
+	free_reqs = r;
+	nr_done++;
+	pthread_cond_signal(&vq_cond);
+	pthread_mutex_unlock(&vq_mtx);
+}
+
+/* ---- thread pool, as blockif_thr() ---- */
+
+static pthread_mutex_t bc_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bc_cond = PTHREAD_COND_INITIALIZER;
+static struct req *pendq, **pendq_tail = &pendq;
+static bool closing;
+static pthread_t btid[NUMTHR];
+
+static void *pool_thr(void *arg)
+{
+	struct req *r;
+	ssize_t len;
+
+	(void)arg;
+	pthread_mutex_lock(&bc_mtx);
+	for (;;) {
+		while ((pendq == NULL) && !closing) {
+			pthread_cond_wait(&bc_cond, &bc_mtx);
+		}
+		if (pendq == NULL) {
+			break;
+		}
+		r = pendq;
+		pendq = r->next;
+		if (pendq == NULL) {
+			pendq_tail = &pendq;
+		}
+		pthread_mutex_unlock(&bc_mtx);
+
+		len = r->write ? pwrite(img_fd, r->buf, BLK_SIZE, r->blk * BLK_SIZE) :
+			pread(img_fd, r->buf, BLK_SIZE, r->blk * BLK_SIZE);
+		req_done(r, (len == BLK_SIZE) ? 0 : EIO);
+
+		pthread_mutex_lock(&bc_mtx);
+	}
+	pthread_mutex_unlock(&bc_mtx);
+	return NULL;
+}
+
+static int pool_start(void)
+{
+	uint32_t i;
+
+	closing = false;
+	for (i = 0U; i < NUMTHR; i++) {
+		pthread_create(&btid[i], NULL, pool_thr, NULL);
+	}
+	return 0;
+}
+
+/* blockif_request() is called once per request */
+static void pool_submit(struct req **batch, uint32_t n)
+{
+	uint32_t i;
+
+	for (i = 0U; i < n; i++) {
+		pthread_mutex_lock(&bc_mtx);
+		batch[i]->next = NULL;
+		*pendq_tail = batch[i];
+		pendq_tail = &batch[i]->next;
+		pthread_cond_signal(&bc_cond);
+		pthread_mutex_unlock(&bc_mtx);
+	}
+}
+
+static void pool_stop(void)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&bc_mtx);
+	closing = true;
+	pthread_cond_broadcast(&bc_cond);
+	pthread_mutex_unlock(&bc_mtx);
+	for (i = 0U; i < NUMTHR; i++) {
+		pthread_join(btid[i], NULL);
+	}
+}
+
+/* ---- io_uring, as blockif_uring_*() ---- */
+
+static struct {
+	int fd;
+	uint32_t *sq_tail, *sq_array, sq_mask, sq_local_tail;
+	uint32_t *cq_head, *cq_tail, cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+	pthread_t tid;
+} ring;
+
+static int uring_start(void);
+static void *uring_thr(void *arg);
+
+static void uring_prep(struct req *r)
+{
+	uint32_t idx = ring.sq_local_tail & ring.sq_mask;
+	struct io_uring_sqe *sqe = &ring.sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = (uint64_t)(uintptr_t)r;
+	if (r == NULL) {
+		sqe->opcode = IORING_OP_NOP;
+		sqe->flags = IOSQE_IO_DRAIN;
+	} else {
+		/* the request buffers are registered, like guest memory */
+		sqe->opcode = r->write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+		sqe->fd = img_fd;
+		sqe->off = r->blk * BLK_SIZE;
+		sqe->addr = (uint64_t)(uintptr_t)r->buf;
+		sqe->len = BLK_SIZE;
+		sqe->buf_index = 0U;
+	}
+	ring.sq_array[idx] = idx;
+	ring.sq_local_tail++;
+}
+
+static void uring_enter(uint32_t n)
+{
+	int ret;
+
+	__atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+	while (n > 0U) {
+		ret = (int)syscall(__NR_io_uring_enter, ring.fd, n, 0U, 0U, NULL, 0);
+		if (ret < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+				continue;
+			}
+			bench_fail("io_uring_enter");
+		}
+		n -= (uint32_t)ret;
+	}
+}
+
+static void uring_submit(struct req **batch, uint32_t n)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&bc_mtx);
+	for (i = 0U; i < n; i++) {
+		uring_prep(batch[i]);
+	}
+	uring_enter(n);
+	pthread_mutex_unlock(&bc_mtx);
+}
+
+static void *uring_thr(void *arg)
+{
+	struct io_uring_cqe *cqe;
+	struct req *r;
+	uint32_t head, tail;
+	bool stop = false;
+
+	(void)arg;
+	while (!stop) {
+		if ((syscall(__NR_io_uring_enter, ring.fd, 0U, 1U, IORING_ENTER_GETEVENTS, NULL, 0) < 0) &&
+				(errno != EINTR)) {
+			bench_fail("io_uring_enter getevents");
+		}
+		head = *ring.cq_head;
+		tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail) {
+			cqe = &ring.cqes[head & ring.cq_mask];
+			r = (struct req *)(uintptr_t)cqe->user_data;
+			head++;
+			if (r == NULL) {
+				stop = true;
+			} else {
+				req_done(r, (cqe->res == (int)BLK_SIZE) ? 0 : EIO);
+			}
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static int uring_start(void)
+{
+	struct io_uring_params p;
+	struct iovec iov;
+	char *sq, *cq;
+
+	memset(&ring, 0, sizeof(ring));
+	memset(&p, 0, sizeof(p));
+	ring.fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (ring.fd < 0) {
+		return -1;
+	}
+	ring.sq_ring_sz = p.sq_off.array + (p.sq_entries * sizeof(uint32_t));
+	ring.cq_ring_sz = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) != 0U) {
+		if (ring.cq_ring_sz > ring.sq_ring_sz) {
+			ring.sq_ring_sz = ring.cq_ring_sz;
+		}
+		ring.cq_ring_sz = ring.sq_ring_sz;
+	}
+	ring.sq_ring = mmap(NULL, ring.sq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+	ring.cq_ring = ((p.features & IORING_FEAT_SINGLE_MMAP) != 0U) ? ring.sq_ring :
+		mmap(NULL, ring.cq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+	ring.sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sqes = mmap(NULL, ring.sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if ((ring.sq_ring == MAP_FAILED) || (ring.cq_ring == MAP_FAILED) || (ring.sqes == MAP_FAILED)) {
+		bench_fail("io_uring mmap");
+	}
+
+	sq = ring.sq_ring;
+	ring.sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+	ring.sq_array = (uint32_t *)(sq + p.sq_off.array);
+	ring.sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+	ring.sq_local_tail = *ring.sq_tail;
+	cq = ring.cq_ring;
+	ring.cq_head = (uint32_t *)(cq + p.cq_off.head);
+	ring.cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+	ring.cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	iov.iov_base = bufs;
+	iov.iov_len = MAX_QD * BLK_SIZE;
+	if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, &iov, 1U) < 0) {
+		bench_fail("io_uring_register");
+	}
+	pthread_create(&ring.tid, NULL, uring_thr, NULL);
+	return 0;
+}
+
+static void uring_stop(void)
+{
+	pthread_mutex_lock(&bc_mtx);
+	uring_prep(NULL);
+	uring_enter(1U);
+	pthread_mutex_unlock(&bc_mtx);
+	pthread_join(ring.tid, NULL);
+
+	munmap(ring.sqes, ring.sqes_sz);
+	if (ring.cq_ring != ring.sq_ring) {
+		munmap(ring.cq_ring, ring.cq_ring_sz);
+	}
+	munmap(ring.sq_ring, ring.sq_ring_sz);
+	close(ring.fd);
+}
+
+/* ---- workload ---- */
+
+static uint64_t nr_csw(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (uint64_t)ru.ru_nvcsw + (uint64_t)ru.ru_nivcsw;
+}
+
+static void run(const struct engine *e, uint32_t qd, bool write)
+{
+	struct req *batch[MAX_QD];
+	uint64_t seed = 0x9E3779B97F4A7C15UL, t, csw;
+	uint32_t i, n, submitted = 0U;
+	char name[64];
+
+	free_reqs = NULL;
+	for (i = 0U; i < qd; i++) {
+		reqs[i].buf = bufs + (i * BLK_SIZE);
+		reqs[i].next = free_reqs;
+		free_reqs = &reqs[i];
+	}
+	nr_done = 0U;
+	mismatch = false;
+	if (e->start() != 0) {
+		printf("  %-44s unavailable\n", e->name);
+		return;
+	}
+
+	csw = nr_csw();
+	t = bench_now_ns();
+	pthread_mutex_lock(&vq_mtx);
+	while (nr_done < NR_REQS) {
+		/* one notify: queue every free slot */
+		n = 0U;
+		while ((free_reqs != NULL) && (submitted < NR_REQS)) {
+			batch[n] = free_reqs;
+			free_reqs = free_reqs->next;
+			batch[n]->blk = bench_rand(&seed) % NR_BLKS;
+			batch[n]->write = write;
+			if (write) {
+				*(uint64_t *)batch[n]->buf = batch[n]->blk;
+			}
+			n++;
+			submitted++;
+		}
+		if (n > 0U) {
+			pthread_mutex_unlock(&vq_mtx);
+			e->submit(batch, n);
+			pthread_mutex_lock(&vq_mtx);
+		}
+		if ((nr_done < NR_REQS) && ((free_reqs == NULL) || (submitted == NR_REQS))) {
+			pthread_cond_wait(&vq_cond, &vq_mtx);
+		}
+	}
+	pthread_mutex_unlock(&vq_mtx);
+	t = bench_now_ns() - t;
+	csw = nr_csw() - csw;
+	e->stop();
+
+	if (mismatch) {
+		bench_fail("request failed or returned the wrong block");
+	}
+	snprintf(name, sizeof(name), "%s, %s", write ? "write" : "read", e->name);
+	bench_report(name, t, NR_REQS);
+	printf("  %-44s %10.2f csw/op\n", "", (double)csw / (double)NR_REQS);
+}
+
+static void check_image(void)
+{
+	uint64_t tag;
+	uint32_t blk;
+
+	for (blk = 0U; blk < NR_BLKS; blk++) {
+		if ((pread(img_fd, &tag, sizeof(tag), (off_t)blk * BLK_SIZE) != sizeof(tag)) || (tag != blk)) {
+			bench_fail("image corrupted by the writes");
+		}
+	}
+}
+
+int main(void)
+{
+	static const struct engine engines[] = {
+		{ "thread pool", pool_start, pool_submit, pool_stop },
+		{ "io_uring", uring_start, uring_submit, uring_stop },
+	};
+	static const uint32_t depths[] = { 1U, 8U, 32U, 64U };
+	char path[] = "/tmp/acrnbench-XXXXXX";
+	uint64_t blk;
+	uint32_t d, e;
+
+	img_fd = mkstemp(path);
+	if (img_fd < 0) {
+		bench_fail("mkstemp");
+	}
+	unlink(path);
+	bufs = aligned_alloc(BLK_SIZE, MAX_QD * BLK_SIZE);
+	memset(bufs, 0, MAX_QD * BLK_SIZE);
+	for (blk = 0UL; blk < NR_BLKS; blk++) {
+		*(uint64_t *)bufs = blk;
+		if (pwrite(img_fd, bufs, BLK_SIZE, (off_t)(blk * BLK_SIZE)) != BLK_SIZE) {
+			bench_fail("image setup");
+		}
+	}
+
+	for (d = 0U; d < (sizeof(depths) / sizeof(depths[0])); d++) {
+		printf("queue depth %u\n", depths[d]);
+		for (e = 0U; e < (sizeof(engines) / sizeof(engines[0])); e++) {
+			run(&engines[e], depths[d], false);
+		}
+		for (e = 0U; e < (sizeof(engines) / sizeof(engines[0])); e++) {
+			run(&engines[e], depths[d], true);
+		}
+	}
+	check_image();
+	close(img_fd);
+	free(bufs);
+	return 0;
+}
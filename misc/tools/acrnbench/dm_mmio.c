@@ -0,0 +1,489 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Device model MMIO dispatch, as done by emulate_mem() for every MMIO
+ * request: the former RB tree under mmio_rwlock with one hint for the VM
+ * against the sorted range snapshot looked up without a lock and the
+ * per-vCPU hint (devicemodel/core/mem.c).
+ *
+ * The lookup and the call of the range handler are measured, the handler
+ * itself does nothing. Four access patterns are run for 32 and 256 ranges:
+ * one vCPU hammering one device, four vCPUs each hammering its own device
+ * in turns, accesses spread over all ranges and accesses to addresses only
+ * the fallback range claims. The cost of a register plus unregister is
+ * printed as well, as BAR reprogramming does it. Both variants must find
+ * the same range for every access.
+ *
+ * All vCPUs run on one thread here, so the rwlock is never contended.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <string.h>
+#include "bench.h"
+#include "tree.h"
+
+#define MAX_RANGES	256U
+#define NR_VCPUS	4
+#define NR_ACCESSES	(1U << 16)
+#define ROUNDS		16U
+#define MEM_F_READ	1
+
+typedef int (*mem_func_t)(void *ctx, int vcpu, int dir, uint64_t addr, int size, uint64_t *val,
+	void *arg1, long arg2);
+
+struct mem_range {
+	const char *name;
+	int flags;
+	mem_func_t handler;
+	void *arg1;
+	long arg2;
+	uint64_t base;
+	uint64_t size;
+};
+
+static __attribute__((noinline)) int handler(void *ctx, int vcpu, int dir, uint64_t addr, int size,
+	uint64_t *val, void *arg1, long arg2)
+{
+	*val = (uint64_t)arg2;
+	return 0;
+}
+
+/* ---- the former RB tree ---- */
+
+struct mmio_rb_range {
+	RB_ENTRY(mmio_rb_range)	mr_link;
+	struct mem_range	mr_param;
+	uint64_t		mr_base;
+	uint64_t		mr_end;
+};
+
+static RB_HEAD(mmio_rb_tree, mmio_rb_range) mmio_rb_root, mmio_rb_fallback;
+RB_PROTOTYPE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
+
+static struct mmio_rb_range *mmio_hint;
+static pthread_rwlock_t mmio_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+static int mmio_rb_range_compare(struct mmio_rb_range *a, struct mmio_rb_range *b)
+{
+	if (a->mr_end < b->mr_base) {
+		return -1;
+	} else if (a->mr_base > b->mr_end) {
+		return 1;
+	}
+	return 0;
+}
+
+RB_GENERATE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
+
+static int rb_lookup(struct mmio_rb_tree *rbt, uint64_t addr, struct mmio_rb_range **entry)
+{
+	struct mmio_rb_range find, *res;
+
+	find.mr_base = find.mr_end = addr;
+	res = RB_FIND(mmio_rb_tree, rbt, &find);
+	if (res != NULL) {
+		*entry = res;
+		return 0;
+	}
+	return -1;
+}
+
+/* the former emulate_mem() */
+static int emulate_rb(int vcpu, uint64_t paddr, uint64_t *val)
+{
+	struct mmio_rb_range *hint, *entry = NULL;
+
+	pthread_rwlock_rdlock(&mmio_rwlock);
+	hint = mmio_hint;
+	if ((hint != NULL) && (paddr >= hint->mr_base) && (paddr <= hint->mr_end)) {
+		entry = hint;
+	} else if (rb_lookup(&mmio_rb_root, paddr, &entry) == 0) {
+		mmio_hint = entry;
+	} else if (rb_lookup(&mmio_rb_fallback, paddr, &entry) != 0) {
+		pthread_rwlock_unlock(&mmio_rwlock);
+		return -ESRCH;
+	}
+	pthread_rwlock_unlock(&mmio_rwlock);
+
+	return (*entry->mr_param.handler)(NULL, vcpu, MEM_F_READ, paddr, 4, val,
+		entry->mr_param.arg1, entry->mr_param.arg2);
+}
+
+static int rb_register(struct mmio_rb_tree *rbt, struct mem_range *memp)
+{
+	struct mmio_rb_range *mrp = malloc(sizeof(*mrp));
+	int err = -1;
+
+	if (mrp != NULL) {
+		mrp->mr_param = *memp;
+		mrp->mr_base = memp->base;
+		mrp->mr_end = memp->base + memp->size - 1UL;
+		pthread_rwlock_wrlock(&mmio_rwlock);
+		if (RB_INSERT(mmio_rb_tree, rbt, mrp) == NULL) {
+			err = 0;
+		}
+		pthread_rwlock_unlock(&mmio_rwlock);
+		if (err != 0) {
+			free(mrp);
+		}
+	}
+	return err;
+}
+
+static int rb_unregister(struct mmio_rb_tree *rbt, struct mem_range *memp)
+{
+	struct mmio_rb_range *entry = NULL;
+	int err = -1;
+
+	pthread_rwlock_wrlock(&mmio_rwlock);
+	if ((rb_lookup(rbt, memp->base, &entry) == 0) && (entry->mr_base == memp->base)) {
+		RB_REMOVE(mmio_rb_tree, rbt, entry);
+		if (mmio_hint == entry) {
+			mmio_hint = NULL;
+		}
+		err = 0;
+	}
+	pthread_rwlock_unlock(&mmio_rwlock);
+	if (err == 0) {
+		free(entry);
+	}
+	return err;
+}
+
+/* ---- the snapshot, as in devicemodel/core/mem.c ---- */
+
+struct mmio_range {
+	struct mem_range	mr_param;
+	uint64_t		mr_base;
+	uint64_t		mr_end;
+};
+
+struct mmio_snapshot {
+	uint64_t		gen;
+	int			nr_ranges;
+	int			nr_fallback;
+	struct mmio_range	ranges[];
+};
+
+struct mmio_vcpu_cache {
+	int			reading;
+	uint64_t		gen;
+	struct mmio_range	hint;
+} __attribute__((aligned(64)));
+
+static struct mmio_vcpu_cache mmio_cache[NR_VCPUS];
+static struct mmio_snapshot *mmio_snap;
+static uint64_t mmio_gen;
+
+static struct mmio_range *mmio_set(struct mmio_snapshot *snap, bool fallback, int *num)
+{
+	*num = fallback ? snap->nr_fallback : snap->nr_ranges;
+	return fallback ? &snap->ranges[snap->nr_ranges] : snap->ranges;
+}
+
+static int mmio_search(const struct mmio_range *set, int num, uint64_t addr)
+{
+	int lo = 0, hi = num, mid;
+
+	while (lo < hi) {
+		mid = lo + ((hi - lo) / 2);
+		if (set[mid].mr_end < addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static struct mmio_range *mmio_lookup(struct mmio_snapshot *snap, bool fallback, uint64_t addr)
+{
+	struct mmio_range *set;
+	int num, i;
+
+	set = mmio_set(snap, fallback, &num);
+	i = mmio_search(set, num, addr);
+	if ((i < num) && (set[i].mr_base <= addr)) {
+		return &set[i];
+	}
+	return NULL;
+}
+
+static struct mmio_snapshot *mmio_snapshot_dup(int extra)
+{
+	struct mmio_snapshot *old = mmio_snap, *new;
+	int num = old->nr_ranges + old->nr_fallback;
+
+	new = malloc(sizeof(*new) + ((num + extra) * sizeof(struct mmio_range)));
+	if (new != NULL) {
+		memcpy(new, old, sizeof(*new) + (num * sizeof(struct mmio_range)));
+		new->gen = old->gen + 1UL;
+	}
+	return new;
+}
+
+static void mmio_publish(struct mmio_snapshot *new)
+{
+	struct mmio_snapshot *old = mmio_snap;
+	int i;
+
+	__atomic_store_n(&mmio_snap, new, __ATOMIC_SEQ_CST);
+	for (i = 0; i < NR_VCPUS; i++) {
+		while (__atomic_load_n(&mmio_cache[i].reading, __ATOMIC_SEQ_CST) != 0) {
+			sched_yield();
+		}
+	}
+	__atomic_store_n(&mmio_gen, new->gen, __ATOMIC_SEQ_CST);
+	free(old);
+}
+
+/* emulate_mem() */
+static int emulate_snap(int vcpu, uint64_t paddr, uint64_t *val)
+{
+	struct mmio_vcpu_cache *cache = &mmio_cache[vcpu];
+	struct mmio_snapshot *snap;
+	struct mmio_range *entry;
+	struct mem_range mr;
+	int err = 0;
+
+	if ((cache->gen == __atomic_load_n(&mmio_gen, __ATOMIC_SEQ_CST)) &&
+			(paddr >= cache->hint.mr_base) && (paddr <= cache->hint.mr_end)) {
+		mr = cache->hint.mr_param;
+	} else {
+		__atomic_store_n(&cache->reading, 1, __ATOMIC_SEQ_CST);
+		snap = __atomic_load_n(&mmio_snap, __ATOMIC_SEQ_CST);
+		entry = mmio_lookup(snap, false, paddr);
+		if (entry != NULL) {
+			cache->hint = *entry;
+			cache->gen = snap->gen;
+			mr = entry->mr_param;
+		} else {
+			entry = mmio_lookup(snap, true, paddr);
+			if (entry != NULL) {
+				mr = entry->mr_param;
+			} else {
+				err = -ESRCH;
+			}
+		}
+		__atomic_store_n(&cache->reading, 0, __ATOMIC_SEQ_CST);
+		if (err != 0) {
+			return err;
+		}
+	}
+
+	return (*mr.handler)(NULL, vcpu, MEM_F_READ, paddr, 4, val, mr.arg1, mr.arg2);
+}
+
+static int snap_register(bool fallback, struct mem_range *memp)
+{
+	struct mmio_snapshot *new;
+	struct mmio_range *set;
+	uint64_t base = memp->base, end = memp->base + memp->size - 1UL;
+	int num, i, err = -1;
+
+	new = mmio_snapshot_dup(1);
+	if (new != NULL) {
+		set = mmio_set(new, fallback, &num);
+		i = mmio_search(set, num, base);
+		if ((i == num) || (set[i].mr_base > end)) {
+			memmove(&set[i + 1], &set[i],
+				(char *)&new->ranges[new->nr_ranges + new->nr_fallback] - (char *)&set[i]);
+			set[i].mr_param = *memp;
+			set[i].mr_base = base;
+			set[i].mr_end = end;
+			if (fallback) {
+				new->nr_fallback++;
+			} else {
+				new->nr_ranges++;
+			}
+			mmio_publish(new);
+			err = 0;
+		} else {
+			free(new);
+		}
+	}
+	return err;
+}
+
+static int snap_unregister(bool fallback, struct mem_range *memp)
+{
+	struct mmio_snapshot *new;
+	struct mmio_range *entry, *end;
+	int err = -1;
+
+	entry = mmio_lookup(mmio_snap, fallback, memp->base);
+	if ((entry != NULL) && (entry->mr_base == memp->base)) {
+		new = mmio_snapshot_dup(0);
+		if (new != NULL) {
+			entry = &new->ranges[entry - mmio_snap->ranges];
+			end = &new->ranges[new->nr_ranges + new->nr_fallback];
+			memmove(entry, entry + 1, (char *)end - (char *)(entry + 1));
+			if (fallback) {
+				new->nr_fallback--;
+			} else {
+				new->nr_ranges--;
+			}
+			mmio_publish(new);
+			err = 0;
+		}
+	}
+	return err;
+}
+
+/* ---- benchmark ---- */
+
+static struct mem_range ranges[MAX_RANGES];
+static struct mem_range fallback;
+static uint64_t addrs[NR_ACCESSES];
+static int vcpus[NR_ACCESSES];
+
+/* BARs of 4K to 1M, naturally aligned, with holes between them */
+static void setup(uint32_t nr, uint64_t *seed)
+{
+	uint64_t end = 0xc0000000UL, base, size;
+	uint32_t i;
+	struct mmio_rb_range *np, *tmp;
+
+	RB_FOREACH_SAFE(np, mmio_rb_tree, &mmio_rb_root, tmp) {
+		RB_REMOVE(mmio_rb_tree, &mmio_rb_root, np);
+		free(np);
+	}
+	RB_FOREACH_SAFE(np, mmio_rb_tree, &mmio_rb_fallback, tmp) {
+		RB_REMOVE(mmio_rb_tree, &mmio_rb_fallback, np);
+		free(np);
+	}
+	mmio_hint = NULL;
+	free(mmio_snap);
+	mmio_snap = calloc(1, sizeof(*mmio_snap));
+	if (mmio_snap == NULL) {
+		bench_fail("out of memory");
+	}
+	mmio_snap->gen = mmio_gen + 1UL;
+	mmio_gen = mmio_snap->gen;
+
+	for (i = 0U; i < nr; i++) {
+		size = 0x1000UL << (bench_rand(seed) % 9U);
+		base = (end + ((bench_rand(seed) % 4U) * 0x1000UL) + size - 1UL) & ~(size - 1UL);
+		end = base + size;
+		ranges[i] = (struct mem_range){ "bar", 0, handler, NULL, (long)i, base, size };
+		if ((rb_register(&mmio_rb_root, &ranges[i]) != 0) || (snap_register(false, &ranges[i]) != 0)) {
+			bench_fail("register");
+		}
+	}
+	/* like the PCI hole fallback of the device model */
+	fallback = (struct mem_range){ "fallback", 0, handler, NULL, -1L, 0x80000000UL, 0x80000000UL };
+	if ((rb_register(&mmio_rb_fallback, &fallback) != 0) || (snap_register(true, &fallback) != 0)) {
+		bench_fail("register fallback");
+	}
+}
+
+static uint64_t in_range(uint32_t i, uint64_t *seed)
+{
+	return ranges[i].base + ((bench_rand(seed) % ranges[i].size) & ~3UL);
+}
+
+static void gen(uint32_t pattern, uint32_t nr, uint64_t *seed)
+{
+	uint32_t i, dev[NR_VCPUS];
+
+	for (i = 0U; i < NR_VCPUS; i++) {
+		dev[i] = (uint32_t)(bench_rand(seed) % nr);
+	}
+	for (i = 0U; i < NR_ACCESSES; i++) {
+		switch (pattern) {
+		case 0U:
+			vcpus[i] = 0;
+			addrs[i] = in_range(dev[0], seed);
+			break;
+		case 1U:
+			vcpus[i] = (int)(i % NR_VCPUS);
+			addrs[i] = in_range(dev[vcpus[i]], seed);
+			break;
+		case 2U:
+			vcpus[i] = (int)(i % NR_VCPUS);
+			addrs[i] = in_range((uint32_t)(bench_rand(seed) % nr), seed);
+			break;
+		default:
+			/* below the BARs, in the fallback only */
+			vcpus[i] = (int)(i % NR_VCPUS);
+			addrs[i] = 0x80000000UL + ((bench_rand(seed) % 0x40000000UL) & ~3UL);
+			break;
+		}
+	}
+}
+
+static void run(uint32_t nr)
+{
+	static const char *const patterns[] = {
+		"one vCPU, one device", "4 vCPUs, a device each", "4 vCPUs, spread", "4 vCPUs, fallback only",
+	};
+	uint64_t seed = 0x9E3779B97F4A7C15UL, t, v1, v2, sum;
+	uint32_t p, r, i, b;
+	int e1, e2;
+	char name[64];
+
+	setup(nr, &seed);
+	printf("%u ranges\n", nr);
+	for (p = 0U; p < 4U; p++) {
+		gen(p, nr, &seed);
+		for (i = 0U; i < NR_ACCESSES; i++) {
+			v1 = v2 = 0UL;
+			e1 = emulate_rb(vcpus[i], addrs[i], &v1);
+			e2 = emulate_snap(vcpus[i], addrs[i], &v2);
+			if ((e1 != e2) || (v1 != v2)) {
+				bench_fail("rb tree and snapshot disagree");
+			}
+		}
+		for (b = 0U; b < 2U; b++) {
+			sum = 0UL;
+			t = bench_now_ns();
+			for (r = 0U; r < ROUNDS; r++) {
+				for (i = 0U; i < NR_ACCESSES; i++) {
+					if (b != 0U) {
+						(void)emulate_snap(vcpus[i], addrs[i], &v1);
+					} else {
+						(void)emulate_rb(vcpus[i], addrs[i], &v1);
+					}
+					sum += v1;
+				}
+			}
+			t = bench_now_ns() - t;
+			BENCH_KEEP(sum);
+			snprintf(name, sizeof(name), "%s, %s", patterns[p], (b != 0U) ? "snapshot" : "rb tree");
+			bench_report(name, t, ROUNDS * NR_ACCESSES);
+		}
+	}
+
+	/* move a BAR away and back, as a guest sizing it does */
+	for (b = 0U; b < 2U; b++) {
+		t = bench_now_ns();
+		for (r = 0U; r < 1024U; r++) {
+			i = r % nr;
+			if (b != 0U) {
+				e1 = snap_unregister(false, &ranges[i]) | snap_register(false, &ranges[i]);
+			} else {
+				e1 = rb_unregister(&mmio_rb_root, &ranges[i]) | rb_register(&mmio_rb_root, &ranges[i]);
+			}
+			if (e1 != 0) {
+				bench_fail("re-register");
+			}
+		}
+		t = bench_now_ns() - t;
+		bench_report((b != 0U) ? "unregister + register, snapshot" : "unregister + register, rb tree",
+			t, 1024U);
+	}
+}
+
+int main(void)
+{
+	run(32U);
+	run(256U);
+	return 0;
+}
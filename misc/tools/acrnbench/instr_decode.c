@@ -0,0 +1,427 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * MMIO instruction decoding, as done by decode_instruction() on every MMIO
+ * exit: vie_init() fetching the instruction through a guest page walk and
+ * local_decode_instruction() parsing it, against the same fetch followed by
+ * the per-vCPU decode cache. The decoder and the cache are not copies: the
+ * Makefile extracts them from hypervisor/arch/x86/guest/instr_emul.c.
+ *
+ * The fetch follows copy_from_gva(): a 4-level guest page walk in which
+ * every paging structure is reached through a 4-level EPT walk, then the
+ * EPT walk of the code page and the copy. The VMCS reads around it are not
+ * modelled. The exits replay streams of instructions taken from MMIO
+ * accessors of compiled drivers: a driver loop over a few hot ones, 32
+ * instructions in turn (more than the cache holds) and one RIP whose code
+ * is patched between two instructions on every exit. Both variants must
+ * decode every exit alike.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include "bench.h"
+
+enum cpu_reg_name {
+	CPU_REG_RAX, CPU_REG_RCX, CPU_REG_RDX, CPU_REG_RBX, CPU_REG_RSP, CPU_REG_RBP, CPU_REG_RSI, CPU_REG_RDI,
+	CPU_REG_R8, CPU_REG_R9, CPU_REG_R10, CPU_REG_R11, CPU_REG_R12, CPU_REG_R13, CPU_REG_R14, CPU_REG_R15,
+	CPU_REG_CR0, CPU_REG_CR2, CPU_REG_CR3, CPU_REG_CR4, CPU_REG_DR7, CPU_REG_RIP, CPU_REG_RFLAGS,
+	CPU_REG_EFER, CPU_REG_PDPTE0, CPU_REG_PDPTE1, CPU_REG_PDPTE2, CPU_REG_PDPTE3,
+	CPU_REG_ES, CPU_REG_CS, CPU_REG_SS, CPU_REG_DS, CPU_REG_FS, CPU_REG_GS,
+	CPU_REG_LDTR, CPU_REG_TR, CPU_REG_IDTR, CPU_REG_GDTR
+};
+
+enum vm_cpu_mode {
+	CPU_MODE_REAL,
+	CPU_MODE_PROTECTED,
+	CPU_MODE_COMPATIBILITY,
+	CPU_MODE_64BIT,
+};
+
+#define CPU_REG_LAST	CPU_REG_GDTR
+#define pr_err(...)	do { } while (0)
+
+/* the hypervisor memcpy_s() */
+static void *memcpy_s(void *d, size_t dmax, const void *s, size_t slen)
+{
+	if ((slen != 0U) && (dmax != 0U) && (dmax >= slen) && (d != s)) {
+		asm volatile ("rep; movsb" : "=&D"(d), "=&S"(s) : "c"(slen), "0"(d), "1"(s) : "memory");
+	}
+	return d;
+}
+
+#include "instr_emul_types.inc"
+
+struct instr_emul_ctxt {
+	struct instr_emul_vie vie;
+	struct instr_emul_cache_entry cache[VIE_CACHE_SIZE];
+};
+
+#include "instr_decode.inc"
+
+/* ---- guest memory ---- */
+
+#define HOST_MEM	(32UL << 20)
+#define GUEST_MEM	(16UL << 20)
+#define GUEST_HPA	(8UL << 20)		/* where guest memory sits */
+#define TEXT_GVA	0xffffffff81000000UL
+#define TEXT_GPA	(GUEST_MEM - 0x200000UL)
+#define PTE_P		0x1UL
+#define PTE_RW		0x2UL
+#define PTE_NX		(1UL << 63U)
+#define PFN_MASK	0x000ffffffffff000UL
+#define INVALID_HPA	(~0UL)
+
+static uint8_t *host;
+static uint64_t next_hpa = 0x1000UL;		/* EPT tables below guest memory */
+static uint64_t eptp, guest_cr3, next_gpa = 0x100000UL;
+
+static uint64_t *hva(uint64_t hpa)
+{
+	return (uint64_t *)(host + hpa);
+}
+
+static uint64_t ept_alloc(void)
+{
+	uint64_t hpa = next_hpa;
+
+	next_hpa += 0x1000UL;
+	if (next_hpa > GUEST_HPA) {
+		bench_fail("ept tables");
+	}
+	return hpa;
+}
+
+/* lookup_address() on the EPT, 4K pages only */
+static uint64_t gpa2hpa(uint64_t gpa)
+{
+	uint64_t table = eptp, entry = 0UL;
+	uint32_t level;
+
+	for (level = 4U; level > 0U; level--) {
+		entry = hva(table)[(gpa >> (12U + (9U * (level - 1U)))) & 0x1ffUL];
+		if ((entry & 0x7UL) == 0UL) {
+			return INVALID_HPA;
+		}
+		table = entry & PFN_MASK;
+	}
+	return table | (gpa & 0xfffUL);
+}
+
+static void ept_map_guest(void)
+{
+	uint64_t gpa, table, *entry;
+	uint32_t level;
+
+	eptp = ept_alloc();
+	for (gpa = 0UL; gpa < GUEST_MEM; gpa += 0x1000UL) {
+		table = eptp;
+		for (level = 4U; level > 1U; level--) {
+			entry = &hva(table)[(gpa >> (12U + (9U * (level - 1U)))) & 0x1ffUL];
+			if (*entry == 0UL) {
+				*entry = ept_alloc() | 0x7UL;
+			}
+			table = *entry & PFN_MASK;
+		}
+		hva(table)[(gpa >> 12U) & 0x1ffUL] = (GUEST_HPA + gpa) | 0x7UL;
+	}
+}
+
+static uint64_t *gva_ptr(uint64_t gpa)
+{
+	return hva(gpa2hpa(gpa));
+}
+
+static void guest_map(uint64_t gva, uint64_t gpa)
+{
+	uint64_t table = guest_cr3, *entry;
+	uint32_t level;
+
+	for (level = 4U; level > 1U; level--) {
+		entry = &gva_ptr(table)[(gva >> (12U + (9U * (level - 1U)))) & 0x1ffUL];
+		if (*entry == 0UL) {
+			*entry = next_gpa | PTE_P | PTE_RW;
+			next_gpa += 0x1000UL;
+		}
+		table = *entry & PFN_MASK;
+	}
+	gva_ptr(table)[(gva >> 12U) & 0x1ffUL] = gpa | PTE_P;
+}
+
+/* local_gva2gpa_common() for 4-level paging, supervisor fetch */
+static int32_t gva2gpa(uint64_t gva, uint64_t *gpa)
+{
+	uint64_t addr = guest_cr3, entry = 0UL, *base;
+	uint32_t i = 4U, shift = 12U;
+	int32_t fault = 0;
+
+	while ((i != 0U) && (fault == 0)) {
+		i--;
+		addr &= PFN_MASK;
+		base = gva_ptr(addr);
+		if (base == NULL) {
+			fault = 1;
+		} else {
+			shift = (i * 9U) + 12U;
+			entry = base[(gva >> shift) & 0x1ffUL];
+			if ((entry & PTE_P) == 0UL) {
+				fault = 1;
+			}
+			if ((fault == 0) && ((entry & PTE_NX) != 0UL)) {
+				fault = 1;
+			}
+		}
+		addr = entry;
+	}
+	if (fault == 0) {
+		entry >>= shift;
+		entry <<= (shift + 12U);
+		entry >>= 12U;
+		*gpa = entry | (gva & 0xfffUL);
+	}
+	return (fault != 0) ? -1 : 0;
+}
+
+/* copy_from_gva() */
+static int32_t copy_from_gva(void *h_ptr, uint64_t gva, uint32_t size)
+{
+	uint64_t gpa = 0UL, hpa;
+	uint32_t len;
+
+	while (size > 0U) {
+		if (gva2gpa(gva, &gpa) != 0) {
+			return -1;
+		}
+		hpa = gpa2hpa(gpa);
+		if (hpa == INVALID_HPA) {
+			return -1;
+		}
+		len = 0x1000U - ((uint32_t)gpa & 0xfffU);
+		len = (size > len) ? len : size;
+		(void)memcpy_s(h_ptr, len, host + hpa, len);
+		gva += len;
+		h_ptr = (uint8_t *)h_ptr + len;
+		size -= len;
+	}
+	return 0;
+}
+
+/* vie_init() */
+static int32_t vie_init(struct instr_emul_vie *vie, uint64_t rip, uint32_t inst_len)
+{
+	size_t n = sizeof(*vie);
+	void *p = vie;
+	int32_t ret;
+
+	asm volatile ("rep ; stosb" : "+D"(p), "+c"(n) : "a"(0) : "memory");
+	vie->base_register = CPU_REG_LAST;
+	vie->index_register = CPU_REG_LAST;
+	vie->segment_register = CPU_REG_LAST;
+	ret = copy_from_gva(vie->inst, rip, inst_len);
+	if (ret == 0) {
+		vie->num_valid = (uint8_t)inst_len;
+	}
+	return ret;
+}
+
+/* ---- replay ---- */
+
+struct instr {
+	uint8_t len;
+	uint8_t bytes[VIE_INST_SIZE];
+	uint64_t rip;
+};
+
+/* MMIO accessors as compiled into drivers, 64-bit mode */
+static struct instr instrs[] = {
+	{ 3U, { 0x8bU, 0x47U, 0x10U } },				/* mov eax,[rdi+0x10] */
+	{ 3U, { 0x89U, 0x47U, 0x10U } },				/* mov [rdi+0x10],eax */
+	{ 2U, { 0x8bU, 0x07U } },					/* mov eax,[rdi] */
+	{ 2U, { 0x89U, 0x07U } },					/* mov [rdi],eax */
+	{ 6U, { 0x8bU, 0x83U, 0x28U, 0x20U, 0x00U, 0x00U } },		/* mov eax,[rbx+0x2028] */
+	{ 6U, { 0x89U, 0x83U, 0x28U, 0x20U, 0x00U, 0x00U } },		/* mov [rbx+0x2028],eax */
+	{ 3U, { 0x48U, 0x8bU, 0x07U } },				/* mov rax,[rdi] */
+	{ 3U, { 0x48U, 0x89U, 0x07U } },				/* mov [rdi],rax */
+	{ 4U, { 0x0fU, 0xb6U, 0x47U, 0x04U } },			/* movzx eax,byte [rdi+4] */
+	{ 4U, { 0x0fU, 0xb7U, 0x46U, 0x0eU } },			/* movzx eax,word [rsi+0xe] */
+	{ 4U, { 0x66U, 0x89U, 0x47U, 0x02U } },			/* mov [rdi+2],ax */
+	{ 4U, { 0x66U, 0x8bU, 0x47U, 0x02U } },			/* mov ax,[rdi+2] */
+	{ 3U, { 0x88U, 0x47U, 0x01U } },				/* mov [rdi+1],al */
+	{ 3U, { 0x8aU, 0x47U, 0x01U } },				/* mov al,[rdi+1] */
+	{ 7U, { 0xc7U, 0x40U, 0x38U, 0x01U, 0x00U, 0x00U, 0x00U } },	/* mov dword [rax+0x38],1 */
+	{ 4U, { 0xc6U, 0x40U, 0x14U, 0x01U } },			/* mov byte [rax+0x14],1 */
+	{ 3U, { 0x89U, 0x0cU, 0x02U } },				/* mov [rdx+rax],ecx */
+	{ 3U, { 0x8bU, 0x0cU, 0x82U } },				/* mov ecx,[rdx+rax*4] */
+	{ 7U, { 0x45U, 0x8bU, 0x81U, 0x00U, 0x01U, 0x00U, 0x00U } },	/* mov r8d,[r9+0x100] */
+	{ 4U, { 0x44U, 0x89U, 0x41U, 0x08U } },			/* mov [rcx+8],r8d */
+	{ 2U, { 0x85U, 0x10U } },					/* test [rax],edx */
+	{ 3U, { 0x09U, 0x47U, 0x08U } },				/* or [rdi+8],eax */
+	{ 2U, { 0x23U, 0x02U } },					/* and eax,[rdx] */
+	{ 4U, { 0x83U, 0x4fU, 0x08U, 0x01U } },			/* or dword [rdi+8],1 */
+	{ 7U, { 0x81U, 0x67U, 0x08U, 0xffU, 0xffU, 0xfeU, 0xffU } },	/* and dword [rdi+8],0xfffeffff */
+	{ 3U, { 0x3bU, 0x47U, 0x0cU } },				/* cmp eax,[rdi+0xc] */
+	{ 5U, { 0x0fU, 0xbaU, 0x67U, 0x04U, 0x03U } },		/* bt dword [rdi+4],3 */
+	{ 8U, { 0x48U, 0xc7U, 0x47U, 0x18U, 0x00U, 0x00U, 0x00U, 0x00U } }, /* mov qword [rdi+0x18],0 */
+	{ 5U, { 0x41U, 0x89U, 0x44U, 0x24U, 0x04U } },		/* mov [r12+4],eax */
+	{ 7U, { 0x8bU, 0x84U, 0x87U, 0x80U, 0x00U, 0x00U, 0x00U } },	/* mov eax,[rdi+rax*4+0x80] */
+	{ 3U, { 0x2bU, 0x47U, 0x04U } },				/* sub eax,[rdi+4] */
+	{ 2U, { 0xf3U, 0xabU } },					/* rep stosd */
+};
+
+#define NR_INSTRS	(sizeof(instrs) / sizeof(instrs[0]))
+#define NR_EXITS	(1U << 16)
+#define ROUNDS		16U
+#define PATCH_RIP	(TEXT_GVA + 0x1f00UL)
+
+static uint32_t stream[NR_EXITS];
+static struct instr_emul_ctxt ctxt;
+
+static void setup(void)
+{
+	uint64_t off;
+	uint32_t i;
+
+	host = aligned_alloc(0x1000U, HOST_MEM);
+	if (host == NULL) {
+		bench_fail("out of memory");
+	}
+	memset(host, 0, HOST_MEM);
+	ept_map_guest();
+	guest_cr3 = next_gpa;
+	next_gpa += 0x1000UL;
+	/* 2M of kernel text, 4K mapped */
+	for (off = 0UL; off < 0x200000UL; off += 0x1000UL) {
+		guest_map(TEXT_GVA + off, TEXT_GPA + off);
+	}
+	/* the accessors are spread over the text, none crossing a page */
+	for (i = 0U; i < NR_INSTRS; i++) {
+		instrs[i].rip = TEXT_GVA + (i * 0x3c40UL);
+		if (copy_from_gva(&ctxt, instrs[i].rip, 1U) != 0) {
+			bench_fail("text not mapped");
+		}
+		memcpy(host + gpa2hpa(TEXT_GPA + (instrs[i].rip - TEXT_GVA)), instrs[i].bytes, instrs[i].len);
+	}
+}
+
+/* a hot driver loop: a few accessors take most exits */
+static void gen_hot(uint64_t *seed)
+{
+	static const uint32_t hot[] = { 0U, 0U, 0U, 0U, 1U, 1U, 1U, 4U, 4U, 5U, 8U, 14U, 16U, 21U };
+	uint32_t i;
+
+	for (i = 0U; i < NR_EXITS; i++) {
+		stream[i] = hot[bench_rand(seed) % (sizeof(hot) / sizeof(hot[0]))];
+	}
+}
+
+static void gen_all(void)
+{
+	uint32_t i;
+
+	for (i = 0U; i < NR_EXITS; i++) {
+		stream[i] = i % NR_INSTRS;
+	}
+}
+
+static void patch(uint32_t exit)
+{
+	const struct instr *in = &instrs[((exit & 1U) != 0U) ? 1U : 0U];
+
+	memcpy(host + gpa2hpa(TEXT_GPA + (PATCH_RIP - TEXT_GVA)), in->bytes, in->len);
+}
+
+static bool same_decode(const struct instr_emul_vie *a, const struct instr_emul_vie *b)
+{
+	return (a->num_valid == b->num_valid) && (a->num_processed == b->num_processed) &&
+		(a->opsize == b->opsize) && (a->addrsize == b->addrsize) && (a->rex_w == b->rex_w) &&
+		(a->rex_r == b->rex_r) && (a->rex_x == b->rex_x) && (a->rex_b == b->rex_b) &&
+		(a->repz_present == b->repz_present) && (a->opsize_override == b->opsize_override) &&
+		(a->mod == b->mod) && (a->reg == b->reg) && (a->rm == b->rm) && (a->ss == b->ss) &&
+		(a->index == b->index) && (a->base == b->base) && (a->scale == b->scale) &&
+		(a->base_register == b->base_register) && (a->index_register == b->index_register) &&
+		(a->segment_register == b->segment_register) && (a->displacement == b->displacement) &&
+		(a->immediate == b->immediate) && (a->opcode == b->opcode) &&
+		(a->op.op_type == b->op.op_type) && (a->op.op_flags == b->op.op_flags) && (a->decoded == b->decoded) &&
+		(memcmp(a->inst, b->inst, VIE_INST_SIZE) == 0);
+}
+
+/* 0: fetch only, 1: fetch and decode, 2: fetch and decode cache */
+static uint32_t one_exit(uint32_t variant, uint32_t exit, bool patched)
+{
+	uint64_t rip = patched ? PATCH_RIP : instrs[stream[exit]].rip;
+	uint32_t len = patched ? instrs[exit & 1U].len : instrs[stream[exit]].len;
+	uint32_t hit = 0U;
+
+	if (patched) {
+		patch(exit);
+	}
+	if (vie_init(&ctxt.vie, rip, len) != 0) {
+		bench_fail("fetch");
+	}
+	if (variant == 1U) {
+		if (local_decode_instruction(CPU_MODE_64BIT, false, &ctxt.vie) != 0) {
+			bench_fail("decode");
+		}
+	} else if (variant == 2U) {
+		if (lookup_decode_cache(&ctxt, CPU_MODE_64BIT, false)) {
+			hit = 1U;
+		} else if (local_decode_instruction(CPU_MODE_64BIT, false, &ctxt.vie) == 0) {
+			update_decode_cache(&ctxt, CPU_MODE_64BIT, false);
+		} else {
+			bench_fail("decode");
+		}
+	} else {
+		BENCH_KEEP(ctxt.vie.inst[0]);
+	}
+	return hit;
+}
+
+static void run(const char *name, bool patched)
+{
+	static const char *const variants[] = { "fetch only", "fetch + decode", "fetch + decode cache" };
+	struct instr_emul_vie ref;
+	uint32_t i, r, v, hits = 0U;
+	uint64_t t;
+	char buf[80];
+
+	printf("%s\n", name);
+	memset(ctxt.cache, 0, sizeof(ctxt.cache));
+	for (i = 0U; i < NR_EXITS; i++) {
+		(void)one_exit(1U, i, patched);
+		ref = ctxt.vie;
+		hits += one_exit(2U, i, patched);
+		if (!same_decode(&ref, &ctxt.vie)) {
+			bench_fail("decode cache and decoder disagree");
+		}
+	}
+	for (v = 0U; v < 3U; v++) {
+		t = bench_now_ns();
+		for (r = 0U; r < ROUNDS; r++) {
+			for (i = 0U; i < NR_EXITS; i++) {
+				(void)one_exit(v, i, patched);
+			}
+		}
+		t = bench_now_ns() - t;
+		snprintf(buf, sizeof(buf), "%s", variants[v]);
+		bench_report(buf, t, ROUNDS * NR_EXITS);
+	}
+	printf("  %-44s %10.1f %%\n", "decode cache hits", (100.0 * hits) / NR_EXITS);
+}
+
+int main(void)
+{
+	uint64_t seed = 0x9E3779B97F4A7C15UL;
+
+	setup();
+	gen_hot(&seed);
+	run("driver loop, 8 hot accessors", false);
+	gen_all();
+	run("32 accessors in turn", false);
+	run("code patched between two accessors", true);
+	free(host);
+	return 0;
+}
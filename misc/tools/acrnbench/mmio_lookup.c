@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Emulated MMIO handler lookup, as done by hv_emulate_mmio() for every
+ * MMIO exit: the former linear scan of vm->emul_mmio[] against the sorted
+ * range index with the per-vCPU hint (hypervisor/dm/io_req.c).
+ *
+ * Three access patterns are measured for 16 (the Kconfig default), 64 and
+ * 128 registered regions: a vCPU hammering the same device, accesses
+ * spread over all regions, and accesses no region claims, which is how
+ * every access forwarded to the device model starts.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include "bench.h"
+
+#define MAX_REGIONS	128U
+#define NR_ACCESSES	(1U << 16)
+#define ROUNDS		64U
+
+struct mem_io_node {
+	void *read_write;
+	uint64_t range_start;
+	uint64_t range_end;
+};
+
+struct vm_model {
+	struct mem_io_node emul_mmio[MAX_REGIONS];
+	struct mem_io_node *emul_mmio_index[MAX_REGIONS];
+	uint16_t nr_emul_mmio_regions;
+	uint16_t max_emul_mmio_regions;
+	bool emul_mmio_overlapped;
+	struct mem_io_node *mmio_hint;
+};
+
+static int handler;
+
+/* baseline: every slot up to the highest one ever used is checked */
+static struct mem_io_node *find_linear(struct vm_model *vm, uint64_t address, uint64_t size)
+{
+	struct mem_io_node *node;
+	uint16_t idx;
+
+	for (idx = 0U; idx <= vm->max_emul_mmio_regions; idx++) {
+		node = &vm->emul_mmio[idx];
+		if ((node->read_write != NULL) && ((address + size) > node->range_start) &&
+				(address < node->range_end)) {
+			return ((address >= node->range_start) && ((address + size) <= node->range_end)) ?
+				node : NULL;
+		}
+	}
+	return NULL;
+}
+
+/* same as mmio_index_lower_bound() */
+static uint16_t lower_bound(const struct vm_model *vm, uint64_t start, uint64_t end)
+{
+	uint16_t low = 0U, high = vm->nr_emul_mmio_regions, mid;
+	const struct mem_io_node *node;
+
+	while (low < high) {
+		mid = low + ((high - low) >> 1U);
+		node = vm->emul_mmio_index[mid];
+		if ((node->range_start < start) || ((node->range_start == start) && (node->range_end < end))) {
+			low = mid + 1U;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+/* same as find_access_mmio_node() */
+static struct mem_io_node *find_indexed(struct vm_model *vm, uint64_t address, uint64_t size)
+{
+	struct mem_io_node *node = vm->mmio_hint;
+	uint16_t pos;
+
+	if ((node == NULL) || (node->read_write == NULL) ||
+			(address < node->range_start) || ((address + size) > node->range_end)) {
+		node = NULL;
+		pos = lower_bound(vm, address + size, 0UL);
+		if (pos > 0U) {
+			node = vm->emul_mmio_index[pos - 1U];
+			if (node->range_end <= address) {
+				node = NULL;
+			} else if (node->range_start <= address) {
+				vm->mmio_hint = node;
+			}
+		}
+		if (vm->emul_mmio_overlapped && ((node == NULL) || (address < node->range_start)
+				|| ((address + size) > node->range_end))) {
+			for (pos = 0U; pos < vm->nr_emul_mmio_regions; pos++) {
+				if ((address >= vm->emul_mmio_index[pos]->range_start) &&
+						((address + size) <= vm->emul_mmio_index[pos]->range_end)) {
+					node = vm->emul_mmio_index[pos];
+					vm->mmio_hint = node;
+					break;
+				}
+			}
+		}
+	}
+	/* a node only partly covering the access is an error either way */
+	if ((node != NULL) && ((address < node->range_start) || ((address + size) > node->range_end))) {
+		node = NULL;
+	}
+	return node;
+}
+
+static void register_region(struct vm_model *vm, uint16_t slot, uint64_t start, uint64_t end)
+{
+	struct mem_io_node *node = &vm->emul_mmio[slot];
+	uint16_t pos, idx;
+
+	node->read_write = &handler;
+	node->range_start = start;
+	node->range_end = end;
+	if (slot > vm->max_emul_mmio_regions) {
+		vm->max_emul_mmio_regions = slot;
+	}
+
+	pos = lower_bound(vm, start, end);
+	for (idx = vm->nr_emul_mmio_regions; idx > pos; idx--) {
+		vm->emul_mmio_index[idx] = vm->emul_mmio_index[idx - 1U];
+	}
+	vm->emul_mmio_index[pos] = node;
+	vm->nr_emul_mmio_regions++;
+
+	vm->emul_mmio_overlapped = false;
+	for (idx = 1U; idx < vm->nr_emul_mmio_regions; idx++) {
+		if (vm->emul_mmio_index[idx - 1U]->range_end > vm->emul_mmio_index[idx]->range_start) {
+			vm->emul_mmio_overlapped = true;
+		}
+	}
+}
+
+/* 4K..64K regions at random page aligned places below 4G, no overlap */
+static void setup(struct vm_model *vm, uint16_t nr, uint64_t *seed)
+{
+	uint64_t start, end;
+	uint16_t i, j;
+	bool clash;
+
+	memset(vm, 0, sizeof(*vm));
+	for (i = 0U; i < nr; i++) {
+		do {
+			start = (0xC0000000UL + ((bench_rand(seed) % 0x3F000UL) << 12U));
+			end = start + ((1UL + (bench_rand(seed) % 16UL)) << 12U);
+			clash = false;
+			for (j = 0U; j < i; j++) {
+				if ((start < vm->emul_mmio[j].range_end) && (end > vm->emul_mmio[j].range_start)) {
+					clash = true;
+				}
+			}
+		} while (clash);
+		register_region(vm, i, start, end);
+	}
+}
+
+static void make_accesses(const struct vm_model *vm, uint64_t *addr, int pattern, uint64_t *seed)
+{
+	const struct mem_io_node *node;
+	uint32_t i;
+
+	for (i = 0U; i < NR_ACCESSES; i++) {
+		switch (pattern) {
+		case 0:		/* one device, registered halfway */
+			node = &vm->emul_mmio[vm->nr_emul_mmio_regions / 2U];
+			addr[i] = node->range_start + ((bench_rand(seed) % (node->range_end - node->range_start)) & ~3UL);
+			break;
+		case 1:		/* all devices */
+			node = &vm->emul_mmio[bench_rand(seed) % vm->nr_emul_mmio_regions];
+			addr[i] = node->range_start + ((bench_rand(seed) % (node->range_end - node->range_start)) & ~3UL);
+			break;
+		default:	/* nobody's */
+			addr[i] = 0x80000000UL + ((bench_rand(seed) % 0x10000000UL) & ~3UL);
+			break;
+		}
+	}
+}
+
+static void run(uint16_t nr)
+{
+	static const char *const patterns[] = { "same device", "all devices", "unclaimed" };
+	static uint64_t addr[NR_ACCESSES];
+	static struct vm_model vm;
+	char name[64];
+	uint64_t seed = 0x9E3779B97F4A7C15UL, t, sum;
+	uint32_t i, r;
+	int p;
+
+	setup(&vm, nr, &seed);
+	printf("%u regions\n", nr);
+	for (p = 0; p < 3; p++) {
+		make_accesses(&vm, addr, p, &seed);
+		for (i = 0U; i < NR_ACCESSES; i++) {
+			if (find_linear(&vm, addr[i], 4UL) != find_indexed(&vm, addr[i], 4UL)) {
+				bench_fail("linear and indexed lookup disagree");
+			}
+		}
+
+		sum = 0UL;
+		t = bench_now_ns();
+		for (r = 0U; r < ROUNDS; r++) {
+			for (i = 0U; i < NR_ACCESSES; i++) {
+				sum += (uint64_t)find_linear(&vm, addr[i], 4UL);
+			}
+		}
+		t = bench_now_ns() - t;
+		BENCH_KEEP(sum);
+		snprintf(name, sizeof(name), "%s, linear scan", patterns[p]);
+		bench_report(name, t, (uint64_t)ROUNDS * NR_ACCESSES);
+
+		sum = 0UL;
+		vm.mmio_hint = NULL;
+		t = bench_now_ns();
+		for (r = 0U; r < ROUNDS; r++) {
+			for (i = 0U; i < NR_ACCESSES; i++) {
+				sum += (uint64_t)find_indexed(&vm, addr[i], 4UL);
+			}
+		}
+		t = bench_now_ns() - t;
+		BENCH_KEEP(sum);
+		snprintf(name, sizeof(name), "%s, hint + sorted index", patterns[p]);
+		bench_report(name, t, (uint64_t)ROUNDS * NR_ACCESSES);
+	}
+}
+
+/* two ranges sharing a start must each be found by their exact pair */
+static void check_ties(void)
+{
+	static struct vm_model vm;
+	uint16_t pos;
+
+	memset(&vm, 0, sizeof(vm));
+	register_region(&vm, 0U, 0xFEC00000UL, 0xFEC10000UL);
+	register_region(&vm, 1U, 0xFEC00000UL, 0xFEC01000UL);
+	register_region(&vm, 2U, 0xFEB00000UL, 0xFEB01000UL);
+
+	pos = lower_bound(&vm, 0xFEC00000UL, 0xFEC01000UL);
+	if (vm.emul_mmio_index[pos] != &vm.emul_mmio[1]) {
+		bench_fail("equal start, narrow range not found");
+	}
+	pos = lower_bound(&vm, 0xFEC00000UL, 0xFEC10000UL);
+	if (vm.emul_mmio_index[pos] != &vm.emul_mmio[0]) {
+		bench_fail("equal start, wide range not found");
+	}
+	if (find_indexed(&vm, 0xFEC08000UL, 4UL) != &vm.emul_mmio[0]) {
+		bench_fail("access covered by the wide range only");
+	}
+}
+
+int main(void)
+{
+	check_ties();
+	run(16U);
+	run(64U);
+	run(128U);
+	return 0;
+}
@@ -0,0 +1,630 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * virtio-net rx and tx paths of devicemodel/hw/pci/virtio/virtio_net.c:
+ * the former loops doing vq_getchain()/vq_relchain() per frame against
+ * the batched ones, which fetch VIRTIO_NET_BATCH chains with one avail
+ * index read and publish them with one used index update.
+ *
+ * The tap is stood in for by a packet mode pipe, which like a tap hands
+ * out one frame per read and takes one per write, so the syscall count is
+ * the same as with a real tap. Each round the host queues 64 frames (rx)
+ * or the guest posts 64 frames (tx); only the device side handling them is
+ * timed. The software loopback backend, which copies tx frames straight
+ * into rx buffers, shows the virtqueue cost without the syscalls, on top
+ * of both the per chain and the batched calls. Every frame carries a
+ * sequence number that the receiving side checks.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "bench.h"
+
+#define QSIZE		256U
+#define BATCH		16U		/* VIRTIO_NET_BATCH */
+#define RX_BUDGET	256U		/* VIRTIO_NET_RX_BUDGET */
+#define BURST		64U
+#define ROUNDS		4096U
+#define MAXSEGS		4U
+#define VHDRLEN		12U		/* mergeable rx buffers header */
+#define BUFSZ		2048U
+
+#define VRING_DESC_F_NEXT	1U
+#define VRING_DESC_F_WRITE	2U
+
+struct vring_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+};
+
+struct vring_avail {
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[QSIZE];
+};
+
+struct vring_used_elem {
+	uint32_t id;
+	uint32_t len;
+};
+
+struct vring_used {
+	uint16_t flags;
+	uint16_t idx;
+	struct vring_used_elem ring[QSIZE];
+};
+
+struct vq {
+	struct vring_desc desc[QSIZE];
+	struct vring_avail avail;
+	struct vring_used used;
+	uint16_t last_avail, save_used;
+	/* guest driver */
+	uint16_t avail_idx, last_used;
+};
+
+struct vq_chain {
+	uint16_t idx;
+	int niov;
+	struct iovec *iov;
+	uint32_t iolen;
+};
+
+struct frame {
+	struct iovec *iov;
+	int iovcnt;
+	int len;
+};
+
+static struct vq rxq, txq;
+static char *guest_mem;
+static int rx_pipe[2], tx_pipe[2];	/* the tap, one direction each */
+static uint64_t intr;
+
+/* ---- virtio core, split ring ---- */
+
+static inline bool vq_has_descs(struct vq *vq)
+{
+	return __atomic_load_n(&vq->avail.idx, __ATOMIC_ACQUIRE) != vq->last_avail;
+}
+
+static int vq_walk_chain(struct vq *vq, uint16_t next, struct iovec *iov, int n_iov)
+{
+	struct vring_desc *vd;
+	int i;
+
+	for (i = 0; i < n_iov; next = vd->next) {
+		vd = &vq->desc[next & (QSIZE - 1U)];
+		iov[i].iov_base = guest_mem + vd->addr;
+		iov[i].iov_len = vd->len;
+		i++;
+		if ((vd->flags & VRING_DESC_F_NEXT) == 0U) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int vq_getchain(struct vq *vq, uint16_t *pidx, struct iovec *iov, int n_iov)
+{
+	if ((uint16_t)(__atomic_load_n(&vq->avail.idx, __ATOMIC_ACQUIRE) - vq->last_avail) == 0U) {
+		return 0;
+	}
+	*pidx = vq->avail.ring[vq->last_avail & (QSIZE - 1U)];
+	vq->last_avail++;
+	return vq_walk_chain(vq, *pidx, iov, n_iov);
+}
+
+static int vq_getchains(struct vq *vq, struct vq_chain *chains, int n, struct iovec *iov, int n_iov)
+{
+	uint16_t navail = (uint16_t)(__atomic_load_n(&vq->avail.idx, __ATOMIC_ACQUIRE) - vq->last_avail);
+	int got, used = 0, r;
+
+	for (got = 0; (got < n) && (got < navail); got++) {
+		chains[got].idx = vq->avail.ring[vq->last_avail & (QSIZE - 1U)];
+		r = vq_walk_chain(vq, chains[got].idx, &iov[used], n_iov - used);
+		if ((r < 0) || (used + r > n_iov)) {
+			break;
+		}
+		vq->last_avail++;
+		chains[got].niov = r;
+		chains[got].iov = &iov[used];
+		chains[got].iolen = 0U;
+		used += r;
+	}
+	return got;
+}
+
+static void vq_relchain(struct vq *vq, uint16_t idx, uint32_t iolen)
+{
+	struct vring_used_elem *vue = &vq->used.ring[vq->used.idx & (QSIZE - 1U)];
+
+	vue->id = idx;
+	vue->len = iolen;
+	__atomic_store_n(&vq->used.idx, (uint16_t)(vq->used.idx + 1U), __ATOMIC_RELEASE);
+}
+
+static void vq_relchains(struct vq *vq, const struct vq_chain *chains, int n)
+{
+	uint16_t uidx = vq->used.idx;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		vq->used.ring[uidx & (QSIZE - 1U)].id = chains[i].idx;
+		vq->used.ring[uidx & (QSIZE - 1U)].len = chains[i].iolen;
+		uidx++;
+	}
+	__atomic_store_n(&vq->used.idx, uidx, __ATOMIC_RELEASE);
+}
+
+static void vq_endchains(struct vq *vq, int used_all_avail)
+{
+	uint16_t old_idx = vq->save_used;
+
+	(void)used_all_avail;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	vq->save_used = vq->used.idx;
+	if (vq->save_used != old_idx) {
+		intr++;
+	}
+}
+
+/* same as iov_trim_hdr() */
+static struct iovec *iov_trim_hdr(struct iovec *iov, int *niov, size_t tlen)
+{
+	if (iov[0].iov_len < tlen) {
+		return NULL;
+	}
+	iov[0].iov_len -= tlen;
+	if (iov[0].iov_len == 0U) {
+		if (*niov <= 1) {
+			return NULL;
+		}
+		*niov -= 1;
+		return &iov[1];
+	}
+	iov[0].iov_base = (char *)iov[0].iov_base + tlen;
+	return &iov[0];
+}
+
+/* ---- rx ---- */
+
+static void rx_per_chain(void)
+{
+	struct iovec iov[MAXSEGS], *riov;
+	uint16_t idx;
+	void *vrx;
+	int n;
+	ssize_t len;
+
+	do {
+		n = vq_getchain(&rxq, &idx, iov, MAXSEGS);
+		if (n < 1) {
+			return;
+		}
+		vrx = iov[0].iov_base;
+		riov = iov_trim_hdr(iov, &n, VHDRLEN);
+		if (riov == NULL) {
+			return;
+		}
+		len = readv(rx_pipe[0], riov, n);
+		if ((len < 0) && (errno == EWOULDBLOCK)) {
+			rxq.last_avail--;
+			vq_endchains(&rxq, 0);
+			return;
+		}
+		memset(vrx, 0, VHDRLEN);
+		vq_relchain(&rxq, idx, (uint32_t)len + VHDRLEN);
+	} while (vq_has_descs(&rxq));
+	vq_endchains(&rxq, 1);
+}
+
+static void rx_batched(void)
+{
+	struct iovec iov[MAXSEGS * BATCH], *riov;
+	struct vq_chain chains[BATCH], *c;
+	int budget = RX_BUDGET, n, i, niov;
+	void *vrx;
+	ssize_t len;
+
+	do {
+		n = vq_getchains(&rxq, chains, (budget < (int)BATCH) ? budget : (int)BATCH,
+				iov, MAXSEGS * BATCH);
+		if (n < 1) {
+			return;
+		}
+		for (i = 0; i < n; i++) {
+			c = &chains[i];
+			niov = c->niov;
+			vrx = c->iov[0].iov_base;
+			riov = iov_trim_hdr(c->iov, &niov, VHDRLEN);
+			if (riov == NULL) {
+				c->iolen = 0U;
+				vq_relchains(&rxq, chains, i + 1);
+				rxq.last_avail -= (uint16_t)(n - i - 1);
+				vq_endchains(&rxq, 0);
+				return;
+			}
+			len = readv(rx_pipe[0], riov, niov);
+			if ((len < 0) && (errno == EWOULDBLOCK)) {
+				vq_relchains(&rxq, chains, i);
+				rxq.last_avail -= (uint16_t)(n - i);
+				vq_endchains(&rxq, 0);
+				return;
+			}
+			memset(vrx, 0, VHDRLEN);
+			c->iolen = (uint32_t)len + VHDRLEN;
+		}
+		vq_relchains(&rxq, chains, n);
+		budget -= n;
+	} while ((budget > 0) && vq_has_descs(&rxq));
+	vq_endchains(&rxq, !vq_has_descs(&rxq));
+}
+
+/* ---- tx ---- */
+
+static void tap_tx(struct frame *frames, int n)
+{
+	static char pad[60];
+	struct iovec *iov;
+	int i, iovcnt;
+
+	for (i = 0; i < n; i++) {
+		iov = frames[i].iov;
+		iovcnt = frames[i].iovcnt;
+		if (frames[i].len < 60) {
+			iov[iovcnt].iov_base = pad;
+			iov[iovcnt].iov_len = 60U - (size_t)frames[i].len;
+			iovcnt++;
+		}
+		if (writev(tx_pipe[1], iov, iovcnt) < 0) {
+			bench_fail("tap writev");
+		}
+	}
+}
+
+static void tx_per_chain(void)
+{
+	struct iovec iov[MAXSEGS + 1];
+	struct frame f;
+	uint16_t idx;
+	int i, n;
+
+	while (vq_has_descs(&txq)) {
+		n = vq_getchain(&txq, &idx, iov, MAXSEGS);
+		if (n < 2) {
+			return;
+		}
+		f.iov = &iov[1];
+		f.iovcnt = n - 1;
+		f.len = 0;
+		for (i = 1; i < n; i++) {
+			f.len += (int)iov[i].iov_len;
+		}
+		tap_tx(&f, 1);
+		vq_relchain(&txq, idx, (uint32_t)f.len + (uint32_t)iov[0].iov_len);
+	}
+	vq_endchains(&txq, 1);
+}
+
+static int tx_fetch(struct vq_chain *chains, struct frame *frames, struct iovec *iov, int *nframes)
+{
+	int i, j, n, niov;
+	struct iovec *tiov;
+
+	n = vq_getchains(&txq, chains, BATCH, iov, MAXSEGS * BATCH);
+	for (i = 0, *nframes = 0; i < n; i++) {
+		niov = chains[i].niov;
+		tiov = iov_trim_hdr(chains[i].iov, &niov, VHDRLEN);
+		if (tiov == NULL) {
+			chains[i].iolen = 0U;
+			continue;
+		}
+		frames[*nframes].iov = tiov;
+		frames[*nframes].iovcnt = niov;
+		frames[*nframes].len = 0;
+		for (j = 0; j < niov; j++) {
+			frames[*nframes].len += (int)tiov[j].iov_len;
+		}
+		chains[i].iolen = VHDRLEN + (uint32_t)frames[*nframes].len;
+		(*nframes)++;
+	}
+	return n;
+}
+
+static void tx_batched(void)
+{
+	struct iovec iov[(MAXSEGS * BATCH) + 1];
+	struct vq_chain chains[BATCH];
+	struct frame frames[BATCH];
+	int n, nframes;
+
+	while (vq_has_descs(&txq)) {
+		n = tx_fetch(chains, frames, iov, &nframes);
+		if (n < 1) {
+			return;
+		}
+		tap_tx(frames, nframes);
+		vq_relchains(&txq, chains, n);
+	}
+	vq_endchains(&txq, 1);
+}
+
+/* virtio_net_loopback_copy(): one tx frame into one rx chain */
+static uint32_t loopback_copy(struct iovec *rx_iov, int niov, const struct frame *f)
+{
+	struct iovec *riov;
+	size_t off = 0U, soff = 0U, len, copied = 0U;
+	int j = 0;
+
+	memset(rx_iov[0].iov_base, 0, VHDRLEN);
+	riov = iov_trim_hdr(rx_iov, &niov, VHDRLEN);
+	while ((riov != NULL) && (j < f->iovcnt) && (niov > 0)) {
+		len = f->iov[j].iov_len - soff;
+		if (len > (riov->iov_len - off)) {
+			len = riov->iov_len - off;
+		}
+		memcpy((char *)riov->iov_base + off, (char *)f->iov[j].iov_base + soff, len);
+		copied += len;
+		soff += len;
+		off += len;
+		if (soff == f->iov[j].iov_len) {
+			j++;
+			soff = 0U;
+		}
+		if (off == riov->iov_len) {
+			riov++;
+			niov--;
+			off = 0U;
+		}
+	}
+	return (uint32_t)copied + VHDRLEN;
+}
+
+/* the loopback backend on top of the per chain calls */
+static void loopback_per_chain(void)
+{
+	struct iovec iov[MAXSEGS + 1], riov[MAXSEGS];
+	struct frame f;
+	uint16_t idx, ridx;
+	int i, n, rn;
+
+	while (vq_has_descs(&txq)) {
+		n = vq_getchain(&txq, &idx, iov, MAXSEGS);
+		if (n < 2) {
+			return;
+		}
+		f.iov = &iov[1];
+		f.iovcnt = n - 1;
+		f.len = 0;
+		for (i = 1; i < n; i++) {
+			f.len += (int)iov[i].iov_len;
+		}
+		rn = vq_getchain(&rxq, &ridx, riov, MAXSEGS);
+		if (rn > 0) {
+			vq_relchain(&rxq, ridx, loopback_copy(riov, rn, &f));
+		}
+		vq_relchain(&txq, idx, (uint32_t)f.len + (uint32_t)iov[0].iov_len);
+	}
+	vq_endchains(&rxq, !vq_has_descs(&rxq));
+	vq_endchains(&txq, 1);
+}
+
+/* virtio_net_loopback_tx() */
+static void loopback_batched(void)
+{
+	struct iovec iov[(MAXSEGS * BATCH) + 1], riov[MAXSEGS * BATCH];
+	struct vq_chain chains[BATCH], rchains[BATCH];
+	struct frame frames[BATCH];
+	int n, nframes, got, i;
+
+	while (vq_has_descs(&txq)) {
+		n = tx_fetch(chains, frames, iov, &nframes);
+		if (n < 1) {
+			return;
+		}
+		got = vq_getchains(&rxq, rchains, nframes, riov, MAXSEGS * BATCH);
+		for (i = 0; i < got; i++) {
+			rchains[i].iolen = loopback_copy(rchains[i].iov, rchains[i].niov, &frames[i]);
+		}
+		vq_relchains(&rxq, rchains, got);
+		vq_relchains(&txq, chains, n);
+	}
+	vq_endchains(&rxq, !vq_has_descs(&rxq));
+	vq_endchains(&txq, 1);
+}
+
+/* ---- guest and host side, not timed ---- */
+
+static void guest_init(void)
+{
+	uint32_t i;
+
+	memset(&rxq, 0, sizeof(rxq));
+	memset(&txq, 0, sizeof(txq));
+	for (i = 0U; i < QSIZE; i++) {
+		/* rx: one buffer for header and frame */
+		rxq.desc[i].addr = (uint64_t)i * BUFSZ;
+		rxq.desc[i].len = BUFSZ;
+		rxq.desc[i].flags = VRING_DESC_F_WRITE;
+		rxq.avail.ring[i] = (uint16_t)i;
+	}
+	rxq.avail_idx = QSIZE;
+	__atomic_store_n(&rxq.avail.idx, rxq.avail_idx, __ATOMIC_RELEASE);
+}
+
+/* post the tx frames as a header and a data descriptor each */
+static void guest_tx(uint32_t seq, uint32_t size)
+{
+	struct vring_desc *hd, *dd;
+	uint16_t head;
+	uint32_t i;
+
+	for (i = 0U; i < BURST; i++) {
+		head = (uint16_t)((txq.avail_idx * 2U) & (QSIZE - 1U));
+		hd = &txq.desc[head];
+		dd = &txq.desc[head + 1U];
+		hd->addr = (QSIZE * BUFSZ) + ((uint64_t)head * BUFSZ);
+		hd->len = VHDRLEN;
+		hd->flags = VRING_DESC_F_NEXT;
+		hd->next = head + 1U;
+		dd->addr = hd->addr + VHDRLEN;
+		dd->len = size;
+		dd->flags = 0U;
+		*(uint32_t *)(guest_mem + dd->addr) = seq + i;
+		txq.avail.ring[txq.avail_idx & (QSIZE - 1U)] = head;
+		txq.avail_idx++;
+	}
+	__atomic_store_n(&txq.avail.idx, txq.avail_idx, __ATOMIC_RELEASE);
+}
+
+static void guest_tx_reap(uint32_t size)
+{
+	while (txq.last_used != __atomic_load_n(&txq.used.idx, __ATOMIC_ACQUIRE)) {
+		if (txq.used.ring[txq.last_used & (QSIZE - 1U)].len != (VHDRLEN + size)) {
+			bench_fail("tx used length");
+		}
+		txq.last_used++;
+	}
+}
+
+/* check the received frames and post their buffers again */
+static uint32_t guest_rx_reap(uint32_t seq, uint32_t size)
+{
+	struct vring_used_elem *ue;
+	uint32_t n = 0U, len = (size < 60U) ? 60U : size;
+
+	while (rxq.last_used != __atomic_load_n(&rxq.used.idx, __ATOMIC_ACQUIRE)) {
+		ue = &rxq.used.ring[rxq.last_used & (QSIZE - 1U)];
+		if ((ue->len != (VHDRLEN + len)) && (ue->len != (VHDRLEN + size))) {
+			bench_fail("rx used length");
+		}
+		if (*(uint32_t *)(guest_mem + ((uint64_t)ue->id * BUFSZ) + VHDRLEN) != (seq + n)) {
+			bench_fail("rx frame out of order");
+		}
+		rxq.avail.ring[rxq.avail_idx & (QSIZE - 1U)] = (uint16_t)ue->id;
+		rxq.avail_idx++;
+		rxq.last_used++;
+		n++;
+	}
+	__atomic_store_n(&rxq.avail.idx, rxq.avail_idx, __ATOMIC_RELEASE);
+	return n;
+}
+
+static void host_send(uint32_t seq, uint32_t size)
+{
+	static char frame[BUFSZ];
+	uint32_t i;
+
+	for (i = 0U; i < BURST; i++) {
+		*(uint32_t *)frame = seq + i;
+		if (write(rx_pipe[1], frame, size) != (ssize_t)size) {
+			bench_fail("host write");
+		}
+	}
+}
+
+static void host_recv(uint32_t seq, uint32_t size)
+{
+	static char frame[BUFSZ];
+	uint32_t i;
+	ssize_t len;
+
+	for (i = 0U; i < BURST; i++) {
+		len = read(tx_pipe[0], frame, sizeof(frame));
+		if ((len != (ssize_t)((size < 60U) ? 60U : size)) || (*(uint32_t *)frame != (seq + i))) {
+			bench_fail("host received a bad frame");
+		}
+	}
+}
+
+static uint64_t run_rx(void (*rx)(void), uint32_t size)
+{
+	uint64_t t = 0UL, t0;
+	uint32_t r, seq = 0U;
+
+	guest_init();
+	intr = 0UL;
+	for (r = 0U; r < ROUNDS; r++) {
+		host_send(seq, size);
+		t0 = bench_now_ns();
+		rx();
+		t += bench_now_ns() - t0;
+		if (guest_rx_reap(seq, size) != BURST) {
+			bench_fail("rx frames lost");
+		}
+		seq += BURST;
+	}
+	return t;
+}
+
+static uint64_t run_tx(void (*tx)(void), uint32_t size, bool loopback)
+{
+	uint64_t t = 0UL, t0;
+	uint32_t r, seq = 0U;
+
+	guest_init();
+	intr = 0UL;
+	for (r = 0U; r < ROUNDS; r++) {
+		guest_tx(seq, size);
+		t0 = bench_now_ns();
+		tx();
+		t += bench_now_ns() - t0;
+		guest_tx_reap(size);
+		if (loopback) {
+			if (guest_rx_reap(seq, size) != BURST) {
+				bench_fail("loopback frames lost");
+			}
+		} else {
+			host_recv(seq, size);
+		}
+		seq += BURST;
+	}
+	return t;
+}
+
+int main(void)
+{
+	static const uint32_t sizes[] = { 64U, 1500U };
+	char name[64];
+	uint64_t t;
+	uint32_t s;
+
+	guest_mem = calloc(2U * QSIZE, BUFSZ);
+	if ((guest_mem == NULL) || (pipe2(rx_pipe, O_DIRECT | O_NONBLOCK) != 0) ||
+			(pipe2(tx_pipe, O_DIRECT | O_NONBLOCK) != 0) ||
+			(fcntl(rx_pipe[1], F_SETPIPE_SZ, 1 << 20) < 0) ||
+			(fcntl(tx_pipe[1], F_SETPIPE_SZ, 1 << 20) < 0)) {
+		bench_fail("setup");
+	}
+
+	for (s = 0U; s < (sizeof(sizes) / sizeof(sizes[0])); s++) {
+		printf("%u byte frames, %u per wakeup\n", sizes[s], BURST);
+
+		t = run_rx(rx_per_chain, sizes[s]);
+		snprintf(name, sizeof(name), "rx, per chain (%.2f intr/wakeup)", (double)intr / ROUNDS);
+		bench_report(name, t, (uint64_t)ROUNDS * BURST);
+		t = run_rx(rx_batched, sizes[s]);
+		snprintf(name, sizeof(name), "rx, batched (%.2f intr/wakeup)", (double)intr / ROUNDS);
+		bench_report(name, t, (uint64_t)ROUNDS * BURST);
+
+		bench_report("tx, per chain", run_tx(tx_per_chain, sizes[s], false), (uint64_t)ROUNDS * BURST);
+		bench_report("tx, batched", run_tx(tx_batched, sizes[s], false), (uint64_t)ROUNDS * BURST);
+		bench_report("loopback, per chain", run_tx(loopback_per_chain, sizes[s], true),
+			(uint64_t)ROUNDS * BURST);
+		bench_report("loopback, batched", run_tx(loopback_batched, sizes[s], true),
+			(uint64_t)ROUNDS * BURST);
+	}
+	free(guest_mem);
+	return 0;
+}
@@ -0,0 +1,519 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * vCPU load balancing: per-pCPU BVT runqueues alone against the push to
+ * idle pCPUs of CONFIG_SCHED_BALANCE (hypervisor/common/schedule.c and
+ * sched_bvt.c), as a discrete time simulation in steps of 100us.
+ *
+ * Each pCPU runs the BVT rules of sched_bvt.c: the runqueue is ordered by
+ * evt, a woken thread gets its avt pulled up to the svt, the first thread
+ * runs until it is one CSA ahead of the second. With balancing, schedule()
+ * first lets pick_migrate() choose the queued thread with the latest evt
+ * which may run on an idle pCPU, moves it to the lowest such pCPU unless
+ * vcpu_migrate() refuses (another vCPU of the VM or an RT vCPU is there),
+ * and the slice timer fires each mcu while a push is possible. A moved
+ * vCPU is charged a cold cache penalty.
+ *
+ * Every vCPU runs a fixed amount of work in bursts separated by I/O waits.
+ * Reported are the makespan, the share of pCPU time used, Jain's fairness
+ * index of the per-vCPU slowdown (completion time over work plus waits,
+ * 1.0 when all vCPUs are slowed down alike) and the migrations. Both
+ * variants must do the same work, and no vCPU may ever run outside its
+ * affinity or next to another vCPU of its VM.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include "bench.h"
+
+#define MAX_PCPUS	8U
+#define MAX_VCPUS	32U
+#define MCU_TICKS	10U		/* BVT_MCU_MS, in 100us ticks */
+#define CSA_MCU		5U		/* BVT_CSA_MCU */
+#define MIGRATE_TICKS	1U		/* VMCLEAR, cold caches and TLB */
+#define IDLE		(-1)
+
+struct vcpu {
+	uint32_t vm;
+	uint32_t pcpu;
+	uint64_t mask;
+	bool rt;
+	bool done;
+	bool blocked;
+	uint32_t total;		/* ticks of work */
+	uint32_t work;		/* ticks of work left */
+	uint32_t burst;		/* ticks left in this burst */
+	uint32_t wait;		/* ticks left in this I/O wait */
+	uint32_t waited;	/* ticks spent in I/O waits */
+	uint32_t penalty;	/* migration ticks left to pay */
+	uint32_t burst_mean;
+	uint32_t wait_mean;
+	int64_t avt;		/* mcu */
+	uint32_t residual;	/* ticks */
+	uint64_t start;
+	uint64_t finish;
+	uint64_t seed;		/* per vCPU, the same bursts in both variants */
+};
+
+struct pcpu {
+	uint32_t rq[MAX_VCPUS];
+	uint32_t nr;
+	int32_t curr;
+	uint64_t slice_end;	/* 0: no slice end */
+	uint64_t timer;		/* 0: slice timer not armed */
+	bool resched;
+	bool rt;
+	uint64_t busy;
+};
+
+struct sim {
+	uint32_t nr_pcpus;
+	uint32_t nr_vcpus;
+	struct pcpu pcpu[MAX_PCPUS];
+	struct vcpu vcpu[MAX_VCPUS];
+	bool balance;
+	uint64_t idle_bitmap;
+	uint64_t now;
+	uint64_t worked;
+	uint32_t migrations;
+	uint32_t refused;
+};
+
+struct result {
+	uint64_t makespan;
+	double util;
+	double jain;
+	uint32_t migrations;
+	uint32_t refused;
+};
+
+/* uniform on 1 .. 2 * mean - 1 */
+static uint32_t draw(uint64_t *seed, uint32_t mean)
+{
+	return 1U + (uint32_t)(bench_rand(seed) % ((2U * mean) - 1U));
+}
+
+static void rq_remove(struct pcpu *p, uint32_t v)
+{
+	uint32_t i;
+
+	for (i = 0U; i < p->nr; i++) {
+		if (p->rq[i] == v) {
+			memmove(&p->rq[i], &p->rq[i + 1U], (p->nr - i - 1U) * sizeof(p->rq[0]));
+			p->nr--;
+			return;
+		}
+	}
+	bench_fail("vcpu not in runqueue");
+}
+
+/* runqueue_add(): before the first one with a later evt */
+static void rq_add(struct sim *s, struct pcpu *p, uint32_t v)
+{
+	uint32_t i;
+
+	for (i = 0U; i < p->nr; i++) {
+		if (s->vcpu[p->rq[i]].avt > s->vcpu[v].avt) {
+			break;
+		}
+	}
+	memmove(&p->rq[i + 1U], &p->rq[i], (p->nr - i) * sizeof(p->rq[0]));
+	p->rq[i] = v;
+	p->nr++;
+}
+
+/* sched_bvt_wake() */
+static void bvt_wake(struct sim *s, struct pcpu *p, uint32_t v)
+{
+	int64_t svt = (p->nr != 0U) ? s->vcpu[p->rq[0]].avt : 0L;
+
+	if (s->vcpu[v].avt <= (svt - (int64_t)CSA_MCU)) {
+		s->vcpu[v].avt = svt;
+	}
+	rq_add(s, p, v);
+}
+
+/* update_vt() */
+static void update_vt(struct sim *s, struct pcpu *p, uint32_t v)
+{
+	struct vcpu *vc = &s->vcpu[v];
+	uint32_t ran = (uint32_t)(s->now - vc->start) + vc->residual;
+
+	vc->avt += ran / MCU_TICKS;
+	vc->residual = ran % MCU_TICKS;
+	if (!vc->blocked && !vc->done) {
+		rq_remove(p, v);
+		rq_add(s, p, v);
+	}
+}
+
+/* sched_bvt_pick_migrate(): latest evt first, the first one stays */
+static int32_t pick_migrate(struct sim *s, struct pcpu *p, uint64_t mask)
+{
+	uint32_t i;
+	int32_t v;
+
+	for (i = p->nr; i > 1U; i--) {
+		v = (int32_t)p->rq[i - 1U];
+		if ((v != p->curr) && ((s->vcpu[v].mask & mask) != 0UL)) {
+			return v;
+		}
+	}
+	return IDLE;
+}
+
+static uint64_t idle_pcpus(struct sim *s, uint32_t id)
+{
+	return s->balance ? (s->idle_bitmap & ~(1UL << id)) : 0UL;
+}
+
+/* vcpu_migrate() refuses a pCPU with a vCPU of the same VM or an RT vCPU */
+static bool may_migrate(struct sim *s, uint32_t v, uint32_t to)
+{
+	uint32_t i;
+
+	if (s->pcpu[to].rt) {
+		return false;
+	}
+	for (i = 0U; i < s->nr_vcpus; i++) {
+		if ((i != v) && !s->vcpu[i].done && (s->vcpu[i].pcpu == to) && (s->vcpu[i].vm == s->vcpu[v].vm)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* sched_balance() */
+static void balance(struct sim *s, uint32_t id)
+{
+	struct pcpu *p = &s->pcpu[id];
+	uint64_t idle = idle_pcpus(s, id);
+	int32_t v = IDLE;
+	uint32_t to;
+
+	if (idle != 0UL) {
+		v = pick_migrate(s, p, idle);
+	}
+	if ((v != IDLE) && !s->vcpu[v].rt) {
+		to = (uint32_t)__builtin_ctzl(s->vcpu[v].mask & idle);
+		if ((s->pcpu[to].curr == IDLE) && !s->pcpu[to].resched && may_migrate(s, (uint32_t)v, to)) {
+			rq_remove(p, (uint32_t)v);
+			s->vcpu[v].pcpu = to;
+			s->vcpu[v].penalty += MIGRATE_TICKS;
+			bvt_wake(s, &s->pcpu[to], (uint32_t)v);
+			s->idle_bitmap &= ~(1UL << to);
+			s->pcpu[to].resched = true;
+			s->migrations++;
+		} else {
+			s->refused++;
+		}
+	}
+}
+
+/* slice_timer_deadline() */
+static void arm_timer(struct sim *s, struct pcpu *p)
+{
+	p->timer = p->slice_end;
+	if (s->balance && (p->timer != 0UL) && (p->timer > (s->now + MCU_TICKS))) {
+		p->timer = s->now + MCU_TICKS;
+	}
+}
+
+/* schedule() with sched_bvt_pick_next() */
+static void schedule(struct sim *s, uint32_t id)
+{
+	struct pcpu *p = &s->pcpu[id];
+	struct vcpu *first;
+	int64_t delta;
+
+	if (s->balance) {
+		balance(s, id);
+	}
+	if (p->curr != IDLE) {
+		update_vt(s, p, (uint32_t)p->curr);
+	}
+	p->resched = false;
+	p->slice_end = 0UL;
+	if (p->nr == 0U) {
+		p->curr = IDLE;
+		s->idle_bitmap |= (1UL << id);
+	} else {
+		first = &s->vcpu[p->rq[0]];
+		if (p->nr > 1U) {
+			delta = s->vcpu[p->rq[1]].avt - first->avt;
+			p->slice_end = s->now + (((uint64_t)delta + CSA_MCU) * MCU_TICKS);
+		}
+		first->start = s->now;
+		p->curr = (int32_t)p->rq[0];
+		s->idle_bitmap &= ~(1UL << id);
+	}
+	arm_timer(s, p);
+}
+
+/* sched_slice_handler() */
+static void slice_timer(struct sim *s, uint32_t id)
+{
+	struct pcpu *p = &s->pcpu[id];
+
+	p->timer = 0UL;
+	if (p->curr != IDLE) {
+		if (s->now >= p->slice_end) {
+			p->resched = true;
+		} else if ((idle_pcpus(s, id) != 0UL) && (pick_migrate(s, p, idle_pcpus(s, id)) != IDLE)) {
+			p->resched = true;
+		} else {
+			arm_timer(s, p);
+		}
+	}
+}
+
+static void check(struct sim *s)
+{
+	uint32_t i, j;
+
+	for (i = 0U; i < s->nr_vcpus; i++) {
+		if ((s->vcpu[i].mask & (1UL << s->vcpu[i].pcpu)) == 0UL) {
+			bench_fail("vcpu outside of its affinity");
+		}
+		for (j = i + 1U; j < s->nr_vcpus; j++) {
+			if (!s->vcpu[i].done && !s->vcpu[j].done && (s->vcpu[i].vm == s->vcpu[j].vm) &&
+					(s->vcpu[i].pcpu == s->vcpu[j].pcpu)) {
+				bench_fail("two vcpus of a vm on one pcpu");
+			}
+		}
+		if (!s->vcpu[i].rt && s->pcpu[s->vcpu[i].pcpu].rt) {
+			bench_fail("vcpu moved next to an rt vcpu");
+		}
+	}
+}
+
+/* run the current vCPU of each pCPU for one tick */
+static void tick(struct sim *s, uint32_t id)
+{
+	struct pcpu *p = &s->pcpu[id];
+	struct vcpu *vc;
+
+	if (p->curr == IDLE) {
+		return;
+	}
+	vc = &s->vcpu[p->curr];
+	p->busy++;
+	if (vc->penalty != 0U) {
+		vc->penalty--;
+		return;
+	}
+	vc->work--;
+	vc->burst--;
+	s->worked++;
+	if (vc->work == 0U) {
+		vc->done = true;
+		vc->finish = s->now + 1UL;
+	} else if (vc->burst == 0U) {
+		vc->blocked = true;
+		vc->wait = draw(&vc->seed, vc->wait_mean);
+		vc->waited += vc->wait;
+	} else {
+		return;
+	}
+	/* sleep_thread() */
+	rq_remove(p, (uint32_t)p->curr);
+	p->resched = true;
+}
+
+static void simulate(struct sim *s, struct result *r)
+{
+	uint32_t i, nr = 0U, left = s->nr_vcpus;
+	double sum = 0.0, sum2 = 0.0, slowdown;
+	uint64_t busy = 0UL, total = 0UL;
+
+	for (i = 0U; i < s->nr_pcpus; i++) {
+		s->pcpu[i].curr = IDLE;
+		s->pcpu[i].resched = true;
+	}
+	for (s->now = 0UL; left != 0U; s->now++) {
+		for (i = 0U; i < s->nr_vcpus; i++) {
+			if (s->vcpu[i].blocked && (--s->vcpu[i].wait == 0U)) {
+				/* wake_thread() */
+				s->vcpu[i].blocked = false;
+				s->vcpu[i].burst = draw(&s->vcpu[i].seed, s->vcpu[i].burst_mean);
+				bvt_wake(s, &s->pcpu[s->vcpu[i].pcpu], i);
+				s->pcpu[s->vcpu[i].pcpu].resched = true;
+			}
+		}
+		for (i = 0U; i < s->nr_pcpus; i++) {
+			if ((s->pcpu[i].timer != 0UL) && (s->now >= s->pcpu[i].timer)) {
+				slice_timer(s, i);
+			}
+		}
+		for (i = 0U; i < s->nr_pcpus; i++) {
+			if (s->pcpu[i].resched) {
+				schedule(s, i);
+			}
+		}
+		check(s);
+		if (s->now > (100UL * MCU_TICKS * 1000UL)) {
+			bench_fail("no progress in 100s");
+		}
+		for (i = 0U; i < s->nr_pcpus; i++) {
+			tick(s, i);
+		}
+		left = 0U;
+		for (i = 0U; i < s->nr_vcpus; i++) {
+			left += s->vcpu[i].done ? 0U : 1U;
+		}
+	}
+
+	r->makespan = s->now;
+	r->migrations = s->migrations;
+	r->refused = s->refused;
+	for (i = 0U; i < s->nr_pcpus; i++) {
+		busy += s->pcpu[i].busy;
+	}
+	r->util = (double)busy / (double)(s->now * s->nr_pcpus);
+	for (i = 0U; i < s->nr_vcpus; i++) {
+		total += s->vcpu[i].total;
+		if (!s->vcpu[i].rt) {
+			slowdown = (double)s->vcpu[i].finish / (double)(s->vcpu[i].total + s->vcpu[i].waited);
+			sum += slowdown;
+			sum2 += slowdown * slowdown;
+			nr++;
+		}
+	}
+	if (s->worked != total) {
+		bench_fail("work lost");
+	}
+	r->jain = (sum * sum) / ((double)nr * sum2);
+}
+
+static void add_vcpu(struct sim *s, uint32_t vm, uint32_t pcpu, uint64_t mask, uint32_t work,
+	uint32_t burst_mean, uint32_t wait_mean, uint64_t seed)
+{
+	struct vcpu *vc = &s->vcpu[s->nr_vcpus];
+
+	memset(vc, 0, sizeof(*vc));
+	vc->vm = vm;
+	vc->pcpu = pcpu;
+	vc->mask = mask;
+	vc->total = work;
+	vc->work = work;
+	vc->burst_mean = burst_mean;
+	vc->wait_mean = wait_mean;
+	vc->seed = seed;
+	vc->burst = draw(&vc->seed, burst_mean);
+	rq_add(s, &s->pcpu[pcpu], s->nr_vcpus);
+	s->nr_vcpus++;
+}
+
+/* two vCPU VMs created on pCPU 0 and 1, all allowed on pCPU 0-3 */
+static void setup_skewed(struct sim *s, uint64_t seed)
+{
+	uint32_t vm;
+
+	s->nr_pcpus = 4U;
+	for (vm = 0U; vm < 3U; vm++) {
+		add_vcpu(s, vm, 0U, 0xfUL, 2000U, 50U, 5U, seed + (2U * vm));
+		add_vcpu(s, vm, 1U, 0xfUL, 2000U, 50U, 5U, seed + (2U * vm) + 1U);
+	}
+}
+
+/* two four vCPU VMs spread over pCPU 0-3, half of the time in I/O waits */
+static void setup_even(struct sim *s, uint64_t seed)
+{
+	uint32_t vm, i;
+
+	s->nr_pcpus = 4U;
+	for (vm = 0U; vm < 2U; vm++) {
+		for (i = 0U; i < 4U; i++) {
+			add_vcpu(s, vm, i, 0xfUL << i & 0xfUL, 2000U, 20U, 20U, seed + (4U * vm) + i);
+		}
+	}
+}
+
+/*
+ * An RT VM pinned to pCPU 3, the others created on pCPU 0 and 1 and, as
+ * sanitize_vm_config() demands, not allowed on pCPU 3.
+ */
+static void setup_rt(struct sim *s, uint64_t seed)
+{
+	s->nr_pcpus = 4U;
+	s->pcpu[3].rt = true;
+	add_vcpu(s, 0U, 3U, 0x8UL, 200U, 1U, 10U, seed);
+	s->vcpu[0].rt = true;
+	add_vcpu(s, 1U, 0U, 0x7UL, 2000U, 50U, 5U, seed + 1U);
+	add_vcpu(s, 1U, 1U, 0x7UL, 2000U, 50U, 5U, seed + 2U);
+	add_vcpu(s, 2U, 0U, 0x7UL, 2000U, 50U, 5U, seed + 3U);
+	add_vcpu(s, 3U, 0U, 0x7UL, 2000U, 50U, 5U, seed + 4U);
+	add_vcpu(s, 3U, 1U, 0x7UL, 2000U, 50U, 5U, seed + 5U);
+}
+
+/*
+ * 8 pCPUs, 5 VMs of 1 to 4 vCPUs, each vCPU created on a pCPU of its own
+ * within the VM and allowed on random pCPUs above it.
+ */
+static void setup_random(struct sim *s, uint64_t seed)
+{
+	uint64_t r = seed, used;
+	uint32_t vm, i, nr, home;
+
+	s->nr_pcpus = 8U;
+	for (vm = 0U; vm < 5U; vm++) {
+		nr = 1U + (uint32_t)(bench_rand(&r) % 4U);
+		used = 0UL;
+		for (i = 0U; i < nr; i++) {
+			do {
+				/* skewed towards the low pCPUs, as configs tend to be */
+				home = (uint32_t)(bench_rand(&r) % 4U) + (uint32_t)(bench_rand(&r) % 5U);
+			} while ((used & (1UL << home)) != 0UL);
+			used |= 1UL << home;
+			add_vcpu(s, vm, home, (1UL << home) | ((bench_rand(&r) & 0xffUL) & ~((2UL << home) - 1UL)),
+				1000U + (uint32_t)(bench_rand(&r) % 2000U),
+				10U + (uint32_t)(bench_rand(&r) % 90U),
+				5U + (uint32_t)(bench_rand(&r) % 45U), bench_rand(&r));
+		}
+	}
+}
+
+static void run(const char *name, void (*setup)(struct sim *s, uint64_t seed), uint32_t seeds)
+{
+	static struct sim sim;
+	struct result r, sum[2];
+	uint32_t b, i;
+
+	printf("%s%s\n", name, (seeds > 1U) ? ", mean of the seeds" : "");
+	memset(sum, 0, sizeof(sum));
+	for (i = 0U; i < seeds; i++) {
+		for (b = 0U; b < 2U; b++) {
+			memset(&sim, 0, sizeof(sim));
+			setup(&sim, 0x9E3779B97F4A7C15UL + (i * 0x100UL));
+			sim.balance = (b != 0U);
+			simulate(&sim, &r);
+			if (!sim.balance && (r.migrations != 0U)) {
+				bench_fail("migration without balancing");
+			}
+			sum[b].makespan += r.makespan;
+			sum[b].util += r.util;
+			sum[b].jain += r.jain;
+			sum[b].migrations += r.migrations;
+			sum[b].refused += r.refused;
+		}
+	}
+	for (b = 0U; b < 2U; b++) {
+		printf("  %-10s makespan %7.1f ms  util %5.1f%%  jain %5.3f  %6.1f migrations %6.1f refused\n",
+			(b != 0U) ? "balance" : "no balance",
+			(double)sum[b].makespan / (10.0 * seeds), (100.0 * sum[b].util) / seeds,
+			sum[b].jain / seeds, (double)sum[b].migrations / seeds, (double)sum[b].refused / seeds);
+	}
+}
+
+int main(void)
+{
+	run("3 VMs x 2 vCPUs created on pCPU 0-1 of 4", setup_skewed, 1U);
+	run("2 VMs x 4 vCPUs spread over 4 pCPUs", setup_even, 1U);
+	run("RT VM on pCPU 3, 5 vCPUs created on pCPU 0-1", setup_rt, 1U);
+	run("5 random VMs on 8 pCPUs, 32 seeds", setup_random, 32U);
+	return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Per-pCPU hypervisor timer queue (hypervisor/arch/x86/timer.c): the former
+ * sorted timer_list against the pairing heap.
+ *
+ * Two workloads run for 4 to 1024 armed timers:
+ * - expire: timer_softirq() takes the earliest timer and re-arms it one
+ *   period later, as periodic timers do;
+ * - reprogram: a random armed timer is deleted and added with a new
+ *   deadline, as a guest reprogramming its vLAPIC timer does.
+ * Both queues must expire the timers in the same deadline order.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include "bench.h"
+
+#define MAX_TIMERS	1024U
+#define NR_OPS		(1U << 20)
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+struct hv_timer {
+	uint64_t fire_tsc;
+	uint64_t period;
+	/* baseline */
+	struct list_head node;
+	/* pairing heap */
+	struct hv_timer *child, *sibling, *prev;
+};
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - __builtin_offsetof(type, member)))
+
+static struct hv_timer timers[MAX_TIMERS];
+static uint64_t order_list[NR_OPS], order_heap[NR_OPS];
+
+/* ---- sorted list, as before ---- */
+
+static struct list_head timer_list;
+
+static void list_add_after(struct list_head *n, struct list_head *prev)
+{
+	n->next = prev->next;
+	n->prev = prev;
+	prev->next->prev = n;
+	prev->next = n;
+}
+
+static void list_del_init(struct list_head *n)
+{
+	n->prev->next = n->next;
+	n->next->prev = n->prev;
+	n->next = n;
+	n->prev = n;
+}
+
+static void list_add_timer(struct hv_timer *timer)
+{
+	struct list_head *pos, *prev = &timer_list;
+	struct hv_timer *tmp;
+
+	for (pos = timer_list.next; pos != &timer_list; pos = pos->next) {
+		tmp = container_of(pos, struct hv_timer, node);
+		if (tmp->fire_tsc < timer->fire_tsc) {
+			prev = &tmp->node;
+		} else {
+			break;
+		}
+	}
+	list_add_after(&timer->node, prev);
+}
+
+static struct hv_timer *list_first_timer(void)
+{
+	return container_of(timer_list.next, struct hv_timer, node);
+}
+
+static void list_del_timer(struct hv_timer *timer)
+{
+	list_del_init(&timer->node);
+}
+
+/* ---- pairing heap, as now ---- */
+
+static struct hv_timer *timer_heap;
+
+static struct hv_timer *heap_meld(struct hv_timer *a, struct hv_timer *b)
+{
+	struct hv_timer *root, *child;
+
+	if (a == NULL) {
+		return b;
+	}
+	if (b == NULL) {
+		return a;
+	}
+	if (b->fire_tsc < a->fire_tsc) {
+		root = b;
+		child = a;
+	} else {
+		root = a;
+		child = b;
+	}
+	child->sibling = root->child;
+	if (root->child != NULL) {
+		root->child->prev = child;
+	}
+	child->prev = root;
+	root->child = child;
+	root->sibling = NULL;
+	root->prev = NULL;
+	return root;
+}
+
+static struct hv_timer *heap_merge_pairs(struct hv_timer *first)
+{
+	struct hv_timer *a = first, *b, *next, *pairs = NULL, *root = NULL;
+
+	while (a != NULL) {
+		b = a->sibling;
+		next = (b != NULL) ? b->sibling : NULL;
+		a->sibling = NULL;
+		if (b != NULL) {
+			b->sibling = NULL;
+		}
+		a = heap_meld(a, b);
+		a->sibling = pairs;
+		pairs = a;
+		a = next;
+	}
+	while (pairs != NULL) {
+		next = pairs->sibling;
+		pairs->sibling = NULL;
+		root = heap_meld(root, pairs);
+		pairs = next;
+	}
+	return root;
+}
+
+static void heap_add_timer(struct hv_timer *timer)
+{
+	timer->child = NULL;
+	timer->sibling = NULL;
+	timer->prev = NULL;
+	timer_heap = heap_meld(timer_heap, timer);
+}
+
+static void heap_del_timer(struct hv_timer *timer)
+{
+	struct hv_timer *subheap = heap_merge_pairs(timer->child);
+
+	if (timer_heap == timer) {
+		timer_heap = subheap;
+	} else {
+		if (timer->prev->child == timer) {
+			timer->prev->child = timer->sibling;
+		} else {
+			timer->prev->sibling = timer->sibling;
+		}
+		if (timer->sibling != NULL) {
+			timer->sibling->prev = timer->prev;
+		}
+		timer_heap = heap_meld(timer_heap, subheap);
+	}
+	timer->child = NULL;
+	timer->sibling = NULL;
+	timer->prev = NULL;
+}
+
+/* ---- workloads ---- */
+
+static void arm_all(uint32_t nr, bool heap)
+{
+	uint64_t seed = 0x2545F4914F6CDD1DUL;
+	uint32_t i;
+
+	timer_list.next = &timer_list;
+	timer_list.prev = &timer_list;
+	timer_heap = NULL;
+	for (i = 0U; i < nr; i++) {
+		/* periods between 100us and 10ms at 2GHz, distinct deadlines */
+		timers[i].period = 200000UL + (bench_rand(&seed) % 20000000UL);
+		timers[i].fire_tsc = (timers[i].period << 10U) + i;
+		if (heap) {
+			heap_add_timer(&timers[i]);
+		} else {
+			list_add_timer(&timers[i]);
+		}
+	}
+}
+
+static uint64_t expire(uint32_t nr, bool heap, uint64_t *order)
+{
+	struct hv_timer *timer;
+	uint64_t t;
+	uint32_t op;
+
+	arm_all(nr, heap);
+	t = bench_now_ns();
+	for (op = 0U; op < NR_OPS; op++) {
+		timer = heap ? timer_heap : list_first_timer();
+		order[op] = timer->fire_tsc;
+		if (heap) {
+			heap_del_timer(timer);
+		} else {
+			list_del_timer(timer);
+		}
+		timer->fire_tsc += timer->period << 10U;
+		if (heap) {
+			heap_add_timer(timer);
+		} else {
+			list_add_timer(timer);
+		}
+	}
+	return bench_now_ns() - t;
+}
+
+static uint64_t reprogram(uint32_t nr, bool heap, uint64_t *order)
+{
+	struct hv_timer *timer;
+	uint64_t seed = 0x9E3779B97F4A7C15UL, t;
+	uint32_t op;
+
+	arm_all(nr, heap);
+	t = bench_now_ns();
+	for (op = 0U; op < NR_OPS; op++) {
+		timer = &timers[bench_rand(&seed) % nr];
+		if (heap) {
+			heap_del_timer(timer);
+		} else {
+			list_del_timer(timer);
+		}
+		timer->fire_tsc = ((bench_rand(&seed) % 20000000UL) << 10U) + (timer - timers);
+		if (heap) {
+			heap_add_timer(timer);
+		} else {
+			list_add_timer(timer);
+		}
+		/* the next deadline is what gets programmed */
+		order[op] = heap ? timer_heap->fire_tsc : list_first_timer()->fire_tsc;
+	}
+	return bench_now_ns() - t;
+}
+
+int main(void)
+{
+	static const uint32_t sizes[] = { 4U, 16U, 64U, 256U, 1024U };
+	uint64_t t_list, t_heap;
+	uint32_t i;
+
+	for (i = 0U; i < (sizeof(sizes) / sizeof(sizes[0])); i++) {
+		printf("%u timers\n", sizes[i]);
+
+		t_list = expire(sizes[i], false, order_list);
+		t_heap = expire(sizes[i], true, order_heap);
+		if (memcmp(order_list, order_heap, sizeof(order_list)) != 0) {
+			bench_fail("expire order differs");
+		}
+		bench_report("expire + re-arm, sorted list", t_list, NR_OPS);
+		bench_report("expire + re-arm, pairing heap", t_heap, NR_OPS);
+
+		t_list = reprogram(sizes[i], false, order_list);
+		t_heap = reprogram(sizes[i], true, order_heap);
+		if (memcmp(order_list, order_heap, sizeof(order_list)) != 0) {
+			bench_fail("next deadline differs");
+		}
+		bench_report("del + add, sorted list", t_list, NR_OPS);
+		bench_report("del + add, pairing heap", t_heap, NR_OPS);
+	}
+	return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * acrntrace reader: the former one write() per trace entry and fixed
+ * polling period against sbuf_write() from misc/tools/acrntrace/sbuf.c,
+ * which drains the whole head..tail span with one writev(), and the
+ * reader waking early once the sbuf is filled past a threshold.
+ *
+ * First a full 4M sbuf is drained to a file with both, and the file is
+ * checked for every entry in order. Then a producer standing in for the
+ * hypervisor fills the sbuf at 1 to 32 million entries per second, in
+ * virtual time: the drains run for real and their measured duration is
+ * what advances the clock, sleeps only advance it. Reported are the
+ * entries lost to overrun, the share of a core spent draining and the
+ * reader wakeups.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "bench.h"
+#include "sbuf.h"
+
+#define ELE_SIZE	32U				/* TRACE_ELEMENT_SIZE */
+#define ELE_NUM		((4U * 1024U * 1024U - 64U) / ELE_SIZE)	/* TRACE_ELEMENT_NUM */
+#define PERIOD_NS	10000000UL			/* default -i 10 */
+#define WAKEUP_SLICES	10U
+#define WAKEUP_THRESHOLD_SHIFT	2U
+#define SIM_NS		500000000UL
+
+static shared_buf_t *sbuf;
+static int out_fd;
+static uint64_t seq;
+
+/* the former sbuf_write(): one entry per call */
+static int sbuf_write_entry(int fd, shared_buf_t *sb)
+{
+	const void *start;
+	int written;
+
+	if (sb->head == sb->tail) {
+		return 0;
+	}
+	start = (void *)sb + SBUF_HEAD_SIZE + sb->head;
+	written = (int)write(fd, start, sb->ele_size);
+	if (written != (int)sb->ele_size) {
+		return -1;
+	}
+	sb->head += sb->ele_size;
+	if (sb->head >= sb->size) {
+		sb->head -= sb->size;
+	}
+	return (int)sb->ele_size;
+}
+
+/* sbuf_put() without OVERWRITE_EN, as the trace sbufs are set up */
+static bool sbuf_put(shared_buf_t *sb)
+{
+	uint32_t next_tail = sb->tail + sb->ele_size;
+
+	if (next_tail >= sb->size) {
+		next_tail -= sb->size;
+	}
+	if (next_tail == sb->head) {
+		sb->overrun_cnt++;
+		return false;
+	}
+	memcpy((char *)sb + SBUF_HEAD_SIZE + sb->tail, &seq, sizeof(seq));
+	seq++;
+	__atomic_store_n(&sb->tail, next_tail, __ATOMIC_RELEASE);
+	return true;
+}
+
+static void sbuf_reset(uint32_t start)
+{
+	memset(sbuf, 0, SBUF_HEAD_SIZE);
+	sbuf->magic = SBUF_MAGIC;
+	sbuf->ele_num = ELE_NUM;
+	sbuf->ele_size = ELE_SIZE;
+	sbuf->size = ELE_NUM * ELE_SIZE;
+	sbuf->head = start * ELE_SIZE;
+	sbuf->tail = start * ELE_SIZE;
+	seq = 0UL;
+	if ((lseek(out_fd, 0, SEEK_SET) != 0) || (ftruncate(out_fd, 0) != 0)) {
+		bench_fail("output file");
+	}
+}
+
+static void check_output(uint64_t nr)
+{
+	uint64_t i, tag;
+
+	for (i = 0UL; i < nr; i++) {
+		if ((pread(out_fd, &tag, sizeof(tag), (off_t)(i * ELE_SIZE)) != sizeof(tag)) || (tag != i)) {
+			bench_fail("trace file lost or reordered an entry");
+		}
+	}
+}
+
+/* drain a full sbuf, starting at entry 'start' so that it may wrap */
+static void drain_full(bool bulk, uint32_t start)
+{
+	uint64_t t;
+	uint32_t i;
+	char name[64];
+
+	sbuf_reset(start);
+	for (i = 0U; i < (ELE_NUM - 1U); i++) {
+		(void)sbuf_put(sbuf);
+	}
+	t = bench_now_ns();
+	if (bulk) {
+		if (sbuf_write(out_fd, sbuf) != (int)((ELE_NUM - 1U) * ELE_SIZE)) {
+			bench_fail("bulk drain");
+		}
+	} else {
+		while (sbuf_write_entry(out_fd, sbuf) > 0) {
+		}
+	}
+	t = bench_now_ns() - t;
+	if (sbuf->head != sbuf->tail) {
+		bench_fail("sbuf not drained");
+	}
+	check_output(ELE_NUM - 1U);
+	snprintf(name, sizeof(name), "%s, %s", (start == 0U) ? "contiguous" : "wrapped",
+		bulk ? "bulk writev" : "write per entry");
+	bench_report(name, t, ELE_NUM - 1U);
+}
+
+/* ---- reader simulation ---- */
+
+struct sim {
+	uint64_t vt;		/* virtual time, ns */
+	uint64_t produced;	/* entries offered by the producer */
+	uint64_t busy;		/* ns spent draining */
+	uint64_t wakeups;
+	uint64_t rate;		/* entries per second */
+};
+
+static void produce(struct sim *s)
+{
+	uint64_t due = (s->rate * s->vt) / 1000000000UL;
+
+	while (s->produced < due) {
+		(void)sbuf_put(sbuf);
+		s->produced++;
+	}
+}
+
+static bool drain(struct sim *s, bool bulk)
+{
+	uint64_t t = bench_now_ns();
+	int ret;
+
+	if (bulk) {
+		ret = sbuf_write(out_fd, sbuf);
+	} else {
+		ret = sbuf_write_entry(out_fd, sbuf);
+	}
+	if (ret < 0) {
+		bench_fail("drain");
+	}
+	t = bench_now_ns() - t;
+	s->vt += t;
+	s->busy += t;
+	/* keep the output file small, not timed */
+	if (lseek(out_fd, 0, SEEK_CUR) > (64L << 20)) {
+		(void)lseek(out_fd, 0, SEEK_SET);
+	}
+	produce(s);
+	return ret > 0;
+}
+
+static void simulate(uint64_t rate, bool bulk)
+{
+	struct sim s = { 0UL, 0UL, 0UL, 0UL, rate };
+	uint32_t threshold = (ELE_NUM * ELE_SIZE) >> WAKEUP_THRESHOLD_SHIFT;
+	uint64_t slice = PERIOD_NS / WAKEUP_SLICES, waited;
+
+	sbuf_reset(0U);
+	while (s.vt < SIM_NS) {
+		s.wakeups++;
+		if (!bulk) {
+			/* do { sbuf_write() } while (ret > 0); usleep(period) */
+			while (drain(&s, false) && (s.vt < SIM_NS)) {
+			}
+			s.vt += PERIOD_NS;
+			produce(&s);
+		} else {
+			(void)drain(&s, true);
+			for (waited = 0UL; waited < PERIOD_NS; waited += slice) {
+				if (sbuf_used(sbuf) >= threshold) {
+					break;
+				}
+				s.vt += slice;
+				s.wakeups++;
+				produce(&s);
+			}
+		}
+	}
+	printf("  %-28s %6.2f%% lost %6.2f%% core %8.0f wakeups/s\n",
+		bulk ? "bulk writev, threshold" : "write per entry, period",
+		(100.0 * sbuf->overrun_cnt) / (double)s.produced,
+		(100.0 * (double)s.busy) / (double)s.vt,
+		((double)s.wakeups * 1e9) / (double)s.vt);
+}
+
+int main(void)
+{
+	static const uint64_t rates[] = { 1000000UL, 4000000UL, 16000000UL, 32000000UL };
+	char path[] = "/tmp/acrnbench-XXXXXX";
+	uint32_t i;
+
+	sbuf = aligned_alloc(4096U, SBUF_HEAD_SIZE + (ELE_NUM * ELE_SIZE) + 4096U);
+	out_fd = mkstemp(path);
+	if ((sbuf == NULL) || (out_fd < 0)) {
+		bench_fail("setup");
+	}
+	unlink(path);
+
+	printf("draining a full sbuf of %u entries\n", ELE_NUM - 1U);
+	drain_full(false, 0U);
+	drain_full(true, 0U);
+	drain_full(false, ELE_NUM / 2U);
+	drain_full(true, ELE_NUM / 2U);
+
+	for (i = 0U; i < (sizeof(rates) / sizeof(rates[0])); i++) {
+		printf("%lu M entries/s\n", rates[i] / 1000000UL);
+		simulate(rates[i], false);
+		simulate(rates[i], true);
+	}
+
+	close(out_fd);
+	free(sbuf);
+	return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * vPCI device lookup by BDF, as done by pci_find_vdev() for every config
+ * space access: the former linear walk of vpci->pci_vdevs[] against the
+ * per-bus devfn bitmap index (hypervisor/dm/vpci/vdev.c).
+ *
+ * The vdevs keep the size of the real struct pci_vdev, whose 4K config
+ * space puts every bdf on a page of its own. Measured are an SOS boot
+ * enumeration, which reads the vendor ID of function 0 of every device on
+ * every bus and of the other functions of multi-function devices, and
+ * runtime accesses spread over the present devices. Both lookups must
+ * agree on all 65536 BDFs.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include "bench.h"
+
+#define PCI_BUSMAX	255U
+#define MAX_VDEVS	1024U		/* Kconfig range of MAX_PCI_DEV_NUM */
+#define NR_ACCESSES	(1U << 16)
+
+union pci_bdf {
+	uint16_t value;
+	struct {
+		uint8_t f : 3;
+		uint8_t d : 5;
+		uint8_t b;
+	} bits;
+};
+
+struct pci_vdev {
+	const void *vpci;
+	union pci_bdf bdf;
+	void *pdev;
+	uint8_t cfgdata[4096];
+	uint8_t rest[512];		/* bars, msi, msix, sriov, pointers */
+};
+
+struct acrn_vpci {
+	uint32_t pci_vdev_cnt;
+	struct pci_vdev pci_vdevs[MAX_VDEVS];
+	uint64_t devfn_bitmap[PCI_BUSMAX + 1U][4];
+	uint16_t bus_start[PCI_BUSMAX + 1U];
+	uint16_t bdf_indexed_cnt;
+	struct pci_vdev *vdevs_by_bdf[MAX_VDEVS];
+};
+
+/* the former pci_find_vdev() */
+static struct pci_vdev *find_linear(struct acrn_vpci *vpci, union pci_bdf vbdf)
+{
+	struct pci_vdev *vdev = NULL;
+	uint32_t i;
+
+	for (i = 0U; i < vpci->pci_vdev_cnt; i++) {
+		if (vpci->pci_vdevs[i].bdf.value == vbdf.value) {
+			vdev = &vpci->pci_vdevs[i];
+			break;
+		}
+	}
+	return vdev;
+}
+
+/* same as pci_vdev_bdf_rank() */
+static uint16_t bdf_rank(const struct acrn_vpci *vpci, union pci_bdf bdf)
+{
+	const uint64_t *bitmap = vpci->devfn_bitmap[bdf.bits.b];
+	uint32_t devfn = bdf.value & 0xffU;
+	uint32_t word = devfn >> 6U;
+	uint32_t i;
+	uint16_t rank = vpci->bus_start[bdf.bits.b];
+
+	for (i = 0U; i < word; i++) {
+		rank += (uint16_t)__builtin_popcountl(bitmap[i]);
+	}
+	return rank + (uint16_t)__builtin_popcountl(bitmap[word] & ((1UL << (devfn & 0x3fU)) - 1UL));
+}
+
+static inline bool bdf_indexed(const struct acrn_vpci *vpci, union pci_bdf bdf)
+{
+	uint32_t devfn = bdf.value & 0xffU;
+
+	return ((vpci->devfn_bitmap[bdf.bits.b][devfn >> 6U] & (1UL << (devfn & 0x3fU))) != 0UL);
+}
+
+/* same as pci_find_vdev() */
+static struct pci_vdev *find_indexed(struct acrn_vpci *vpci, union pci_bdf vbdf)
+{
+	struct pci_vdev *vdev = NULL;
+
+	if (bdf_indexed(vpci, vbdf)) {
+		vdev = vpci->vdevs_by_bdf[bdf_rank(vpci, vbdf)];
+	}
+	return vdev;
+}
+
+/* same as pci_vdev_add_bdf() */
+static void add_bdf(struct acrn_vpci *vpci, struct pci_vdev *vdev)
+{
+	union pci_bdf bdf = vdev->bdf;
+	uint32_t devfn = bdf.value & 0xffU, bus;
+	uint16_t rank, i;
+
+	if (!bdf_indexed(vpci, bdf)) {
+		rank = bdf_rank(vpci, bdf);
+		for (i = vpci->bdf_indexed_cnt; i > rank; i--) {
+			vpci->vdevs_by_bdf[i] = vpci->vdevs_by_bdf[i - 1U];
+		}
+		vpci->vdevs_by_bdf[rank] = vdev;
+		vpci->bdf_indexed_cnt++;
+		vpci->devfn_bitmap[bdf.bits.b][devfn >> 6U] |= (1UL << (devfn & 0x3fU));
+		for (bus = (uint32_t)bdf.bits.b + 1U; bus <= PCI_BUSMAX; bus++) {
+			vpci->bus_start[bus]++;
+		}
+	}
+}
+
+/*
+ * Devices in the order the SOS vdevs are created: host bridge and the
+ * integrated devices on bus 0, some of them multi-function, then one
+ * device per bus behind the root ports (more on large setups, like VFs),
+ * with up to 8 functions each.
+ */
+static void setup(struct acrn_vpci *vpci, uint32_t nr, uint64_t *seed)
+{
+	struct pci_vdev *vdev;
+	uint32_t bus = 0U, dev = 0U, func = 0U, nfunc = 1U;
+	uint32_t per_bus = (nr + PCI_BUSMAX) / (PCI_BUSMAX + 1U);
+
+	memset(vpci, 0, sizeof(*vpci));
+	while (vpci->pci_vdev_cnt < nr) {
+		vdev = &vpci->pci_vdevs[vpci->pci_vdev_cnt];
+		vdev->bdf.value = (uint16_t)((bus << 8U) | (dev << 3U) | func);
+		vdev->cfgdata[0] = 0x86U;
+		vdev->cfgdata[1] = 0x80U;
+		/* header type: multi-function */
+		vdev->cfgdata[0xeU] = (nfunc > 1U) ? 0x80U : 0U;
+		add_bdf(vpci, vdev);
+		vpci->pci_vdev_cnt++;
+
+		if (++func < nfunc) {
+			continue;
+		}
+		func = 0U;
+		if ((bus == 0U) && (dev < 30U)) {
+			dev += 1U + (uint32_t)(bench_rand(seed) % 2U);
+		} else if ((bus != 0U) && ((dev + 1U) < per_bus)) {
+			dev++;
+		} else {
+			bus++;
+			dev = 0U;
+		}
+		nfunc = ((bench_rand(seed) % 4U) == 0U) ? (2U + (uint32_t)(bench_rand(seed) % 7U)) : 1U;
+		if (bus > PCI_BUSMAX) {
+			bench_fail("too many devices");
+		}
+	}
+}
+
+/* a config read of the vendor id, ~0 if nobody is there */
+static inline uint32_t read_cfg(struct acrn_vpci *vpci, union pci_bdf bdf, bool indexed, uint32_t offset)
+{
+	struct pci_vdev *vdev = indexed ? find_indexed(vpci, bdf) : find_linear(vpci, bdf);
+
+	return (vdev != NULL) ? vdev->cfgdata[offset] : ~0U;
+}
+
+/* brute force probe of every device number on every bus */
+static uint32_t enumerate(struct acrn_vpci *vpci, bool indexed, uint32_t *lookups)
+{
+	union pci_bdf bdf;
+	uint32_t bus, dev, func, found = 0U;
+
+	*lookups = 0U;
+	for (bus = 0U; bus <= PCI_BUSMAX; bus++) {
+		for (dev = 0U; dev < 32U; dev++) {
+			bdf.value = (uint16_t)((bus << 8U) | (dev << 3U));
+			(*lookups)++;
+			if (read_cfg(vpci, bdf, indexed, 0U) == ~0U) {
+				continue;
+			}
+			found++;
+			(*lookups)++;
+			if ((read_cfg(vpci, bdf, indexed, 0xeU) & 0x80U) == 0U) {
+				continue;
+			}
+			for (func = 1U; func < 8U; func++) {
+				bdf.value = (uint16_t)((bus << 8U) | (dev << 3U) | func);
+				(*lookups)++;
+				if (read_cfg(vpci, bdf, indexed, 0U) != ~0U) {
+					found++;
+				}
+			}
+		}
+	}
+	return found;
+}
+
+static void run(struct acrn_vpci *vpci, uint32_t nr)
+{
+	static union pci_bdf bdfs[NR_ACCESSES];
+	uint64_t seed = 0x9E3779B97F4A7C15UL, t, sum;
+	uint32_t i, v, found, lookups;
+	union pci_bdf bdf;
+	char name[64];
+
+	setup(vpci, nr, &seed);
+	for (v = 0U; v <= 0xffffU; v++) {
+		bdf.value = (uint16_t)v;
+		if (find_linear(vpci, bdf) != find_indexed(vpci, bdf)) {
+			bench_fail("linear and indexed lookup disagree");
+		}
+	}
+	printf("%u vdevs\n", nr);
+
+	for (i = 0U; i < 2U; i++) {
+		t = bench_now_ns();
+		found = enumerate(vpci, i != 0U, &lookups);
+		t = bench_now_ns() - t;
+		if (found != nr) {
+			bench_fail("enumeration missed a device");
+		}
+		snprintf(name, sizeof(name), "boot enumeration, %s", (i != 0U) ? "bitmap index" : "linear scan");
+		bench_report(name, t, lookups);
+		printf("  %-44s %10.1f us/scan\n", "", (double)t / 1000.0);
+	}
+
+	for (i = 0U; i < NR_ACCESSES; i++) {
+		bdfs[i] = vpci->pci_vdevs[bench_rand(&seed) % nr].bdf;
+	}
+	for (v = 0U; v < 2U; v++) {
+		sum = 0UL;
+		t = bench_now_ns();
+		for (i = 0U; i < NR_ACCESSES; i++) {
+			sum += read_cfg(vpci, bdfs[i], v != 0U, 0U);
+		}
+		t = bench_now_ns() - t;
+		BENCH_KEEP(sum);
+		snprintf(name, sizeof(name), "runtime access, %s", (v != 0U) ? "bitmap index" : "linear scan");
+		bench_report(name, t, NR_ACCESSES);
+	}
+}
+
+int main(void)
+{
+	static const uint32_t sizes[] = { 16U, 96U, 1024U };
+	struct acrn_vpci *vpci = malloc(sizeof(*vpci));
+	uint32_t i;
+
+	if (vpci == NULL) {
+		bench_fail("out of memory");
+	}
+	for (i = 0U; i < (sizeof(sizes) / sizeof(sizes[0])); i++) {
+		run(vpci, sizes[i]);
+	}
+	free(vpci);
+	return 0;
+}
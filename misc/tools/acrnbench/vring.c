@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Split against packed virtqueue, ring operations only. The device side is
+ * vq_getchain(), vq_relchain() and the used index/flags publication of
+ * devicemodel/hw/pci/virtio/virtio.c without indirect descriptors and
+ * interrupts. The guest side is a synthetic driver laid out like Linux
+ * virtio_ring: it posts a batch of chains, the device serves them all and
+ * the driver reaps the used buffers.
+ *
+ * Chains of 1 (net rx) and 3 (blk) descriptors are measured on one hot
+ * queue and on 512 queues served round robin, whose rings do not fit in the
+ * cache, which is closer to a guest writing them from another core. The
+ * device side is timed on its own as well. Every buffer must come back
+ * with the length it was posted with.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "bench.h"
+
+#define QSIZE		256U
+#define BATCH		32U
+#define MAX_CHAIN	4U
+#define NR_QUEUES	512U
+#define NR_BUFS		(1U << 22)
+
+#define VRING_DESC_F_NEXT	1U
+#define VRING_DESC_F_WRITE	2U
+#define VRING_PACKED_DESC_F_AVAIL	7U
+#define VRING_PACKED_DESC_F_USED	15U
+
+struct vring_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+};
+
+struct vring_avail {
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[QSIZE];
+	uint16_t used_event;
+};
+
+struct vring_used_elem {
+	uint32_t id;
+	uint32_t len;
+};
+
+struct vring_used {
+	uint16_t flags;
+	uint16_t idx;
+	struct vring_used_elem ring[QSIZE];
+	uint16_t avail_event;
+};
+
+struct vring_packed_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t id;
+	uint16_t flags;
+};
+
+/* guest memory, laid out as the spec asks: each area its own pages */
+struct split_ring {
+	struct vring_desc desc[QSIZE] __attribute__((aligned(4096)));
+	struct vring_avail avail __attribute__((aligned(4096)));
+	struct vring_used used __attribute__((aligned(4096)));
+};
+
+struct packed_ring {
+	struct vring_packed_desc desc[QSIZE] __attribute__((aligned(4096)));
+};
+
+/* device state, struct virtio_vq_info */
+struct vq {
+	bool packed;
+	volatile struct vring_desc *desc;
+	volatile struct vring_avail *avail;
+	volatile struct vring_used *used;
+	volatile struct vring_packed_desc *pdesc;
+	uint16_t last_avail, used_idx, save_used;
+	bool avail_wrap, used_wrap;
+	uint16_t chain_ndesc[QSIZE];
+};
+
+/* driver state, struct vring_virtqueue */
+struct drv {
+	uint16_t free_head, num_free, avail_idx, last_used;
+	uint16_t next_avail, next_used;
+	bool avail_wrap, used_wrap;
+	uint16_t free_ids[QSIZE], nfree_ids;
+	uint16_t ndesc[QSIZE];
+	uint32_t posted_len[QSIZE];
+};
+
+struct queue {
+	struct vq vq;
+	struct drv drv;
+};
+
+static char guest_mem[1U << 20];
+static struct queue *queues;
+static void *rings;
+static uint64_t bad;
+
+static inline void *paddr_guest2host(uint64_t gpa, uint32_t len)
+{
+	(void)len;
+	return &guest_mem[gpa & (sizeof(guest_mem) - 1U)];
+}
+
+/* ---- device side ---- */
+
+static int vq_getchain_split(struct vq *vq, uint16_t *pidx, struct iovec *iov, int n_iov)
+{
+	volatile struct vring_desc *vdir;
+	uint16_t ndesc, next;
+	int i;
+
+	ndesc = (uint16_t)(vq->avail->idx - vq->last_avail);
+	if (ndesc == 0U) {
+		return 0;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	next = vq->avail->ring[vq->last_avail & (QSIZE - 1U)];
+	*pidx = next;
+	vq->last_avail++;
+	for (i = 0; i < n_iov; next = vdir->next) {
+		if (next >= QSIZE) {
+			return -1;
+		}
+		vdir = &vq->desc[next];
+		iov[i].iov_base = paddr_guest2host(vdir->addr, vdir->len);
+		iov[i].iov_len = vdir->len;
+		i++;
+		if ((vdir->flags & VRING_DESC_F_NEXT) == 0U) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static inline bool packed_desc_avail(const struct vq *vq, uint16_t flags)
+{
+	return (((flags >> VRING_PACKED_DESC_F_AVAIL) & 1U) == vq->avail_wrap) &&
+		(((flags >> VRING_PACKED_DESC_F_USED) & 1U) != vq->avail_wrap);
+}
+
+static int vq_getchain_packed(struct vq *vq, uint16_t *pidx, struct iovec *iov, int n_iov)
+{
+	volatile struct vring_packed_desc *vdir;
+	uint16_t idx = vq->last_avail, dflags, ndesc;
+	int i = 0;
+
+	if (!packed_desc_avail(vq, vq->pdesc[idx].flags)) {
+		return 0;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	for (ndesc = 1U; i < n_iov; ndesc++) {
+		if ((idx & 7U) == 0U) {
+			__builtin_prefetch((const void *)&vq->pdesc[(idx + 8U) & (QSIZE - 1U)]);
+		}
+		vdir = &vq->pdesc[idx];
+		dflags = vdir->flags;
+		if ((ndesc > 1U) && !packed_desc_avail(vq, dflags)) {
+			return -1;
+		}
+		iov[i].iov_base = paddr_guest2host(vdir->addr, vdir->len);
+		iov[i].iov_len = vdir->len;
+		i++;
+		if (++idx >= QSIZE) {
+			idx = 0U;
+			vq->avail_wrap = !vq->avail_wrap;
+		}
+		if ((dflags & VRING_DESC_F_NEXT) == 0U) {
+			if (vdir->id >= QSIZE) {
+				return -1;
+			}
+			*pidx = vdir->id;
+			vq->chain_ndesc[*pidx] = ndesc;
+			vq->last_avail = idx;
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void vq_relchain(struct vq *vq, uint16_t id, uint32_t iolen)
+{
+	volatile struct vring_used_elem *vue;
+	volatile struct vring_packed_desc *vd;
+	uint16_t flags;
+
+	if (!vq->packed) {
+		vue = &vq->used->ring[vq->used->idx & (QSIZE - 1U)];
+		vue->id = id;
+		vue->len = iolen;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		vq->used->idx++;
+	} else {
+		vd = &vq->pdesc[vq->used_idx];
+		vd->id = id;
+		vd->len = iolen;
+		flags = vq->used_wrap ? ((1U << VRING_PACKED_DESC_F_AVAIL) | (1U << VRING_PACKED_DESC_F_USED)) : 0U;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		vd->flags = flags;
+		vq->used_idx += vq->chain_ndesc[id];
+		if (vq->used_idx >= QSIZE) {
+			vq->used_idx -= QSIZE;
+			vq->used_wrap = !vq->used_wrap;
+		}
+	}
+}
+
+/* a backend serving everything available, then vq_endchains() */
+static uint32_t device_serve(struct vq *vq)
+{
+	struct iovec iov[MAX_CHAIN];
+	uint32_t n = 0U, iolen;
+	uint16_t id;
+	int i, r;
+
+	for (;;) {
+		r = vq->packed ? vq_getchain_packed(vq, &id, iov, MAX_CHAIN) :
+			vq_getchain_split(vq, &id, iov, MAX_CHAIN);
+		if (r <= 0) {
+			bad += (r < 0) ? 1U : 0U;
+			break;
+		}
+		iolen = 0U;
+		for (i = 0; i < r; i++) {
+			iolen += (uint32_t)iov[i].iov_len;
+		}
+		vq_relchain(vq, id, iolen);
+		n++;
+	}
+	if (!vq->packed) {
+		/* the interrupt decision reads the used index once */
+		vq->save_used = vq->used->idx;
+	}
+	return n;
+}
+
+/* ---- driver side ---- */
+
+static void drv_post(struct queue *q, uint32_t nr, uint32_t chain, uint64_t *seed)
+{
+	struct drv *d = &q->drv;
+	struct vq *vq = &q->vq;
+	volatile struct vring_desc *vd;
+	volatile struct vring_packed_desc *pd;
+	uint16_t head, idx, id, flags, head_flags = 0U;
+	uint32_t b, c, len, total;
+
+	for (b = 0U; b < nr; b++) {
+		total = 0U;
+		if (!vq->packed) {
+			head = d->free_head;
+			idx = head;
+			for (c = 0U; c < chain; c++) {
+				vd = &vq->desc[idx];
+				len = 64U + (uint32_t)(bench_rand(seed) & 0x7C0U);
+				vd->addr = (uint64_t)idx << 11U;
+				vd->len = len;
+				vd->flags = (c + 1U < chain) ? VRING_DESC_F_NEXT : VRING_DESC_F_WRITE;
+				total += len;
+				idx = vd->next;
+			}
+			d->free_head = idx;
+			d->num_free -= (uint16_t)chain;
+			d->posted_len[head] = total;
+			vq->avail->ring[d->avail_idx & (QSIZE - 1U)] = head;
+			d->avail_idx++;
+		} else {
+			id = d->free_ids[--d->nfree_ids];
+			head = d->next_avail;
+			for (c = 0U; c < chain; c++) {
+				pd = &vq->pdesc[d->next_avail];
+				len = 64U + (uint32_t)(bench_rand(seed) & 0x7C0U);
+				pd->addr = (uint64_t)d->next_avail << 11U;
+				pd->len = len;
+				pd->id = id;
+				flags = (c + 1U < chain) ? VRING_DESC_F_NEXT : VRING_DESC_F_WRITE;
+				flags |= d->avail_wrap ? (1U << VRING_PACKED_DESC_F_AVAIL) :
+					(1U << VRING_PACKED_DESC_F_USED);
+				/* the head's flags go last, as in virtqueue_add_packed() */
+				if (c == 0U) {
+					head_flags = flags;
+				} else {
+					pd->flags = flags;
+				}
+				total += len;
+				if (++d->next_avail >= QSIZE) {
+					d->next_avail = 0U;
+					d->avail_wrap = !d->avail_wrap;
+				}
+			}
+			d->ndesc[id] = (uint16_t)chain;
+			d->posted_len[id] = total;
+			d->num_free -= (uint16_t)chain;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			vq->pdesc[head].flags = head_flags;
+		}
+	}
+	if (!vq->packed) {
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		vq->avail->idx = d->avail_idx;
+	}
+}
+
+static uint32_t drv_reap(struct queue *q)
+{
+	struct drv *d = &q->drv;
+	struct vq *vq = &q->vq;
+	volatile struct vring_used_elem *vue;
+	uint16_t id, flags, idx, c;
+	uint32_t n = 0U;
+
+	if (!vq->packed) {
+		while (d->last_used != vq->used->idx) {
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			vue = &vq->used->ring[d->last_used & (QSIZE - 1U)];
+			id = (uint16_t)vue->id;
+			bad += (vue->len != d->posted_len[id]) ? 1U : 0U;
+			/* walk the chain to put it back on the free list */
+			idx = id;
+			for (c = 1U; (vq->desc[idx].flags & VRING_DESC_F_NEXT) != 0U; c++) {
+				idx = vq->desc[idx].next;
+			}
+			vq->desc[idx].next = d->free_head;
+			d->free_head = id;
+			d->num_free += c;
+			d->last_used++;
+			n++;
+		}
+	} else {
+		for (;;) {
+			flags = vq->pdesc[d->next_used].flags;
+			if ((((flags >> VRING_PACKED_DESC_F_AVAIL) & 1U) != d->used_wrap) ||
+					(((flags >> VRING_PACKED_DESC_F_USED) & 1U) != d->used_wrap)) {
+				break;
+			}
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			id = vq->pdesc[d->next_used].id;
+			bad += (vq->pdesc[d->next_used].len != d->posted_len[id]) ? 1U : 0U;
+			d->num_free += d->ndesc[id];
+			d->next_used += d->ndesc[id];
+			if (d->next_used >= QSIZE) {
+				d->next_used -= QSIZE;
+				d->used_wrap = !d->used_wrap;
+			}
+			d->free_ids[d->nfree_ids++] = id;
+			n++;
+		}
+	}
+	return n;
+}
+
+static void setup(uint32_t nr_queues, bool packed)
+{
+	struct queue *q;
+	uint32_t i, j;
+
+	memset(queues, 0, nr_queues * sizeof(*queues));
+	memset(rings, 0, nr_queues * sizeof(struct split_ring));
+	for (i = 0U; i < nr_queues; i++) {
+		q = &queues[i];
+		q->vq.packed = packed;
+		q->drv.num_free = QSIZE;
+		if (packed) {
+			q->vq.pdesc = ((struct packed_ring *)rings)[i].desc;
+			q->vq.avail_wrap = true;
+			q->vq.used_wrap = true;
+			q->drv.avail_wrap = true;
+			q->drv.used_wrap = true;
+			for (j = 0U; j < QSIZE; j++) {
+				q->drv.free_ids[j] = (uint16_t)j;
+			}
+			q->drv.nfree_ids = QSIZE;
+		} else {
+			q->vq.desc = ((struct split_ring *)rings)[i].desc;
+			q->vq.avail = &((struct split_ring *)rings)[i].avail;
+			q->vq.used = &((struct split_ring *)rings)[i].used;
+			for (j = 0U; j < QSIZE; j++) {
+				((struct split_ring *)rings)[i].desc[j].next = (uint16_t)(j + 1U);
+			}
+		}
+	}
+}
+
+static uint64_t run(uint32_t nr_queues, bool packed, uint32_t chain, uint64_t *t_dev)
+{
+	uint64_t seed = 0x9E3779B97F4A7C15UL, t, t0;
+	uint32_t done = 0U, qi = 0U, n;
+	struct queue *q;
+
+	setup(nr_queues, packed);
+	*t_dev = 0UL;
+	t = bench_now_ns();
+	while (done < NR_BUFS) {
+		q = &queues[qi];
+		qi = (qi + 1U) % nr_queues;
+		drv_post(q, BATCH, chain, &seed);
+		t0 = bench_now_ns();
+		n = device_serve(&q->vq);
+		*t_dev += bench_now_ns() - t0;
+		if ((drv_reap(q) != n) || (n != BATCH)) {
+			bench_fail("buffers lost");
+		}
+		done += n;
+	}
+	t = bench_now_ns() - t;
+	if (bad != 0U) {
+		bench_fail("bad chain or used length");
+	}
+	return t;
+}
+
+int main(void)
+{
+	static const uint32_t chains[] = { 1U, 3U };
+	static const uint32_t nr_queues[] = { 1U, NR_QUEUES };
+	static const char *const layouts[] = { "split", "packed" };
+	char name[64];
+	uint64_t t, t_dev;
+	uint32_t c, n, l;
+
+	queues = calloc(NR_QUEUES, sizeof(*queues));
+	rings = aligned_alloc(4096U, NR_QUEUES * sizeof(struct split_ring));
+	if ((queues == NULL) || (rings == NULL)) {
+		bench_fail("out of memory");
+	}
+
+	for (n = 0U; n < 2U; n++) {
+		printf("%u queue%s, %u chains per notify\n", nr_queues[n], (n == 0U) ? "" : "s", BATCH);
+		for (c = 0U; c < 2U; c++) {
+			for (l = 0U; l < 2U; l++) {
+				t = run(nr_queues[n], l != 0U, chains[c], &t_dev);
+				snprintf(name, sizeof(name), "%u desc chain, %s, device", chains[c], layouts[l]);
+				bench_report(name, t_dev, NR_BUFS);
+				snprintf(name, sizeof(name), "%u desc chain, %s, device + driver", chains[c], layouts[l]);
+				bench_report(name, t, NR_BUFS);
+			}
+		}
+	}
+	free(rings);
+	free(queues);
+	return 0;
+}
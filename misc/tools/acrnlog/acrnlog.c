@@ -23,6 +23,34 @@
 #define LOG_INCOMPLETE_WARNING	"WARNING: logs missing here! "\
 				"Try reducing polling interval"
 
+/*
+ * Binary log records, must match hypervisor/include/debug/logmsg.h.
+ * A record starts with LOG_BIN_MARKER, which a text message never does.
+ */
+#define LOG_BIN_MARKER		0xA5
+#define LOG_BIN_FMT		1
+#define LOG_BIN_MSG		2
+#define LOG_FMT_TABLE_SIZE	1024
+
+struct log_bin_hdr {
+	__u8 marker;
+	__u8 type;
+	__u8 nr_entries;
+	__u8 severity;
+	__u16 pcpu_id;
+	__u16 fmt_id;
+	__u32 seq;
+	__u16 len;		/* payload length */
+	__u16 reserved;
+	__u64 tsc;
+} __attribute__((packed));
+
+/* formats of binary records, one table per boot (cur or last) */
+struct hvlog_fmts {
+	unsigned int tsc_khz;
+	char *fmt[LOG_FMT_TABLE_SIZE];
+};
+
 /* Count of /dev/acrn_hvlog_cur_xxx */
 static int cur_cnt,last_cnt;
 static unsigned long interval = DEFAULT_POLL_INTERVAL;
@@ -75,10 +103,10 @@ struct hvlog_msg {
 struct hvlog_dev {
 	int fd;
 	struct hvlog_msg *msg;	/* pointer to msg */
+	struct hvlog_fmts *fmts;	/* formats of binary records */
 
 	int latched;		/* 1 if an sbuf element latched */
 	char entry_latch[LOG_ELEMENT_SIZE];	/* latch for an sbuf element */
-	struct hvlog_msg latched_msg;	/* latch for parsed msg */
 };
 
 size_t write_log_file(struct hvlog_file * log, const char *buf, size_t len);
@@ -107,92 +135,289 @@ static int get_dev_cnt(char *prefix)
 	return cnt;
 }
 
+/* read the next sbuf entry of dev, the latched one first */
+static int hvlog_next_entry(struct hvlog_dev *dev, char *entry)
+{
+	if (dev->latched) {
+		dev->latched = 0;
+		memcpy(entry, dev->entry_latch, LOG_ELEMENT_SIZE);
+		return LOG_ELEMENT_SIZE;
+	}
+
+	return read(dev->fd, entry, LOG_ELEMENT_SIZE);
+}
+
+/* keep an entry that starts a new msg to be processed next time */
+static void hvlog_latch_entry(struct hvlog_dev *dev, const char *entry)
+{
+	dev->latched = 1;
+	memcpy(dev->entry_latch, entry, LOG_ELEMENT_SIZE);
+}
+
+static int is_text_head(const char *entry)
+{
+	return memmem(entry, strnlen(entry, LOG_ELEMENT_SIZE), "][seq=", 6) != NULL;
+}
+
+static int is_bin_head(const char *entry)
+{
+	return (unsigned char)entry[0] == LOG_BIN_MARKER;
+}
+
+/*
+ * Format the arguments of a binary record with fmt, the way the
+ * hypervisor printf would. Only the conversions it supports take an
+ * argument: d, i, u, x, X, c and s, with h, hh, l and ll modifiers.
+ */
+static size_t hvlog_format_bin(char *out, size_t size, const char *fmt,
+			       const __u8 *args, size_t args_len)
+{
+	char spec[32], str[LOG_MSG_SIZE];
+	const char *s = fmt, *start;
+	size_t pos = 0, n, ai = 0;
+	__u64 val;
+	__u16 slen;
+	int is_long, nr_h, ret;
+	char ch;
+
+	while (*s && pos + 1 < size) {
+		if (*s != '%') {
+			out[pos++] = *s++;
+			continue;
+		}
+
+		start = s++;
+		while (*s && strchr("#0123456789- +.", *s))
+			s++;
+		n = s - start;
+		is_long = 0;
+		nr_h = 0;
+		if (*s == 'h') {
+			nr_h++;
+			s++;
+			if (*s == 'h') {
+				nr_h++;
+				s++;
+			}
+		} else if (*s == 'l') {
+			is_long = 1;
+			s++;
+			if (*s == 'l')
+				s++;
+		}
+		ch = *s;
+		if (ch)
+			s++;
+
+		/* rebuild the spec with glibc length modifiers */
+		if (n + 4 > sizeof(spec))
+			n = sizeof(spec) - 4;
+		memcpy(spec, start, n);
+		if (is_long) {
+			spec[n++] = 'l';
+			spec[n++] = 'l';
+		}
+		while (nr_h-- > 0)
+			spec[n++] = 'h';
+		spec[n++] = ch;
+		spec[n] = 0;
+
+		ret = 0;
+		if (ch && strchr("diuxXc", ch)) {
+			if (ai + sizeof(val) > args_len)
+				break;
+			memcpy(&val, args + ai, sizeof(val));
+			ai += sizeof(val);
+			if (ch == 'c')
+				ret = snprintf(out + pos, size - pos, spec, (int)val);
+			else if (is_long)
+				ret = snprintf(out + pos, size - pos, spec, (long long)val);
+			else
+				ret = snprintf(out + pos, size - pos, spec, (int)val);
+		} else if (ch == 's') {
+			if (ai + sizeof(slen) > args_len)
+				break;
+			memcpy(&slen, args + ai, sizeof(slen));
+			ai += sizeof(slen);
+			if (slen > args_len - ai)
+				slen = args_len - ai;
+			if (slen >= sizeof(str))
+				slen = sizeof(str) - 1;
+			memcpy(str, args + ai, slen);
+			str[slen] = 0;
+			ai += slen;
+			ret = snprintf(out + pos, size - pos, spec, str);
+		} else {
+			/* '%' or unknown conversion, printed as it is */
+			n = s - start;
+			if (ch == '%')
+				n = 1;
+			ret = snprintf(out + pos, size - pos, "%.*s", (int)n, start);
+		}
+
+		if (ret < 0)
+			break;
+		pos += ((size_t)ret < size - pos) ? (size_t)ret : size - pos - 1;
+	}
+
+	out[pos] = 0;
+	return pos;
+}
+
+/*
+ * Read the rest of a binary record starting with entry. A format record
+ * is stored in dev->fmts and 0 returned, a message record is decoded
+ * into msg and 1 returned. -1 is returned for a truncated record.
+ */
+static int hvlog_read_bin(struct hvlog_dev *dev, const char *entry,
+			  struct hvlog_msg *msg)
+{
+	char rec[LOG_MSG_SIZE];
+	struct log_bin_hdr hdr;
+	struct hvlog_fmts *fmts = dev->fmts;
+	const __u8 *payload;
+	unsigned long long usec = 0;
+	unsigned int tsc_khz;
+	const char *fmt;
+	char *f;
+	size_t len;
+	int i;
+
+	memcpy(&hdr, entry, sizeof(hdr));
+	if (hdr.nr_entries == 0 ||
+	    hdr.nr_entries * LOG_ELEMENT_SIZE > sizeof(rec) ||
+	    hdr.len > hdr.nr_entries * LOG_ELEMENT_SIZE - sizeof(hdr))
+		return -1;
+
+	memcpy(rec, entry, LOG_ELEMENT_SIZE);
+	for (i = 1; i < hdr.nr_entries; i++) {
+		if (read(dev->fd, &rec[i * LOG_ELEMENT_SIZE], LOG_ELEMENT_SIZE)
+		    != LOG_ELEMENT_SIZE)
+			return -1;
+	}
+	payload = (const __u8 *)rec + sizeof(hdr);
+
+	if (hdr.type == LOG_BIN_FMT) {
+		if (hdr.fmt_id >= LOG_FMT_TABLE_SIZE ||
+		    hdr.len < sizeof(tsc_khz))
+			return 0;
+		memcpy(&tsc_khz, payload, sizeof(tsc_khz));
+		len = hdr.len - sizeof(tsc_khz);
+		f = malloc(len + 1);
+		if (!f)
+			return 0;
+		memcpy(f, payload + sizeof(tsc_khz), len);
+		f[len] = 0;
+		free(fmts->fmt[hdr.fmt_id]);
+		fmts->fmt[hdr.fmt_id] = f;
+		fmts->tsc_khz = tsc_khz;
+		return 0;
+	}
+
+	if (hdr.type != LOG_BIN_MSG)
+		return 0;
+
+	if (fmts->tsc_khz)
+		usec = hdr.tsc / fmts->tsc_khz * 1000 +
+			hdr.tsc % fmts->tsc_khz * 1000 / fmts->tsc_khz;
+
+	memset(msg, 0, sizeof(struct hvlog_msg));
+	msg->seq = hdr.seq;
+	msg->cpu = hdr.pcpu_id;
+	msg->sev = hdr.severity;
+	msg->usec = usec;
+	len = snprintf(msg->raw, LOG_MSG_SIZE, "[%lluus][cpu=%hu][sev=%u][seq=%u]:",
+		       usec, hdr.pcpu_id, hdr.severity, hdr.seq);
+
+	fmt = (hdr.fmt_id < LOG_FMT_TABLE_SIZE) ? fmts->fmt[hdr.fmt_id] : NULL;
+	if (fmt)
+		len += hvlog_format_bin(&msg->raw[len], LOG_MSG_SIZE - 1 - len,
+					fmt, payload, hdr.len);
+	else
+		len += snprintf(&msg->raw[len], LOG_MSG_SIZE - 1 - len,
+				"<unknown format %hu>", hdr.fmt_id);
+	msg->len = len;
+
+	return 1;
+}
+
 /*
  * The function read a complete msg from acrnlog dev.
- * read one more sbuf entry if read an entry doesn't end with '\0'
- * however, if the new entry contains a new msg - which means the ending char
- * is lost, it will be latched to be process next time.
+ * A text msg is continued in the next sbuf entry if an entry doesn't end
+ * with '\0'. However, if the next entry starts a new msg - which means the
+ * ending char is lost, it will be latched to be processed next time.
+ * Binary records carry their own length and are decoded to text.
  */
 struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 {
-	char *p = NULL;
-	int ret;
-	size_t len = 0;
-	struct hvlog_msg *msg[2];
-	int msg_num;
+	char entry[LOG_ELEMENT_SIZE + 1];
 	char warn_msg[LOG_MSG_SIZE] = {0};
+	struct hvlog_msg *msg = dev->msg;
+	size_t len;
+	char *p;
+	int ret;
 
-	msg[0] = dev->msg;
-	msg[1] = &dev->latched_msg;
-
-	memset(msg[0], 0, sizeof(struct hvlog_msg) + LOG_MSG_SIZE);
-	msg_num = 0;
+	entry[LOG_ELEMENT_SIZE] = 0;
 
-	do {
-		if (dev->latched) {
-			/* handle the latched msg first */
-			dev->latched = 0;
-			memcpy(&msg[0]->raw[msg[0]->len], dev->entry_latch,
-			       LOG_ELEMENT_SIZE);
-			msg_num++;
-			memcpy(msg[0], msg[1], sizeof(struct hvlog_msg));
-		} else {
-			ret =
-			    read(dev->fd, &msg[0]->raw[msg[0]->len],
-				 LOG_ELEMENT_SIZE);
-			if (!ret)
-				break;
-			/* do we read a new meaasge?
-			 * msg[0]->raw[msg[0]->len format: [%lluus][cpu=%d][sev=%d][seq=%llu]: */
-			p = strstr(&msg[0]->raw[msg[0]->len], "][seq=");
-			if (p) {
-				p = p + strlen("][seq=");
-				msg[msg_num]->seq = strtoull(p, NULL, 10);
-				if ((errno == ERANGE && (msg[msg_num]->seq == ULLONG_MAX))
-						|| (errno != 0 && msg[msg_num]->seq == 0)) {
-					if (snprintf(warn_msg, LOG_MSG_SIZE, "\n\n\t%s[invalid seq]\n\n\n",
-								LOG_INCOMPLETE_WARNING) >= LOG_MSG_SIZE) {
-						printf("WARN: warning message is truncated\n");
-					}
-					write_log_file(&cur_log, warn_msg, strnlen(warn_msg, LOG_MSG_SIZE));
-				} else {
-					msg_num++;
-					/* if we read another new msg, latch it */
-					/* to process next time */
-					if (msg_num > 1) {
-						dev->latched = 1;
-						memcpy(dev->entry_latch,
-							   &msg[0]->raw[msg[0]->len],
-							LOG_ELEMENT_SIZE);
-						break;
-					}
-				}
-			}
+	while (1) {
+		memset(msg, 0, sizeof(struct hvlog_msg) + LOG_MSG_SIZE);
+		if (hvlog_next_entry(dev, entry) <= 0)
+			return NULL;
+
+		if (is_bin_head(entry)) {
+			ret = hvlog_read_bin(dev, entry, msg);
+			if (ret < 0)
+				return NULL;
+			if (ret == 0)
+				continue;
+			break;
 		}
 
-		if (msg_num == 0) {
-			/* if head of a message lost, continue to read */
-			memset(msg[0], 0, sizeof(struct hvlog_msg)
-			       + LOG_MSG_SIZE);
+		/* if head of a message lost, continue to read */
+		if (!is_text_head(entry))
+			continue;
+
+		/* entry format: [%lluus][cpu=%d][sev=%d][seq=%llu]: */
+		p = strstr(entry, "][seq=") + strlen("][seq=");
+		errno = 0;
+		msg->seq = strtoull(p, NULL, 10);
+		if ((errno == ERANGE && (msg->seq == ULLONG_MAX))
+				|| (errno != 0 && msg->seq == 0)) {
+			if (snprintf(warn_msg, LOG_MSG_SIZE, "\n\n\t%s[invalid seq]\n\n\n",
+						LOG_INCOMPLETE_WARNING) >= LOG_MSG_SIZE) {
+				printf("WARN: warning message is truncated\n");
+			}
+			write_log_file(&cur_log, warn_msg, strnlen(warn_msg, LOG_MSG_SIZE));
 			continue;
 		}
 
-		len = strnlen(&msg[0]->raw[msg[0]->len], LOG_MSG_SIZE);
-		msg[0]->len += len;
-	} while (len == LOG_ELEMENT_SIZE &&
-		 msg[0]->len < LOG_MSG_SIZE - LOG_ELEMENT_SIZE);
+		len = strnlen(entry, LOG_ELEMENT_SIZE);
+		memcpy(msg->raw, entry, len);
+		msg->len = len;
 
-	if (!msg[0]->len)
-		return NULL;
+		while (len == LOG_ELEMENT_SIZE &&
+		       msg->len < LOG_MSG_SIZE - LOG_ELEMENT_SIZE) {
+			if (hvlog_next_entry(dev, entry) <= 0)
+				break;
+			if (is_bin_head(entry) || is_text_head(entry)) {
+				hvlog_latch_entry(dev, entry);
+				break;
+			}
+			len = strnlen(entry, LOG_ELEMENT_SIZE);
+			memcpy(&msg->raw[msg->len], entry, len);
+			msg->len += len;
+		}
+		break;
+	}
 
-	msg[0]->raw[msg[0]->len] = '\n';
-	msg[0]->raw[msg[0]->len + 1] = 0;
-	msg[0]->len++;
+	msg->raw[msg->len] = '\n';
+	msg->raw[msg->len + 1] = 0;
+	msg->len++;
 
-	return msg[0];
+	return msg;
 }
 
-struct hvlog_dev *hvlog_open_dev(const char *path)
+struct hvlog_dev *hvlog_open_dev(const char *path, struct hvlog_fmts *fmts)
 {
 	struct hvlog_dev *dev;
 
@@ -202,6 +427,7 @@ struct hvlog_dev *hvlog_open_dev(const char *path)
 		goto open_dev;
 	}
 
+	dev->fmts = fmts;
 	dev->fd = open(path, O_RDONLY);
 	if (dev->fd < 0) {
 		printf("%s %d\n", __FUNCTION__, __LINE__);
@@ -245,55 +471,119 @@ static struct hvlog_data {
 } *cur, *last;
 
 /*
- * read the earliest msg from each dev, to hvlog_data[].msg
- * hvlog_data[] will be used for reordering
+ * min-heap of the hvlog_data[] indexes holding a msg, ordered by seq,
+ * to merge the per cpu logs
  */
-static int hvlog_dev_read_msg(struct hvlog_data *data, int num_dev)
+struct hvlog_heap {
+	int *idx;
+	int size;
+	int refill;		/* dev to read once its msg is consumed, or -1 */
+};
+
+static struct hvlog_heap cur_heap, last_heap;
+static struct hvlog_fmts cur_fmts, last_fmts;
+
+static int hvlog_heap_init(struct hvlog_heap *heap, int num_dev)
 {
-	int i, new_read;
+	heap->idx = calloc(num_dev, sizeof(int));
+	heap->size = 0;
+	heap->refill = -1;
 
-	new_read = 0;
-	for (i = 0; i < num_dev; i++) {
-		if (data[i].msg)
-			continue;
-		if (!data[i].dev)
-			continue;
+	return heap->idx ? 0 : -1;
+}
+
+static inline __u64 heap_seq(struct hvlog_data *data, struct hvlog_heap *heap,
+			     int i)
+{
+	return data[heap->idx[i]].msg->seq;
+}
+
+static void hvlog_heap_push(struct hvlog_data *data, struct hvlog_heap *heap,
+			    int dev_idx)
+{
+	int i = heap->size++, parent;
 
-		data[i].msg = hvlog_read_dev(data[i].dev);
-		if (data[i].msg)
-			new_read++;
+	heap->idx[i] = dev_idx;
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (heap_seq(data, heap, parent) <= heap_seq(data, heap, i))
+			break;
+		heap->idx[i] = heap->idx[parent];
+		heap->idx[parent] = dev_idx;
+		i = parent;
+	}
+}
+
+static int hvlog_heap_pop(struct hvlog_data *data, struct hvlog_heap *heap)
+{
+	int top = heap->idx[0], i = 0, child, tmp;
+
+	heap->idx[0] = heap->idx[--heap->size];
+	while ((child = 2 * i + 1) < heap->size) {
+		if (child + 1 < heap->size &&
+		    heap_seq(data, heap, child + 1) < heap_seq(data, heap, child))
+			child++;
+		if (heap_seq(data, heap, i) <= heap_seq(data, heap, child))
+			break;
+		tmp = heap->idx[i];
+		heap->idx[i] = heap->idx[child];
+		heap->idx[child] = tmp;
+		i = child;
 	}
 
-	return new_read;
+	return top;
 }
 
-static struct hvlog_msg *get_min_seq_msg(struct hvlog_data *data, int num_dev)
+static void hvlog_dev_fill(struct hvlog_data *data, struct hvlog_heap *heap,
+			   int i)
 {
-	int i, index_min = -1;
-	__u64 min_seq = 0;
-	struct hvlog_msg *msg;
+	if (data[i].msg || !data[i].dev)
+		return;
 
-	for (i = 0; i < num_dev; i++) {
-		if (!data[i].msg)
-			continue;
+	data[i].msg = hvlog_read_dev(data[i].dev);
+	if (data[i].msg)
+		hvlog_heap_push(data, heap, i);
+}
 
-		if (index_min == -1) {
-			index_min = i;
-			min_seq = data[i].msg->seq;
-			continue;
-		}
+/*
+ * read the earliest msg from each dev, to hvlog_data[].msg
+ * hvlog_data[] will be used for reordering
+ */
+static void hvlog_dev_read_msg(struct hvlog_data *data, int num_dev,
+			       struct hvlog_heap *heap)
+{
+	int i;
 
-		if (data[i].msg->seq > min_seq)
-			continue;
-		index_min = i;
-		min_seq = data[i].msg->seq;
+	for (i = 0; i < num_dev; i++)
+		hvlog_dev_fill(data, heap, i);
+}
+
+/*
+ * Return the msg with the lowest seq among all devs. Only the dev the
+ * previous msg came from is read again, unless the next seq is not the
+ * expected one and may still sit in a dev with nothing pending.
+ */
+static struct hvlog_msg *get_min_seq_msg(struct hvlog_data *data, int num_dev,
+					 struct hvlog_heap *heap, __u64 next_seq)
+{
+	struct hvlog_msg *msg;
+	int i;
+
+	if (heap->refill >= 0) {
+		hvlog_dev_fill(data, heap, heap->refill);
+		heap->refill = -1;
 	}
 
-	if (index_min == -1)
+	if (heap->size == 0 || heap_seq(data, heap, 0) != next_seq)
+		hvlog_dev_read_msg(data, num_dev, heap);
+
+	if (heap->size == 0)
 		return NULL;
 
-	msg = data[index_min].msg;
-	data[index_min].msg = NULL;
+	i = hvlog_heap_pop(data, heap);
+	msg = data[i].msg;
+	data[i].msg = NULL;
+	heap->refill = i;
 
 	return msg;
 }
@@ -353,8 +643,7 @@ static void *cur_read_func(void *arg)
 	char warn_msg[LOG_MSG_SIZE] = {0};
 
 	while (1) {
-		hvlog_dev_read_msg(cur, cur_cnt);
-		msg = get_min_seq_msg(cur, cur_cnt);
+		msg = get_min_seq_msg(cur, cur_cnt, &cur_heap, last_seq + 1);
 		if (!msg) {
 			usleep(interval);
 			continue;
@@ -490,6 +779,7 @@ int main(int argc, char *argv[])
 	int i, ret;
 	int num_cur, num_last;
 	struct hvlog_msg *msg;
+	__u64 last_seq = 0;
 
 	if (parse_opt(argc, argv))
 		return -1;
@@ -511,14 +801,14 @@ int main(int argc, char *argv[])
 		return -1;
 
 	cur = calloc(cur_cnt, sizeof(struct hvlog_data));
-	if (!cur) {
+	if (!cur || hvlog_heap_init(&cur_heap, cur_cnt)) {
 		printf("Failed to allocate buf for cur log buf\n");
 		return -1;
 	}
 
 	if (last_cnt) {
 		last = calloc(cur_cnt, sizeof(struct hvlog_data));
-		if (!last) {
+		if (!last || hvlog_heap_init(&last_heap, cur_cnt)) {
 			printf("Failed to allocate buf for last log buf\n");
 			free(cur);
 			return -1;
@@ -531,7 +821,7 @@ int main(int argc, char *argv[])
 			printf("ERROR: cur hvlog path is truncated\n");
 			return -1;
 		}
-		cur[i].dev = hvlog_open_dev(name);
+		cur[i].dev = hvlog_open_dev(name, &cur_fmts);
 		if (!cur[i].dev)
 			perror(name);
 		else
@@ -546,7 +836,7 @@ int main(int argc, char *argv[])
 				printf("ERROR: last hvlog path is truncated\n");
 				return -1;
 			}
-			last[i].dev = hvlog_open_dev(name);
+			last[i].dev = hvlog_open_dev(name, &last_fmts);
 			if (!last[i].dev)
 				perror(name);
 			else
@@ -568,10 +858,11 @@ int main(int argc, char *argv[])
 
 	if (num_last) {
 		while (1) {
-			hvlog_dev_read_msg(last, cur_cnt);
-			msg = get_min_seq_msg(last, cur_cnt);
+			msg = get_min_seq_msg(last, cur_cnt, &last_heap,
+					      last_seq + 1);
 			if (!msg)
 				break;
+			last_seq = msg->seq;
 			write_log_file(&last_log, msg->raw, msg->len);
 		}
 	}
@@ -223,6 +223,8 @@ static void reader_fn(param_t * param)
 	int ret;
 	int fd = param->trace_fd;
 	shared_buf_t *sbuf = param->sbuf;
+	uint32_t threshold;
+	uint64_t slice, waited;
 
 	pr_dbg("reader thread[%lu] created for FILE*[0x%p]\n",
 	       pthread_self(), fp);
@@ -234,12 +236,24 @@ static void reader_fn(param_t * param)
 	if (flags & FLAG_CLEAR_BUF)
 		sbuf_clear_buffered(sbuf);
 
+	threshold = sbuf->size >> WAKEUP_THRESHOLD_SHIFT;
+	slice = period / WAKEUP_SLICES;
+
 	while (1) {
-		do {
-			ret = sbuf_write(fd, sbuf);
-		} while (ret > 0);
+		ret = sbuf_write(fd, sbuf);
+		if (ret < 0)
+			usleep(period);
 
-		usleep(period);
+		/*
+		 * Sleep until either the polling period is over or the
+		 * buffer has filled past the threshold, so a burst of
+		 * trace events is drained before the buffer overruns.
+		 */
+		for (waited = 0; waited < period; waited += slice) {
+			if (sbuf_used(sbuf) >= threshold)
+				break;
+			usleep(slice);
+		}
 	}
 }
 
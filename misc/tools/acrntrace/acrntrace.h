@@ -24,6 +24,14 @@
 #define TIME_STR_LEN		16
 #define CMD_MAX_LEN		48
 
+/*
+ * The reader wakes up every period / WAKEUP_SLICES to check the fill
+ * level, and drains early once the sbuf is 1 / (1 << WAKEUP_THRESHOLD_SHIFT)
+ * full.
+ */
+#define WAKEUP_SLICES		10
+#define WAKEUP_THRESHOLD_SHIFT	2
+
 #define pr_fmt(fmt)             "acrntrace: " fmt
 #define pr_info(fmt, ...)       printf(pr_fmt(fmt), ##__VA_ARGS__)
 #define pr_err(fmt, ...)        printf(pr_fmt(fmt), ##__VA_ARGS__)
@@ -7,6 +7,7 @@
 #include <asm/errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include "sbuf.h"
@@ -46,29 +47,80 @@ int sbuf_get(shared_buf_t *sbuf, uint8_t *data)
 	return sbuf->ele_size;
 }
 
+uint32_t sbuf_used(shared_buf_t *sbuf)
+{
+	uint32_t head = sbuf->head;
+	uint32_t tail = __atomic_load_n(&sbuf->tail, __ATOMIC_ACQUIRE);
+
+	return (tail >= head) ? (tail - head) : (sbuf->size - head + tail);
+}
+
+/*
+ * Drain everything between head and tail to fd. The pending data is
+ * at most two contiguous spans (when it wraps around the end of the
+ * buffer), so it goes out with a single writev() in the common case.
+ * Returns the number of bytes drained, or -1 on a write error.
+ */
 int sbuf_write(int fd, shared_buf_t *sbuf)
 {
-	const void *start;
-	int written;
+	void *base;
+	struct iovec iov[2];
+	uint32_t head, tail, total;
+	int iovcnt;
+	ssize_t written;
 
 	if (sbuf == NULL)
 		return -EINVAL;
 
-	if (sbuf_is_empty(sbuf)) {
+	head = sbuf->head;
+	/* pairs with the hypervisor publishing tail after the data */
+	tail = __atomic_load_n(&sbuf->tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
 		return 0;
-	}
 
-	start = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->head;
-        written = write(fd, start, sbuf->ele_size);
-	if (written != sbuf->ele_size) {
-		printf("Failed to write: ret %d (ele_size %d), errno %d\n",
-			written, sbuf->ele_size, (written == -1) ? errno : 0);
-		return -1;
+	base = (void *)sbuf + SBUF_HEAD_SIZE;
+	iov[0].iov_base = base + head;
+	if (tail > head) {
+		iov[0].iov_len = tail - head;
+		iovcnt = 1;
+	} else {
+		iov[0].iov_len = sbuf->size - head;
+		iov[1].iov_base = base;
+		iov[1].iov_len = tail;
+		iovcnt = (tail != 0U) ? 2 : 1;
+	}
+	total = iov[0].iov_len + ((iovcnt == 2) ? iov[1].iov_len : 0U);
+
+	while (iovcnt > 0) {
+		written = writev(fd, iov, iovcnt);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			printf("Failed to write: errno %d\n", errno);
+			return -1;
+		}
+		/* nothing went out although data is left, e.g. a full disk */
+		if (written == 0) {
+			printf("Failed to write: no progress\n");
+			return -1;
+		}
+
+		/* short write, skip what went out and retry the rest */
+		while (iovcnt > 0 && (size_t)written >= iov[0].iov_len) {
+			written -= iov[0].iov_len;
+			iov[0] = iov[1];
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov[0].iov_base += written;
+			iov[0].iov_len -= written;
+		}
 	}
 
-	sbuf->head = sbuf_next_ptr(sbuf->head, sbuf->ele_size, sbuf->size);
+	/* hand the space back only once all of it has been written */
+	__atomic_store_n(&sbuf->head, tail, __ATOMIC_RELEASE);
 
-	return sbuf->ele_size;
+	return total;
 }
 
 int sbuf_clear_buffered(shared_buf_t *sbuf)